@@ -0,0 +1,71 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __PROSPER_TRANSIENT_UNIFORM_BUFFER_HPP__
+#define __PROSPER_TRANSIENT_UNIFORM_BUFFER_HPP__
+
+#include "prosper_definitions.hpp"
+#include "prosper_includes.hpp"
+#include <memory>
+#include <vector>
+#include <cinttypes>
+#include <limits>
+
+#undef max
+
+#pragma warning(push)
+#pragma warning(disable : 4251)
+namespace prosper
+{
+	class IPrContext;
+	class IBuffer;
+	class IDescriptorSet;
+
+	// Bump allocator for uniform data which only has to live for a single frame (e.g. per-draw constants).
+	// The data is written directly into a persistently mapped buffer, which is split into one region per frame in flight.
+	// The buffer is bound to a dynamic uniform buffer binding once (see BindToDescriptorSet), individual allocations
+	// are then selected with the dynamic offset when binding the descriptor set.
+	class DLLPROSPER TransientUniformBuffer
+		: public std::enable_shared_from_this<TransientUniformBuffer>
+	{
+	public:
+		// rangeSize is the size of the uniform block in the shader; Allocations mustn't be larger than that
+		static std::shared_ptr<TransientUniformBuffer> Create(IPrContext &context,DeviceSize sizePerFrame,DeviceSize rangeSize);
+		TransientUniformBuffer(const TransientUniformBuffer&)=delete;
+		TransientUniformBuffer &operator=(const TransientUniformBuffer&)=delete;
+
+		// Fails if the region of the current frame is full, or if the region is still in use by the GPU
+		bool Allocate(const void *data,DeviceSize size,uint32_t &outDynamicOffset);
+		template<typename T>
+			bool Allocate(const T &data,uint32_t &outDynamicOffset);
+		bool BindToDescriptorSet(IDescriptorSet &descSet,uint32_t bindingIdx) const;
+
+		IBuffer &GetBuffer() const;
+		DeviceSize GetRangeSize() const;
+		DeviceSize GetSizePerFrame() const;
+		// Number of bytes allocated for the current frame
+		DeviceSize GetUsedSize() const;
+	private:
+		TransientUniformBuffer(IPrContext &context,const std::shared_ptr<IBuffer> &buffer,DeviceSize regionSize,DeviceSize rangeSize,DeviceSize alignment,uint32_t regionCount);
+		bool BeginFrame();
+		IPrContext &m_context;
+		std::shared_ptr<IBuffer> m_buffer = nullptr;
+		std::vector<bool> m_regionsInUse = {};
+		uint64_t m_frameId = std::numeric_limits<uint64_t>::max();
+		uint32_t m_currentRegion = std::numeric_limits<uint32_t>::max();
+		DeviceSize m_regionSize = 0ull;
+		DeviceSize m_rangeSize = 0ull;
+		DeviceSize m_alignment = 0ull;
+		DeviceSize m_offset = 0ull;
+	};
+};
+#pragma warning(pop)
+
+template<typename T>
+	bool prosper::TransientUniformBuffer::Allocate(const T &data,uint32_t &outDynamicOffset)
+{
+	return Allocate(&data,sizeof(data),outDynamicOffset);
+}
+
+#endif
@@ -9,6 +9,7 @@
 #include "prosper_includes.hpp"
 #include <memory>
 #include <unordered_map>
+#include <optional>
 
 // TODO: Move this to prosper_vulkan implementation?
 namespace vk
@@ -60,6 +61,7 @@ namespace prosper
 		DLLPROSPER void register_debug_shader_pipeline(void *vkPtr,const ShaderPipelineInfo &pipelineInfo);
 		DLLPROSPER void deregister_debug_object(void *vkPtr);
 
+		// Note: For pipelines, the returned object is the Shader
 		DLLPROSPER void *get_object(void *vkObj,ObjectType &type);
 		DLLPROSPER VlkImage *get_image(const vk::Image &vkImage);
 		DLLPROSPER VlkImageView *get_image_view(const vk::ImageView &vkImageView);
@@ -69,7 +71,7 @@ namespace prosper
 		DLLPROSPER VlkRenderPass *get_render_pass(const vk::RenderPass &vkBuffer);
 		DLLPROSPER VlkFramebuffer *get_framebuffer(const vk::Framebuffer &vkBuffer);
 		DLLPROSPER VlkDescriptorSetGroup *get_descriptor_set_group(const vk::DescriptorSet &vkBuffer);
-		DLLPROSPER ShaderPipelineInfo *get_shader_pipeline(const vk::Pipeline &vkPipeline);
+		DLLPROSPER std::optional<ShaderPipelineInfo> get_shader_pipeline(const vk::Pipeline &vkPipeline);
 	};
 };
 
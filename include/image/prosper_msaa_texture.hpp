@@ -22,8 +22,13 @@ namespace prosper
 
 		// Resets resolved flag
 		void Reset();
+		// True if the last render pass that was begun with a render target containing this texture resolves it into its resolved texture
+		// (see RenderPassCreateInfo::AttachmentInfo::resolveAttachment), in which case Resolve only transitions the image layouts.
+		// Cleared by Reset and Resolve.
+		bool IsResolvedByRenderPass() const;
 		virtual void SetDebugName(const std::string &name) override;
 	protected:
+		friend IPrimaryCommandBuffer;
 		friend std::shared_ptr<Texture> IPrContext::CreateTexture(
 			const util::TextureCreateInfo &createInfo,IImage &img,
 			const std::optional<util::ImageViewCreateInfo> &imageViewCreateInfo,
@@ -36,6 +41,7 @@ namespace prosper
 		);
 		std::shared_ptr<Texture> m_resolvedTexture = nullptr;
 		bool m_bResolved = false;
+		bool m_bResolvedByRenderPass = false;
 	};
 };
 
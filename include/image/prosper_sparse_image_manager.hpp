@@ -0,0 +1,154 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __PROSPER_SPARSE_IMAGE_MANAGER_HPP__
+#define __PROSPER_SPARSE_IMAGE_MANAGER_HPP__
+
+#include "prosper_definitions.hpp"
+#include "prosper_includes.hpp"
+#include "prosper_structs.hpp"
+#include <memory>
+#include <vector>
+#include <functional>
+
+#undef max
+
+namespace Anvil
+{
+	class MemoryBlock;
+};
+
+#pragma warning(push)
+#pragma warning(disable : 4251)
+namespace prosper
+{
+	class IPrContext;
+	class IImage;
+	class IBuffer;
+	class IFence;
+
+	// Manages the page residency of a sparse image. Only pages that have been requested recently are backed by memory,
+	// the mip tail is always resident.
+	// Shaders write a non-zero value into the feedback buffer for every page they sample, and use the page table buffer
+	// to fall back to a coarser mip level for pages which aren't resident (yet). There is one feedback buffer per frame
+	// that may be in flight, so the CPU only ever reads and clears buffers which the GPU is done with.
+	// Pages are indexed by layer, mip level and position (see GetPageIndex). Both buffers contain one uint32 per page.
+	class DLLPROSPER SparseImageManager
+		: public std::enable_shared_from_this<SparseImageManager>
+	{
+	public:
+		using PageIndex = uint32_t;
+		static constexpr PageIndex INVALID_PAGE = std::numeric_limits<PageIndex>::max();
+		// Number of pages allocated at once
+		static constexpr uint32_t PAGES_PER_MEMORY_BLOCK = 64u;
+		struct DLLPROSPER PageInfo
+		{
+			uint32_t layer = 0u;
+			uint32_t mipLevel = 0u;
+			uint32_t x = 0u;
+			uint32_t y = 0u;
+		};
+
+		// The Sparse flag will be added to the create info. Returns nullptr if sparse residency is not supported for the image.
+		// Memory will never be bound to more than maxResidentPages pages (not including the mip tail) at once.
+		static std::shared_ptr<SparseImageManager> Create(IPrContext &context,const util::ImageCreateInfo &createInfo,uint32_t maxResidentPages);
+		~SparseImageManager();
+		SparseImageManager(const SparseImageManager&)=delete;
+		SparseImageManager &operator=(const SparseImageManager&)=delete;
+
+		IImage &GetImage() const;
+		const std::shared_ptr<IImage> &GetImagePtr() const;
+		// Host-visible feedback buffer for the frame that is currently being recorded. Has to be re-queried every frame.
+		IBuffer &GetFeedbackBuffer();
+		// 1 if the page is resident, otherwise 0
+		IBuffer &GetPageTableBuffer() const;
+
+		uint32_t GetPageCount() const;
+		uint32_t GetResidentPageCount() const;
+		uint32_t GetMaxResidentPageCount() const;
+		// Size of a page in texels
+		const Extent3D &GetPageExtents() const;
+		// Size of a page in bytes
+		DeviceSize GetPageSize() const;
+		// All mip levels starting at this level are always resident
+		uint32_t GetMipTailFirstLevel() const;
+		PageIndex GetPageIndex(uint32_t layer,uint32_t mipLevel,uint32_t x,uint32_t y) const;
+		PageInfo GetPageInfo(PageIndex page) const;
+		bool IsPageResident(PageIndex page) const;
+
+		void RequestPage(PageIndex page);
+		// Reads and clears the page requests written by shaders into the feedback buffers of all frames which have been
+		// completed by the GPU. Requests are only seen GetSwapchainImageCount() frames after the shaders have written them.
+		// Called automatically by Update.
+		bool ProcessFeedback();
+		// Binds memory to the requested pages, and releases the memory of pages which haven't been requested
+		// in a while if the budget is exceeded. All changes are submitted as a single sparse bind operation.
+		// Pages become resident in the page table once the operation has been completed, which is checked on the next call.
+		bool Update(uint32_t maxBindsPerUpdate=std::numeric_limits<uint32_t>::max());
+	private:
+		enum class PageState : uint8_t
+		{
+			NonResident = 0u,
+			Requested,
+			PendingBind,
+			Resident
+		};
+		struct Page
+		{
+			uint64_t lastRequestFrame = 0ull;
+			uint32_t memorySlot = std::numeric_limits<uint32_t>::max();
+			PageState state = PageState::NonResident;
+		};
+		struct FeedbackBuffer
+		{
+			std::shared_ptr<IBuffer> buffer = nullptr;
+			// Frame the buffer was handed out for, or max if it doesn't contain any unprocessed requests
+			uint64_t frameId = std::numeric_limits<uint64_t>::max();
+		};
+		struct MipLevel
+		{
+			uint32_t firstPage = 0u;
+			uint32_t pageCountX = 0u;
+			uint32_t pageCountY = 0u;
+		};
+		SparseImageManager(IPrContext &context,const std::shared_ptr<IImage> &img,uint32_t maxResidentPages);
+		bool Initialize();
+		void RequestPage(PageIndex page,uint64_t frameId);
+		bool ProcessFeedback(FeedbackBuffer &feedbackBuffer);
+		uint64_t GetFeedbackLatency() const;
+		bool FinalizePendingBinds();
+		void SchedulePageTableUpdate(PageIndex first,PageIndex last);
+		uint32_t AllocateMemorySlot();
+
+		IPrContext &m_context;
+		std::shared_ptr<IImage> m_image = nullptr;
+		std::vector<FeedbackBuffer> m_feedbackBuffers = {};
+		std::shared_ptr<IBuffer> m_pageTableBuffer = nullptr;
+		std::shared_ptr<IFence> m_bindFence = nullptr;
+		std::vector<std::unique_ptr<Anvil::MemoryBlock,std::function<void(Anvil::MemoryBlock*)>>> m_memoryBlocks = {};
+		std::unique_ptr<Anvil::MemoryBlock,std::function<void(Anvil::MemoryBlock*)>> m_mipTailMemory = nullptr;
+
+		std::vector<Page> m_pages = {};
+		std::vector<MipLevel> m_mipLevels = {};
+		std::vector<uint32_t> m_pageTable = {};
+		std::vector<uint32_t> m_feedbackData = {};
+		std::vector<PageIndex> m_requestedPages = {};
+		std::vector<PageIndex> m_residentPages = {};
+		std::vector<PageIndex> m_pendingBinds = {};
+		// Slots of unbound pages can only be re-used once the unbind operation has completed
+		std::vector<uint32_t> m_pendingFreeSlots = {};
+		std::vector<uint32_t> m_freeSlots = {};
+		Extent3D m_pageExtents = {};
+		DeviceSize m_pageSize = 0ull;
+		uint32_t m_memoryTypeBits = 0u;
+		uint32_t m_pagesPerLayer = 0u;
+		uint32_t m_mipTailFirstLevel = 0u;
+		uint32_t m_maxResidentPages = 0u;
+		uint32_t m_numSlots = 0u;
+		bool m_bindInProgress = false;
+	};
+};
+#pragma warning(pop)
+
+#endif
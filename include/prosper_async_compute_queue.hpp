@@ -0,0 +1,85 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __PROSPER_ASYNC_COMPUTE_QUEUE_HPP__
+#define __PROSPER_ASYNC_COMPUTE_QUEUE_HPP__
+
+#include "prosper_definitions.hpp"
+#include "prosper_includes.hpp"
+#include "prosper_enums.hpp"
+#include "prosper_structs.hpp"
+#include <memory>
+#include <vector>
+
+#pragma warning(push)
+#pragma warning(disable : 4251)
+namespace prosper
+{
+	class IPrContext;
+	class IBuffer;
+	class IImage;
+	class IPrimaryCommandBuffer;
+
+	// Executes compute work (e.g. ShaderCompute::BeginCompute with the command buffer returned by BeginRecording) on the compute queue.
+	// The compute work of a frame is submitted once the frame has been submitted and waits for it to complete. It overlaps with the next frame,
+	// which only waits for the compute work at the stages where the results are consumed. These should be as late in the pipeline as possible,
+	// since all work of the next frame at those stages is blocked until the compute work has been completed.
+	// Resources that are accessed by both queues have to be specified when recording starts. If the device has a dedicated compute queue family,
+	// their ownership is transferred to the compute queue and back to the universal queue.
+	class DLLPROSPER AsyncComputeQueue
+		: public std::enable_shared_from_this<AsyncComputeQueue>
+	{
+	public:
+		struct DLLPROSPER BufferDependency
+		{
+			std::shared_ptr<IBuffer> buffer = nullptr;
+			// Last access by the graphics work of the current frame
+			PipelineStageFlags srcStageMask = PipelineStageFlags::ComputeShaderBit;
+			AccessFlags srcAccessMask = AccessFlags::ShaderWriteBit;
+			// First access by the graphics work of the next frame
+			PipelineStageFlags dstStageMask = PipelineStageFlags::ComputeShaderBit;
+			AccessFlags dstAccessMask = AccessFlags::ShaderReadBit;
+			AccessFlags computeAccessMask = AccessFlags::ShaderReadBit | AccessFlags::ShaderWriteBit;
+		};
+		struct DLLPROSPER ImageDependency
+		{
+			std::shared_ptr<IImage> image = nullptr;
+			util::ImageSubresourceRange subresourceRange {};
+			PipelineStageFlags srcStageMask = PipelineStageFlags::ColorAttachmentOutputBit;
+			AccessFlags srcAccessMask = AccessFlags::ColorAttachmentWriteBit;
+			PipelineStageFlags dstStageMask = PipelineStageFlags::FragmentShaderBit;
+			AccessFlags dstAccessMask = AccessFlags::ShaderReadBit;
+			AccessFlags computeAccessMask = AccessFlags::ShaderReadBit | AccessFlags::ShaderWriteBit;
+			// Layout of the image before and after the compute work
+			ImageLayout graphicsLayout = ImageLayout::ShaderReadOnlyOptimal;
+			ImageLayout computeLayout = ImageLayout::General;
+		};
+		static std::shared_ptr<AsyncComputeQueue> Create(IPrContext &context);
+		AsyncComputeQueue(const AsyncComputeQueue&)=delete;
+		AsyncComputeQueue &operator=(const AsyncComputeQueue&)=delete;
+
+		// Starts recording the compute work for the current frame. Returns nullptr if recording has already been started.
+		std::shared_ptr<IPrimaryCommandBuffer> BeginRecording(const std::vector<BufferDependency> &buffers={},const std::vector<ImageDependency> &images={});
+		// Has to be called while the frame is being recorded, after all graphics work accessing the shared resources has been recorded to 'drawCmd'.
+		bool Submit(IPrimaryCommandBuffer &drawCmd);
+		bool IsRecording() const;
+
+		// Returns false if the compute work is executed on the universal queue family
+		bool HasDedicatedComputeQueue() const;
+	private:
+		struct Batch;
+		AsyncComputeQueue(IPrContext &context,uint32_t computeQueueFamilyIndex,uint32_t universalQueueFamilyIndex);
+		std::shared_ptr<Batch> GetFreeBatch();
+
+		IPrContext &m_context;
+		uint32_t m_computeQueueFamilyIndex = QUEUE_FAMILY_IGNORED;
+		uint32_t m_universalQueueFamilyIndex = QUEUE_FAMILY_IGNORED;
+		std::shared_ptr<Batch> m_currentBatch = nullptr;
+		// Batches are re-used once the frame that has waited on them has been completed
+		std::vector<std::shared_ptr<Batch>> m_freeBatches = {};
+	};
+};
+#pragma warning(pop)
+
+#endif
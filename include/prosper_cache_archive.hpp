@@ -0,0 +1,85 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __PROSPER_CACHE_ARCHIVE_HPP__
+#define __PROSPER_CACHE_ARCHIVE_HPP__
+
+#include "prosper_definitions.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+#include <cinttypes>
+
+#pragma warning(push)
+#pragma warning(disable : 4251)
+namespace prosper
+{
+	// Single packed file containing the pipeline cache and the compiled SPIR-V of all shaders.
+	// The archive is memory-mapped, entries can be handed to the driver directly without reading them into memory first.
+	// All methods are thread-safe.
+	// Layout: Header | entry data (each aligned to ENTRY_ALIGNMENT) | index
+	class DLLPROSPER CacheArchive
+	{
+	public:
+		static constexpr uint32_t FORMAT_VERSION = 1u;
+		static constexpr uint32_t ENTRY_ALIGNMENT = 16u;
+
+		// Maps the archive at the specified (absolute) path. If the file doesn't exist or is invalid, an empty archive is returned.
+		static std::unique_ptr<CacheArchive> Open(const std::string &path);
+		~CacheArchive();
+		CacheArchive(const CacheArchive&)=delete;
+		CacheArchive &operator=(const CacheArchive&)=delete;
+
+		// Invokes the reader with the data of the entry. The archive stays locked while the reader is executed, so the data
+		// must not be accessed after the reader has returned (Write may unmap it). Returns false if the entry doesn't exist or the reader failed.
+		bool Read(const std::string &name,const std::function<bool(const void*,uint64_t)> &reader) const;
+		// The entry will only be written to disk on the next call to Write
+		void Store(const std::string &name,std::vector<uint8_t> &&data);
+		void Store(const std::string &name,const void *data,uint64_t size);
+		// Merges the pending entries with the existing ones and replaces the archive on disk
+		bool Write();
+
+		bool HasPendingEntries() const;
+		uint32_t GetEntryCount() const;
+		const std::string &GetPath() const;
+	private:
+#pragma pack(push,1)
+		struct Header
+		{
+			char magic[4];
+			uint32_t version;
+			uint32_t entryCount;
+			uint32_t reserved;
+			uint64_t indexOffset;
+		};
+#pragma pack(pop)
+		struct IndexEntry
+		{
+			uint64_t offset = 0ull;
+			uint64_t size = 0ull;
+		};
+		CacheArchive(const std::string &path);
+		bool Map();
+		void Unmap();
+
+		std::string m_path;
+		const uint8_t *m_mappedData = nullptr;
+		uint64_t m_mappedSize = 0ull;
+#ifdef _WIN32
+		void *m_fileHandle = nullptr;
+		void *m_mappingHandle = nullptr;
+#else
+		int m_fileDescriptor = -1;
+#endif
+		std::unordered_map<std::string,IndexEntry> m_index;
+		std::unordered_map<std::string,std::vector<uint8_t>> m_pendingEntries;
+		mutable std::mutex m_mutex;
+	};
+};
+#pragma warning(pop)
+
+#endif
@@ -47,6 +47,9 @@ namespace prosper
 		virtual bool RecordDrawIndexed(uint32_t indexCount,uint32_t instanceCount=1,uint32_t firstIndex=0,int32_t vertexOffset=0,uint32_t firstInstance=0);
 		virtual bool RecordDrawIndexedIndirect(IBuffer &buf,DeviceSize offset,uint32_t drawCount,uint32_t stride);
 		virtual bool RecordDrawIndirect(IBuffer &buf,DeviceSize offset,uint32_t count,uint32_t stride);
+		// Requires VK_KHR_draw_indirect_count (see util::is_draw_indirect_count_supported)
+		virtual bool RecordDrawIndexedIndirectCount(IBuffer &buf,DeviceSize offset,IBuffer &countBuf,DeviceSize countBufOffset,uint32_t maxDrawCount,uint32_t stride);
+		virtual bool RecordDrawIndirectCount(IBuffer &buf,DeviceSize offset,IBuffer &countBuf,DeviceSize countBufOffset,uint32_t maxDrawCount,uint32_t stride);
 		virtual bool RecordFillBuffer(IBuffer &buf,DeviceSize offset,DeviceSize size,uint32_t data);
 		// bool RecordResetEvent(Event &ev,PipelineStateFlags stageMask);
 		virtual bool RecordSetBlendConstants(const std::array<float,4> &blendConstants);
@@ -10,6 +10,10 @@
 #include <queue>
 #include <memory>
 #include <optional>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include "prosper_includes.hpp"
 #include "prosper_structs.hpp"
 #include "shader/prosper_shader_manager.hpp"
@@ -68,6 +72,9 @@ namespace prosper
 	class ISecondaryCommandBuffer;
 	class IFence;
 	class IEvent;
+	class CacheArchive;
+	class MemoryBudgetTracker;
+	class UploadContextPool;
 	class ComputePipelineCreateInfo;
 	class GraphicsPipelineCreateInfo;
 	struct DescriptorSetInfo;
@@ -157,6 +164,13 @@ namespace prosper
 		virtual void ReloadWindow()=0;
 
 		ShaderManager &GetShaderManager() const;
+		// Packed archive containing the pipeline cache and the compiled SPIR-V of all shaders
+		CacheArchive *GetCacheArchive() const;
+		// Read-only archive containing the precompiled SPIR-V of all shaders, or nullptr if there is none
+		CacheArchive *GetShaderArchive() const;
+		MemoryBudgetTracker *GetMemoryBudgetTracker() const;
+		// Pool of upload contexts that can be flushed without waiting for the GPU, as opposed to the setup command buffer
+		UploadContextPool &GetUploadContextPool() const;
 
 		::util::WeakHandle<Shader> RegisterShader(const std::string &identifier,const std::function<Shader*(IPrContext&,const std::string&)> &fFactory);
 		::util::WeakHandle<Shader> GetShader(const std::string &identifier) const;
@@ -175,11 +189,18 @@ namespace prosper
 		void FlushSetupCommandBuffer();
 
 		void KeepResourceAliveUntilPresentationComplete(const std::shared_ptr<void> &resource);
+		// The callback will be invoked once the GPU has finished executing the current (or most recently submitted) frame.
+		// If the device is idle, the callback is invoked immediately.
+		void AddFrameCompletionCallback(const std::function<void()> &callback);
+		// Executes the task on the worker thread of the context. Tasks are executed in order and
+		// all pending tasks are completed before the context is released.
+		void AddWorkerTask(const std::function<void()> &task);
 		template<class T>
 			void ReleaseResource(T *resource)
 		{
 			KeepResourceAliveUntilPresentationComplete(std::shared_ptr<T>(resource,[](T *p) {delete p;}));
 		}
+		// Writes the pipeline cache, as well as all newly compiled shaders, to the cache archive
 		virtual bool SavePipelineCache()=0;
 
 		const std::shared_ptr<Texture> &GetDummyTexture() const;
@@ -196,8 +217,12 @@ namespace prosper
 
 		virtual std::shared_ptr<prosper::IPrimaryCommandBuffer> AllocatePrimaryLevelCommandBuffer(prosper::QueueFamilyType queueFamilyType,uint32_t &universalQueueFamilyIndex)=0;
 		virtual std::shared_ptr<prosper::ISecondaryCommandBuffer> AllocateSecondaryLevelCommandBuffer(prosper::QueueFamilyType queueFamilyType,uint32_t &universalQueueFamilyIndex)=0;
-		virtual void SubmitCommandBuffer(prosper::ICommandBuffer &cmd,prosper::QueueFamilyType queueFamilyType,bool shouldBlock=false,prosper::IFence *fence=nullptr)=0;
-		void SubmitCommandBuffer(prosper::ICommandBuffer &cmd,bool shouldBlock=false,prosper::IFence *fence=nullptr);
+		// Submissions that neither block nor have a fence may be deferred until the end of the current frame, use a fence if the
+		// results are required earlier. Returns false if the submission has been made right away and failed.
+		virtual bool SubmitCommandBuffer(prosper::ICommandBuffer &cmd,prosper::QueueFamilyType queueFamilyType,bool shouldBlock=false,prosper::IFence *fence=nullptr)=0;
+		bool SubmitCommandBuffer(prosper::ICommandBuffer &cmd,bool shouldBlock=false,prosper::IFence *fence=nullptr);
+		// Returns false if the device has no queue family of the specified type (e.g. no dedicated transfer queue family)
+		virtual bool GetQueueFamilyIndex(prosper::QueueFamilyType queueFamilyType,uint32_t &queueFamilyIndex) const=0;
 
 		bool IsRecording() const;
 
@@ -210,11 +235,14 @@ namespace prosper
 				const std::shared_ptr<IBuffer> &buffer,uint64_t offset,const T &data,
 				const BufferUpdateInfo &updateInfo={}
 			);
+		// The function will be invoked at the beginning of the next frame, before any other commands are recorded into the draw command buffer
+		void ScheduleRecordCommands(const std::function<void(prosper::IPrimaryCommandBuffer&)> &fRecord);
 
 		void WaitIdle();
 		virtual Result WaitForFence(const IFence &fence,uint64_t timeout=std::numeric_limits<uint64_t>::max()) const=0;
 		virtual Result WaitForFences(const std::vector<IFence*> &fences,bool waitAll=true,uint64_t timeout=std::numeric_limits<uint64_t>::max()) const=0;
 		virtual void DrawFrame(const std::function<void(const std::shared_ptr<prosper::IPrimaryCommandBuffer>&,uint32_t)> &drawFrame)=0;
+		// See SubmitCommandBuffer
 		virtual bool Submit(ICommandBuffer &cmdBuf,bool shouldBlock=false,IFence *optFence=nullptr)=0;
 
 		void RegisterResource(const std::shared_ptr<void> &resource);
@@ -267,6 +295,8 @@ namespace prosper
 			SubPassID subPassId=0,
 			PipelineID basePipelineId=std::numeric_limits<PipelineID>::max()
 		);
+		// Pipelines are reference counted, since identical pipelines are shared between shaders.
+		// AddPipeline and ClearPipeline are thread-safe.
 		bool ClearPipeline(bool graphicsShader,PipelineID pipelineId);
 		uint32_t GetLastAcquiredSwapchainImageIndex() const;
 
@@ -304,6 +334,10 @@ namespace prosper
 
 		void ClearKeepAliveResources();
 		void ClearKeepAliveResources(uint32_t n);
+		void RunFrameCompletionCallbacks(bool allFrames=false);
+		void JoinWorkerThread();
+		// Records all scheduled commands and buffer updates into the specified (draw) command buffer
+		void RecordScheduledCommands(prosper::IPrimaryCommandBuffer &cmd);
 		void InitDummyTextures();
 		void InitDummyBuffer();
 		void InitTemporaryBuffer();
@@ -317,14 +351,60 @@ namespace prosper
 
 		Callbacks m_callbacks {};
 		std::vector<std::vector<std::shared_ptr<void>>> m_keepAliveResources;
+		std::vector<std::vector<std::function<void()>>> m_frameCompletionCallbacks;
+
+		// The worker thread is started on demand
+		std::thread m_workerThread;
+		std::mutex m_workerMutex;
+		std::condition_variable m_workerCondition;
+		std::queue<std::function<void()>> m_workerTasks;
+		bool m_workerRunning = false;
+
+		// Pipelines with identical state and SPIR-V are shared between shaders (see AddPipeline)
+		struct SharedPipeline
+		{
+			PipelineID pipelineId = std::numeric_limits<PipelineID>::max();
+			uint32_t refCount = 0u;
+			// Full key, only used to resolve hash collisions
+			std::string description;
+			std::vector<std::vector<uint32_t>> spirv;
+		};
+		struct SharedPipelineTable
+		{
+			std::unordered_multimap<uint64_t,SharedPipeline> keyToPipeline;
+			std::unordered_map<PipelineID,uint64_t> pipelineToKey;
+		};
+		SharedPipelineTable m_sharedGraphicsPipelines {};
+		SharedPipelineTable m_sharedComputePipelines {};
+		// Pipelines may be added from background threads (e.g. pipeline variants)
+		std::mutex m_pipelineMutex;
 		std::unique_ptr<ShaderManager> m_shaderManager = nullptr;
+		std::unique_ptr<CacheArchive> m_cacheArchive = nullptr;
+		std::unique_ptr<CacheArchive> m_shaderArchive = nullptr;
+		std::unique_ptr<MemoryBudgetTracker> m_memoryBudgetTracker = nullptr;
+		std::unique_ptr<UploadContextPool> m_uploadContextPool = nullptr;
 		std::unique_ptr<GLFW::Window> m_glfwWindow = nullptr;
 		std::shared_ptr<IDynamicResizableBuffer> m_tmpBuffer = nullptr;
 		std::vector<std::shared_ptr<IDynamicResizableBuffer>> m_deviceImgBuffers = {};
 		std::vector<std::shared_ptr<prosper::IImage>> m_swapchainImages {};
 		uint32_t m_numSwapchainImages = 0u;
 
-		std::queue<std::function<void(prosper::IPrimaryCommandBuffer&)>> m_scheduledBufferUpdates;
+		struct ScheduledBufferUpdate
+		{
+			std::shared_ptr<IBuffer> buffer;
+			uint64_t offset;
+			uint64_t size;
+			uint64_t dataOffset; // Offset into m_scheduledBufferUpdateData
+			BufferUpdateInfo updateInfo;
+		};
+		void RecordScheduledBufferUpdates(
+			prosper::ICommandBuffer &cmd,const std::vector<ScheduledBufferUpdate> &updates,const std::vector<uint8_t> &data,size_t first,size_t end
+		);
+		// Every scheduled command is recorded after the buffer updates that have been scheduled before it (first = number of updates at that point)
+		std::vector<std::pair<size_t,std::function<void(prosper::IPrimaryCommandBuffer&)>>> m_scheduledCommands;
+		std::vector<ScheduledBufferUpdate> m_scheduledBufferUpdates;
+		// Linear arena for the data of all scheduled buffer updates, which is reset once the updates have been recorded
+		std::vector<uint8_t> m_scheduledBufferUpdateData;
 		std::vector<std::shared_ptr<prosper::IPrimaryCommandBuffer>> m_commandBuffers;
 
 		uint32_t m_lastSemaporeUsed;
@@ -9,13 +9,50 @@
 #include <cinttypes>
 #include <vulkan/vulkan.hpp>
 #include <string>
+#include <vector>
+#include <optional>
 
 namespace prosper
 {
 	class IPrContext;
+	class CacheArchive;
+	class ShaderManager;
 	enum class Vendor : uint32_t;
+	enum class ShaderStage : uint8_t;
 	DLLPROSPER void dump_parsed_shader(IPrContext &context,uint32_t stage,const std::string &shaderFile,const std::string &fileName);
+	DLLPROSPER void dump_parsed_shader(ShaderStage stage,const std::string &shaderFile,const std::string &fileName,std::optional<Vendor> vendor={});
+	// Looks up the SPIR-V in the context's cache archive first, and compiles the shader (and stores the result in the archive) if it isn't cached
 	DLLPROSPER bool glsl_to_spv(IPrContext &context,uint32_t stage,const std::string &fileName,std::vector<unsigned int> &spirv,std::string *infoLog,std::string *debugInfoLog,bool bReload);
+	// Compiles a GLSL (.gls) or HLSL (.hls) shader file through glslang. Doesn't require a context or device and may be called from multiple threads
+	// concurrently. If a vendor is specified, the corresponding GLS_VENDOR_* definition is set.
+	DLLPROSPER bool glsl_to_spv(ShaderStage stage,const std::string &fileName,std::vector<unsigned int> &spirv,std::string *infoLog,std::string *debugInfoLog,std::optional<Vendor> vendor={},bool bReload=false);
+
+	// Precompiled shader archive, which is created offline by the shader precompiler (see tools/shader_precompiler) and shipped alongside the shaders.
+	// It is looked up before the shader cache and the shader sources, so no shaders have to be compiled at runtime.
+	constexpr uint32_t SHADER_ARCHIVE_VERSION = 1u;
+	DLLPROSPER std::string get_shader_archive_entry_name(const std::string &fileName,std::optional<Vendor> vendor={});
+	DLLPROSPER void write_shader_archive_version(CacheArchive &archive);
+	// Returns false if the archive was created by an incompatible version of the precompiler
+	DLLPROSPER bool is_shader_archive_compatible(const CacheArchive &archive);
+	// Compiles the shader once without and once for every vendor. Vendor-specific SPIR-V is only stored if it differs from the generic SPIR-V.
+	DLLPROSPER bool precompile_shader(CacheArchive &archive,ShaderStage stage,const std::string &fileName,std::string *infoLog);
+
+	// The manifest lists the stages of all registered shaders (one '<stage> <path>' pair per line) and is the input for the shader precompiler
+	struct DLLPROSPER ShaderManifestEntry
+	{
+		ShaderStage stage;
+		std::string path;
+	};
+	DLLPROSPER bool write_shader_manifest(const ShaderManager &shaderManager,const std::string &fileName);
+	DLLPROSPER bool read_shader_manifest(const std::string &fileName,std::vector<ShaderManifestEntry> &outEntries);
+
+	// Include dependency graph of all shaders that have been compiled so far. Paths are canonicalized and lower-case.
+	// Returns all files that are (directly or indirectly) included by the specified file
+	DLLPROSPER std::vector<std::string> get_glsl_include_dependencies(const std::string &fileName);
+	// Returns all files that (directly or indirectly) include the specified file
+	DLLPROSPER std::vector<std::string> get_glsl_include_dependents(const std::string &fileName);
+	// Include files are only read once and then cached for all shaders; Clearing the cache forces them to be re-read
+	DLLPROSPER void clear_glsl_include_cache();
 };
 
 #endif
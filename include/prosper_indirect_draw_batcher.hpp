@@ -0,0 +1,109 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __PROSPER_INDIRECT_DRAW_BATCHER_HPP__
+#define __PROSPER_INDIRECT_DRAW_BATCHER_HPP__
+
+#include "prosper_definitions.hpp"
+#include "prosper_includes.hpp"
+#include "prosper_structs.hpp"
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <limits>
+
+#undef max
+
+#pragma warning(push)
+#pragma warning(disable : 4251)
+namespace prosper
+{
+	class IPrContext;
+	class IBuffer;
+	class IDescriptorSet;
+	class ICommandBuffer;
+	class IPrimaryCommandBuffer;
+	class ShaderGraphics;
+
+	// Collects indexed draws that share the same pipeline, descriptor sets and vertex/index buffers into batches,
+	// which are recorded with a single multi-draw-indirect call each. Per-draw data should be fetched in the shader
+	// through the instance index (i.e. via 'firstInstance').
+	// If a count buffer is used, the draw count of each batch is read from the GPU, which allows a compute shader to
+	// cull draws by compacting the indirect commands of a batch and writing the new count.
+	class DLLPROSPER IndirectDrawBatcher
+	{
+	public:
+		struct DLLPROSPER DrawState
+		{
+			ShaderGraphics *shader = nullptr;
+			uint32_t pipelineIdx = 0u;
+			uint32_t firstSet = 0u;
+			std::vector<IDescriptorSet*> descriptorSets = {};
+			std::vector<IBuffer*> vertexBuffers = {};
+			IBuffer *indexBuffer = nullptr;
+			IndexType indexType = IndexType::UInt16;
+
+			bool operator==(const DrawState &other) const;
+			bool operator!=(const DrawState &other) const;
+		};
+		using BatchId = uint32_t;
+		static constexpr BatchId INVALID_BATCH = std::numeric_limits<BatchId>::max();
+
+		// Returns nullptr if a count buffer was requested, but VK_KHR_draw_indirect_count is not available.
+		// If a count buffer is used, maxDrawCount is clamped to the maxDrawIndirectCount limit of the device.
+		static std::shared_ptr<IndirectDrawBatcher> Create(IPrContext &context,uint32_t maxDrawCount,bool useCountBuffer=false);
+		IndirectDrawBatcher(const IndirectDrawBatcher&)=delete;
+		IndirectDrawBatcher &operator=(const IndirectDrawBatcher&)=delete;
+
+		// Returns the batch for the specified state, or creates a new one if there is none yet.
+		// Returns INVALID_BATCH if the number of batches would exceed the maximum draw count.
+		BatchId GetBatch(const DrawState &state);
+		bool AddDrawIndexed(BatchId batchId,const util::DrawIndexedIndirectCommand &cmd);
+		bool AddDrawIndexed(BatchId batchId,uint32_t indexCount,uint32_t instanceCount=1u,uint32_t firstIndex=0u,int32_t vertexOffset=0,uint32_t firstInstance=0u);
+
+		// Writes the indirect commands (and draw counts) of all batches to the GPU. Has to be recorded outside of a render pass.
+		// The destination stage and access mask can be changed if the buffers are consumed by a culling pass first.
+		bool RecordUpload(
+			ICommandBuffer &cmd,PipelineStageFlags dstStageMask=PipelineStageFlags::DrawIndirectBit,AccessFlags dstAccessMask=AccessFlags::IndirectCommandReadBit
+		);
+		// Records all batches. Has to be recorded inside of a render pass, after RecordUpload.
+		bool RecordDraws(const std::shared_ptr<IPrimaryCommandBuffer> &cmd);
+		// Clears all batches and draws, should be called at the beginning of a frame
+		void Clear();
+
+		IBuffer &GetIndirectBuffer() const;
+		// Only available if the batcher was created with a count buffer
+		IBuffer *GetCountBuffer() const;
+		// Offset of the first indirect command of the batch. Only valid after RecordUpload.
+		DeviceSize GetCommandBufferOffset(BatchId batchId) const;
+		DeviceSize GetCountBufferOffset(BatchId batchId) const;
+		uint32_t GetDrawCount(BatchId batchId) const;
+		uint32_t GetBatchCount() const;
+		uint32_t GetTotalDrawCount() const;
+		uint32_t GetMaxDrawCount() const;
+	private:
+		struct Batch
+		{
+			DrawState state = {};
+			std::vector<util::DrawIndexedIndirectCommand> commands = {};
+			uint32_t firstCommand = 0u;
+		};
+		IndirectDrawBatcher(IPrContext &context,const std::shared_ptr<IBuffer> &indirectBuffer,const std::shared_ptr<IBuffer> &countBuffer,uint32_t maxDrawCount);
+		IPrContext &m_context;
+		std::shared_ptr<IBuffer> m_indirectBuffer = nullptr;
+		std::shared_ptr<IBuffer> m_countBuffer = nullptr;
+		std::vector<Batch> m_batches = {};
+		// Batch order for recording, sorted by shader and pipeline to minimize pipeline switches
+		std::vector<BatchId> m_sortedBatches = {};
+		std::unordered_multimap<size_t,BatchId> m_stateToBatch = {};
+		std::vector<util::DrawIndexedIndirectCommand> m_uploadData = {};
+		uint32_t m_maxDrawCount = 0u;
+		uint32_t m_maxDrawIndirectCount = 0u;
+		uint32_t m_drawCount = 0u;
+		bool m_uploaded = false;
+	};
+};
+#pragma warning(pop)
+
+#endif
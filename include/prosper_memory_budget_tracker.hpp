@@ -0,0 +1,105 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __PROSPER_MEMORY_BUDGET_TRACKER_HPP__
+#define __PROSPER_MEMORY_BUDGET_TRACKER_HPP__
+
+#include "prosper_definitions.hpp"
+#include "prosper_includes.hpp"
+#include "prosper_enums.hpp"
+#include <vector>
+#include <memory>
+#include <functional>
+#include <optional>
+
+#pragma warning(push)
+#pragma warning(disable : 4251)
+namespace prosper
+{
+	class IPrContext;
+	// Keeps track of the memory usage and budget of every memory heap. If VK_EXT_memory_budget is available, the budget and usage reported
+	// by the driver are used (which include allocations by other processes and the driver itself), otherwise the budget is the heap size
+	// and the usage is the memory allocated through prosper (see MemoryTracker).
+	// The budgets are re-queried every few frames; Eviction callbacks are invoked in priority order once the usage of a heap
+	// comes close to its budget.
+	class DLLPROSPER MemoryBudgetTracker
+	{
+	public:
+		struct DLLPROSPER HeapBudget
+		{
+			DeviceSize size = 0ull;
+			DeviceSize budget = 0ull;
+			DeviceSize usage = 0ull;
+			// Memory allocated by prosper resources
+			DeviceSize trackedUsage = 0ull;
+			bool deviceLocal = false;
+		};
+		enum class Pressure : uint8_t
+		{
+			None = 0u,
+			High, // Usage has exceeded the eviction threshold
+			Critical // Usage has exceeded the critical threshold, further allocations are likely to fail or cause paging
+		};
+		// Called with the heap and the number of bytes that should be released. Returns the number of bytes that were actually released.
+		using EvictionCallback = std::function<DeviceSize(uint32_t,DeviceSize)>;
+		using UpdateCallback = std::function<void(const MemoryBudgetTracker&)>;
+		using CallbackId = uint32_t;
+		static std::unique_ptr<MemoryBudgetTracker> Create(IPrContext &context);
+		MemoryBudgetTracker(const MemoryBudgetTracker&)=delete;
+		MemoryBudgetTracker &operator=(const MemoryBudgetTracker&)=delete;
+
+		// Budgets are re-queried every n frames
+		void SetUpdateInterval(uint32_t frameInterval);
+		uint32_t GetUpdateInterval() const;
+		// All thresholds are fractions of the budget. Evictions are triggered once the usage exceeds 'evictionThreshold',
+		// and will try to bring the usage down to 'targetThreshold'.
+		void SetThresholds(float targetThreshold,float evictionThreshold,float criticalThreshold);
+
+		// Callbacks with a lower priority are invoked first
+		CallbackId AddEvictionCallback(int32_t priority,const EvictionCallback &callback);
+		void RemoveEvictionCallback(CallbackId id);
+		// Invoked whenever new usage data has been published
+		CallbackId AddUpdateCallback(const UpdateCallback &callback);
+		void RemoveUpdateCallback(CallbackId id);
+
+		// Called once per frame by the context
+		void OnFrame();
+		void Update();
+		// Has to be called before a large allocation is made. Triggers evictions if the allocation would exceed the eviction threshold,
+		// and returns false if it would still exceed the budget afterwards.
+		bool RequestMemory(uint32_t heapIndex,DeviceSize size);
+
+		bool IsDriverBudgetAvailable() const;
+		const std::vector<HeapBudget> &GetHeapBudgets() const;
+		const HeapBudget *GetHeapBudget(uint32_t heapIndex) const;
+		std::optional<uint32_t> FindHeapIndex(MemoryFeatureFlags featureFlags) const;
+		Pressure GetPressure(uint32_t heapIndex) const;
+	private:
+		struct EvictionCallbackInfo
+		{
+			CallbackId id;
+			int32_t priority;
+			EvictionCallback callback;
+		};
+		MemoryBudgetTracker(IPrContext &context,bool driverBudgetAvailable);
+		void QueryBudgets();
+		DeviceSize Evict(uint32_t heapIndex,DeviceSize size);
+
+		IPrContext &m_context;
+		std::vector<HeapBudget> m_heapBudgets = {};
+		std::vector<EvictionCallbackInfo> m_evictionCallbacks = {};
+		std::vector<std::pair<CallbackId,UpdateCallback>> m_updateCallbacks = {};
+		CallbackId m_nextCallbackId = 0u;
+		uint32_t m_updateInterval = 30u;
+		uint32_t m_framesSinceUpdate = 0u;
+		float m_targetThreshold = 0.8f;
+		float m_evictionThreshold = 0.9f;
+		float m_criticalThreshold = 0.97f;
+		bool m_driverBudgetAvailable = false;
+		bool m_evicting = false;
+	};
+};
+#pragma warning(pop)
+
+#endif
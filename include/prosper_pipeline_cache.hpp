@@ -38,6 +38,9 @@ namespace prosper
 
 		static Anvil::PipelineCacheUniquePtr Create(Anvil::BaseDevice &dev);
 		static Anvil::PipelineCacheUniquePtr Load(Anvil::BaseDevice &dev,const std::string &fileName,LoadError &outErr);
+		// Data has to contain the entire cache blob, including the header (e.g. a memory-mapped cache archive entry)
+		static Anvil::PipelineCacheUniquePtr Load(Anvil::BaseDevice &dev,const void *data,size_t size,LoadError &outErr);
+		static bool GetData(Anvil::PipelineCache &cache,std::vector<uint8_t> &outData);
 		static bool Save(Anvil::PipelineCache &cache,const std::string &fileName);
 
 #pragma pack(push,1)
@@ -0,0 +1,157 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __PROSPER_RENDER_GRAPH_HPP__
+#define __PROSPER_RENDER_GRAPH_HPP__
+
+#include "prosper_definitions.hpp"
+#include "prosper_includes.hpp"
+#include "prosper_structs.hpp"
+#include <memory>
+#include <functional>
+#include <vector>
+#include <string>
+#include <optional>
+#include <limits>
+
+#undef max
+
+#pragma warning(push)
+#pragma warning(disable : 4251)
+namespace prosper
+{
+	class IPrContext;
+	class IImage;
+	class IBuffer;
+	class ICommandBuffer;
+
+	// The render graph takes the resource accesses declared by each pass and derives the
+	// pipeline barriers between them. All barriers required by a pass are merged into a single
+	// pipeline barrier, passes whose results are never consumed are culled, and transient images
+	// with non-overlapping lifetimes share the same physical image.
+	// Note: Resource states are tracked per resource, not per subresource.
+	class DLLPROSPER RenderGraph
+	{
+	public:
+		using ResourceId = uint32_t;
+		static constexpr ResourceId INVALID_RESOURCE = std::numeric_limits<ResourceId>::max();
+
+		class DLLPROSPER PassBuilder
+		{
+		public:
+			void ReadImage(ResourceId img,PipelineStageFlags stageMask,ImageLayout layout,AccessFlags accessMask=AccessFlags::ShaderReadBit);
+			void WriteImage(ResourceId img,PipelineStageFlags stageMask,ImageLayout layout,AccessFlags accessMask=AccessFlags::ColorAttachmentWriteBit);
+			void ReadBuffer(ResourceId buf,PipelineStageFlags stageMask,AccessFlags accessMask=AccessFlags::ShaderReadBit);
+			void WriteBuffer(ResourceId buf,PipelineStageFlags stageMask,AccessFlags accessMask=AccessFlags::ShaderWriteBit);
+			// Passes with side effects (e.g. presentation or readback) are never culled
+			void SetHasSideEffects(bool sideEffects=true);
+		private:
+			friend RenderGraph;
+			PassBuilder(RenderGraph &graph,uint32_t passIndex);
+			// Multiple accesses of the same resource within a pass are merged into one
+			void AddAccess(ResourceId resource,PipelineStageFlags stageMask,AccessFlags accessMask,ImageLayout layout,bool write);
+			RenderGraph &m_graph;
+			uint32_t m_passIndex = 0u;
+		};
+
+		RenderGraph(IPrContext &context);
+		RenderGraph(const RenderGraph&)=delete;
+		RenderGraph &operator=(const RenderGraph&)=delete;
+
+		// External resources are considered outputs of the graph, unless specified otherwise.
+		// If a final state is specified for an image, it will be transitioned into it at the end of the graph.
+		ResourceId ImportImage(
+			const std::shared_ptr<IImage> &img,const util::BarrierImageLayout &initialState,
+			const std::optional<util::BarrierImageLayout> &finalState={},bool isOutput=true
+		);
+		ResourceId ImportBuffer(const std::shared_ptr<IBuffer> &buf,PipelineStageFlags initialStageMask,AccessFlags initialAccessMask,bool isOutput=true);
+		// Transient images only live for the duration of the graph; Their contents are undefined at the first access.
+		ResourceId CreateTransientImage(const util::ImageCreateInfo &createInfo);
+		void MarkAsOutput(ResourceId resource);
+
+		void AddPass(const std::string &name,const std::function<void(PassBuilder&)> &setup,const std::function<void(ICommandBuffer&)> &execute);
+
+		bool Compile();
+		bool Execute(ICommandBuffer &cmd);
+		// Clears all passes and resources. Physical transient images are kept and will be re-used by the next compilation.
+		void Reset();
+
+		IImage *GetImage(ResourceId resource) const;
+		IBuffer *GetBuffer(ResourceId resource) const;
+		uint32_t GetPassCount() const;
+		uint32_t GetCulledPassCount() const;
+		uint32_t GetBarrierCount() const;
+	private:
+		enum class ResourceType : uint8_t
+		{
+			Image = 0u,
+			Buffer
+		};
+		struct Access
+		{
+			ResourceId resource = INVALID_RESOURCE;
+			PipelineStageFlags stageMask = PipelineStageFlags::None;
+			AccessFlags accessMask = {};
+			ImageLayout layout = ImageLayout::Undefined;
+			bool write = false;
+			// A pass may both read and write the same resource
+			bool read = false;
+		};
+		struct ResourceState
+		{
+			PipelineStageFlags stageMask = PipelineStageFlags::TopOfPipeBit;
+			AccessFlags accessMask = {};
+			ImageLayout layout = ImageLayout::Undefined;
+			bool lastAccessWasWrite = false;
+		};
+		struct Resource
+		{
+			ResourceType type = ResourceType::Image;
+			std::shared_ptr<IImage> image = nullptr;
+			std::shared_ptr<IBuffer> buffer = nullptr;
+			std::optional<util::ImageCreateInfo> transientCreateInfo = {};
+			ResourceState initialState = {};
+			std::optional<util::BarrierImageLayout> finalState = {};
+			// Transient resource which previously occupied the same physical image
+			ResourceId aliasedResource = INVALID_RESOURCE;
+			uint32_t transientImageIndex = std::numeric_limits<uint32_t>::max();
+			bool isOutput = false;
+		};
+		struct Pass
+		{
+			std::string name;
+			std::vector<Access> accesses;
+			std::function<void(ICommandBuffer&)> execute = nullptr;
+			bool sideEffects = false;
+			bool culled = false;
+			std::unique_ptr<util::PipelineBarrierInfo> barrier = nullptr;
+		};
+		struct TransientImage
+		{
+			std::shared_ptr<IImage> image = nullptr;
+			util::ImageCreateInfo createInfo = {};
+			ResourceId lastResource = INVALID_RESOURCE;
+			uint32_t lastUsePass = 0u;
+			// Accesses of the image at the end of previous executions (which may still be in flight), which the first use has to wait for
+			ResourceState lastState = {};
+		};
+		ResourceId AddResource(Resource &&resource);
+		void CullPasses();
+		bool AssignTransientImages();
+		void ComputeBarriers();
+		// Returns true if the state of any transient image has changed, in which case the barriers have to be re-computed
+		bool UpdateTransientImageStates();
+
+		IPrContext &m_context;
+		std::vector<Resource> m_resources = {};
+		std::vector<Pass> m_passes = {};
+		std::vector<ResourceState> m_finalStates = {};
+		std::vector<TransientImage> m_transientImagePool = {};
+		std::unique_ptr<util::PipelineBarrierInfo> m_finalBarrier = nullptr;
+		bool m_compiled = false;
+	};
+};
+#pragma warning(pop)
+
+#endif
@@ -280,6 +280,25 @@ namespace prosper
 			Extent3D extent;
 		};
 
+		// Memory layout matches VkDrawIndirectCommand
+		struct DLLPROSPER DrawIndirectCommand
+		{
+			uint32_t vertexCount = 0u;
+			uint32_t instanceCount = 1u;
+			uint32_t firstVertex = 0u;
+			uint32_t firstInstance = 0u;
+		};
+
+		// Memory layout matches VkDrawIndexedIndirectCommand
+		struct DLLPROSPER DrawIndexedIndirectCommand
+		{
+			uint32_t indexCount = 0u;
+			uint32_t instanceCount = 1u;
+			uint32_t firstIndex = 0u;
+			int32_t vertexOffset = 0;
+			uint32_t firstInstance = 0u;
+		};
+
 		struct DLLPROSPER SubresourceLayout
 		{
 			DeviceSize offset;
@@ -312,7 +331,11 @@ namespace prosper
 				SparseAliasedResidency = Sparse<<1u, // Only has an effect if Sparse-flag is set
 
 				AllocateDiscreteMemory = SparseAliasedResidency<<1u,
-				DontAllocateMemory = AllocateDiscreteMemory<<1u
+				DontAllocateMemory = AllocateDiscreteMemory<<1u,
+				// The image is only used as an attachment whose contents are never read after the render pass (e.g. multisampled attachments
+				// which are resolved, depth attachments with a store op of DontCare). It is backed by lazily allocated memory if the device supports it,
+				// which usually means it never gets any physical memory. Creation fails if any non-attachment usages or initial data are specified.
+				TransientAttachment = DontAllocateMemory<<1u
 			};
 			Flags flags = Flags::None;
 			QueueFamilyFlags queueFamilyMask = QueueFamilyFlags::GraphicsBit;
@@ -388,6 +411,9 @@ namespace prosper
 				prosper::AttachmentStoreOp storeOp = prosper::AttachmentStoreOp::Store;
 				prosper::ImageLayout initialLayout = prosper::ImageLayout::ColorAttachmentOptimal;
 				prosper::ImageLayout finalLayout = prosper::ImageLayout::ShaderReadOnlyOptimal;
+				// Index of a single-sampled attachment this (multi-sampled color) attachment is resolved to at the end of every sub-pass that renders to it.
+				// Resolve attachments are not used as color attachments themselves.
+				std::optional<std::size_t> resolveAttachment = {};
 			};
 			struct DLLPROSPER SubPass
 			{
@@ -413,10 +439,16 @@ namespace prosper
 				std::vector<std::size_t> colorAttachments = {};
 				bool useDepthStencilAttachment = false;
 				std::vector<Dependency> dependencies = {};
+				// Attachments written by a previous sub-pass, which are read by the fragment shader through subpassInput (input_attachment_index = index in this list).
+				// The dependencies to the sub-passes that write them are added automatically.
+				std::vector<std::size_t> inputAttachments = {};
+				bool UsesAttachment(std::size_t attachmentIndex,bool isDepthStencilAttachment) const;
 			};
 			RenderPassCreateInfo(const std::vector<AttachmentInfo> &attachments={},const std::vector<SubPass> &subPasses={});
 			bool operator==(const RenderPassCreateInfo &other) const;
 			bool operator!=(const RenderPassCreateInfo &other) const;
+			bool IsResolveAttachment(std::size_t attachmentIndex) const;
+			uint32_t GetSubPassCount() const;
 			std::vector<AttachmentInfo> attachments;
 			std::vector<SubPass> subPasses;
 		};
@@ -0,0 +1,97 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __PROSPER_TRANSFER_UPLOAD_QUEUE_HPP__
+#define __PROSPER_TRANSFER_UPLOAD_QUEUE_HPP__
+
+#include "prosper_definitions.hpp"
+#include "prosper_includes.hpp"
+#include "prosper_enums.hpp"
+#include "prosper_structs.hpp"
+#include <memory>
+#include <vector>
+
+#pragma warning(push)
+#pragma warning(disable : 4251)
+namespace prosper
+{
+	class IPrContext;
+	class IBuffer;
+	class IImage;
+
+	// Uploads buffer and image data on the transfer queue, so large uploads don't delay the submission of the frame on the universal queue.
+	// Uploads are batched until Flush is called (or the batch size limit has been reached). Every batch is submitted to the transfer queue with
+	// a semaphore, which the next frame waits on before executing any of the destination stages of the uploads in the batch.
+	// If the device has a dedicated transfer queue family, the ownership of the destination resources is released by the transfer queue
+	// and acquired by the universal queue at the beginning of the next frame.
+	//
+	// The destination resources must not be in use by the GPU while an upload is pending, and can be used starting with the frame after the Flush.
+	// Previous contents of uploaded image subresources are discarded.
+	class DLLPROSPER TransferUploadQueue
+	{
+	public:
+		struct DLLPROSPER BufferUploadInfo
+		{
+			// Stages and access types the buffer will be used with after the upload
+			PipelineStageFlags dstStageMask = util::PIPELINE_STAGE_SHADER_INPUT_FLAGS;
+			AccessFlags dstAccessMask = AccessFlags::ShaderReadBit;
+		};
+		struct DLLPROSPER ImageUploadInfo
+		{
+			uint32_t mipLevel = 0u;
+			uint32_t baseArrayLayer = 0u;
+			uint32_t layerCount = 1u;
+			ImageAspectFlags aspectMask = ImageAspectFlags::ColorBit;
+			// Layout the image will be transitioned to after the upload
+			ImageLayout dstImageLayout = ImageLayout::ShaderReadOnlyOptimal;
+			PipelineStageFlags dstStageMask = PipelineStageFlags::FragmentShaderBit;
+			AccessFlags dstAccessMask = AccessFlags::ShaderReadBit;
+		};
+		static std::unique_ptr<TransferUploadQueue> Create(IPrContext &context,DeviceSize maxBatchSize=64ull *1'024ull *1'024ull);
+		~TransferUploadQueue();
+		TransferUploadQueue(const TransferUploadQueue&)=delete;
+		TransferUploadQueue &operator=(const TransferUploadQueue&)=delete;
+
+		// The data is copied, so it doesn't have to be kept alive until the upload is complete
+		bool UploadBuffer(const std::shared_ptr<IBuffer> &buffer,DeviceSize offset,DeviceSize size,const void *data,const BufferUploadInfo &uploadInfo={});
+		// Uploads the data for the specified mipmap level and layers. The data has to be tightly packed.
+		bool UploadImage(const std::shared_ptr<IImage> &image,const void *data,DeviceSize size,const ImageUploadInfo &uploadInfo={});
+		// Submits all pending uploads to the transfer queue
+		bool Flush();
+
+		// Returns false if uploads are submitted to the universal queue because the device has no dedicated transfer queue family
+		bool HasDedicatedTransferQueue() const;
+		uint32_t GetPendingUploadCount() const;
+		DeviceSize GetPendingUploadSize() const;
+	private:
+		struct BufferUpload
+		{
+			std::shared_ptr<IBuffer> buffer;
+			DeviceSize stagingOffset;
+			DeviceSize offset;
+			DeviceSize size;
+			BufferUploadInfo uploadInfo;
+		};
+		struct ImageUpload
+		{
+			std::shared_ptr<IImage> image;
+			DeviceSize stagingOffset;
+			ImageUploadInfo uploadInfo;
+		};
+		struct Batch;
+		TransferUploadQueue(IPrContext &context,DeviceSize maxBatchSize,uint32_t transferQueueFamilyIndex,uint32_t universalQueueFamilyIndex);
+		DeviceSize AddStagingData(const void *data,DeviceSize size);
+
+		IPrContext &m_context;
+		DeviceSize m_maxBatchSize = 0ull;
+		uint32_t m_transferQueueFamilyIndex = QUEUE_FAMILY_IGNORED;
+		uint32_t m_universalQueueFamilyIndex = QUEUE_FAMILY_IGNORED;
+		std::vector<uint8_t> m_stagingData = {};
+		std::vector<BufferUpload> m_bufferUploads = {};
+		std::vector<ImageUpload> m_imageUploads = {};
+	};
+};
+#pragma warning(pop)
+
+#endif
@@ -0,0 +1,80 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __PROSPER_UPLOAD_CONTEXT_POOL_HPP__
+#define __PROSPER_UPLOAD_CONTEXT_POOL_HPP__
+
+#include "prosper_definitions.hpp"
+#include "prosper_includes.hpp"
+#include <memory>
+#include <vector>
+#include <deque>
+
+#pragma warning(push)
+#pragma warning(disable : 4251)
+namespace prosper
+{
+	class IPrContext;
+	class IPrimaryCommandBuffer;
+	class IFence;
+
+	// Non-blocking alternative to the setup command buffer (see IPrContext::GetSetupCommandBuffer). Every upload context has its own command buffer
+	// and fence; Flushing a context submits it to the universal queue without waiting for it, and returns an id that can be used to wait for
+	// that particular submission later on. Contexts are returned to the pool once their fence has been signalled.
+	// Submissions are executed in order with the frame(s) submitted afterwards, so resources written by an upload can be used by the
+	// next frame without waiting for the upload on the CPU.
+	class DLLPROSPER UploadContextPool
+	{
+	public:
+		using SubmissionId = uint64_t;
+		static constexpr SubmissionId INVALID_SUBMISSION_ID = 0ull;
+		class DLLPROSPER UploadContext
+		{
+		public:
+			UploadContext(const UploadContext&)=delete;
+			UploadContext &operator=(const UploadContext&)=delete;
+			IPrimaryCommandBuffer &GetCommandBuffer() const;
+			// Keeps the resource (e.g. a staging buffer) alive until the GPU has finished executing the upload
+			void KeepResourceAlive(const std::shared_ptr<void> &resource);
+		private:
+			friend UploadContextPool;
+			UploadContext()=default;
+			std::shared_ptr<IPrimaryCommandBuffer> m_cmdBuffer = nullptr;
+			std::shared_ptr<IFence> m_fence = nullptr;
+			std::vector<std::shared_ptr<void>> m_resources = {};
+			SubmissionId m_submissionId = INVALID_SUBMISSION_ID;
+		};
+		static std::unique_ptr<UploadContextPool> Create(IPrContext &context,uint32_t maxInFlight=16u);
+		UploadContextPool(const UploadContextPool&)=delete;
+		UploadContextPool &operator=(const UploadContextPool&)=delete;
+
+		// Returns a context which is ready for recording. If the maximum number of contexts is in flight, this waits for the oldest one.
+		UploadContext &Acquire();
+		// Submits the context without waiting for it. The context must not be used anymore afterwards.
+		SubmissionId Flush(UploadContext &context);
+		bool IsComplete(SubmissionId submissionId);
+		bool Wait(SubmissionId submissionId);
+		bool WaitAll();
+		// Returns all contexts that have been completed to the pool. This is called by the context once per frame.
+		void Recycle();
+
+		uint32_t GetInFlightCount() const;
+		uint32_t GetContextCount() const;
+	private:
+		UploadContextPool(IPrContext &context,uint32_t maxInFlight);
+		UploadContext *FindInFlightContext(SubmissionId submissionId) const;
+		void ReleaseContext(UploadContext &context);
+
+		IPrContext &m_context;
+		uint32_t m_maxInFlight = 0u;
+		SubmissionId m_nextSubmissionId = INVALID_SUBMISSION_ID +1ull;
+		std::vector<std::unique_ptr<UploadContext>> m_contexts = {};
+		// In-flight contexts in submission order
+		std::deque<UploadContext*> m_inFlight = {};
+		std::vector<UploadContext*> m_free = {};
+	};
+};
+#pragma warning(pop)
+
+#endif
@@ -8,6 +8,7 @@
 #include <mathutil/umath.h>
 #include <functional>
 #include <optional>
+#include <future>
 #include "prosper_definitions.hpp"
 #include "prosper_includes.hpp"
 #include "prosper_enums.hpp"
@@ -55,6 +56,8 @@ namespace prosper
 	namespace util
 	{
 		DLLPROSPER bool get_current_render_pass_target(prosper::IPrimaryCommandBuffer &cmdBuffer,prosper::IRenderPass **outRp=nullptr,prosper::IImage **outImg=nullptr,prosper::IFramebuffer **outFb=nullptr,prosper::RenderTarget **outRt=nullptr);
+		// Index of the sub-pass that is currently being recorded, or std::numeric_limits<uint32_t>::max() if no render pass is active
+		DLLPROSPER uint32_t get_current_sub_pass_id(prosper::IPrimaryCommandBuffer &cmdBuffer);
 
 		DLLPROSPER BufferBarrier create_buffer_barrier(const util::BufferBarrierInfo &barrierInfo,IBuffer &buffer);
 		DLLPROSPER ImageBarrier create_image_barrier(IImage &img,const util::ImageBarrierInfo &barrierInfo);
@@ -100,6 +103,9 @@ namespace prosper
 		//get_queue_family_index
 		DLLPROSPER std::pair<const Anvil::MemoryType*,MemoryFeatureFlags> find_compatible_memory_type(Anvil::BaseDevice &dev,MemoryFeatureFlags featureFlags);
 		DLLPROSPER bool save_texture(const std::string &fileName,prosper::IImage &image,const uimg::TextureInfo &texInfo,const std::function<void(const std::string&)> &errorHandler=nullptr);
+		// Same as save_texture, but doesn't stall the render loop. The image data is copied as part of the current frame and
+		// encoded on a worker thread once the GPU has completed the frame. Note: The error handler may be called from the worker thread!
+		DLLPROSPER std::future<bool> save_texture_async(const std::string &fileName,prosper::IImage &image,const uimg::TextureInfo &texInfo,const std::function<void(const std::string&)> &errorHandler=nullptr);
 
 		// Clamps the specified size in bytes to a percentage of the total available GPU memory
 		DLLPROSPER uint64_t clamp_gpu_memory_size(Anvil::BaseDevice &dev,uint64_t size,float percentageOfGPUMemory,MemoryFeatureFlags featureFlags);
@@ -129,8 +135,18 @@ namespace prosper
 			uint32_t maxSurfaceImageCount = 0;
 			uint32_t maxImageArrayLayers = 0;
 			DeviceSize maxStorageBufferRange = 0;
+			DeviceSize maxUniformBufferRange = 0;
+			DeviceSize minUniformBufferOffsetAlignment = 0;
+			uint32_t maxPerStageDescriptorSamplers = 0;
+			uint32_t maxPerStageDescriptorSampledImages = 0;
+			// Limits for bindings with the UpdateAfterBindBit flag; Zero if descriptor indexing (partially bound, update-after-bind sampled images) is not supported
+			uint32_t maxPerStageDescriptorUpdateAfterBindSamplers = 0;
+			uint32_t maxPerStageDescriptorUpdateAfterBindSampledImages = 0;
+			// 1 if multi-draw-indirect is not supported
+			uint32_t maxDrawIndirectCount = 0;
 		};
 		DLLPROSPER Limits get_physical_device_limits(const IPrContext &context);
+		DLLPROSPER bool is_draw_indirect_count_supported(const IPrContext &context);
 
 		struct DLLPROSPER PhysicalDeviceImageFormatProperties
 		{
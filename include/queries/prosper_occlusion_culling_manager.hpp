@@ -0,0 +1,111 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __PROSPER_OCCLUSION_CULLING_MANAGER_HPP__
+#define __PROSPER_OCCLUSION_CULLING_MANAGER_HPP__
+
+#include "prosper_definitions.hpp"
+#include "prosper_includes.hpp"
+#include <memory>
+#include <vector>
+#include <queue>
+#include <limits>
+
+#undef max
+
+#pragma warning(push)
+#pragma warning(disable : 4251)
+namespace prosper
+{
+	class IPrContext;
+	class ICommandBuffer;
+	class QueryPool;
+
+	// Occlusion culling with temporal coherence. Queries are issued in per-frame batches and their results are read back
+	// once the GPU has finished the frame (i.e. up to GetSwapchainImageCount() frames later), so the CPU never waits for a query.
+	// Every object keeps a short history of its query results; Objects whose visibility has been stable for a while
+	// are only re-tested every few frames, objects with uncertain visibility are tested every frame.
+	//
+	// Usage per frame:
+	// 1) BeginFrame (outside of a render pass)
+	// 2) For every object: If ShouldTest returns true, draw its bounding volume (or the object itself) between RecordBeginQuery and RecordEndQuery.
+	//    Use IsVisible to determine whether the object should be rendered.
+	class DLLPROSPER OcclusionCullingManager
+		: public std::enable_shared_from_this<OcclusionCullingManager>
+	{
+	public:
+		using ObjectId = uint32_t;
+		static constexpr ObjectId INVALID_OBJECT = std::numeric_limits<ObjectId>::max();
+		struct DLLPROSPER CreateInfo
+		{
+			// Maximum number of queries that can be issued in a single frame
+			uint32_t maxQueriesPerFrame = 1'024u;
+			// Number of identical consecutive results required before an object's visibility is considered stable
+			uint32_t stableResultCount = 3u;
+			// Stable objects are only re-tested every n frames. Occluded objects should be re-tested more frequently, since
+			// they will not be rendered until a query reports them as visible again.
+			uint32_t visibleRetestInterval = 8u;
+			uint32_t occludedRetestInterval = 2u;
+		};
+		static std::shared_ptr<OcclusionCullingManager> Create(IPrContext &context,const CreateInfo &createInfo);
+		~OcclusionCullingManager();
+		OcclusionCullingManager(const OcclusionCullingManager&)=delete;
+		OcclusionCullingManager &operator=(const OcclusionCullingManager&)=delete;
+
+		ObjectId AddObject();
+		void RemoveObject(ObjectId id);
+
+		// Resets the queries that will be used for this frame. Has to be called once per frame, before any queries are recorded.
+		bool BeginFrame(ICommandBuffer &cmdBuffer);
+		bool ShouldTest(ObjectId id) const;
+		// Objects are considered visible until a query has reported otherwise
+		bool IsVisible(ObjectId id) const;
+		// Returns false if no query could be issued (e.g. because the maximum number of queries for this frame has been reached)
+		bool RecordBeginQuery(ICommandBuffer &cmdBuffer,ObjectId id);
+		bool RecordEndQuery(ICommandBuffer &cmdBuffer);
+
+		uint32_t GetQueryCount() const;
+		uint32_t GetObjectCount() const;
+		const CreateInfo &GetCreateInfo() const;
+	private:
+		struct Object
+		{
+			// Bit n is set if the object was visible in the n-th most recent result
+			uint32_t history = 0u;
+			uint32_t resultCount = 0u;
+			uint64_t lastTestFrame = std::numeric_limits<uint64_t>::max();
+			// Objects are re-added with a new generation, so results for a removed object are discarded
+			uint32_t generation = 0u;
+			bool valid = false;
+		};
+		struct QueryInfo
+		{
+			ObjectId object = INVALID_OBJECT;
+			uint32_t generation = 0u;
+		};
+		struct Batch
+		{
+			std::vector<QueryInfo> queries = {};
+			bool inUse = false;
+		};
+		OcclusionCullingManager(IPrContext &context,const std::shared_ptr<QueryPool> &queryPool,const CreateInfo &createInfo,uint32_t batchCount);
+		void ProcessBatchResults(uint32_t batchIdx);
+		bool IsStable(const Object &o) const;
+
+		IPrContext &m_context;
+		CreateInfo m_createInfo {};
+		std::shared_ptr<QueryPool> m_queryPool = nullptr;
+		std::vector<Batch> m_batches = {};
+		std::vector<Object> m_objects = {};
+		std::queue<ObjectId> m_freeObjects = {};
+		std::vector<uint64_t> m_resultData = {};
+		uint64_t m_frameId = std::numeric_limits<uint64_t>::max();
+		uint32_t m_currentBatch = std::numeric_limits<uint32_t>::max();
+		uint32_t m_activeQuery = std::numeric_limits<uint32_t>::max();
+		uint32_t m_numObjects = 0u;
+	};
+};
+#pragma warning(pop)
+
+#endif
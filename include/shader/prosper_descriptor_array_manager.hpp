@@ -7,7 +7,8 @@
 
 #include "prosper_definitions.hpp"
 #include <memory>
-#include <queue>
+#include <vector>
+#include <algorithm>
 #include <optional>
 #include <functional>
 #include <unordered_map>
@@ -21,19 +22,35 @@ namespace prosper
 	class IDescriptorSet;
 	class IDescriptorSetGroup;
 	class IPrContext;
+	// Manages a (bindless) texture array in a single descriptor set binding.
+	// If descriptor indexing is supported, the array is created as partially bound with update-after-bind, which allows
+	// it to be updated while it is still bound in pending command buffers. Descriptor writes are staged
+	// and pushed to the device in one batch at the beginning of the next frame (see FlushPendingUpdates), and removed
+	// slots are only re-used once the GPU has finished all frames that may still reference them.
 	class DLLPROSPER DescriptorArrayManager
 		: public std::enable_shared_from_this<DescriptorArrayManager>
 	{
 	public:
+		// Upper bound for the array size. Some implementations report limits in the range of millions (or effectively unbounded),
+		// which would allocate far more descriptor pool memory than is ever needed.
+		static constexpr uint32_t MAX_ARRAY_SIZE = 65'536u;
 		template<class TDescriptorArrayManager>
-			static std::shared_ptr<TDescriptorArrayManager> Create(prosper::IPrContext &context,prosper::ShaderStageFlags shaderStages);
+			static std::shared_ptr<TDescriptorArrayManager> Create(prosper::IPrContext &context,prosper::ShaderStageFlags shaderStages,std::optional<uint32_t> maxArraySize={});
 		template<class TDescriptorArrayManager>
 			static std::shared_ptr<TDescriptorArrayManager> Create(const std::shared_ptr<prosper::IDescriptorSetGroup> &matArrayDsg,uint32_t bindingIndex);
 		using ArrayIndex = uint32_t;
 		static const auto INVALID_ARRAY_INDEX = std::numeric_limits<ArrayIndex>::max();
+		static uint32_t GetMaxArraySize(prosper::IPrContext &context,bool *outUpdateAfterBind=nullptr);
 
 		virtual ~DescriptorArrayManager()=default;
+		// The index will become available again once the GPU has finished using it
 		void RemoveItem(ArrayIndex index);
+		// Pushes all staged descriptor writes to the device. This happens automatically at the beginning of the next frame,
+		// but has to be called manually if items that have been added during the current frame are used in the same frame.
+		void FlushPendingUpdates();
+		bool HasPendingUpdates() const;
+		ArrayIndex GetArraySize() const;
+		const std::shared_ptr<prosper::IDescriptorSetGroup> &GetDescriptorSetGroup() const;
 	protected:
 		DescriptorArrayManager(
 			const std::shared_ptr<prosper::IDescriptorSetGroup> &matArrayDsg,ArrayIndex maxArrayLayers,uint32_t bindingIndex=0
@@ -45,28 +62,35 @@ namespace prosper
 		void PushFreeIndex(ArrayIndex index);
 		std::shared_ptr<prosper::IDescriptorSetGroup> m_dsgArray = nullptr;
 		uint32_t m_bindingIndex = 0;
-		std::queue<ArrayIndex> m_freeIndices = {};
+		std::vector<ArrayIndex> m_freeIndices = {};
 		ArrayIndex m_nextIndex = 0;
 		ArrayIndex m_maxArrayLayers = 0;
+		bool m_pendingUpdates = false;
 	};
 };
 
 template<class TDescriptorArrayManager>
-	std::shared_ptr<TDescriptorArrayManager> prosper::DescriptorArrayManager::Create(prosper::IPrContext &context,prosper::ShaderStageFlags shaderStages)
+	std::shared_ptr<TDescriptorArrayManager> prosper::DescriptorArrayManager::Create(prosper::IPrContext &context,prosper::ShaderStageFlags shaderStages,std::optional<uint32_t> maxArraySize)
 {
-	auto limits = prosper::util::get_physical_device_limits(context);
-	auto maxArrayLayers = limits.maxImageArrayLayers;
+	auto updateAfterBind = false;
+	auto arraySize = GetMaxArraySize(context,&updateAfterBind);
+	if(maxArraySize.has_value())
+		arraySize = std::min(arraySize,*maxArraySize);
+	auto flags = prosper::DescriptorBindingFlags::None;
+	if(updateAfterBind)
+		flags |= prosper::DescriptorBindingFlags::PartiallyBoundBit | prosper::DescriptorBindingFlags::UpdateAfterBindBit | prosper::DescriptorBindingFlags::UpdateUnusedWhilePendingBit;
 	auto matArrayDsg = context.CreateDescriptorSetGroup({
 		{
 			prosper::DescriptorSetInfo::Binding {
 				prosper::DescriptorType::CombinedImageSampler,
 				shaderStages,
-				maxArrayLayers,
-				0
+				arraySize,
+				0,
+				flags
 			}
 		}
 	});
-	return Create(matArrayDsg,0u);
+	return Create<TDescriptorArrayManager>(matArrayDsg,0u);
 }
 
 template<class TDescriptorArrayManager>
@@ -15,6 +15,8 @@
 #include <unordered_map>
 #include <optional>
 #include <functional>
+#include <mutex>
+#include <atomic>
 
 #undef max
 
@@ -43,11 +45,15 @@ namespace prosper
 		{
 			Binding()=default;
 			// If 'bindingIndex' is not specified, it will use the index of the previous binding, incremented by the previous array size
-			Binding(DescriptorType type,ShaderStageFlags shaderStages,uint32_t descriptorArraySize=1u,uint32_t bindingIndex=std::numeric_limits<uint32_t>::max());
+			Binding(
+				DescriptorType type,ShaderStageFlags shaderStages,uint32_t descriptorArraySize=1u,uint32_t bindingIndex=std::numeric_limits<uint32_t>::max(),
+				DescriptorBindingFlags flags=DescriptorBindingFlags::None
+			);
 			DescriptorType type = {};
 			ShaderStageFlags shaderStages = ShaderStageFlags::All;
 			uint32_t bindingIndex = std::numeric_limits<uint32_t>::max();
 			uint32_t descriptorArraySize = 1u;
+			DescriptorBindingFlags flags = DescriptorBindingFlags::None;
 		};
 		DescriptorSetInfo()=default;
 		DescriptorSetInfo(const std::vector<Binding> &bindings);
@@ -77,12 +83,43 @@ namespace prosper
 		std::string debugName;
 
 		std::vector<PushConstantRange> pushConstantRanges {};
+		// Stages of all push constant ranges covering each 4-byte push constant word, built when the pipeline is baked
+		std::vector<ShaderStageFlags> pushConstantStages {};
 		// TODO: These should be unique_ptrs, but that results in compiler errors
 		// that I haven't been able to get around
 		std::shared_ptr<prosper::BasePipelineCreateInfo> createInfo = nullptr;
 		std::vector<std::shared_ptr<DescriptorSetCreateInfo>> descSetInfos {};
 	};
 
+	// Specialization constant values which identify a pipeline variant (see Shader::GetPipelineVariant)
+	class DLLPROSPER SpecializationConstantValues
+	{
+	public:
+		void Set(ShaderStage stage,uint32_t constantId,uint32_t numBytes,const void *data);
+		template<typename T>
+			void Set(ShaderStage stage,uint32_t constantId,const T &value);
+		void Clear();
+		bool IsEmpty() const;
+
+		// Calls the function for every constant, sorted by stage and constant id
+		void ForEach(const std::function<void(ShaderStage,uint32_t,uint32_t,const void*)> &f) const;
+		bool Contains(ShaderStage stage,uint32_t constantId) const;
+		// Canonical representation of all values, used to look up variants
+		const std::string &GetKey() const;
+	private:
+		struct Entry
+		{
+			ShaderStage stage;
+			uint32_t constantId;
+			uint32_t numBytes;
+			uint32_t offset;
+		};
+		std::vector<Entry> m_entries {};
+		std::vector<uint8_t> m_data {};
+		mutable std::string m_key {};
+		mutable bool m_keyDirty = true;
+	};
+
 	class IDescriptorSetGroup;
 	class IRenderPass;
 	class ICommandBuffer;
@@ -110,7 +147,7 @@ namespace prosper
 		Shader(IPrContext &context,const std::string &identifier,const std::string &csShader);
 		Shader(const Shader&)=delete;
 		Shader &operator=(const Shader&)=delete;
-		virtual ~Shader() override=default;
+		virtual ~Shader() override;
 
 		void Release(bool bDelete=true);
 		void SetDebugName(uint32_t pipelineIdx,const std::string &name);
@@ -121,6 +158,11 @@ namespace prosper
 
 		void Initialize(bool bReloadSourceCode=false);
 		void ReloadPipelines(bool bReloadSourceCode=false);
+		// Shaders can be registered with deferred initialization (see ShaderManager::SetLazyInitializationEnabled), in which case
+		// they're initialized the first time they're used. If that happens while a frame is being recorded, the initialization is
+		// postponed until the frame has been completed and the shader remains invalid until then. Returns IsValid().
+		bool EnsureInitialized();
+		bool IsInitializationPending() const;
 		uint32_t GetPipelineCount() const;
 
 		bool IsGraphicsShader() const;
@@ -163,6 +205,16 @@ namespace prosper
 
 		// Has to be called before the pipeline is initialized!
 		void SetStageSourceFilePath(ShaderStage stage,const std::string &filePath);
+
+		// Returns the variant of the pipeline with the specified specialization constant values (in addition to the constants of the pipeline itself).
+		// Variants are created on demand on a background thread, as derivatives of the pipeline. If the variant isn't ready yet, {} is returned,
+		// unless 'wait' is set, in which case the calling thread will wait for it.
+		std::optional<PipelineID> GetPipelineVariant(uint32_t pipelineIdx,const SpecializationConstantValues &values,bool wait=false);
+		// Can be called after BeginDraw/BeginCompute to switch to a variant of the pipeline. Variants use the same layout as the pipeline,
+		// so descriptor sets and push constants are unaffected. If the variant isn't ready yet and 'fallbackToBasePipeline' is
+		// set, the pipeline without the variant constants will be bound instead.
+		bool BindPipelineVariant(prosper::ICommandBuffer &cmdBuffer,uint32_t pipelineIdx,const SpecializationConstantValues &values,bool fallbackToBasePipeline=true);
+		uint32_t GetPipelineVariantCount(uint32_t pipelineIdx) const;
 	protected:
 		virtual void OnPipelineBound() {};
 		virtual void OnPipelineUnbound() {};
@@ -183,24 +235,41 @@ namespace prosper
 		ShaderStageData *GetStage(ShaderStage stage);
 		const ShaderStageData *GetStage(ShaderStage stage) const;
 		void InitializeDescriptorSetGroup(prosper::BasePipelineCreateInfo &pipelineInfo);
+		void InitializePushConstantStages(PipelineInfo &pipelineInfo);
 		std::vector<PipelineInfo> m_pipelineInfos {};
 		// Pipeline this pipeline is derived from
 		std::weak_ptr<Shader> m_basePipeline = {};
 		uint32_t m_currentPipelineIdx = std::numeric_limits<uint32_t>::max();
 	private:
+		friend ShaderManager;
 		std::weak_ptr<prosper::IPrimaryCommandBuffer> m_currentCmd = {};
 		static std::function<void(Shader&,ShaderStage,const std::string&,const std::string&)> s_logCallback;
 		using std::enable_shared_from_this<Shader>::shared_from_this;
 
-		bool InitializeSources(bool bReload=false);
+		bool InitializeSources(bool bReload=false,bool bLogErrors=true);
 		void InitializeStages();
+		void SetInitializationPending();
+		// Compiles the sources ahead of the deferred initialization, may be called from any thread
+		void PrefetchSources();
+		std::optional<PipelineID> CreatePipelineVariant(uint32_t pipelineIdx,const SpecializationConstantValues &values);
+		void ClearPipelineVariants();
 		
 		std::array<std::shared_ptr<ShaderStageData>,umath::to_integral(prosper::ShaderStage::Count)> m_stages;
 		bool m_bValid = false;
 		bool m_bFirstTimeInit = true;
+		std::atomic<bool> m_bInitializationPending = false;
+		bool m_bSourcesPrefetched = false;
+		bool m_bInitializationScheduled = false;
+		// Locked during initialization and source prefetching
+		std::recursive_mutex m_initializationMutex;
 		std::string m_identifier;
 
 		PipelineBindPoint m_pipelineBindPoint = static_cast<PipelineBindPoint>(-1);
+
+		// Pipeline variants by pipeline index and specialization constant key
+		struct PipelineVariant;
+		std::vector<std::unordered_map<std::string,std::shared_ptr<PipelineVariant>>> m_pipelineVariants {};
+		mutable std::mutex m_pipelineVariantMutex;
 	};
 
 	class DLLPROSPER ShaderGraphics
@@ -261,6 +330,11 @@ namespace prosper
 		bool RecordBindIndexBuffer(prosper::IBuffer &indexBuffer,prosper::IndexType indexType=prosper::IndexType::UInt16,DeviceSize offset=0ull);
 		bool RecordDraw(uint32_t vertCount,uint32_t instanceCount=1u,uint32_t firstVertex=0u,uint32_t firstInstance=0u);
 		bool RecordDrawIndexed(uint32_t indexCount,uint32_t instanceCount=1u,uint32_t firstIndex=0u,int32_t vertexOffset=0,uint32_t firstInstance=0u);
+		bool RecordDrawIndexedIndirect(prosper::IBuffer &buffer,DeviceSize offset,uint32_t drawCount,uint32_t stride=sizeof(util::DrawIndexedIndirectCommand));
+		bool RecordDrawIndexedIndirectCount(
+			prosper::IBuffer &buffer,DeviceSize offset,prosper::IBuffer &countBuffer,DeviceSize countBufferOffset,uint32_t maxDrawCount,
+			uint32_t stride=sizeof(util::DrawIndexedIndirectCommand)
+		);
 		void AddVertexAttribute(prosper::GraphicsPipelineCreateInfo &pipelineInfo,VertexAttribute &attr);
 		bool AddSpecializationConstant(prosper::GraphicsPipelineCreateInfo &pipelineInfo,prosper::ShaderStage stage,uint32_t constantId,uint32_t numBytes,const void *data);
 		virtual bool BeginDraw(const std::shared_ptr<prosper::IPrimaryCommandBuffer> &cmdBuffer,uint32_t pipelineIdx=0u,RecordFlags recordFlags=RecordFlags::RenderPassTargetAsViewportAndScissor);
@@ -277,6 +351,8 @@ namespace prosper
 		void ToggleDynamicScissorState(prosper::GraphicsPipelineCreateInfo &pipelineInfo,bool bEnable);
 		virtual void InitializeGfxPipeline(prosper::GraphicsPipelineCreateInfo &pipelineInfo,uint32_t pipelineIdx);
 		virtual void InitializeRenderPass(std::shared_ptr<IRenderPass> &outRenderPass,uint32_t pipelineIdx);
+		// Index of the sub-pass of the render pass the pipeline is used in
+		virtual uint32_t GetSubPassId(uint32_t pipelineIdx) const;
 
 		void CreateCachedRenderPass(size_t hashCode,const prosper::util::RenderPassCreateInfo &renderPassInfo,std::shared_ptr<IRenderPass> &outRenderPass,uint32_t pipelineIdx,const std::string &debugName="");
 		template<class TShader>
@@ -354,6 +430,8 @@ template<class TShader>
 template<class TShader>
 	const std::shared_ptr<prosper::IRenderPass> &prosper::ShaderGraphics::GetRenderPass(prosper::IPrContext &context,uint32_t pipelineIdx)
 {
+	// The render pass is created when the shader is initialized
+	context.GetShaderManager().template FindShader<TShader>();
 	return GetRenderPass(context,typeid(TShader).hash_code(),pipelineIdx);
 }
 
@@ -363,6 +441,12 @@ template<class TShader>
 	return CreateCachedRenderPass(typeid(TShader).hash_code(),renderPassInfo,outRenderPass,pipelineIdx,"shader_" +std::string(typeid(TShader).name()) +std::string("_rp"));
 }
 
+template<typename T>
+	void prosper::SpecializationConstantValues::Set(ShaderStage stage,uint32_t constantId,const T &value)
+{
+	Set(stage,constantId,sizeof(value),&value);
+}
+
 template<class T>
 	bool prosper::Shader::RecordPushConstants(const T &data,uint32_t offset)
 {
@@ -7,6 +7,8 @@
 #include <unordered_map>
 #include <functional>
 #include <string>
+#include <vector>
+#include <future>
 
 namespace util {class ShaderInfo;};
 #pragma warning(push)
@@ -20,9 +22,18 @@ namespace prosper
 	{
 	public:
 		ShaderManager(IPrContext &context);
-		~ShaderManager()=default;
+		~ShaderManager();
 
 		::util::WeakHandle<::util::ShaderInfo> PreRegisterShader(const std::string &identifier);
+		// If enabled, shaders which have been pre-registered are only compiled and initialized once they're
+		// retrieved via GetShader/FindShader or used for the first time. Shaders which are first needed while a frame is being
+		// recorded only become available once that frame has been completed, so they should be retrieved or prefetched ahead of time.
+		// Enabled by default.
+		void SetLazyInitializationEnabled(bool enabled);
+		bool IsLazyInitializationEnabled() const;
+		// Compiles the sources of the specified shaders on background threads, if they haven't been initialized yet.
+		// Should be called for shaders that are likely to be needed soon (e.g. when a game mode is being loaded).
+		void PrefetchShaders(const std::vector<std::string> &identifiers);
 		::util::WeakHandle<Shader> RegisterShader(const std::string &identifier,const std::function<Shader*(IPrContext&,const std::string&)> &fFactory);
 		::util::WeakHandle<Shader> RegisterShader(const std::string &identifier,const std::function<Shader*(IPrContext&,const std::string&,bool&)> &fFactory);
 		::util::WeakHandle<Shader> GetShader(const std::string &identifier) const;
@@ -37,7 +48,10 @@ namespace prosper
 		ShaderManager(const ShaderManager&)=delete;
 		ShaderManager &operator=(const ShaderManager&)=delete;
 	private:
+		void InitializeLazyShader(Shader &shader) const;
 		std::unordered_map<std::string,std::shared_ptr<Shader>> m_shaders;
+		std::vector<std::future<void>> m_prefetchTasks;
+		bool m_lazyInitializationEnabled = true;
 
 		// Pre-registered shaders
 		std::unordered_map<std::string,std::shared_ptr<::util::ShaderInfo>> m_shaderInfo;
@@ -55,7 +69,10 @@ template<class T>
 	auto it = std::find_if(m_shaders.begin(),m_shaders.end(),[](const std::pair<std::string,std::shared_ptr<Shader>> &pair) {
 		return typeid(T) == typeid(*pair.second);
 	});
-	return (it != m_shaders.end()) ? it->second.get() : nullptr;
+	if(it == m_shaders.end())
+		return nullptr;
+	InitializeLazyShader(*it->second);
+	return it->second.get();
 }
 #pragma warning(pop)
 
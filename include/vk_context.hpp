@@ -36,12 +36,14 @@ namespace Anvil
 struct VkSurfaceKHR_T;
 namespace prosper
 {
+	class VlkSubmissionBatcher;
 	class DLLPROSPER VlkContext
 		: public IPrContext
 	{
 	public:
 		static std::shared_ptr<VlkContext> Create(const std::string &appName,bool bEnableValidation);
 		static IPrContext &GetContext(Anvil::BaseDevice &dev);
+		virtual ~VlkContext() override;
 
 		Anvil::SGPUDevice &GetDevice();
 		const std::shared_ptr<Anvil::RenderPass> &GetMainRenderPass() const;
@@ -78,8 +80,23 @@ namespace prosper
 		virtual Result WaitForFences(const std::vector<IFence*> &fences,bool waitAll=true,uint64_t timeout=std::numeric_limits<uint64_t>::max()) const override;
 		virtual void DrawFrame(const std::function<void(const std::shared_ptr<prosper::IPrimaryCommandBuffer>&,uint32_t)> &drawFrame) override;
 		virtual bool Submit(ICommandBuffer &cmdBuf,bool shouldBlock=false,IFence *optFence=nullptr) override;
-		virtual void SubmitCommandBuffer(prosper::ICommandBuffer &cmd,prosper::QueueFamilyType queueFamilyType,bool shouldBlock=false,prosper::IFence *fence=nullptr) override;
+		virtual bool SubmitCommandBuffer(prosper::ICommandBuffer &cmd,prosper::QueueFamilyType queueFamilyType,bool shouldBlock=false,prosper::IFence *fence=nullptr) override;
 		using IPrContext::SubmitCommandBuffer;
+		virtual bool GetQueueFamilyIndex(prosper::QueueFamilyType queueFamilyType,uint32_t &queueFamilyIndex) const override;
+		// Returns the first queue of the specified family, or the universal queue if the device has no such queue family
+		Anvil::Queue &GetQueue(prosper::QueueFamilyType queueFamilyType);
+		// The next frame submitted to the universal queue will wait for the semaphore at the specified stages. The semaphore has to be signalled by
+		// a submission that has been made before the frame is submitted, and has to be kept alive until the frame has been completed.
+		void AddFrameWaitSemaphore(Anvil::Semaphore &semaphore,PipelineStageFlags waitStageMask);
+		// The semaphore will be signalled once the frame that is currently being recorded (or the next frame, if no frame is being recorded)
+		// has been executed. Submissions that wait on the semaphore have to be made after the frame has been submitted (see AddFrameSubmissionCallback).
+		void AddFrameSignalSemaphore(Anvil::Semaphore &semaphore);
+		// The callback is invoked once, right after the current (or next) frame has been submitted to the universal queue
+		void AddFrameSubmissionCallback(const std::function<void()> &callback);
+		// Non-blocking submissions without a fence are collected by the batcher and flushed when the next frame is submitted,
+		// when another submission is flushed, or when the device is waited on
+		VlkSubmissionBatcher &GetSubmissionBatcher();
+		bool FlushSubmissions();
 
 		Anvil::PipelineLayout *GetPipelineLayout(bool graphicsShader,PipelineID pipelineId);
 	protected:
@@ -116,6 +133,10 @@ namespace prosper
 
 		std::vector<Anvil::SemaphoreUniquePtr> m_frameSignalSemaphores;
 		std::vector<Anvil::SemaphoreUniquePtr> m_frameWaitSemaphores;
+		std::vector<std::pair<Anvil::Semaphore*,PipelineStageFlags>> m_pendingFrameWaitSemaphores;
+		std::vector<Anvil::Semaphore*> m_pendingFrameSignalSemaphores;
+		std::vector<std::function<void()>> m_frameSubmissionCallbacks;
+		std::unique_ptr<VlkSubmissionBatcher> m_submissionBatcher;
 	private:
 		void ReleaseSwapchain();
 		bool GetUniversalQueueFamilyIndex(prosper::QueueFamilyType queueFamilyType,uint32_t &queueFamilyIndex) const;
@@ -0,0 +1,97 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "stdafx_prosper.h"
+#include "buffers/prosper_transient_uniform_buffer.hpp"
+#include "buffers/prosper_buffer.hpp"
+#include "buffers/prosper_buffer_create_info.hpp"
+#include "prosper_descriptor_set_group.hpp"
+#include "prosper_context.hpp"
+#include "prosper_util.hpp"
+#include <algorithm>
+
+using namespace prosper;
+
+static DeviceSize align_size(DeviceSize size,DeviceSize alignment)
+{
+	return ((size +alignment -1ull) /alignment) *alignment;
+}
+
+std::shared_ptr<TransientUniformBuffer> TransientUniformBuffer::Create(IPrContext &context,DeviceSize sizePerFrame,DeviceSize rangeSize)
+{
+	auto limits = util::get_physical_device_limits(context);
+	if(rangeSize == 0ull || rangeSize > limits.maxUniformBufferRange || rangeSize > sizePerFrame)
+		return nullptr;
+	auto alignment = std::max(limits.minUniformBufferOffsetAlignment,static_cast<DeviceSize>(1ull));
+	auto regionSize = align_size(sizePerFrame,alignment);
+	// One region per frame that may be in flight, plus the one that is being recorded
+	auto regionCount = context.GetSwapchainImageCount() +1u;
+
+	util::BufferCreateInfo createInfo {};
+	// The descriptor range of an allocation at the end of the last region may extend past the region
+	createInfo.size = regionSize *regionCount +rangeSize;
+	createInfo.usageFlags = BufferUsageFlags::UniformBufferBit;
+	createInfo.memoryFeatures = MemoryFeatureFlags::CPUToGPU | MemoryFeatureFlags::HostCoherent;
+	auto buf = context.CreateBuffer(createInfo);
+	if(buf == nullptr)
+		return nullptr;
+	buf->SetDebugName("transient_uniform_buf");
+	buf->SetPermanentlyMapped(true);
+	return std::shared_ptr<TransientUniformBuffer>{new TransientUniformBuffer{context,buf,regionSize,rangeSize,alignment,regionCount}};
+}
+
+TransientUniformBuffer::TransientUniformBuffer(IPrContext &context,const std::shared_ptr<IBuffer> &buffer,DeviceSize regionSize,DeviceSize rangeSize,DeviceSize alignment,uint32_t regionCount)
+	: m_context{context},m_buffer{buffer},m_regionsInUse(regionCount,false),m_regionSize{regionSize},m_rangeSize{rangeSize},m_alignment{alignment}
+{}
+
+bool TransientUniformBuffer::BeginFrame()
+{
+	auto frameId = m_context.GetLastFrameId();
+	if(frameId == m_frameId)
+		return m_currentRegion != std::numeric_limits<uint32_t>::max();
+	m_frameId = frameId;
+	if(m_currentRegion != std::numeric_limits<uint32_t>::max())
+	{
+		// The region can be re-used once the GPU has finished the frame
+		auto prevRegion = m_currentRegion;
+		m_currentRegion = std::numeric_limits<uint32_t>::max();
+		std::weak_ptr<TransientUniformBuffer> wpThis = shared_from_this();
+		m_context.AddFrameCompletionCallback([wpThis,prevRegion]() {
+			if(wpThis.expired() == false)
+				wpThis.lock()->m_regionsInUse.at(prevRegion) = false;
+		});
+	}
+	auto it = std::find(m_regionsInUse.begin(),m_regionsInUse.end(),false);
+	if(it == m_regionsInUse.end())
+		return false;
+	*it = true;
+	m_currentRegion = it -m_regionsInUse.begin();
+	m_offset = 0ull;
+	return true;
+}
+
+bool TransientUniformBuffer::Allocate(const void *data,DeviceSize size,uint32_t &outDynamicOffset)
+{
+	if(size > m_rangeSize || BeginFrame() == false)
+		return false;
+	auto offset = align_size(m_offset,m_alignment);
+	if(offset +size > m_regionSize)
+		return false;
+	m_offset = offset +size;
+	auto bufOffset = m_currentRegion *m_regionSize +offset;
+	if(m_buffer->Write(bufOffset,size,data) == false)
+		return false;
+	outDynamicOffset = static_cast<uint32_t>(bufOffset);
+	return true;
+}
+
+bool TransientUniformBuffer::BindToDescriptorSet(IDescriptorSet &descSet,uint32_t bindingIdx) const
+{
+	return descSet.SetBindingDynamicUniformBuffer(*m_buffer,bindingIdx,0ull,m_rangeSize);
+}
+
+IBuffer &TransientUniformBuffer::GetBuffer() const {return *m_buffer;}
+DeviceSize TransientUniformBuffer::GetRangeSize() const {return m_rangeSize;}
+DeviceSize TransientUniformBuffer::GetSizePerFrame() const {return m_regionSize;}
+DeviceSize TransientUniformBuffer::GetUsedSize() const {return (m_frameId == m_context.GetLastFrameId()) ? m_offset : 0ull;}
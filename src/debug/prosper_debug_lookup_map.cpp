@@ -27,34 +27,75 @@
 #include <sharedutils/util.h>
 #include <sharedutils/util_string.h>
 
+#include <shared_mutex>
+#include <array>
+
 #undef GetObject
+// Objects are registered and looked up from multiple threads (e.g. when recording command buffers in parallel),
+// so the table is split into shards, each with its own reader-writer lock. Lookups only take a shared lock on a single shard,
+// and entries are stored by value, so no allocations are required beyond the map nodes themselves.
 class DLLPROSPER ObjectLookupHandler
 {
 public:
-	void RegisterObject(void *vkPtr,void *objPtr,prosper::debug::ObjectType type) {m_lookupTable[vkPtr] = {std::make_shared<void*>(objPtr),type};}
-	void RegisterObject(void *vkPtr,const std::shared_ptr<void> &objPtr,prosper::debug::ObjectType type) {m_lookupTable[vkPtr] = {objPtr,type};}
+	struct Entry
+	{
+		void *object = nullptr;
+		prosper::debug::ObjectType type = prosper::debug::ObjectType::Image;
+		// Only used for pipelines
+		uint32_t pipelineIdx = std::numeric_limits<uint32_t>::max();
+	};
+	void RegisterObject(void *vkPtr,const Entry &entry)
+	{
+		auto &shard = GetShard(vkPtr);
+		std::unique_lock lock {shard.mutex};
+		shard.lookupTable[vkPtr] = entry;
+	}
 	void ClearObject(void *vkPtr)
 	{
-		auto it = m_lookupTable.find(vkPtr);
-		if(it != m_lookupTable.end())
-			m_lookupTable.erase(it);
+		auto &shard = GetShard(vkPtr);
+		std::unique_lock lock {shard.mutex};
+		shard.lookupTable.erase(vkPtr);
+	}
+	std::optional<Entry> GetEntry(void *vkPtr) const
+	{
+		auto &shard = GetShard(vkPtr);
+		std::shared_lock lock {shard.mutex};
+		auto it = shard.lookupTable.find(vkPtr);
+		if(it == shard.lookupTable.end())
+			return {};
+		return it->second;
 	}
 	void *GetObject(void *vkPtr,prosper::debug::ObjectType *outType=nullptr) const
 	{
-		auto it = m_lookupTable.find(vkPtr);
-		if(it == m_lookupTable.end())
+		auto entry = GetEntry(vkPtr);
+		if(entry.has_value() == false)
 			return nullptr;
 		if(outType != nullptr)
-			*outType = it->second.second;
-		return *std::static_pointer_cast<void*>(it->second.first);
+			*outType = entry->type;
+		return entry->object;
 	}
 	template<class T>
-		T *GetObject(void *vkPtr) const
+		T *GetObject(void *vkPtr,prosper::debug::ObjectType type) const
 	{
-		return static_cast<T*>(vkPtr);
+		auto entry = GetEntry(vkPtr);
+		return (entry.has_value() && entry->type == type) ? static_cast<T*>(entry->object) : nullptr;
 	}
 private:
-	std::unordered_map<void*,std::pair<std::shared_ptr<void>,prosper::debug::ObjectType>> m_lookupTable = {};
+	static constexpr size_t NUM_SHARDS = 64;
+	struct Shard
+	{
+		mutable std::shared_mutex mutex;
+		std::unordered_map<void*,Entry> lookupTable = {};
+	};
+	const Shard &GetShard(void *vkPtr) const {return const_cast<ObjectLookupHandler*>(this)->GetShard(vkPtr);}
+	Shard &GetShard(void *vkPtr)
+	{
+		// Handles are either pointers or driver-assigned 64-bit values; Discard the low bits, which are often aligned
+		auto h = reinterpret_cast<uintptr_t>(vkPtr);
+		h ^= h>>17;
+		return m_shards[(h>>4) %NUM_SHARDS];
+	}
+	std::array<Shard,NUM_SHARDS> m_shards {};
 };
 
 static std::unique_ptr<ObjectLookupHandler> s_lookupHandler = nullptr;
@@ -73,13 +114,13 @@ void prosper::debug::register_debug_object(void *vkPtr,void *objPtr,ObjectType t
 {
 	if(s_lookupHandler == nullptr)
 		return;
-	s_lookupHandler->RegisterObject(vkPtr,objPtr,type);
+	s_lookupHandler->RegisterObject(vkPtr,{objPtr,type});
 }
 void prosper::debug::register_debug_shader_pipeline(void *vkPtr,const ShaderPipelineInfo &pipelineInfo)
 {
 	if(s_lookupHandler == nullptr)
 		return;
-	s_lookupHandler->RegisterObject(vkPtr,std::make_shared<ShaderPipelineInfo>(pipelineInfo),ObjectType::Pipeline);
+	s_lookupHandler->RegisterObject(vkPtr,{pipelineInfo.shader,ObjectType::Pipeline,pipelineInfo.pipelineIdx});
 }
 void prosper::debug::deregister_debug_object(void *vkPtr)
 {
@@ -96,39 +137,44 @@ void *prosper::debug::get_object(void *vkObj,ObjectType &type)
 }
 prosper::VlkImage *prosper::debug::get_image(const vk::Image &vkImage)
 {
-	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkImage>(vkImage) : nullptr;
+	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkImage>(vkImage,ObjectType::Image) : nullptr;
 }
 prosper::VlkImageView *prosper::debug::get_image_view(const vk::ImageView &vkImageView)
 {
-	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkImageView>(vkImageView) : nullptr;
+	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkImageView>(vkImageView,ObjectType::ImageView) : nullptr;
 }
 prosper::VlkSampler *prosper::debug::get_sampler(const vk::Sampler &vkSampler)
 {
-	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkSampler>(vkSampler) : nullptr;
+	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkSampler>(vkSampler,ObjectType::Sampler) : nullptr;
 }
 prosper::VkBuffer *prosper::debug::get_buffer(const vk::Buffer &vkBuffer)
 {
-	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VkBuffer>(vkBuffer) : nullptr;
+	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VkBuffer>(vkBuffer,ObjectType::Buffer) : nullptr;
 }
 prosper::VlkCommandBuffer *prosper::debug::get_command_buffer(const vk::CommandBuffer &vkBuffer)
 {
-	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkCommandBuffer>(vkBuffer) : nullptr;
+	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkCommandBuffer>(vkBuffer,ObjectType::CommandBuffer) : nullptr;
 }
 prosper::VlkRenderPass *prosper::debug::get_render_pass(const vk::RenderPass &vkBuffer)
 {
-	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkRenderPass>(vkBuffer) : nullptr;
+	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkRenderPass>(vkBuffer,ObjectType::RenderPass) : nullptr;
 }
 prosper::VlkFramebuffer *prosper::debug::get_framebuffer(const vk::Framebuffer &vkBuffer)
 {
-	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkFramebuffer>(vkBuffer) : nullptr;
+	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkFramebuffer>(vkBuffer,ObjectType::Framebuffer) : nullptr;
 }
 prosper::VlkDescriptorSetGroup *prosper::debug::get_descriptor_set_group(const vk::DescriptorSet &vkBuffer)
 {
-	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkDescriptorSetGroup>(vkBuffer) : nullptr;
+	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<VlkDescriptorSetGroup>(vkBuffer,ObjectType::DescriptorSet) : nullptr;
 }
-prosper::debug::ShaderPipelineInfo *prosper::debug::get_shader_pipeline(const vk::Pipeline &vkPipeline)
+std::optional<prosper::debug::ShaderPipelineInfo> prosper::debug::get_shader_pipeline(const vk::Pipeline &vkPipeline)
 {
-	return (s_lookupHandler != nullptr) ? s_lookupHandler->GetObject<prosper::debug::ShaderPipelineInfo>(vkPipeline) : nullptr;
+	if(s_lookupHandler == nullptr)
+		return {};
+	auto entry = s_lookupHandler->GetEntry(vkPipeline);
+	if(entry.has_value() == false || entry->type != ObjectType::Pipeline)
+		return {};
+	return ShaderPipelineInfo{static_cast<Shader*>(entry->object),entry->pipelineIdx};
 }
 
 void prosper::ContextObject::SetDebugName(const std::string &name)
@@ -187,11 +233,12 @@ void prosper::debug::add_debug_object_information(std::string &msgValidation)
 	{
 		auto strHex = msgValidation.substr(pos,posEnd -pos);
 		auto hex = ::util::to_hex_number(strHex);
-		ObjectType type;
-		auto *o = s_lookupHandler->GetObject(reinterpret_cast<void*>(hex),&type);
+		auto entry = s_lookupHandler->GetEntry(reinterpret_cast<void*>(hex));
 		r<<msgValidation.substr(prevPos,posEnd -prevPos);
-		if(o != nullptr)
+		if(entry.has_value() && entry->object != nullptr)
 		{
+			auto *o = entry->object;
+			auto type = entry->type;
 			prosper::ContextObject *contextObject = nullptr;
 			std::string debugName = "";
 			switch(type)
@@ -224,8 +271,7 @@ void prosper::debug::add_debug_object_information(std::string &msgValidation)
 					break;
 				case ObjectType::Pipeline:
 				{
-					auto *info = static_cast<ShaderPipelineInfo*>(o);
-					auto *str = static_cast<ShaderPipelineInfo*>(o)->shader->GetDebugName(info->pipelineIdx);
+					auto *str = static_cast<Shader*>(o)->GetDebugName(entry->pipelineIdx);
 					debugName = (str != nullptr) ? *str : "shader_unknown";
 					break;
 				}
@@ -16,7 +16,8 @@ prosper::MSAATexture::MSAATexture(
 )
 	: Texture(context,img,imgViews,sampler),m_resolvedTexture(resolvedTexture)
 {
-	if(umath::is_flag_set(img.GetUsageFlags(),prosper::ImageUsageFlags::TransferSrcBit) == false)
+	// Transient images can only be resolved by a render pass
+	if(umath::is_flag_set(img.GetUsageFlags(),prosper::ImageUsageFlags::TransferSrcBit) == false && umath::is_flag_set(img.GetUsageFlags(),prosper::ImageUsageFlags::TransientAttachmentBit) == false)
 		throw std::logic_error("MSAA source image must be created with VK_IMAGE_USAGE_TRANSFER_SRC_BIT usage flag!");
 	if((resolvedTexture->GetImage().GetUsageFlags() &prosper::ImageUsageFlags::TransferDstBit) == prosper::ImageUsageFlags::None)
 		throw std::logic_error("MSAA destination image must be created with VK_IMAGE_USAGE_TRANSFER_DST_BIT usage flag!");
@@ -36,10 +37,23 @@ std::shared_ptr<Texture> prosper::MSAATexture::Resolve(
 		m_bResolved = true;
 		return shared_from_this();
 	}
+	auto &imgDst = m_resolvedTexture->GetImage();
+	if(m_bResolved == false && m_bResolvedByRenderPass)
+	{
+		// The render pass has already written the resolved image, only the layouts have to be transitioned
+		m_bResolvedByRenderPass = false;
+		m_bResolved = true;
+		if(msaaLayoutIn != msaaLayoutOut)
+			cmdBuffer.RecordImageBarrier(imgSrc,msaaLayoutIn,msaaLayoutOut);
+		if(resolvedLayoutIn != resolvedLayoutOut)
+			cmdBuffer.RecordImageBarrier(imgDst,resolvedLayoutIn,resolvedLayoutOut);
+		return m_resolvedTexture;
+	}
 	if(m_bResolved == false)
 	{
+		if(umath::is_flag_set(imgSrc.GetUsageFlags(),ImageUsageFlags::TransientAttachmentBit))
+			return nullptr; // Transient images can't be used as transfer source; They have to be resolved by the render pass
 		auto extents = imgSrc.GetExtents();
-		auto &imgDst = m_resolvedTexture->GetImage();
 		if(msaaLayoutIn != ImageLayout::TransferSrcOptimal)
 			cmdBuffer.RecordImageBarrier(imgSrc,msaaLayoutIn,ImageLayout::TransferSrcOptimal);
 		if(resolvedLayoutIn != ImageLayout::TransferDstOptimal)
@@ -63,4 +77,9 @@ void prosper::MSAATexture::SetDebugName(const std::string &name)
 
 bool prosper::MSAATexture::IsMSAATexture() const {return true;}
 
-void prosper::MSAATexture::Reset() {m_bResolved = false;}
+void prosper::MSAATexture::Reset()
+{
+	m_bResolved = false;
+	m_bResolvedByRenderPass = false;
+}
+bool prosper::MSAATexture::IsResolvedByRenderPass() const {return m_bResolvedByRenderPass;}
@@ -0,0 +1,388 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "stdafx_prosper.h"
+#include "image/prosper_sparse_image_manager.hpp"
+#include "image/vk_image.hpp"
+#include "buffers/prosper_buffer.hpp"
+#include "prosper_context.hpp"
+#include "prosper_util.hpp"
+#include "vk_context.hpp"
+#include "vk_fence.hpp"
+#include <wrappers/device.h>
+#include <wrappers/queue.h>
+#include <wrappers/memory_block.h>
+#include <misc/memory_block_create_info.h>
+#include <misc/types.h>
+#include <algorithm>
+
+using namespace prosper;
+
+std::shared_ptr<SparseImageManager> SparseImageManager::Create(IPrContext &context,const util::ImageCreateInfo &createInfo,uint32_t maxResidentPages)
+{
+	if(maxResidentPages == 0u)
+		return nullptr;
+	auto imgCreateInfo = createInfo;
+	imgCreateInfo.flags |= util::ImageCreateInfo::Flags::Sparse;
+	auto img = context.CreateImage(imgCreateInfo);
+	if(img == nullptr)
+		return nullptr;
+	auto manager = std::shared_ptr<SparseImageManager>{new SparseImageManager{context,img,maxResidentPages}};
+	if(manager->Initialize() == false)
+		return nullptr;
+	return manager;
+}
+
+SparseImageManager::SparseImageManager(IPrContext &context,const std::shared_ptr<IImage> &img,uint32_t maxResidentPages)
+	: m_context{context},m_image{img},m_maxResidentPages{maxResidentPages}
+{}
+
+SparseImageManager::~SparseImageManager()
+{
+	if(m_bindInProgress)
+		m_context.WaitForFence(*m_bindFence);
+	// The image may still be in use by frames that haven't been completed yet, and the memory has to outlive the image
+	struct Resources
+	{
+		std::vector<std::unique_ptr<Anvil::MemoryBlock,std::function<void(Anvil::MemoryBlock*)>>> memoryBlocks;
+		std::unique_ptr<Anvil::MemoryBlock,std::function<void(Anvil::MemoryBlock*)>> mipTailMemory;
+		std::shared_ptr<IImage> image;
+	};
+	auto resources = std::make_shared<Resources>();
+	resources->memoryBlocks = std::move(m_memoryBlocks);
+	resources->mipTailMemory = std::move(m_mipTailMemory);
+	resources->image = std::move(m_image);
+	m_context.KeepResourceAliveUntilPresentationComplete(resources);
+}
+
+bool SparseImageManager::Initialize()
+{
+	auto &dev = static_cast<VlkContext&>(m_context).GetDevice();
+	auto &img = static_cast<VlkImage&>(*m_image).GetAnvilImage();
+	const Anvil::SparseImageAspectProperties *aspectProps = nullptr;
+	if(
+		dev.get_sparse_binding_queue(0u) == nullptr ||
+		img.get_sparse_image_aspect_properties(Anvil::ImageAspectFlagBits::COLOR_BIT,&aspectProps) == false || aspectProps == nullptr
+	)
+		return false;
+	m_pageExtents = {aspectProps->granularity.width,aspectProps->granularity.height,aspectProps->granularity.depth};
+	m_pageSize = img.get_image_alignment(0); // Sparse block size
+	m_memoryTypeBits = img.get_image_memory_types(0);
+	auto numMipmaps = m_image->GetMipmapCount();
+	m_mipTailFirstLevel = std::min(aspectProps->mip_tail_first_lod,numMipmaps);
+	if(m_pageExtents.width == 0u || m_pageExtents.height == 0u || m_pageSize == 0ull)
+		return false;
+
+	// Page layout: All pages of all mip levels of layer 0, followed by all pages of layer 1, etc.
+	m_mipLevels.resize(m_mipTailFirstLevel);
+	for(auto i=decltype(m_mipTailFirstLevel){0u};i<m_mipTailFirstLevel;++i)
+	{
+		auto &mipLevel = m_mipLevels.at(i);
+		mipLevel.firstPage = m_pagesPerLayer;
+		mipLevel.pageCountX = (m_image->GetWidth(i) +m_pageExtents.width -1) /m_pageExtents.width;
+		mipLevel.pageCountY = (m_image->GetHeight(i) +m_pageExtents.height -1) /m_pageExtents.height;
+		m_pagesPerLayer += mipLevel.pageCountX *mipLevel.pageCountY;
+	}
+	auto numLayers = m_image->GetLayerCount();
+	auto numPages = m_pagesPerLayer *numLayers;
+	m_pages.resize(numPages);
+	m_pageTable.resize(numPages,0u);
+	m_feedbackData.resize(numPages,0u);
+
+	util::BufferCreateInfo bufCreateInfo {};
+	bufCreateInfo.size = std::max(numPages,1u) *sizeof(uint32_t);
+	bufCreateInfo.usageFlags = BufferUsageFlags::StorageBufferBit | BufferUsageFlags::TransferDstBit;
+	bufCreateInfo.memoryFeatures = MemoryFeatureFlags::GPUToCPU;
+	// One feedback buffer per frame that may be in flight, plus the one that is being recorded
+	m_feedbackBuffers.resize(m_context.GetSwapchainImageCount() +1u);
+	for(auto &feedbackBuffer : m_feedbackBuffers)
+	{
+		feedbackBuffer.buffer = m_context.CreateBuffer(bufCreateInfo,m_feedbackData.data());
+		if(feedbackBuffer.buffer == nullptr)
+			return false;
+		feedbackBuffer.buffer->SetDebugName("sparse_image_feedback_buf");
+	}
+	bufCreateInfo.memoryFeatures = MemoryFeatureFlags::GPUBulk;
+	m_pageTableBuffer = m_context.CreateBuffer(bufCreateInfo,m_pageTable.data());
+	m_bindFence = m_context.CreateFence();
+	if(m_pageTableBuffer == nullptr || m_bindFence == nullptr)
+		return false;
+	m_pageTableBuffer->SetDebugName("sparse_image_page_table_buf");
+
+	if(aspectProps->mip_tail_size == 0ull || m_mipTailFirstLevel >= numMipmaps)
+		return true;
+	// The mip tail can't be split into pages and is always resident, so lower resolution fallbacks are always available
+	auto singleMipTail = (aspectProps->flags &Anvil::SparseImageFormatFlagBits::SINGLE_MIPTAIL_BIT) != Anvil::SparseImageFormatFlagBits::NONE;
+	auto numMipTails = singleMipTail ? 1u : numLayers;
+	m_mipTailMemory = Anvil::MemoryBlock::create(Anvil::MemoryBlockCreateInfo::create_regular(
+		&dev,m_memoryTypeBits,aspectProps->mip_tail_size *numMipTails,Anvil::MemoryFeatureFlagBits::DEVICE_LOCAL_BIT
+	));
+	if(m_mipTailMemory == nullptr)
+		return false;
+	Anvil::Utils::SparseMemoryBindingUpdateInfo updateInfo {};
+	auto bindInfoId = updateInfo.add_bind_info(0u,nullptr,0u,nullptr);
+	for(auto i=decltype(numMipTails){0u};i<numMipTails;++i)
+	{
+		updateInfo.append_opaque_image_memory_update(
+			bindInfoId,&img,aspectProps->mip_tail_offset +i *aspectProps->mip_tail_stride,aspectProps->mip_tail_size,
+			Anvil::SparseMemoryBindFlagBits::NONE,m_mipTailMemory.get(),i *aspectProps->mip_tail_size,false
+		);
+	}
+	updateInfo.set_fence(&static_cast<VlkFence&>(*m_bindFence).GetAnvilFence());
+	if(dev.get_sparse_binding_queue(0u)->bind_sparse_memory(updateInfo) == false)
+		return false;
+	m_context.WaitForFence(*m_bindFence);
+	return m_bindFence->Reset();
+}
+
+IImage &SparseImageManager::GetImage() const {return *m_image;}
+const std::shared_ptr<IImage> &SparseImageManager::GetImagePtr() const {return m_image;}
+IBuffer &SparseImageManager::GetFeedbackBuffer()
+{
+	auto frameId = m_context.GetLastFrameId();
+	auto &feedbackBuffer = m_feedbackBuffers.at(frameId %m_feedbackBuffers.size());
+	if(feedbackBuffer.frameId != frameId)
+	{
+		// The buffer was last handed out for a frame which has been completed already, so the GPU isn't writing to it anymore
+		ProcessFeedback(feedbackBuffer);
+		feedbackBuffer.frameId = frameId;
+	}
+	return *feedbackBuffer.buffer;
+}
+IBuffer &SparseImageManager::GetPageTableBuffer() const {return *m_pageTableBuffer;}
+uint32_t SparseImageManager::GetPageCount() const {return m_pages.size();}
+uint32_t SparseImageManager::GetResidentPageCount() const {return m_residentPages.size();}
+uint32_t SparseImageManager::GetMaxResidentPageCount() const {return m_maxResidentPages;}
+const Extent3D &SparseImageManager::GetPageExtents() const {return m_pageExtents;}
+DeviceSize SparseImageManager::GetPageSize() const {return m_pageSize;}
+uint32_t SparseImageManager::GetMipTailFirstLevel() const {return m_mipTailFirstLevel;}
+SparseImageManager::PageIndex SparseImageManager::GetPageIndex(uint32_t layer,uint32_t mipLevel,uint32_t x,uint32_t y) const
+{
+	if(mipLevel >= m_mipLevels.size() || layer >= m_image->GetLayerCount())
+		return INVALID_PAGE;
+	auto &mip = m_mipLevels.at(mipLevel);
+	if(x >= mip.pageCountX || y >= mip.pageCountY)
+		return INVALID_PAGE;
+	return layer *m_pagesPerLayer +mip.firstPage +y *mip.pageCountX +x;
+}
+SparseImageManager::PageInfo SparseImageManager::GetPageInfo(PageIndex page) const
+{
+	PageInfo info {};
+	info.layer = page /m_pagesPerLayer;
+	auto pageInLayer = page %m_pagesPerLayer;
+	auto it = std::upper_bound(m_mipLevels.begin(),m_mipLevels.end(),pageInLayer,[](uint32_t page,const MipLevel &mipLevel) {
+		return page < mipLevel.firstPage;
+	});
+	info.mipLevel = (it -m_mipLevels.begin()) -1;
+	auto &mip = m_mipLevels.at(info.mipLevel);
+	auto pageInMip = pageInLayer -mip.firstPage;
+	info.x = pageInMip %mip.pageCountX;
+	info.y = pageInMip /mip.pageCountX;
+	return info;
+}
+bool SparseImageManager::IsPageResident(PageIndex page) const {return page < m_pages.size() && m_pages.at(page).state == PageState::Resident;}
+
+void SparseImageManager::RequestPage(PageIndex page) {RequestPage(page,m_context.GetLastFrameId());}
+void SparseImageManager::RequestPage(PageIndex page,uint64_t frameId)
+{
+	if(page >= m_pages.size())
+		return;
+	auto &pageData = m_pages.at(page);
+	pageData.lastRequestFrame = std::max(pageData.lastRequestFrame,frameId);
+	if(pageData.state != PageState::NonResident)
+		return;
+	pageData.state = PageState::Requested;
+	m_requestedPages.push_back(page);
+}
+
+uint64_t SparseImageManager::GetFeedbackLatency() const {return m_context.GetSwapchainImageCount();}
+
+bool SparseImageManager::ProcessFeedback()
+{
+	// The GPU has finished all frames which are at least GetSwapchainImageCount() frames older than the current one
+	auto curFrame = m_context.GetLastFrameId();
+	auto success = true;
+	for(auto &feedbackBuffer : m_feedbackBuffers)
+	{
+		if(feedbackBuffer.frameId == std::numeric_limits<uint64_t>::max() || feedbackBuffer.frameId +GetFeedbackLatency() > curFrame)
+			continue;
+		success = ProcessFeedback(feedbackBuffer) && success;
+	}
+	return success;
+}
+
+bool SparseImageManager::ProcessFeedback(FeedbackBuffer &feedbackBuffer)
+{
+	auto frameId = feedbackBuffer.frameId;
+	if(m_pages.empty() || frameId == std::numeric_limits<uint64_t>::max())
+		return true;
+	feedbackBuffer.frameId = std::numeric_limits<uint64_t>::max();
+	auto size = m_feedbackData.size() *sizeof(m_feedbackData.front());
+	if(feedbackBuffer.buffer->Read(0ull,size,m_feedbackData.data()) == false)
+		return false;
+	auto numPages = m_feedbackData.size();
+	auto hasRequests = false;
+	for(auto i=decltype(numPages){0u};i<numPages;++i)
+	{
+		if(m_feedbackData.at(i) == 0u)
+			continue;
+		// Requests are attributed to the frame which has written them, not the one in which they're being processed
+		RequestPage(i,frameId);
+		m_feedbackData.at(i) = 0u;
+		hasRequests = true;
+	}
+	if(hasRequests == false)
+		return true;
+	return feedbackBuffer.buffer->Write(0ull,size,m_feedbackData.data());
+}
+
+uint32_t SparseImageManager::AllocateMemorySlot()
+{
+	if(m_freeSlots.empty() == false)
+	{
+		auto slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+		return slot;
+	}
+	if(m_numSlots >= m_maxResidentPages)
+		return std::numeric_limits<uint32_t>::max();
+	auto numSlots = std::min(PAGES_PER_MEMORY_BLOCK,m_maxResidentPages -m_numSlots);
+	auto memBlock = Anvil::MemoryBlock::create(Anvil::MemoryBlockCreateInfo::create_regular(
+		&static_cast<VlkContext&>(m_context).GetDevice(),m_memoryTypeBits,numSlots *m_pageSize,Anvil::MemoryFeatureFlagBits::DEVICE_LOCAL_BIT
+	));
+	if(memBlock == nullptr)
+		return std::numeric_limits<uint32_t>::max();
+	m_memoryBlocks.push_back(std::move(memBlock));
+	// Slots are handed out in ascending order
+	for(auto i=numSlots;i>1u;--i)
+		m_freeSlots.push_back(m_numSlots +i -1u);
+	auto slot = m_numSlots;
+	m_numSlots += numSlots;
+	return slot;
+}
+
+void SparseImageManager::SchedulePageTableUpdate(PageIndex first,PageIndex last)
+{
+	IPrContext::BufferUpdateInfo updateInfo {};
+	updateInfo.postUpdateBarrierStageMask = util::PIPELINE_STAGE_SHADER_INPUT_FLAGS;
+	updateInfo.postUpdateBarrierAccessMask = AccessFlags::ShaderReadBit;
+	m_context.ScheduleRecordUpdateBuffer(
+		m_pageTableBuffer,first *sizeof(m_pageTable.front()),(last -first +1) *sizeof(m_pageTable.front()),m_pageTable.data() +first,updateInfo
+	);
+}
+
+bool SparseImageManager::FinalizePendingBinds()
+{
+	if(m_bindInProgress == false)
+		return true;
+	if(m_bindFence->IsSet() == false)
+		return false;
+	m_bindFence->Reset();
+	m_bindInProgress = false;
+	m_freeSlots.insert(m_freeSlots.end(),m_pendingFreeSlots.begin(),m_pendingFreeSlots.end());
+	m_pendingFreeSlots.clear();
+	if(m_pendingBinds.empty())
+		return true;
+	auto first = std::numeric_limits<PageIndex>::max();
+	auto last = PageIndex{0u};
+	for(auto page : m_pendingBinds)
+	{
+		m_pages.at(page).state = PageState::Resident;
+		m_pageTable.at(page) = 1u;
+		m_residentPages.push_back(page);
+		first = std::min(first,page);
+		last = std::max(last,page);
+	}
+	m_pendingBinds.clear();
+	SchedulePageTableUpdate(first,last);
+	return true;
+}
+
+bool SparseImageManager::Update(uint32_t maxBindsPerUpdate)
+{
+	ProcessFeedback();
+	// Only one bind operation can be in flight at a time
+	if(FinalizePendingBinds() == false || m_requestedPages.empty())
+		return true;
+	auto &dev = static_cast<VlkContext&>(m_context).GetDevice();
+	auto &img = static_cast<VlkImage&>(*m_image).GetAnvilImage();
+
+	// Coarser mip levels first, since they're the fallback for all finer levels
+	std::sort(m_requestedPages.begin(),m_requestedPages.end(),[this](PageIndex a,PageIndex b) {
+		auto infoA = GetPageInfo(a);
+		auto infoB = GetPageInfo(b);
+		return (infoA.mipLevel != infoB.mipLevel) ? (infoA.mipLevel > infoB.mipLevel) : (a < b);
+	});
+	// Pages that haven't been requested by any of the frames that may still be in flight can be evicted, least recently used first.
+	// Requests of the most recent frames haven't been read back yet, so the feedback latency has to be taken into account as well.
+	auto curFrame = m_context.GetLastFrameId();
+	auto evictionThreshold = static_cast<uint64_t>(m_context.GetSwapchainImageCount()) +1ull +GetFeedbackLatency();
+	std::sort(m_residentPages.begin(),m_residentPages.end(),[this](PageIndex a,PageIndex b) {
+		return m_pages.at(a).lastRequestFrame > m_pages.at(b).lastRequestFrame;
+	});
+
+	Anvil::Utils::SparseMemoryBindingUpdateInfo updateInfo {};
+	auto bindInfoId = updateInfo.add_bind_info(0u,nullptr,0u,nullptr);
+	auto fAppendUpdate = [this,&img,&updateInfo,bindInfoId](PageIndex page,Anvil::MemoryBlock *memBlock,DeviceSize memOffset) {
+		auto info = GetPageInfo(page);
+		VkOffset3D offset {static_cast<int32_t>(info.x *m_pageExtents.width),static_cast<int32_t>(info.y *m_pageExtents.height),0};
+		// Pages at the edge of the image may be smaller than the page extents
+		VkExtent3D extent {
+			std::min(m_pageExtents.width,m_image->GetWidth(info.mipLevel) -static_cast<uint32_t>(offset.x)),
+			std::min(m_pageExtents.height,m_image->GetHeight(info.mipLevel) -static_cast<uint32_t>(offset.y)),
+			1u
+		};
+		Anvil::ImageSubresource subresource {};
+		subresource.aspect_mask = Anvil::ImageAspectFlagBits::COLOR_BIT;
+		subresource.mip_level = info.mipLevel;
+		subresource.array_layer = info.layer;
+		updateInfo.append_image_memory_update(bindInfoId,&img,subresource,offset,extent,Anvil::SparseMemoryBindFlagBits::NONE,memBlock,memOffset,false);
+	};
+
+	auto first = std::numeric_limits<PageIndex>::max();
+	auto last = PageIndex{0u};
+	for(auto page : m_requestedPages)
+	{
+		if(m_pendingBinds.size() >= maxBindsPerUpdate)
+			break;
+		auto slot = AllocateMemorySlot();
+		if(slot == std::numeric_limits<uint32_t>::max())
+		{
+			if(m_residentPages.empty() || m_pages.at(m_residentPages.back()).lastRequestFrame +evictionThreshold > curFrame)
+				break; // Budget exhausted
+			auto evictPage = m_residentPages.back();
+			m_residentPages.pop_back();
+			auto &evictPageData = m_pages.at(evictPage);
+			fAppendUpdate(evictPage,nullptr,0ull);
+			m_pendingFreeSlots.push_back(evictPageData.memorySlot);
+			evictPageData.memorySlot = std::numeric_limits<uint32_t>::max();
+			evictPageData.state = PageState::NonResident;
+			m_pageTable.at(evictPage) = 0u;
+			first = std::min(first,evictPage);
+			last = std::max(last,evictPage);
+			// The slot can't be re-used before the unbind operation has completed, the page will be bound with a later update
+			continue;
+		}
+		auto &pageData = m_pages.at(page);
+		pageData.memorySlot = slot;
+		pageData.state = PageState::PendingBind;
+		fAppendUpdate(page,m_memoryBlocks.at(slot /PAGES_PER_MEMORY_BLOCK).get(),(slot %PAGES_PER_MEMORY_BLOCK) *m_pageSize);
+		m_pendingBinds.push_back(page);
+	}
+	if(first <= last)
+		SchedulePageTableUpdate(first,last);
+
+	// Pages which couldn't be bound yet remain requested
+	m_requestedPages.erase(std::remove_if(m_requestedPages.begin(),m_requestedPages.end(),[this](PageIndex page) {
+		return m_pages.at(page).state != PageState::Requested;
+	}),m_requestedPages.end());
+	if(m_pendingBinds.empty() && m_pendingFreeSlots.empty())
+		return true;
+
+	updateInfo.set_fence(&static_cast<VlkFence&>(*m_bindFence).GetAnvilFence());
+	if(dev.get_sparse_binding_queue(0u)->bind_sparse_memory(updateInfo) == false)
+		return false;
+	m_bindInProgress = true;
+	return true;
+}
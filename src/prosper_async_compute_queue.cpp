@@ -0,0 +1,203 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "stdafx_prosper.h"
+#include "prosper_async_compute_queue.hpp"
+#include "prosper_context.hpp"
+#include "prosper_command_buffer.hpp"
+#include "buffers/prosper_buffer.hpp"
+#include "image/prosper_image.hpp"
+#include "vk_context.hpp"
+#include "vk_command_buffer.hpp"
+#include "vk_submission_batcher.hpp"
+#include <misc/semaphore_create_info.h>
+#include <wrappers/device.h>
+#include <wrappers/queue.h>
+#include <wrappers/semaphore.h>
+#include <wrappers/command_buffer.h>
+
+using namespace prosper;
+
+struct AsyncComputeQueue::Batch
+{
+	std::shared_ptr<IPrimaryCommandBuffer> cmdBuffer = nullptr;
+	// Signalled by the frame, waited on by the compute work
+	Anvil::SemaphoreUniquePtr graphicsSemaphore = nullptr;
+	// Signalled by the compute work, waited on by the next frame
+	Anvil::SemaphoreUniquePtr computeSemaphore = nullptr;
+	std::vector<BufferDependency> buffers = {};
+	std::vector<ImageDependency> images = {};
+};
+
+std::shared_ptr<AsyncComputeQueue> AsyncComputeQueue::Create(IPrContext &context)
+{
+	uint32_t universalQueueFamilyIndex;
+	if(context.GetQueueFamilyIndex(QueueFamilyType::Universal,universalQueueFamilyIndex) == false)
+		return nullptr;
+	// If there is no dedicated compute queue family, the compute work is submitted to the universal queue instead
+	uint32_t computeQueueFamilyIndex;
+	if(context.GetQueueFamilyIndex(QueueFamilyType::Compute,computeQueueFamilyIndex) == false)
+		computeQueueFamilyIndex = universalQueueFamilyIndex;
+	return std::shared_ptr<AsyncComputeQueue>{new AsyncComputeQueue{context,computeQueueFamilyIndex,universalQueueFamilyIndex}};
+}
+
+AsyncComputeQueue::AsyncComputeQueue(IPrContext &context,uint32_t computeQueueFamilyIndex,uint32_t universalQueueFamilyIndex)
+	: m_context{context},m_computeQueueFamilyIndex{computeQueueFamilyIndex},m_universalQueueFamilyIndex{universalQueueFamilyIndex}
+{}
+
+std::shared_ptr<AsyncComputeQueue::Batch> AsyncComputeQueue::GetFreeBatch()
+{
+	if(m_freeBatches.empty() == false)
+	{
+		auto batch = m_freeBatches.back();
+		m_freeBatches.pop_back();
+		return batch;
+	}
+	auto &dev = static_cast<VlkContext&>(m_context).GetDevice();
+	auto batch = std::make_shared<Batch>();
+	uint32_t queueFamilyIndex;
+	batch->cmdBuffer = m_context.AllocatePrimaryLevelCommandBuffer(QueueFamilyType::Compute,queueFamilyIndex);
+	batch->graphicsSemaphore = Anvil::Semaphore::create(Anvil::SemaphoreCreateInfo::create(&dev));
+	batch->computeSemaphore = Anvil::Semaphore::create(Anvil::SemaphoreCreateInfo::create(&dev));
+	if(batch->cmdBuffer == nullptr || batch->graphicsSemaphore == nullptr || batch->computeSemaphore == nullptr)
+		return nullptr;
+	return batch;
+}
+
+std::shared_ptr<IPrimaryCommandBuffer> AsyncComputeQueue::BeginRecording(const std::vector<BufferDependency> &buffers,const std::vector<ImageDependency> &images)
+{
+	if(m_currentBatch != nullptr)
+		return nullptr;
+	auto batch = GetFreeBatch();
+	if(batch == nullptr || batch->cmdBuffer->StartRecording(true,false) == false)
+		return nullptr;
+	batch->buffers = buffers;
+	batch->images = images;
+
+	// Acquire the shared resources. The barrier is chained to the wait on the graphics semaphore, which happens at the compute shader stage.
+	auto dedicated = HasDedicatedComputeQueue();
+	auto srcQueueFamilyIndex = dedicated ? m_universalQueueFamilyIndex : QUEUE_FAMILY_IGNORED;
+	auto dstQueueFamilyIndex = dedicated ? m_computeQueueFamilyIndex : QUEUE_FAMILY_IGNORED;
+	util::PipelineBarrierInfo acquireBarrierInfo {};
+	acquireBarrierInfo.srcStageMask = PipelineStageFlags::ComputeShaderBit;
+	acquireBarrierInfo.dstStageMask = PipelineStageFlags::ComputeShaderBit;
+	for(auto &dep : batch->buffers)
+	{
+		acquireBarrierInfo.bufferBarriers.push_back(util::BufferBarrier{
+			AccessFlags{},dep.computeAccessMask,srcQueueFamilyIndex,dstQueueFamilyIndex,dep.buffer.get(),0ull,dep.buffer->GetSize()
+		});
+	}
+	for(auto &dep : batch->images)
+	{
+		acquireBarrierInfo.imageBarriers.push_back(util::ImageBarrier{
+			AccessFlags{},dep.computeAccessMask,dep.graphicsLayout,dep.computeLayout,srcQueueFamilyIndex,dstQueueFamilyIndex,dep.image.get(),dep.subresourceRange
+		});
+	}
+	// Without an ownership transfer, buffers are covered by the semaphore and only images need a barrier for the layout transition
+	if(dedicated == false)
+		acquireBarrierInfo.bufferBarriers.clear();
+	if(acquireBarrierInfo.bufferBarriers.empty() == false || acquireBarrierInfo.imageBarriers.empty() == false)
+		batch->cmdBuffer->RecordPipelineBarrier(acquireBarrierInfo);
+	m_currentBatch = batch;
+	return batch->cmdBuffer;
+}
+
+bool AsyncComputeQueue::Submit(IPrimaryCommandBuffer &drawCmd)
+{
+	if(m_currentBatch == nullptr || m_context.IsRecording() == false)
+		return false;
+	auto batch = m_currentBatch;
+	m_currentBatch = nullptr;
+	auto &cmd = *batch->cmdBuffer;
+
+	auto dedicated = HasDedicatedComputeQueue();
+	auto computeQueueFamilyIndex = dedicated ? m_computeQueueFamilyIndex : QUEUE_FAMILY_IGNORED;
+	auto universalQueueFamilyIndex = dedicated ? m_universalQueueFamilyIndex : QUEUE_FAMILY_IGNORED;
+
+	// Release the shared resources on both queues. Layout transitions have to be identical in the release and acquire barriers.
+	util::PipelineBarrierInfo computeReleaseBarrierInfo {};
+	computeReleaseBarrierInfo.srcStageMask = PipelineStageFlags::ComputeShaderBit;
+	computeReleaseBarrierInfo.dstStageMask = PipelineStageFlags::BottomOfPipeBit;
+	util::PipelineBarrierInfo graphicsReleaseBarrierInfo {};
+	graphicsReleaseBarrierInfo.srcStageMask = PipelineStageFlags{};
+	graphicsReleaseBarrierInfo.dstStageMask = PipelineStageFlags::BottomOfPipeBit;
+	auto graphicsAcquireBarrierInfo = std::make_shared<util::PipelineBarrierInfo>();
+	graphicsAcquireBarrierInfo->srcStageMask = PipelineStageFlags{};
+	graphicsAcquireBarrierInfo->dstStageMask = PipelineStageFlags{};
+	for(auto &dep : batch->buffers)
+	{
+		auto size = dep.buffer->GetSize();
+		computeReleaseBarrierInfo.bufferBarriers.push_back(util::BufferBarrier{
+			dep.computeAccessMask,AccessFlags{},computeQueueFamilyIndex,universalQueueFamilyIndex,dep.buffer.get(),0ull,size
+		});
+		graphicsReleaseBarrierInfo.srcStageMask = graphicsReleaseBarrierInfo.srcStageMask | dep.srcStageMask;
+		graphicsReleaseBarrierInfo.bufferBarriers.push_back(util::BufferBarrier{
+			dep.srcAccessMask,AccessFlags{},universalQueueFamilyIndex,computeQueueFamilyIndex,dep.buffer.get(),0ull,size
+		});
+		graphicsAcquireBarrierInfo->srcStageMask = graphicsAcquireBarrierInfo->srcStageMask | dep.dstStageMask;
+		graphicsAcquireBarrierInfo->dstStageMask = graphicsAcquireBarrierInfo->dstStageMask | dep.dstStageMask;
+		graphicsAcquireBarrierInfo->bufferBarriers.push_back(util::BufferBarrier{
+			AccessFlags{},dep.dstAccessMask,computeQueueFamilyIndex,universalQueueFamilyIndex,dep.buffer.get(),0ull,size
+		});
+	}
+	for(auto &dep : batch->images)
+	{
+		computeReleaseBarrierInfo.imageBarriers.push_back(util::ImageBarrier{
+			dep.computeAccessMask,AccessFlags{},dep.computeLayout,dep.graphicsLayout,computeQueueFamilyIndex,universalQueueFamilyIndex,dep.image.get(),dep.subresourceRange
+		});
+		graphicsReleaseBarrierInfo.srcStageMask = graphicsReleaseBarrierInfo.srcStageMask | dep.srcStageMask;
+		graphicsReleaseBarrierInfo.imageBarriers.push_back(util::ImageBarrier{
+			dep.srcAccessMask,AccessFlags{},dep.graphicsLayout,dep.computeLayout,universalQueueFamilyIndex,computeQueueFamilyIndex,dep.image.get(),dep.subresourceRange
+		});
+		graphicsAcquireBarrierInfo->srcStageMask = graphicsAcquireBarrierInfo->srcStageMask | dep.dstStageMask;
+		graphicsAcquireBarrierInfo->dstStageMask = graphicsAcquireBarrierInfo->dstStageMask | dep.dstStageMask;
+		graphicsAcquireBarrierInfo->imageBarriers.push_back(util::ImageBarrier{
+			AccessFlags{},dep.dstAccessMask,dep.computeLayout,dep.graphicsLayout,computeQueueFamilyIndex,universalQueueFamilyIndex,dep.image.get(),dep.subresourceRange
+		});
+	}
+	// Without an ownership transfer, the semaphores are sufficient for buffers
+	if(dedicated == false)
+		computeReleaseBarrierInfo.bufferBarriers.clear();
+	if(computeReleaseBarrierInfo.bufferBarriers.empty() == false || computeReleaseBarrierInfo.imageBarriers.empty() == false)
+		cmd.RecordPipelineBarrier(computeReleaseBarrierInfo);
+	if(cmd.StopRecording() == false)
+		return false;
+	if(dedicated && (graphicsReleaseBarrierInfo.bufferBarriers.empty() == false || graphicsReleaseBarrierInfo.imageBarriers.empty() == false))
+		drawCmd.RecordPipelineBarrier(graphicsReleaseBarrierInfo);
+
+	// The next frame only has to wait for the compute work at the stages where the shared resources are used
+	auto waitStageMask = graphicsAcquireBarrierInfo->dstStageMask;
+	if(waitStageMask == PipelineStageFlags{})
+		waitStageMask = PipelineStageFlags::BottomOfPipeBit;
+
+	auto &vlkContext = static_cast<VlkContext&>(m_context);
+	vlkContext.AddFrameSignalSemaphore(*batch->graphicsSemaphore);
+	std::weak_ptr<AsyncComputeQueue> wpThis = shared_from_this();
+	vlkContext.AddFrameSubmissionCallback([&vlkContext,batch,waitStageMask]() {
+		// All compute batches of the frame are flushed together once the submission callbacks have been run
+		VlkSubmissionBatcher::Submission submission {};
+		submission.queueFamilyType = QueueFamilyType::Compute;
+		submission.cmdBuffers = {&dynamic_cast<VlkCommandBuffer&>(*batch->cmdBuffer).GetAnvilCommandBuffer()};
+		submission.waitSemaphores = {batch->graphicsSemaphore.get()};
+		submission.waitStageMasks = {static_cast<Anvil::PipelineStageFlags>(static_cast<Anvil::PipelineStageFlagBits>(PipelineStageFlags::ComputeShaderBit))};
+		submission.signalSemaphores = {batch->computeSemaphore.get()};
+		vlkContext.GetSubmissionBatcher().Add(std::move(submission));
+		vlkContext.AddFrameWaitSemaphore(*batch->computeSemaphore,waitStageMask);
+	});
+	m_context.ScheduleRecordCommands([wpThis,batch,graphicsAcquireBarrierInfo,dedicated](IPrimaryCommandBuffer &nextDrawCmd) {
+		if(dedicated && (graphicsAcquireBarrierInfo->bufferBarriers.empty() == false || graphicsAcquireBarrierInfo->imageBarriers.empty() == false))
+			nextDrawCmd.RecordPipelineBarrier(*graphicsAcquireBarrierInfo);
+		// This frame waits on the compute semaphore, so the compute work has been completed once the frame has been completed
+		nextDrawCmd.GetContext().AddFrameCompletionCallback([wpThis,batch]() {
+			batch->buffers.clear();
+			batch->images.clear();
+			if(wpThis.expired() == false)
+				wpThis.lock()->m_freeBatches.push_back(batch);
+		});
+	});
+	return true;
+}
+
+bool AsyncComputeQueue::IsRecording() const {return m_currentBatch != nullptr;}
+bool AsyncComputeQueue::HasDedicatedComputeQueue() const {return m_computeQueueFamilyIndex != m_universalQueueFamilyIndex;}
@@ -0,0 +1,285 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "stdafx_prosper.h"
+#include "prosper_cache_archive.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace prosper;
+
+static constexpr char ARCHIVE_MAGIC[4] = {'P','R','C','A'};
+
+std::unique_ptr<CacheArchive> CacheArchive::Open(const std::string &path)
+{
+	auto archive = std::unique_ptr<CacheArchive>{new CacheArchive{path}};
+	archive->Map();
+	return archive;
+}
+
+CacheArchive::CacheArchive(const std::string &path)
+	: m_path{path}
+{}
+
+CacheArchive::~CacheArchive() {Unmap();}
+
+bool CacheArchive::Map()
+{
+	Unmap();
+#ifdef _WIN32
+	auto hFile = CreateFileA(m_path.c_str(),GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,nullptr);
+	if(hFile == INVALID_HANDLE_VALUE)
+		return false;
+	m_fileHandle = hFile;
+	LARGE_INTEGER size;
+	if(GetFileSizeEx(hFile,&size) == FALSE || size.QuadPart < sizeof(Header))
+	{
+		Unmap();
+		return false;
+	}
+	m_mappingHandle = CreateFileMappingA(hFile,nullptr,PAGE_READONLY,0,0,nullptr);
+	if(m_mappingHandle == nullptr)
+	{
+		Unmap();
+		return false;
+	}
+	m_mappedData = static_cast<const uint8_t*>(MapViewOfFile(m_mappingHandle,FILE_MAP_READ,0,0,0));
+	m_mappedSize = size.QuadPart;
+#else
+	m_fileDescriptor = open(m_path.c_str(),O_RDONLY);
+	if(m_fileDescriptor == -1)
+		return false;
+	struct stat st;
+	if(fstat(m_fileDescriptor,&st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header)))
+	{
+		Unmap();
+		return false;
+	}
+	auto *data = mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,m_fileDescriptor,0);
+	if(data != MAP_FAILED)
+	{
+		m_mappedData = static_cast<const uint8_t*>(data);
+		m_mappedSize = st.st_size;
+	}
+#endif
+	if(m_mappedData == nullptr)
+	{
+		Unmap();
+		return false;
+	}
+
+	// Validate the header and index; An invalid archive is treated like an empty one and will be replaced on the next write
+	Header header;
+	std::memcpy(&header,m_mappedData,sizeof(header));
+	if(
+		std::memcmp(header.magic,ARCHIVE_MAGIC,sizeof(ARCHIVE_MAGIC)) != 0 || header.version != FORMAT_VERSION ||
+		header.indexOffset < sizeof(Header) || header.indexOffset > m_mappedSize
+	)
+	{
+		Unmap();
+		return false;
+	}
+	auto *ptr = m_mappedData +header.indexOffset;
+	auto *end = m_mappedData +m_mappedSize;
+	m_index.reserve(header.entryCount);
+	for(auto i=decltype(header.entryCount){0u};i<header.entryCount;++i)
+	{
+		IndexEntry entry {};
+		uint32_t nameLength = 0u;
+		if(static_cast<uint64_t>(end -ptr) < sizeof(entry.offset) +sizeof(entry.size) +sizeof(nameLength))
+			break;
+		std::memcpy(&entry.offset,ptr,sizeof(entry.offset));
+		ptr += sizeof(entry.offset);
+		std::memcpy(&entry.size,ptr,sizeof(entry.size));
+		ptr += sizeof(entry.size);
+		std::memcpy(&nameLength,ptr,sizeof(nameLength));
+		ptr += sizeof(nameLength);
+		if(static_cast<uint64_t>(end -ptr) < nameLength || entry.offset > header.indexOffset || entry.size > header.indexOffset -entry.offset)
+			break;
+		m_index[std::string{reinterpret_cast<const char*>(ptr),nameLength}] = entry;
+		ptr += nameLength;
+	}
+	if(m_index.size() != header.entryCount)
+	{
+		Unmap();
+		return false;
+	}
+	return true;
+}
+
+void CacheArchive::Unmap()
+{
+	m_index.clear();
+#ifdef _WIN32
+	if(m_mappedData)
+		UnmapViewOfFile(m_mappedData);
+	if(m_mappingHandle)
+		CloseHandle(m_mappingHandle);
+	if(m_fileHandle)
+		CloseHandle(m_fileHandle);
+	m_mappingHandle = nullptr;
+	m_fileHandle = nullptr;
+#else
+	if(m_mappedData)
+		munmap(const_cast<uint8_t*>(m_mappedData),m_mappedSize);
+	if(m_fileDescriptor != -1)
+		close(m_fileDescriptor);
+	m_fileDescriptor = -1;
+#endif
+	m_mappedData = nullptr;
+	m_mappedSize = 0ull;
+}
+
+bool CacheArchive::Read(const std::string &name,const std::function<bool(const void*,uint64_t)> &reader) const
+{
+	std::scoped_lock lock {m_mutex};
+	auto itPending = m_pendingEntries.find(name);
+	if(itPending != m_pendingEntries.end())
+		return reader(itPending->second.data(),itPending->second.size());
+	auto it = m_index.find(name);
+	if(it == m_index.end())
+		return false;
+	return reader(m_mappedData +it->second.offset,it->second.size);
+}
+
+void CacheArchive::Store(const std::string &name,std::vector<uint8_t> &&data)
+{
+	std::scoped_lock lock {m_mutex};
+	m_pendingEntries[name] = std::move(data);
+}
+void CacheArchive::Store(const std::string &name,const void *data,uint64_t size)
+{
+	std::vector<uint8_t> blob(size);
+	std::memcpy(blob.data(),data,size);
+	Store(name,std::move(blob));
+}
+
+bool CacheArchive::Write()
+{
+	std::scoped_lock lock {m_mutex};
+	if(m_pendingEntries.empty())
+		return true;
+	struct WriteEntry
+	{
+		std::string name;
+		const void *data = nullptr;
+		uint64_t size = 0ull;
+		uint64_t offset = 0ull;
+	};
+	std::vector<WriteEntry> entries;
+	entries.reserve(m_index.size() +m_pendingEntries.size());
+	for(auto &pair : m_index)
+	{
+		if(m_pendingEntries.find(pair.first) == m_pendingEntries.end())
+			entries.push_back({pair.first,m_mappedData +pair.second.offset,pair.second.size});
+	}
+	for(auto &pair : m_pendingEntries)
+		entries.push_back({pair.first,pair.second.data(),pair.second.size()});
+	// Sort by name so the file layout is deterministic
+	std::sort(entries.begin(),entries.end(),[](const WriteEntry &a,const WriteEntry &b) {return a.name < b.name;});
+
+	auto tmpPath = m_path +".tmp";
+	auto *f = std::fopen(tmpPath.c_str(),"wb");
+	if(f == nullptr)
+		return false;
+	auto success = true;
+	uint64_t offset = 0ull;
+	auto fWrite = [f,&offset,&success](const void *data,uint64_t size) {
+		if(size > 0 && std::fwrite(data,1,size,f) != size)
+			success = false;
+		offset += size;
+	};
+	auto fAlign = [&fWrite,&offset]() {
+		static constexpr std::array<uint8_t,ENTRY_ALIGNMENT> padding {};
+		auto rem = offset %ENTRY_ALIGNMENT;
+		if(rem != 0)
+			fWrite(padding.data(),ENTRY_ALIGNMENT -rem);
+	};
+
+	Header header {};
+	std::memcpy(header.magic,ARCHIVE_MAGIC,sizeof(ARCHIVE_MAGIC));
+	header.version = FORMAT_VERSION;
+	header.entryCount = static_cast<uint32_t>(entries.size());
+	fWrite(&header,sizeof(header));
+	for(auto &entry : entries)
+	{
+		fAlign();
+		entry.offset = offset;
+		fWrite(entry.data,entry.size);
+	}
+	fAlign();
+	header.indexOffset = offset;
+	for(auto &entry : entries)
+	{
+		auto nameLength = static_cast<uint32_t>(entry.name.length());
+		fWrite(&entry.offset,sizeof(entry.offset));
+		fWrite(&entry.size,sizeof(entry.size));
+		fWrite(&nameLength,sizeof(nameLength));
+		fWrite(entry.name.data(),nameLength);
+	}
+	// The header was written with an index offset of zero, which Map rejects. It is only completed once everything else has been written.
+	if(std::fseek(f,0,SEEK_SET) != 0)
+		success = false;
+	else
+		fWrite(&header,sizeof(header));
+	// The data has to be on disk before the rename, otherwise a crash could leave a truncated file at the archive path
+	if(std::fflush(f) != 0)
+		success = false;
+#ifdef _WIN32
+	else if(_commit(_fileno(f)) != 0)
+		success = false;
+#else
+	else if(fsync(fileno(f)) != 0)
+		success = false;
+#endif
+	std::fclose(f);
+	if(success == false)
+	{
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+
+	// The entries that are still referenced from the old mapping have been written, so the mapping can be released now
+	Unmap();
+#ifdef _WIN32
+	success = MoveFileExA(tmpPath.c_str(),m_path.c_str(),MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+	success = std::rename(tmpPath.c_str(),m_path.c_str()) == 0;
+#endif
+	if(success)
+		m_pendingEntries.clear();
+	else
+		std::remove(tmpPath.c_str());
+	Map();
+	return success;
+}
+
+bool CacheArchive::HasPendingEntries() const
+{
+	std::scoped_lock lock {m_mutex};
+	return m_pendingEntries.empty() == false;
+}
+uint32_t CacheArchive::GetEntryCount() const
+{
+	std::scoped_lock lock {m_mutex};
+	auto count = m_index.size();
+	for(auto &pair : m_pendingEntries)
+	{
+		if(m_index.find(pair.first) == m_index.end())
+			++count;
+	}
+	return count;
+}
+const std::string &CacheArchive::GetPath() const {return m_path;}
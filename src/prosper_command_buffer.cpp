@@ -88,6 +88,18 @@ bool prosper::ICommandBuffer::RecordDrawIndirect(IBuffer &buf,DeviceSize offset,
 {
 	return dynamic_cast<VlkCommandBuffer&>(*this)->record_draw_indirect(&dynamic_cast<VlkBuffer&>(buf).GetAnvilBuffer(),offset,count,stride);
 }
+bool prosper::ICommandBuffer::RecordDrawIndexedIndirectCount(IBuffer &buf,DeviceSize offset,IBuffer &countBuf,DeviceSize countBufOffset,uint32_t maxDrawCount,uint32_t stride)
+{
+	return dynamic_cast<VlkCommandBuffer&>(*this)->record_draw_indexed_indirect_count_KHR(
+		&dynamic_cast<VlkBuffer&>(buf).GetAnvilBuffer(),offset,&dynamic_cast<VlkBuffer&>(countBuf).GetAnvilBuffer(),countBufOffset,maxDrawCount,stride
+	);
+}
+bool prosper::ICommandBuffer::RecordDrawIndirectCount(IBuffer &buf,DeviceSize offset,IBuffer &countBuf,DeviceSize countBufOffset,uint32_t maxDrawCount,uint32_t stride)
+{
+	return dynamic_cast<VlkCommandBuffer&>(*this)->record_draw_indirect_count_KHR(
+		&dynamic_cast<VlkBuffer&>(buf).GetAnvilBuffer(),offset,&dynamic_cast<VlkBuffer&>(countBuf).GetAnvilBuffer(),countBufOffset,maxDrawCount,stride
+	);
+}
 bool prosper::ICommandBuffer::RecordFillBuffer(IBuffer &buf,DeviceSize offset,DeviceSize size,uint32_t data)
 {
 	return dynamic_cast<VlkCommandBuffer&>(*this)->record_fill_buffer(&dynamic_cast<VlkBuffer&>(buf).GetAnvilBuffer(),offset,size,data);
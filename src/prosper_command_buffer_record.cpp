@@ -401,9 +401,3 @@ bool prosper::VlkCommandBuffer::RecordUpdateBuffer(IBuffer &buffer,uint64_t offs
 	return m_cmdBuffer->record_update_buffer(&dynamic_cast<VlkBuffer&>(buffer).GetBaseAnvilBuffer(),buffer.GetStartOffset() +offset,size,reinterpret_cast<const uint32_t*>(data));
 }
 
-///////////////
-
-bool prosper::VlkPrimaryCommandBuffer::RecordNextSubPass()
-{
-	return (*this)->record_next_subpass(Anvil::SubpassContents::INLINE);
-}
@@ -20,10 +20,16 @@
 #include "prosper_command_buffer.hpp"
 #include "prosper_fence.hpp"
 #include "prosper_pipeline_cache.hpp"
+#include "prosper_cache_archive.hpp"
+#include "prosper_glstospv.hpp"
+#include "prosper_memory_budget_tracker.hpp"
+#include "prosper_upload_context_pool.hpp"
 #include <wrappers/command_buffer.h>
 #include <iglfw/glfw_window.h>
 #include <sharedutils/util_clock.hpp>
+#include <fsys/filesystem.h>
 #include <thread>
+#include <algorithm>
 
 /* Uncomment the #define below to enable off-screen rendering */
 // #define ENABLE_OFFSCREEN_RENDERING
@@ -90,11 +96,16 @@ void IPrContext::OnClose()
 }
 void IPrContext::Release()
 {
+	JoinWorkerThread();
+
 	s_vertexBuffer = nullptr;
 	s_uvBuffer = nullptr;
 	s_vertexUvBuffer = nullptr;
 
 	m_shaderManager = nullptr;
+	m_shaderArchive = nullptr;
+	m_memoryBudgetTracker = nullptr;
+	m_uploadContextPool = nullptr;
 	m_dummyTexture = nullptr;
 	m_dummyCubemapTexture = nullptr;
 	m_dummyBuffer = nullptr;
@@ -105,8 +116,12 @@ void IPrContext::Release()
 
 	m_setupCmdBuffer = nullptr;
 	m_keepAliveResources.clear();
-	while(m_scheduledBufferUpdates.empty() == false)
-		m_scheduledBufferUpdates.pop();
+	m_frameCompletionCallbacks.clear();
+	m_sharedGraphicsPipelines = {};
+	m_sharedComputePipelines = {};
+	m_scheduledCommands.clear();
+	m_scheduledBufferUpdates.clear();
+	m_scheduledBufferUpdateData.clear();
 
 	m_glfwWindow = nullptr;
 	m_stateFlags |= StateFlags::Closed;
@@ -114,7 +129,14 @@ void IPrContext::Release()
 
 uint64_t IPrContext::GetLastFrameId() const {return m_frameId;}
 
-void IPrContext::EndFrame() {++m_frameId;}
+void IPrContext::EndFrame()
+{
+	++m_frameId;
+	if(m_memoryBudgetTracker)
+		m_memoryBudgetTracker->OnFrame();
+	if(m_uploadContextPool)
+		m_uploadContextPool->Recycle();
+}
 
 void IPrContext::DrawFrame()
 {
@@ -148,6 +170,20 @@ std::shared_ptr<IBuffer> IPrContext::AllocateDeviceImageBuffer(vk::DeviceSize si
 	uint64_t bufferSize = 512 *1'024 *1'024; // 512 MiB
 	auto maxTotalPercent = 0.5f;
 
+	// Give the eviction callbacks a chance to release memory before the heap grows past its budget
+	auto heapIndex = m_memoryBudgetTracker ? m_memoryBudgetTracker->FindHeapIndex(MemoryFeatureFlags::GPUBulk) : std::optional<uint32_t>{};
+	if(heapIndex.has_value() && m_memoryBudgetTracker->RequestMemory(*heapIndex,bufferSize) == false)
+	{
+		// Evicted resources may have left space in the existing buffers
+		for(auto &deviceImgBuf : m_deviceImgBuffers)
+		{
+			auto buf = fAllocateImgBuf(*deviceImgBuf);
+			if(buf)
+				return buf;
+		}
+		std::cout<<"WARNING: Allocating new image buffer of size "<<::util::get_pretty_bytes(bufferSize)<<" exceeds the memory budget of heap "<<*heapIndex<<"!"<<std::endl;
+	}
+
 	if(m_deviceImgBuffers.empty() == false)
 	{
 		auto &imgBuf = m_deviceImgBuffers.back();
@@ -360,12 +396,89 @@ void IPrContext::KeepResourceAliveUntilPresentationComplete(const std::shared_pt
 	DoKeepResourceAliveUntilPresentationComplete(resource);
 }
 
+void IPrContext::AddFrameCompletionCallback(const std::function<void()> &callback)
+{
+	if(umath::is_flag_set(m_stateFlags,StateFlags::Idle))
+	{
+		callback();
+		return;
+	}
+	if(m_frameCompletionCallbacks.size() < m_numSwapchainImages)
+		m_frameCompletionCallbacks.resize(m_numSwapchainImages);
+	if(m_n_swapchain_image >= m_frameCompletionCallbacks.size())
+	{
+		callback();
+		return;
+	}
+	m_frameCompletionCallbacks.at(m_n_swapchain_image).push_back(callback);
+}
+void IPrContext::RunFrameCompletionCallbacks(bool allFrames)
+{
+	auto fRunCallbacks = [](std::vector<std::function<void()>> &callbacks) {
+		// Callbacks may register new callbacks, so we have to move them out first
+		auto curCallbacks = std::move(callbacks);
+		callbacks.clear();
+		for(auto &f : curCallbacks)
+			f();
+	};
+	if(allFrames)
+	{
+		for(auto &callbacks : m_frameCompletionCallbacks)
+			fRunCallbacks(callbacks);
+		return;
+	}
+	if(m_n_swapchain_image >= m_frameCompletionCallbacks.size())
+		return;
+	fRunCallbacks(m_frameCompletionCallbacks.at(m_n_swapchain_image));
+}
+
+void IPrContext::AddWorkerTask(const std::function<void()> &task)
+{
+	std::unique_lock<std::mutex> lock {m_workerMutex};
+	m_workerTasks.push(task);
+	if(m_workerRunning == false)
+	{
+		m_workerRunning = true;
+		m_workerThread = std::thread{[this]() {
+			std::unique_lock<std::mutex> lock {m_workerMutex};
+			for(;;)
+			{
+				m_workerCondition.wait(lock,[this]() {return m_workerTasks.empty() == false || m_workerRunning == false;});
+				if(m_workerTasks.empty())
+					break; // Only reached once the thread has been stopped and all tasks have been completed
+				auto task = std::move(m_workerTasks.front());
+				m_workerTasks.pop();
+				lock.unlock();
+				task();
+				lock.lock();
+			}
+		}};
+	}
+	lock.unlock();
+	m_workerCondition.notify_one();
+}
+void IPrContext::JoinWorkerThread()
+{
+	{
+		std::unique_lock<std::mutex> lock {m_workerMutex};
+		if(m_workerRunning == false)
+			return;
+		m_workerRunning = false;
+	}
+	m_workerCondition.notify_one();
+	if(m_workerThread.joinable())
+		m_workerThread.join();
+}
+
 void IPrContext::WaitIdle()
 {
 	FlushSetupCommandBuffer();
 	DoWaitIdle();
 	umath::set_flag(m_stateFlags,StateFlags::Idle);
+	if(m_uploadContextPool)
+		m_uploadContextPool->Recycle();
 	ClearKeepAliveResources();
+	RunFrameCompletionCallbacks(true);
 }
 
 
@@ -381,13 +494,29 @@ bool IPrContext::ValidationCallback(
 	return true;
 }
 
+static const std::string CACHE_ARCHIVE_PATH = "cache";
+static const std::string CACHE_ARCHIVE_FILE_NAME = "shader_cache.prc";
+static const std::string SHADER_ARCHIVE_FILE_NAME = "shaders.prc";
 void IPrContext::Initialize(const CreateInfo &createInfo)
 {
 	// TODO: Check if resolution is supported
 	m_windowCreationInfo->width = createInfo.width;
 	m_windowCreationInfo->height = createInfo.height;
 	ChangePresentMode(createInfo.presentMode);
+	// Has to be opened before the API is initialized, since the pipeline cache is loaded from it
+	FileManager::CreatePath(CACHE_ARCHIVE_PATH.c_str());
+	m_cacheArchive = CacheArchive::Open(::util::get_program_path() +"/" +CACHE_ARCHIVE_PATH +"/" +CACHE_ARCHIVE_FILE_NAME);
+	m_shaderArchive = CacheArchive::Open(::util::get_program_path() +"/" +Shader::GetRootShaderLocation() +"/" +SHADER_ARCHIVE_FILE_NAME);
+	if(m_shaderArchive->GetEntryCount() == 0u)
+		m_shaderArchive = nullptr;
+	else if(is_shader_archive_compatible(*m_shaderArchive) == false)
+	{
+		std::cout<<"WARNING: Precompiled shader archive '"<<m_shaderArchive->GetPath()<<"' is incompatible and will be ignored! Shaders will be compiled at runtime."<<std::endl;
+		m_shaderArchive = nullptr;
+	}
 	InitAPI(createInfo);
+	m_memoryBudgetTracker = MemoryBudgetTracker::Create(*this);
+	m_uploadContextPool = UploadContextPool::Create(*this);
 	InitBuffers();
 	InitGfxPipelines();
 	InitDummyTextures();
@@ -412,6 +541,10 @@ void IPrContext::DrawFrame(prosper::IPrimaryCommandBuffer &cmd_buffer_ptr,uint32
 }
 
 ShaderManager &IPrContext::GetShaderManager() const {return *m_shaderManager;}
+CacheArchive *IPrContext::GetCacheArchive() const {return m_cacheArchive.get();}
+CacheArchive *IPrContext::GetShaderArchive() const {return m_shaderArchive.get();}
+MemoryBudgetTracker *IPrContext::GetMemoryBudgetTracker() const {return m_memoryBudgetTracker.get();}
+UploadContextPool &IPrContext::GetUploadContextPool() const {return *m_uploadContextPool;}
 
 ::util::WeakHandle<Shader> IPrContext::RegisterShader(const std::string &identifier,const std::function<Shader*(IPrContext&,const std::string&)> &fFactory) {return m_shaderManager->RegisterShader(identifier,fFactory);}
 ::util::WeakHandle<Shader> IPrContext::GetShader(const std::string &identifier) const {return m_shaderManager->GetShader(identifier);}
@@ -456,7 +589,68 @@ void IPrContext::InitDummyTextures()
 	m_dummyCubemapTexture->SetDebugName("context_dummy_cubemap_tex");
 }
 
-void IPrContext::SubmitCommandBuffer(prosper::ICommandBuffer &cmd,bool shouldBlock,prosper::IFence *fence) {SubmitCommandBuffer(cmd,cmd.GetQueueFamilyType(),shouldBlock,fence);}
+bool IPrContext::SubmitCommandBuffer(prosper::ICommandBuffer &cmd,bool shouldBlock,prosper::IFence *fence) {return SubmitCommandBuffer(cmd,cmd.GetQueueFamilyType(),shouldBlock,fence);}
+
+static void record_src_barrier(
+	prosper::ICommandBuffer &cmdBuffer,prosper::IBuffer &buffer,const std::optional<PipelineStageFlags> &srcStageMask,const std::optional<AccessFlags> &srcAccessMask,
+	uint64_t offset,uint64_t size
+)
+{
+	if(srcAccessMask.has_value() == false)
+		return;
+	cmdBuffer.RecordBufferBarrier(
+		buffer,
+		*srcStageMask,PipelineStageFlags::TransferBit,
+		*srcAccessMask,AccessFlags::TransferWriteBit,
+		offset,size
+	);
+}
+static void record_post_update_barrier(
+	prosper::ICommandBuffer &cmdBuffer,prosper::IBuffer &buffer,const std::optional<PipelineStageFlags> &dstStageMask,const std::optional<AccessFlags> &dstAccessMask,
+	uint64_t offset,uint64_t size
+)
+{
+	if(dstStageMask.has_value() == false || dstAccessMask.has_value() == false)
+		return;
+	cmdBuffer.RecordBufferBarrier(
+		buffer,
+		PipelineStageFlags::TransferBit,*dstStageMask,
+		AccessFlags::TransferWriteBit,*dstAccessMask,
+		offset,size
+	);
+}
+static bool record_buffer_update(IPrContext &context,prosper::ICommandBuffer &cmdBuffer,prosper::IBuffer &buffer,uint64_t offset,uint64_t size,const uint8_t *data)
+{
+	const auto maxUpdateSize = 65'536u; // Maximum size allowed per vkCmdUpdateBuffer-call (see https://www.khronos.org/registry/vulkan/specs/1.1-extensions/man/html/vkCmdUpdateBuffer.html)
+	if(size > maxUpdateSize)
+	{
+		// Larger updates are copied from the temporary buffer with a single command
+		auto stagingBuffer = context.AllocateTemporaryBuffer(size,0u,data);
+		if(stagingBuffer)
+		{
+			util::BufferCopy copyInfo {};
+			copyInfo.size = size;
+			copyInfo.srcOffset = 0ull;
+			copyInfo.dstOffset = offset;
+			if(cmdBuffer.RecordCopyBuffer(copyInfo,*stagingBuffer,buffer) == false)
+				return false;
+			context.KeepResourceAliveUntilPresentationComplete(stagingBuffer);
+			return true;
+		}
+	}
+	auto dataOffset = 0ull;
+	do
+	{
+		auto updateSize = umath::min(static_cast<uint64_t>(maxUpdateSize),size);
+		if(cmdBuffer.RecordUpdateBuffer(buffer,offset,updateSize,data +dataOffset) == false)
+			return false;
+		dataOffset += maxUpdateSize;
+		offset += maxUpdateSize;
+		size -= updateSize;
+	}
+	while(size > 0ull);
+	return true;
+}
 
 bool IPrContext::IsRecording() const {return umath::is_flag_set(m_stateFlags,StateFlags::IsRecording);}
 bool IPrContext::ScheduleRecordUpdateBuffer(
@@ -467,33 +661,6 @@ bool IPrContext::ScheduleRecordUpdateBuffer(
 		return true;
 	if((buffer->GetUsageFlags() &prosper::BufferUsageFlags::TransferDstBit) == prosper::BufferUsageFlags::None)
 		throw std::logic_error("Buffer has to have been created with VK_BUFFER_USAGE_TRANSFER_DST_BIT flag to allow buffer updates on command buffer!");
-	const auto fRecordSrcBarrier = [this,buffer,updateInfo,offset,size](prosper::ICommandBuffer &cmdBuffer) {
-		if(updateInfo.srcAccessMask.has_value())
-		{
-			cmdBuffer.RecordBufferBarrier(
-				*buffer,
-				*updateInfo.srcStageMask,PipelineStageFlags::TransferBit,
-				*updateInfo.srcAccessMask,AccessFlags::TransferWriteBit,
-				offset,size
-			);
-		}
-	};
-	const auto fUpdateBuffer = [](prosper::ICommandBuffer &cmdBuffer,prosper::IBuffer &buffer,const uint8_t *data,uint64_t offset,uint64_t size) {
-		auto dataOffset = 0ull;
-		const auto maxUpdateSize = 65'536u; // Maximum size allowed per vkCmdUpdateBuffer-call (see https://www.khronos.org/registry/vulkan/specs/1.1-extensions/man/html/vkCmdUpdateBuffer.html)
-		do
-		{
-			auto updateSize = umath::min(static_cast<uint64_t>(maxUpdateSize),size);
-			if(cmdBuffer.RecordUpdateBuffer(buffer,offset,updateSize,data +dataOffset) == false)
-				return false;
-			dataOffset += maxUpdateSize;
-			offset += maxUpdateSize;
-			size -= updateSize;
-		}
-		while(size > 0ull);
-		return true;
-	};
-
 #ifdef _DEBUG
 	auto fCheckMask = [](vk::AccessFlags srcAccessMask,vk::PipelineStageFlags srcStageMask,vk::AccessFlagBits accessFlag,vk::PipelineStageFlags validStageMask) {
 		if(!(srcAccessMask &accessFlag))
@@ -532,41 +699,134 @@ bool IPrContext::ScheduleRecordUpdateBuffer(
 		auto &drawCmd = GetDrawCommandBuffer();
 		if(prosper::util::get_current_render_pass_target(*drawCmd) == false) // Buffer updates are not allowed while a render pass is active! (https://www.khronos.org/registry/vulkan/specs/1.1-extensions/man/html/vkCmdUpdateBuffer.html)
 		{
-			fRecordSrcBarrier(*drawCmd);
-			if(fUpdateBuffer(*drawCmd,*buffer,static_cast<const uint8_t*>(data),offset,size) == false)
+			record_src_barrier(*drawCmd,*buffer,updateInfo.srcStageMask,updateInfo.srcAccessMask,offset,size);
+			if(record_buffer_update(*this,*drawCmd,*buffer,offset,size,static_cast<const uint8_t*>(data)) == false)
 				return false;
-			if(updateInfo.postUpdateBarrierStageMask.has_value() && updateInfo.postUpdateBarrierAccessMask.has_value())
-			{
-				drawCmd->RecordBufferBarrier(
-					*buffer,
-					PipelineStageFlags::TransferBit,*updateInfo.postUpdateBarrierStageMask,
-					AccessFlags::TransferWriteBit,*updateInfo.postUpdateBarrierAccessMask,
-					offset,size
-				);
-			}
+			record_post_update_barrier(*drawCmd,*buffer,updateInfo.postUpdateBarrierStageMask,updateInfo.postUpdateBarrierAccessMask,offset,size);
 			return true;
 		}
 	}
 	// We'll have to make a copy of the data for later
-	auto ptrData = std::make_shared<std::vector<uint8_t>>(size);
-	memcpy(ptrData->data(),data,size);
-	m_scheduledBufferUpdates.push([buffer,fRecordSrcBarrier,fUpdateBuffer,offset,size,ptrData,updateInfo](prosper::ICommandBuffer &cmdBuffer) {
-		fRecordSrcBarrier(cmdBuffer);
-		fUpdateBuffer(cmdBuffer,*buffer,ptrData->data(),offset,size);
+	auto dataOffset = m_scheduledBufferUpdateData.size();
+	m_scheduledBufferUpdateData.resize(dataOffset +size);
+	memcpy(m_scheduledBufferUpdateData.data() +dataOffset,data,size);
+	m_scheduledBufferUpdates.push_back({buffer,offset,size,dataOffset,updateInfo});
+	return true;
+}
+
+void IPrContext::RecordScheduledBufferUpdates(
+	prosper::ICommandBuffer &cmd,const std::vector<ScheduledBufferUpdate> &updates,const std::vector<uint8_t> &data,size_t first,size_t end
+)
+{
+	if(first >= end)
+		return;
+	// Updates to different buffers are independent of each other, so they can be grouped by buffer
+	std::vector<size_t> order(end -first);
+	for(auto i=first;i<end;++i)
+		order.at(i -first) = i;
+	std::stable_sort(order.begin(),order.end(),[&updates](size_t a,size_t b) {return updates.at(a).buffer.get() < updates.at(b).buffer.get();});
+
+	std::vector<uint8_t> mergedData {};
+	for(auto itGroup=order.begin();itGroup!=order.end();)
+	{
+		auto *buffer = updates.at(*itGroup).buffer.get();
+		auto itGroupEnd = std::find_if(itGroup,order.end(),[&updates,buffer](size_t idx) {return updates.at(idx).buffer.get() != buffer;});
+		// Updates can only be sorted by offset if they don't overlap, otherwise the scheduling order has to be kept so that later updates win
+		std::vector<size_t> sorted(itGroup,itGroupEnd);
+		std::stable_sort(sorted.begin(),sorted.end(),[&updates](size_t a,size_t b) {return updates.at(a).offset < updates.at(b).offset;});
+		auto overlapping = false;
+		for(auto i=static_cast<size_t>(1);i<sorted.size();++i)
+		{
+			auto &prev = updates.at(sorted.at(i -1));
+			if(updates.at(sorted.at(i)).offset < prev.offset +prev.size)
+			{
+				overlapping = true;
+				break;
+			}
+		}
+		if(overlapping)
+			sorted.assign(itGroup,itGroupEnd);
 
-		if(updateInfo.postUpdateBarrierStageMask.has_value() && updateInfo.postUpdateBarrierAccessMask.has_value())
+		// Adjacent updates are merged into a single range
+		for(auto it=sorted.begin();it!=sorted.end();)
 		{
-			cmdBuffer.RecordBufferBarrier(
-				*buffer,
-				PipelineStageFlags::TransferBit,*updateInfo.postUpdateBarrierStageMask,
-				AccessFlags::TransferWriteBit,*updateInfo.postUpdateBarrierAccessMask,
-				offset,size
-			);
+			auto &update = updates.at(*it);
+			auto offset = update.offset;
+			auto size = update.size;
+			auto *rangeData = data.data() +update.dataOffset;
+			auto srcStageMask = update.updateInfo.srcStageMask;
+			auto srcAccessMask = update.updateInfo.srcAccessMask;
+			auto postUpdateBarrierStageMask = update.updateInfo.postUpdateBarrierStageMask;
+			auto postUpdateBarrierAccessMask = update.updateInfo.postUpdateBarrierAccessMask;
+			auto fMergeMask = [](auto &mask,const auto &other) {
+				if(other.has_value() == false)
+					return;
+				mask = mask.has_value() ? (*mask | *other) : *other;
+			};
+			auto usesMergedData = false;
+			for(++it;it!=sorted.end();++it)
+			{
+				auto &next = updates.at(*it);
+				if(next.offset != offset +size)
+					break;
+				if(usesMergedData == false && next.dataOffset != (rangeData -data.data()) +size)
+				{
+					// The data isn't contiguous in the arena
+					mergedData.assign(rangeData,rangeData +size);
+					usesMergedData = true;
+				}
+				if(usesMergedData)
+					mergedData.insert(mergedData.end(),data.begin() +next.dataOffset,data.begin() +next.dataOffset +next.size);
+				size += next.size;
+				fMergeMask(srcStageMask,next.updateInfo.srcStageMask);
+				fMergeMask(srcAccessMask,next.updateInfo.srcAccessMask);
+				fMergeMask(postUpdateBarrierStageMask,next.updateInfo.postUpdateBarrierStageMask);
+				fMergeMask(postUpdateBarrierAccessMask,next.updateInfo.postUpdateBarrierAccessMask);
+			}
+			if(usesMergedData)
+				rangeData = mergedData.data();
+			record_src_barrier(cmd,*buffer,srcStageMask,srcAccessMask,offset,size);
+			record_buffer_update(*this,cmd,*buffer,offset,size,rangeData);
+			record_post_update_barrier(cmd,*buffer,postUpdateBarrierStageMask,postUpdateBarrierAccessMask,offset,size);
 		}
-	});
-	return true;
+		itGroup = itGroupEnd;
+	}
+}
+
+void IPrContext::RecordScheduledCommands(prosper::IPrimaryCommandBuffer &cmd)
+{
+	// Scheduled commands may schedule further commands, which are recorded in the next iteration
+	while(m_scheduledCommands.empty() == false || m_scheduledBufferUpdates.empty() == false)
+	{
+		auto commands = std::move(m_scheduledCommands);
+		auto updates = std::move(m_scheduledBufferUpdates);
+		auto data = std::move(m_scheduledBufferUpdateData);
+		m_scheduledCommands.clear();
+		m_scheduledBufferUpdates.clear();
+		m_scheduledBufferUpdateData.clear();
+
+		size_t firstUpdate = 0;
+		for(auto &pair : commands)
+		{
+			RecordScheduledBufferUpdates(cmd,updates,data,firstUpdate,pair.first);
+			firstUpdate = std::max(firstUpdate,pair.first);
+			pair.second(cmd);
+		}
+		RecordScheduledBufferUpdates(cmd,updates,data,firstUpdate,updates.size());
+
+		// Hand the memory back to the arena, unless something new has been scheduled in the meantime
+		if(m_scheduledBufferUpdates.empty())
+		{
+			updates.clear();
+			data.clear();
+			m_scheduledBufferUpdates = std::move(updates);
+			m_scheduledBufferUpdateData = std::move(data);
+		}
+	}
 }
 
+void IPrContext::ScheduleRecordCommands(const std::function<void(prosper::IPrimaryCommandBuffer&)> &fRecord) {m_scheduledCommands.push_back({m_scheduledBufferUpdates.size(),fRecord});}
+
 void IPrContext::InitTemporaryBuffer()
 {
 	auto bufferSize = 512ull *1'024ull *1'024ull; // 512 MiB
@@ -8,23 +8,24 @@
 #ifdef VK_ENABLE_GLSLANG
 #include "prosper_includes.hpp"
 #include "prosper_glstospv.hpp"
-#include "vk_context.hpp"
+#include "prosper_cache_archive.hpp"
+#include "prosper_context.hpp"
 #include "shader/prosper_shader.hpp"
+#include "shader/prosper_shader_manager.hpp"
 #include <fsys/filesystem.h>
 #include <sharedutils/util_file.h>
 #include <sharedutils/util_string.h>
-#include <wrappers/device.h>
-#include <wrappers/shader_module.h>
-#include <misc/glsl_to_spirv.h>
+#include <glslang/Public/ShaderLang.h>
+#include <SPIRV/GlslangToSpv.h>
 #include <sstream>
-
-static unsigned int get_line_break(std::string &str,int pos=0)
-{
-	auto len = str.length();
-	while(pos < len && str[pos] != '\n')
-		pos++;
-	return pos;
-}
+#include <algorithm>
+#include <cctype>
+#include <mutex>
+#include <queue>
+#include <unordered_set>
+#include <optional>
+#include <cstring>
+#include <array>
 
 struct IncludeLine
 {
@@ -40,77 +41,419 @@ struct IncludeLine
 	UInt32 depth;
 };
 
-static bool glsl_preprocessing(const std::string &path,std::string &shader,std::string *err,std::vector<IncludeLine> &includeLines,unsigned int &lineId,UInt32 depth=0,bool=false)
+// Include file with pre-parsed lines. Include files are only read and parsed once and then shared between all shaders.
+struct GlslSourceFile
 {
-	if(!includeLines.empty() && includeLines.back().lineId == lineId)
-		includeLines.back() = IncludeLine(lineId,path,depth);
-	else
-		includeLines.push_back(IncludeLine(lineId,path,depth));
-	//auto incIdx = includeLines.size() -1;
-	std::string sub = FileManager::GetPath(const_cast<std::string&>(path));
-	auto len = shader.length();
-	unsigned int br;
-	unsigned int brLast = 0;
-	do
+	enum class Directive : uint8_t
 	{
-		//std::cout<<"Length: "<<len<<"("<<shader.length()<<")"<<std::endl;
-		br = get_line_break(shader,brLast);
-		std::string l = shader.substr(brLast,br -brLast);
-		ustring::remove_whitespace(l);
-		if(l.length() >= 8)
+		None = 0u,
+		Include,
+		PragmaOnce,
+		// #if, #ifdef, #ifndef
+		ConditionalBegin,
+		ConditionalEnd
+	};
+	struct Line
+	{
+		size_t offset = 0;
+		size_t length = 0;
+		Directive directive = Directive::None;
+		// Only set for #include directives
+		std::string text;
+		std::string includeTarget;
+	};
+	std::string source;
+	std::vector<Line> lines;
+	// Macro of the '#ifndef X / #define X / ... / #endif' block enclosing the entire file, if there is one
+	std::string includeGuard;
+	// Lines of the #ifndef and #endif directives of the include guard
+	size_t includeGuardBegin = 0;
+	size_t includeGuardEnd = 0;
+	bool pragmaOnce = false;
+};
+
+struct GlslIncludeCache
+{
+	std::mutex mutex;
+	std::unordered_map<std::string,std::shared_ptr<const GlslSourceFile>> files;
+	// Edges from each file to the files it includes directly
+	std::unordered_map<std::string,std::unordered_set<std::string>> includeGraph;
+};
+static GlslIncludeCache &get_glsl_include_cache()
+{
+	static GlslIncludeCache cache {};
+	return cache;
+}
+
+static std::string get_glsl_file_key(const std::string &path)
+{
+	auto key = FileManager::GetCanonicalizedPath(path);
+	ustring::to_lower(key);
+	return key;
+}
+
+static std::shared_ptr<GlslSourceFile> parse_glsl_source(std::string &&source)
+{
+	auto file = std::make_shared<GlslSourceFile>();
+	file->source = std::move(source);
+	auto &src = file->source;
+
+	enum class GuardState : uint8_t
+	{
+		Start = 0u,
+		Ifndef,
+		Define,
+		Closed,
+		Invalid
+	};
+	auto guardState = GuardState::Start;
+	uint32_t conditionalDepth = 0u;
+	auto inBlockComment = false;
+	// Anything other than comments outside of the guard block means the file isn't guarded
+	auto fContent = [&guardState]() {
+		if(guardState != GuardState::Define)
+			guardState = GuardState::Invalid;
+	};
+	auto fReadToken = [&src](size_t &pos,size_t end,bool identifier) -> std::string {
+		pos = src.find_first_not_of(" \t",pos);
+		if(pos >= end)
+			return "";
+		auto start = pos;
+		while(pos < end && (std::isalnum(static_cast<unsigned char>(src[pos])) || (identifier && src[pos] == '_')))
+			++pos;
+		return src.substr(start,pos -start);
+	};
+
+	size_t offset = 0;
+	for(;;)
+	{
+		auto br = src.find('\n',offset);
+		auto end = (br != std::string::npos) ? br : src.length();
+		file->lines.push_back({offset,end -offset});
+		auto &line = file->lines.back();
+		auto lineIndex = file->lines.size() -1;
+		auto first = src.find_first_not_of(" \t\r\f\v",offset);
+		std::string keyword {};
+		size_t pos = 0;
+		if(first < end && src[first] == '#')
+		{
+			pos = first +1;
+			keyword = fReadToken(pos,end,false);
+		}
+		if(keyword == "include")
 		{
-			if(l.substr(0,8) == "#include")
+			// Note: #include directives are expanded even within block comments
+			line.text = src.substr(first,end -first);
+			ustring::remove_whitespace(line.text);
+			if(line.text.compare(0,8,"#include") == 0)
 			{
-				std::string inc = l.substr(8,l.length());
-				ustring::remove_whitespace(inc);
-				ustring::remove_quotes(inc);
-				std::string includePath = "";
-				if(inc.empty() == false && inc.front() == '/')
-					includePath = inc;
-				else
-					includePath = sub.substr(sub.find_first_of("/\\") +1) +inc;
-				includePath = prosper::Shader::GetRootShaderLocation() +"\\" +FileManager::GetCanonicalizedPath(includePath);
-				if(includePath.substr(includePath.length() -4) != ".gls")
-					includePath += ".gls";
-				auto f = FileManager::OpenFile(includePath.c_str(),"rb");
-				if(f != NULL)
+				line.directive = GlslSourceFile::Directive::Include;
+				line.includeTarget = line.text.substr(8);
+				ustring::remove_whitespace(line.includeTarget);
+				ustring::remove_quotes(line.includeTarget);
+			}
+			else
+				line.text.clear();
+			if(inBlockComment == false)
+				fContent();
+		}
+		else if(inBlockComment)
+		{
+			auto posEnd = src.find("*/",offset);
+			if(posEnd < end)
+				inBlockComment = false;
+		}
+		else if(keyword.empty() == false)
+		{
+			if(keyword == "if" || keyword == "ifdef" || keyword == "ifndef")
+				line.directive = GlslSourceFile::Directive::ConditionalBegin;
+			else if(keyword == "endif")
+				line.directive = GlslSourceFile::Directive::ConditionalEnd;
+
+			if(keyword == "pragma")
+			{
+				auto pos2 = pos;
+				if(fReadToken(pos2,end,true) == "once")
 				{
-					unsigned long long flen = f->GetSize();
-					std::vector<char> data(flen +1);
-					f->Read(data.data(),flen);
-					data[flen] = '\0';
-					std::string subShader = data.data();
-					lineId++; // #include-directive
-					if(glsl_preprocessing(includePath,subShader,err,includeLines,lineId,depth +1) == false)
-						return false;
-					includeLines.push_back(IncludeLine(lineId,path,depth,true));
-					lineId--; // Why?
-					//subShader = std::string("\n#line 1\n") +subShader +std::string("\n#line ") +std::to_string(lineId) +std::string("\n");
-					shader = shader.substr(0,brLast) +std::string("//") +l +std::string("\n") +subShader +shader.substr(br);
-					br = CUInt32(brLast) +CUInt32(l.length()) +3 +CUInt32(subShader.length());
+					line.directive = GlslSourceFile::Directive::PragmaOnce;
+					file->pragmaOnce = true;
 				}
 				else
+					fContent();
+			}
+			else if(keyword == "ifndef" && guardState == GuardState::Start)
+			{
+				file->includeGuard = fReadToken(pos,end,true);
+				file->includeGuardBegin = lineIndex;
+				guardState = GuardState::Ifndef;
+				conditionalDepth = 1u;
+			}
+			else if(keyword == "define" && guardState == GuardState::Ifndef)
+				guardState = (fReadToken(pos,end,true) == file->includeGuard) ? GuardState::Define : GuardState::Invalid;
+			else if(guardState == GuardState::Define && (keyword == "if" || keyword == "ifdef" || keyword == "ifndef"))
+				++conditionalDepth;
+			else if(guardState == GuardState::Define && keyword == "endif")
+			{
+				if(--conditionalDepth == 0u)
 				{
-					if(err != NULL)
-						*err = "Unable to include file '" +includePath +"' (In: '" +path +"'): File not found!";
-					shader = shader.substr(0,brLast) +shader.substr(br);
-					br = brLast;
-					return false;
+					guardState = GuardState::Closed;
+					file->includeGuardEnd = lineIndex;
 				}
-				len = shader.length();
 			}
+			else if(guardState == GuardState::Define && conditionalDepth == 1u && (keyword == "else" || keyword == "elif"))
+				guardState = GuardState::Invalid;
+			else
+				fContent();
 		}
+		else if(first < end)
+		{
+			if(src.compare(first,2,"/*") == 0)
+			{
+				auto posEnd = src.find("*/",first +2);
+				if(posEnd >= end)
+					inBlockComment = true;
+			}
+			else if(src.compare(first,2,"//") != 0)
+				fContent();
+		}
+		if(br == std::string::npos)
+			break;
+		offset = br +1;
+	}
+	if(guardState != GuardState::Closed)
+		file->includeGuard.clear();
+	return file;
+}
+
+static std::shared_ptr<const GlslSourceFile> load_glsl_source_file(const std::string &path)
+{
+	auto &cache = get_glsl_include_cache();
+	auto key = get_glsl_file_key(path);
+	{
+		std::scoped_lock lock {cache.mutex};
+		auto it = cache.files.find(key);
+		if(it != cache.files.end())
+			return it->second;
+	}
+	auto f = FileManager::OpenFile(path.c_str(),"rb");
+	if(f == nullptr)
+		return nullptr;
+	std::string source;
+	source.resize(f->GetSize());
+	f->Read(source.data(),source.size());
+	std::shared_ptr<const GlslSourceFile> file = parse_glsl_source(std::move(source));
+
+	std::scoped_lock lock {cache.mutex};
+	return cache.files.insert(std::make_pair(key,file)).first->second;
+}
+
+struct GlslPreprocessState
+{
+	std::string *err;
+	std::vector<IncludeLine> &includeLines;
+	unsigned int &lineId;
+	// Only contain files whose expansion is known to be active, i.e. which haven't been included from within a conditional block
+	std::unordered_set<std::string> includedOnce {};
+	std::unordered_set<std::string> definedGuards {};
+	std::vector<std::string> includeStack {};
+	std::unordered_map<std::string,std::unordered_set<std::string>> includeGraph {};
+};
+
+// Expands all includes of the file in a single pass. The line bookkeeping in 'includeLines' is required to map error messages back to the original files.
+// Conditionals are not evaluated, so a file is only considered as included (for #pragma once and include guards) if it was included outside of
+// any conditional block ('active'). Files included from within conditional blocks are always expanded and rely on their include guards.
+static bool glsl_preprocessing(GlslPreprocessState &state,const std::string &path,const GlslSourceFile &file,std::string &out,UInt32 depth=0,bool active=true)
+{
+	auto &includeLines = state.includeLines;
+	auto &lineId = state.lineId;
+	if(!includeLines.empty() && includeLines.back().lineId == lineId)
+		includeLines.back() = IncludeLine(lineId,path,depth);
+	else
+		includeLines.push_back(IncludeLine(lineId,path,depth));
+	auto key = get_glsl_file_key(path);
+	if(active)
+	{
+		if(file.pragmaOnce)
+			state.includedOnce.insert(key);
+		if(file.includeGuard.empty() == false)
+			state.definedGuards.insert(file.includeGuard);
+	}
+	auto &includes = state.includeGraph[key];
+	// Depth of the conditional blocks of this file, not including the include guard
+	uint32_t conditionalDepth = 0u;
+	auto hasIncludeGuard = (file.includeGuard.empty() == false);
+
+	static const GlslSourceFile emptyFile {"",{GlslSourceFile::Line{}}};
+	std::string sub = FileManager::GetPath(const_cast<std::string&>(path));
+	auto includeBasePath = sub.substr(sub.find_first_of("/\\") +1);
+	auto numLines = file.lines.size();
+	for(auto i=decltype(numLines){0u};i<numLines;++i)
+	{
+		auto &line = file.lines[i];
+		switch(line.directive)
+		{
+		case GlslSourceFile::Directive::None:
+			out.append(file.source,line.offset,line.length);
+			break;
+		case GlslSourceFile::Directive::ConditionalBegin:
+		case GlslSourceFile::Directive::ConditionalEnd:
+			out.append(file.source,line.offset,line.length);
+			if(hasIncludeGuard && (i == file.includeGuardBegin || i == file.includeGuardEnd))
+				break;
+			if(line.directive == GlslSourceFile::Directive::ConditionalBegin)
+				++conditionalDepth;
+			else if(conditionalDepth > 0u)
+				--conditionalDepth;
+			break;
+		case GlslSourceFile::Directive::PragmaOnce:
+			out += "//";
+			out.append(file.source,line.offset,line.length);
+			break;
+		case GlslSourceFile::Directive::Include:
+		{
+			auto &inc = line.includeTarget;
+			std::string includePath = "";
+			if(inc.empty() == false && inc.front() == '/')
+				includePath = inc;
+			else
+				includePath = includeBasePath +inc;
+			includePath = prosper::Shader::GetRootShaderLocation() +"\\" +FileManager::GetCanonicalizedPath(includePath);
+			if(includePath.substr(includePath.length() -4) != ".gls")
+				includePath += ".gls";
+			auto incFile = load_glsl_source_file(includePath);
+			if(incFile == nullptr)
+			{
+				if(state.err != nullptr)
+					*state.err = "Unable to include file '" +includePath +"' (In: '" +path +"'): File not found!";
+				return false;
+			}
+			auto incKey = get_glsl_file_key(includePath);
+			includes.insert(incKey);
+			out += "//";
+			out += line.text;
+			out += '\n';
+			lineId++; // #include-directive
+
+			// Files that have already been included are replaced with an empty file, which keeps the line bookkeeping consistent
+			auto skip = (incFile->pragmaOnce && state.includedOnce.find(incKey) != state.includedOnce.end()) ||
+				(incFile->includeGuard.empty() == false && state.definedGuards.find(incFile->includeGuard) != state.definedGuards.end());
+			if(skip == false && std::find(state.includeStack.begin(),state.includeStack.end(),incKey) != state.includeStack.end())
+			{
+				if(state.err != nullptr)
+					*state.err = "Recursive include of file '" +includePath +"' (In: '" +path +"')!";
+				return false;
+			}
+			state.includeStack.push_back(incKey);
+			auto success = glsl_preprocessing(state,includePath,skip ? emptyFile : *incFile,out,depth +1,active && conditionalDepth == 0u);
+			state.includeStack.pop_back();
+			if(success == false)
+				return false;
+			includeLines.push_back(IncludeLine(lineId,path,depth,true));
+			lineId--;
+			break;
+		}
+		}
+		if(i < numLines -1)
+			out += '\n';
 		lineId++;
-		brLast = br +1;
 	}
-	while(br < len);
 	return true;
 }
 
-static bool glsl_preprocessing(prosper::IPrContext &context,Anvil::ShaderStage stage,const std::string &path,std::string &shader,std::string *err,std::vector<IncludeLine> &includeLines,unsigned int &lineId,bool bHlsl=false)
+static bool glsl_preprocessing(const std::string &path,std::string &shader,std::string *err,std::vector<IncludeLine> &includeLines,unsigned int &lineId)
+{
+	GlslPreprocessState state {err,includeLines,lineId};
+	auto file = parse_glsl_source(std::move(shader));
+	state.includeStack.push_back(get_glsl_file_key(path));
+	shader.clear();
+	shader.reserve(file->source.size());
+	if(glsl_preprocessing(state,path,*file,shader) == false)
+		return false;
+
+	auto &cache = get_glsl_include_cache();
+	std::scoped_lock lock {cache.mutex};
+	for(auto &pair : state.includeGraph)
+		cache.includeGraph[pair.first] = std::move(pair.second);
+	return true;
+}
+
+// Removes the shader's includes from the cache, so they're re-read on the next compilation
+static void invalidate_glsl_includes(const std::string &shaderFile)
+{
+	auto dependencies = prosper::get_glsl_include_dependencies(shaderFile);
+	auto &cache = get_glsl_include_cache();
+	std::scoped_lock lock {cache.mutex};
+	for(auto &dep : dependencies)
+		cache.files.erase(dep);
+}
+
+std::vector<std::string> prosper::get_glsl_include_dependencies(const std::string &shaderFile)
+{
+	auto &cache = get_glsl_include_cache();
+	std::scoped_lock lock {cache.mutex};
+	std::vector<std::string> dependencies;
+	std::unordered_set<std::string> visited {get_glsl_file_key(shaderFile)};
+	std::queue<std::string> queue;
+	queue.push(*visited.begin());
+	while(queue.empty() == false)
+	{
+		auto it = cache.includeGraph.find(queue.front());
+		queue.pop();
+		if(it == cache.includeGraph.end())
+			continue;
+		for(auto &inc : it->second)
+		{
+			if(visited.insert(inc).second == false)
+				continue;
+			dependencies.push_back(inc);
+			queue.push(inc);
+		}
+	}
+	return dependencies;
+}
+
+std::vector<std::string> prosper::get_glsl_include_dependents(const std::string &includeFile)
+{
+	auto &cache = get_glsl_include_cache();
+	std::scoped_lock lock {cache.mutex};
+	std::unordered_map<std::string,std::vector<std::string>> reverseGraph;
+	for(auto &pair : cache.includeGraph)
+	{
+		for(auto &inc : pair.second)
+			reverseGraph[inc].push_back(pair.first);
+	}
+	std::vector<std::string> dependents;
+	std::unordered_set<std::string> visited {get_glsl_file_key(includeFile)};
+	std::queue<std::string> queue;
+	queue.push(*visited.begin());
+	while(queue.empty() == false)
+	{
+		auto it = reverseGraph.find(queue.front());
+		queue.pop();
+		if(it == reverseGraph.end())
+			continue;
+		for(auto &file : it->second)
+		{
+			if(visited.insert(file).second == false)
+				continue;
+			dependents.push_back(file);
+			queue.push(file);
+		}
+	}
+	return dependents;
+}
+
+void prosper::clear_glsl_include_cache()
+{
+	auto &cache = get_glsl_include_cache();
+	std::scoped_lock lock {cache.mutex};
+	cache.files.clear();
+}
+
+static bool glsl_preprocessing(prosper::ShaderStage stage,std::optional<prosper::Vendor> vendor,const std::string &path,std::string &shader,std::string *err,std::vector<IncludeLine> &includeLines,unsigned int &lineId,bool bHlsl=false)
 {
 	lineId = 0;
-	auto r = glsl_preprocessing(path,shader,err,includeLines,lineId,0,true);
+	auto r = glsl_preprocessing(path,shader,err,includeLines,lineId);
 	if(r == false)
 		return false;
 	// Custom definitions
@@ -119,32 +462,34 @@ static bool glsl_preprocessing(prosper::IPrContext &context,Anvil::ShaderStage s
 	std::string prefix = (bHlsl == false) ? "GLS_" : "HLS_";
 	switch(stage)
 	{
-		case Anvil::ShaderStage::FRAGMENT:
+		case prosper::ShaderStage::Fragment:
 			definitions[prefix +"FRAGMENT_SHADER"] = "1";
 			break;
-		case Anvil::ShaderStage::VERTEX:
+		case prosper::ShaderStage::Vertex:
 			definitions[prefix +"VERTEX_SHADER"] = "1";
 			break;
-		case Anvil::ShaderStage::GEOMETRY:
+		case prosper::ShaderStage::Geometry:
 			definitions[prefix +"GEOMETRY_SHADER"] = "1";
 			break;
-		case Anvil::ShaderStage::COMPUTE:
+		case prosper::ShaderStage::Compute:
 			definitions[prefix +"COMPUTE_SHADER"] = "1";
 			break;
 	}
 
-	auto &properties = static_cast<prosper::VlkContext&>(context).GetDevice().get_physical_device_properties();
-	switch(properties.core_vk1_0_properties_ptr->vendor_id)
+	if(vendor.has_value())
 	{
-		case umath::to_integral(prosper::Vendor::AMD):
-			definitions[prefix +"VENDOR_AMD"] = "1";
-			break;
-		case umath::to_integral(prosper::Vendor::Nvidia):
-			definitions[prefix +"VENDOR_NVIDIA"] = "1";
-			break;
-		case umath::to_integral(prosper::Vendor::Intel):
-			definitions[prefix +"VENDOR_INTEL"] = "1";
-			break;
+		switch(*vendor)
+		{
+			case prosper::Vendor::AMD:
+				definitions[prefix +"VENDOR_AMD"] = "1";
+				break;
+			case prosper::Vendor::Nvidia:
+				definitions[prefix +"VENDOR_NVIDIA"] = "1";
+				break;
+			case prosper::Vendor::Intel:
+				definitions[prefix +"VENDOR_INTEL"] = "1";
+				break;
+		}
 	}
 
 	lineId = static_cast<unsigned int>(definitions.size() +1);
@@ -265,63 +610,209 @@ static void glsl_translate_error(const std::string &shaderCode,const std::string
 	}
 }
 
-static bool glsl_to_spv(prosper::IPrContext &context,Anvil::ShaderStage stage,const char *pshader,std::vector<unsigned int> &spirv,std::string *infoLog,std::string *debugInfoLog,const std::string &fileName,bool bHlsl=false)
+// glslang requires a per-process initialization. The initialization is reference-counted, so every thread that compiles shaders holds a reference
+// until it exits; This keeps the built-in symbol tables alive between compilations.
+struct GlslangProcessScope
+{
+	GlslangProcessScope() {glslang::InitializeProcess();}
+	~GlslangProcessScope() {glslang::FinalizeProcess();}
+};
+static void init_glslang_thread()
+{
+	thread_local GlslangProcessScope scope {};
+}
+
+static EShLanguage to_glslang_stage(prosper::ShaderStage stage)
+{
+	switch(stage)
+	{
+		case prosper::ShaderStage::Compute:
+			return EShLangCompute;
+		case prosper::ShaderStage::Fragment:
+			return EShLangFragment;
+		case prosper::ShaderStage::Geometry:
+			return EShLangGeometry;
+		case prosper::ShaderStage::TessellationControl:
+			return EShLangTessControl;
+		case prosper::ShaderStage::TessellationEvaluation:
+			return EShLangTessEvaluation;
+		default:
+			return EShLangVertex;
+	}
+}
+
+// The limits only affect the values of built-in constants (e.g. gl_MaxClipDistances), so we use the same defaults as the glslang reference compiler
+// instead of the limits of a specific device
+static const TBuiltInResource &get_glslang_resources()
+{
+	static const TBuiltInResource resources = []() {
+		TBuiltInResource r {};
+		r.maxLights = 32;
+		r.maxClipPlanes = 6;
+		r.maxTextureUnits = 32;
+		r.maxTextureCoords = 32;
+		r.maxVertexAttribs = 64;
+		r.maxVertexUniformComponents = 4096;
+		r.maxVaryingFloats = 64;
+		r.maxVertexTextureImageUnits = 32;
+		r.maxCombinedTextureImageUnits = 80;
+		r.maxTextureImageUnits = 32;
+		r.maxFragmentUniformComponents = 4096;
+		r.maxDrawBuffers = 32;
+		r.maxVertexUniformVectors = 128;
+		r.maxVaryingVectors = 8;
+		r.maxFragmentUniformVectors = 16;
+		r.maxVertexOutputVectors = 16;
+		r.maxFragmentInputVectors = 15;
+		r.minProgramTexelOffset = -8;
+		r.maxProgramTexelOffset = 7;
+		r.maxClipDistances = 8;
+		r.maxComputeWorkGroupCountX = 65535;
+		r.maxComputeWorkGroupCountY = 65535;
+		r.maxComputeWorkGroupCountZ = 65535;
+		r.maxComputeWorkGroupSizeX = 1024;
+		r.maxComputeWorkGroupSizeY = 1024;
+		r.maxComputeWorkGroupSizeZ = 64;
+		r.maxComputeUniformComponents = 1024;
+		r.maxComputeTextureImageUnits = 16;
+		r.maxComputeImageUniforms = 8;
+		r.maxComputeAtomicCounters = 8;
+		r.maxComputeAtomicCounterBuffers = 1;
+		r.maxVaryingComponents = 60;
+		r.maxVertexOutputComponents = 64;
+		r.maxGeometryInputComponents = 64;
+		r.maxGeometryOutputComponents = 128;
+		r.maxFragmentInputComponents = 128;
+		r.maxImageUnits = 8;
+		r.maxCombinedImageUnitsAndFragmentOutputs = 8;
+		r.maxCombinedShaderOutputResources = 8;
+		r.maxImageSamples = 0;
+		r.maxVertexImageUniforms = 0;
+		r.maxTessControlImageUniforms = 0;
+		r.maxTessEvaluationImageUniforms = 0;
+		r.maxGeometryImageUniforms = 0;
+		r.maxFragmentImageUniforms = 8;
+		r.maxCombinedImageUniforms = 8;
+		r.maxGeometryTextureImageUnits = 16;
+		r.maxGeometryOutputVertices = 256;
+		r.maxGeometryTotalOutputComponents = 1024;
+		r.maxGeometryUniformComponents = 1024;
+		r.maxGeometryVaryingComponents = 64;
+		r.maxTessControlInputComponents = 128;
+		r.maxTessControlOutputComponents = 128;
+		r.maxTessControlTextureImageUnits = 16;
+		r.maxTessControlUniformComponents = 1024;
+		r.maxTessControlTotalOutputComponents = 4096;
+		r.maxTessEvaluationInputComponents = 128;
+		r.maxTessEvaluationOutputComponents = 128;
+		r.maxTessEvaluationTextureImageUnits = 16;
+		r.maxTessEvaluationUniformComponents = 1024;
+		r.maxTessPatchComponents = 120;
+		r.maxPatchVertices = 32;
+		r.maxTessGenLevel = 64;
+		r.maxViewports = 16;
+		r.maxVertexAtomicCounters = 0;
+		r.maxTessControlAtomicCounters = 0;
+		r.maxTessEvaluationAtomicCounters = 0;
+		r.maxGeometryAtomicCounters = 0;
+		r.maxFragmentAtomicCounters = 8;
+		r.maxCombinedAtomicCounters = 8;
+		r.maxAtomicCounterBindings = 1;
+		r.maxVertexAtomicCounterBuffers = 0;
+		r.maxTessControlAtomicCounterBuffers = 0;
+		r.maxTessEvaluationAtomicCounterBuffers = 0;
+		r.maxGeometryAtomicCounterBuffers = 0;
+		r.maxFragmentAtomicCounterBuffers = 1;
+		r.maxCombinedAtomicCounterBuffers = 1;
+		r.maxAtomicCounterBufferSize = 16384;
+		r.maxTransformFeedbackBuffers = 4;
+		r.maxTransformFeedbackInterleavedComponents = 64;
+		r.maxCullDistances = 8;
+		r.maxCombinedClipAndCullDistances = 8;
+		r.maxSamples = 4;
+		r.limits.nonInductiveForLoops = true;
+		r.limits.whileLoops = true;
+		r.limits.doWhileLoops = true;
+		r.limits.generalUniformIndexing = true;
+		r.limits.generalAttributeMatrixVectorIndexing = true;
+		r.limits.generalVaryingIndexing = true;
+		r.limits.generalSamplerIndexing = true;
+		r.limits.generalVariableIndexing = true;
+		r.limits.generalConstantMatrixVectorIndexing = true;
+		return r;
+	}();
+	return resources;
+}
+
+// Compiles the (pre-processed) shader code. On failure, either the shader or the program info log is returned, depending on whether
+// parsing or linking has failed.
+// All sources (including .hls files, which only differ in their pre-processor definitions) are compiled with the GLSL frontend.
+static bool glslang_compile(prosper::ShaderStage stage,const std::string &shaderCode,std::vector<unsigned int> &spirv,std::string &outInfoLog,std::string &outDebugInfoLog)
+{
+	init_glslang_thread();
+	auto lang = to_glslang_stage(stage);
+	auto messages = static_cast<EShMessages>(EShMsgSpvRules | EShMsgVulkanRules);
+	glslang::TShader shader {lang};
+	auto *pShaderCode = shaderCode.c_str();
+	shader.setStrings(&pShaderCode,1);
+	shader.setEnvInput(glslang::EShSourceGlsl,lang,glslang::EShClientVulkan,100);
+	shader.setEnvClient(glslang::EShClientVulkan,glslang::EShTargetVulkan_1_0);
+	shader.setEnvTarget(glslang::EShTargetSpv,glslang::EShTargetSpv_1_0);
+	if(shader.parse(&get_glslang_resources(),110 /* defaultVersion */,false /* forwardCompatible */,messages) == false)
+	{
+		outInfoLog = shader.getInfoLog();
+		outDebugInfoLog = shader.getInfoDebugLog();
+		return false;
+	}
+	glslang::TProgram program {};
+	program.addShader(&shader);
+	if(program.link(messages) == false)
+	{
+		outInfoLog = program.getInfoLog();
+		outDebugInfoLog = program.getInfoDebugLog();
+		return false;
+	}
+	auto *intermediate = program.getIntermediate(lang);
+	if(intermediate == nullptr)
+		return false;
+	spirv.clear();
+	glslang::GlslangToSpv(*intermediate,spirv);
+	return spirv.empty() == false;
+}
+
+static bool glsl_to_spv(prosper::ShaderStage stage,std::optional<prosper::Vendor> vendor,const char *pshader,std::vector<unsigned int> &spirv,std::string *infoLog,std::string *debugInfoLog,const std::string &fileName,bool bHlsl=false)
 {
 	std::string shaderCode{pshader};
 	std::vector<IncludeLine> includeLines;
 	unsigned int lineOffset = 0;
-	if(glsl_preprocessing(context,stage,fileName,shaderCode,infoLog,includeLines,lineOffset,bHlsl) == false)
+	if(glsl_preprocessing(stage,vendor,fileName,shaderCode,infoLog,includeLines,lineOffset,bHlsl) == false)
 	{
 		if(infoLog != nullptr)
 			*infoLog = std::string("Module: \"") +fileName +"\"\n" +(*infoLog);
 		return false;
 	}
-	auto &dev = static_cast<prosper::VlkContext&>(context).GetDevice();
-	auto shaderPtr = Anvil::GLSLShaderToSPIRVGenerator::create(
-		&dev,
-		Anvil::GLSLShaderToSPIRVGenerator::MODE_USE_SPECIFIED_SOURCE,
-		shaderCode,
-		stage
-	);
-	if(shaderPtr == nullptr)
-		return false;
-	if(shaderPtr->get_spirv_blob_size() == 0u)
+	std::string compileInfoLog;
+	std::string compileDebugInfoLog;
+	if(glslang_compile(stage,shaderCode,spirv,compileInfoLog,compileDebugInfoLog) == false)
 	{
-		auto &shaderInfoLog = shaderPtr->get_shader_info_log();
-		if(shaderInfoLog.empty() == false)
+		if(compileInfoLog.empty() == false)
 		{
 			if(infoLog != nullptr)
 			{
-				glsl_translate_error(shaderCode,shaderInfoLog,fileName,includeLines,CUInt32(lineOffset),infoLog);
+				glsl_translate_error(shaderCode,compileInfoLog,fileName,includeLines,CUInt32(lineOffset),infoLog);
 				*infoLog = std::string("Shader File: \"") +fileName +"\"\n" +(*infoLog);
 			}
 			if(debugInfoLog != nullptr)
-				*debugInfoLog = shaderPtr->get_debug_info_log();
-		}
-		else
-		{
-			auto &programInfoLog = shaderPtr->get_program_info_log();
-			if(programInfoLog.empty() == false)
-			{
-				if(infoLog != nullptr)
-				{
-					glsl_translate_error(shaderCode,programInfoLog,fileName,includeLines,CUInt32(lineOffset),infoLog);
-					*infoLog = std::string("Shader File: \"") +fileName +"\"\n" +(*infoLog);
-				}
-				if(debugInfoLog != nullptr)
-					*debugInfoLog = shaderPtr->get_program_debug_info_log();
-			}
-			else if(infoLog != nullptr)
-				*infoLog = "An unknown error has occurred!";
+				*debugInfoLog = compileDebugInfoLog;
 		}
+		else if(infoLog != nullptr)
+			*infoLog = "An unknown error has occurred!";
 		return false;
 	}
-	auto shaderMod = Anvil::ShaderModule::create_from_spirv_generator(&dev,shaderPtr.get());
-	spirv = shaderMod->get_spirv_blob();
 	return true;
 }
 
-void prosper::dump_parsed_shader(IPrContext &context,uint32_t stage,const std::string &shaderFile,const std::string &fileName)
+void prosper::dump_parsed_shader(ShaderStage stage,const std::string &shaderFile,const std::string &fileName,std::optional<Vendor> vendor)
 {
 	auto f = FileManager::OpenFile(shaderFile.c_str(),"r");
 	if(f == nullptr)
@@ -329,20 +820,101 @@ void prosper::dump_parsed_shader(IPrContext &context,uint32_t stage,const std::s
 	auto shaderCode = f->ReadString();
 	std::vector<IncludeLine> includeLines;
 	unsigned int lineOffset = 0;
-	if(glsl_preprocessing(context,static_cast<Anvil::ShaderStage>(stage),fileName,shaderCode,nullptr,includeLines,lineOffset) == false)
+	if(glsl_preprocessing(stage,vendor,fileName,shaderCode,nullptr,includeLines,lineOffset) == false)
 		return;
 	auto fOut = FileManager::OpenFile<VFilePtrReal>(fileName.c_str(),"w");
 	if(fOut == nullptr)
 		return;
 	fOut->WriteString(shaderCode);
 }
+void prosper::dump_parsed_shader(IPrContext &context,uint32_t stage,const std::string &shaderFile,const std::string &fileName)
+{
+	dump_parsed_shader(static_cast<ShaderStage>(stage),shaderFile,fileName,context.GetPhysicalDeviceVendor());
+}
+
+static bool find_shader_source_file(const std::string &fileName,std::string &outFileName,std::string &outExt)
+{
+	auto fNameGls = fileName +".gls";
+	if(FileManager::Exists(fNameGls))
+	{
+		outFileName = fNameGls;
+		outExt = "gls";
+		return true;
+	}
+	auto fNameHls = fileName +".hls";
+	if(FileManager::Exists(fNameHls))
+	{
+		outFileName = fNameHls;
+		outExt = "hls";
+		return true;
+	}
+	return false;
+}
+
+bool prosper::glsl_to_spv(ShaderStage stage,const std::string &fileName,std::vector<unsigned int> &spirv,std::string *infoLog,std::string *debugInfoLog,std::optional<Vendor> vendor,bool bReload)
+{
+	auto fName = fileName;
+	std::string ext;
+	if(!ufile::get_extension(fileName,&ext) && find_shader_source_file(fileName,fName,ext) == false)
+	{
+		if(infoLog != nullptr)
+			*infoLog = std::string("File '") +fileName +std::string(".gls' not found!");
+		return false;
+	}
+	ustring::to_lower(ext);
+	if(ext != "gls" && ext != "hls")
+	{
+		if(infoLog != nullptr)
+			*infoLog = std::string("File '") +fName +std::string("' is not a GLSL or HLSL shader!");
+		return false;
+	}
+	auto f = FileManager::OpenFile(fName.c_str(),"r");
+	if(f == nullptr)
+	{
+		if(infoLog != nullptr)
+			*infoLog = std::string("Unable to open file '") +fName +std::string("'!");
+		return false;
+	}
+	auto content = f->ReadString();
+	if(bReload)
+		invalidate_glsl_includes(fName);
+	return ::glsl_to_spv(stage,vendor,content.c_str(),spirv,infoLog,debugInfoLog,fName,(ext == "hls") ? true : false);
+}
 
 bool prosper::glsl_to_spv(IPrContext &context,uint32_t stage,const std::string &fileName,std::vector<unsigned int> &spirv,std::string *infoLog,std::string *debugInfoLog,bool bReload)
 {
 	auto fName = fileName;
 	std::string ext;
+	std::optional<std::string> archiveEntryName {};
+	// The entry data is only valid while the archive is locked, so it's copied within the reader
+	auto fReadSpirv = [&spirv](const void *data,uint64_t size) -> bool {
+		if((size %sizeof(unsigned int)) != 0)
+			return false;
+		auto origSize = spirv.size();
+		spirv.resize(origSize +size /sizeof(unsigned int));
+		std::memcpy(spirv.data() +origSize,data,size);
+		return true;
+	};
 	if(!ufile::get_extension(fileName,&ext))
 	{
+		// Precompiled shaders take precedence over everything else, unless the shader is explicitly reloaded from its source
+		auto *shaderArchive = context.GetShaderArchive();
+		if(shaderArchive && bReload == false)
+		{
+			if(
+				shaderArchive->Read(get_shader_archive_entry_name(fileName,context.GetPhysicalDeviceVendor()),fReadSpirv) ||
+				shaderArchive->Read(get_shader_archive_entry_name(fileName),fReadSpirv)
+			)
+				return true;
+		}
+		auto *archive = context.GetCacheArchive();
+		if(archive)
+		{
+			archiveEntryName = get_shader_archive_entry_name(fileName);
+			if(bReload == false && archive->Read(*archiveEntryName,fReadSpirv))
+				return true;
+		}
+		// Loose SPIR-V files are only supported for backwards compatibility
 		auto fNameSpv = "cache/" +fileName +".spv";
 		auto bSpvExists = FileManager::Exists(fNameSpv);
 		if(bSpvExists == true)
@@ -388,26 +960,112 @@ bool prosper::glsl_to_spv(IPrContext &context,uint32_t stage,const std::string &
 		auto origSize = spirv.size();
 		spirv.resize(origSize +sz /sizeof(unsigned int));
 		f->Read(spirv.data() +origSize,sz);
+		// Migrate the file into the cache archive
+		if(archiveEntryName.has_value())
+			context.GetCacheArchive()->Store(*archiveEntryName,spirv.data() +origSize,sz);
 		return true;
 	}
-	auto f = FileManager::OpenFile(fName.c_str(),"r");
-	if(f == nullptr)
-	{
-		if(infoLog != nullptr)
-			*infoLog = std::string("Unable to open file '") +fName +std::string("'!");
-		return false;
-	}
-	auto content = f->ReadString();
-	auto r = ::glsl_to_spv(context,static_cast<Anvil::ShaderStage>(stage),content.c_str(),spirv,infoLog,debugInfoLog,fName,(ext == "hls") ? true : false);
+	// The compilation itself doesn't depend on the device
+	auto r = glsl_to_spv(static_cast<ShaderStage>(stage),fName,spirv,infoLog,debugInfoLog,context.GetPhysicalDeviceVendor(),bReload);
 	if(r == false)
 		return r;
-	auto spirvName = "cache/" +fName.substr(0,fName.length() -ext.length()) +"spv";
-	FileManager::CreatePath(ufile::get_path_from_filename(spirvName).c_str());
-	auto fOut = FileManager::OpenFile<VFilePtrReal>(spirvName.c_str(),"wb");
-	if(fOut == nullptr)
-		return r;
-	fOut->Write(spirv.data(),spirv.size() *sizeof(unsigned int));
+	// Written to disk with the next call to IPrContext::SavePipelineCache
+	if(archiveEntryName.has_value())
+		context.GetCacheArchive()->Store(*archiveEntryName,spirv.data(),spirv.size() *sizeof(unsigned int));
 	return r;
 }
 
+static const std::string SHADER_ARCHIVE_VERSION_ENTRY = "__shader_archive_version";
+static const std::array<prosper::Vendor,3> SHADER_ARCHIVE_VENDORS = {prosper::Vendor::AMD,prosper::Vendor::Nvidia,prosper::Vendor::Intel};
+std::string prosper::get_shader_archive_entry_name(const std::string &fileName,std::optional<Vendor> vendor)
+{
+	auto name = FileManager::GetCanonicalizedPath(fileName);
+	ustring::to_lower(name);
+	if(vendor.has_value())
+		name += '.' +std::to_string(umath::to_integral(*vendor));
+	return name +".spv";
+}
+void prosper::write_shader_archive_version(CacheArchive &archive)
+{
+	auto version = SHADER_ARCHIVE_VERSION;
+	archive.Store(SHADER_ARCHIVE_VERSION_ENTRY,&version,sizeof(version));
+}
+bool prosper::is_shader_archive_compatible(const CacheArchive &archive)
+{
+	uint32_t version;
+	auto found = archive.Read(SHADER_ARCHIVE_VERSION_ENTRY,[&version](const void *data,uint64_t size) -> bool {
+		if(size != sizeof(version))
+			return false;
+		std::memcpy(&version,data,sizeof(version));
+		return true;
+	});
+	return found && version == SHADER_ARCHIVE_VERSION;
+}
+bool prosper::precompile_shader(CacheArchive &archive,ShaderStage stage,const std::string &fileName,std::string *infoLog)
+{
+	std::vector<unsigned int> spirv {};
+	if(glsl_to_spv(stage,fileName,spirv,infoLog,nullptr) == false)
+		return false;
+	for(auto vendor : SHADER_ARCHIVE_VENDORS)
+	{
+		std::vector<unsigned int> vendorSpirv {};
+		if(glsl_to_spv(stage,fileName,vendorSpirv,infoLog,nullptr,vendor) == false)
+			return false;
+		if(vendorSpirv != spirv)
+			archive.Store(get_shader_archive_entry_name(fileName,vendor),vendorSpirv.data(),vendorSpirv.size() *sizeof(unsigned int));
+	}
+	archive.Store(get_shader_archive_entry_name(fileName),spirv.data(),spirv.size() *sizeof(unsigned int));
+	return true;
+}
+
+// Same names as used by glslangValidator
+static const std::array<std::string,umath::to_integral(prosper::ShaderStage::Count)> SHADER_STAGE_NAMES = {"comp","frag","geom","tesc","tese","vert"};
+bool prosper::write_shader_manifest(const ShaderManager &shaderManager,const std::string &fileName)
+{
+	std::stringstream ss;
+	for(auto &pair : shaderManager.GetShaders())
+	{
+		if(pair.second == nullptr)
+			continue;
+		for(auto i=decltype(SHADER_STAGE_NAMES.size()){0u};i<SHADER_STAGE_NAMES.size();++i)
+		{
+			auto *stage = pair.second->GetStage(static_cast<ShaderStage>(i));
+			if(stage == nullptr || stage->path.empty())
+				continue;
+			ss<<SHADER_STAGE_NAMES.at(i)<<" "<<stage->path<<"\n";
+		}
+	}
+	auto f = FileManager::OpenFile<VFilePtrReal>(fileName.c_str(),"w");
+	if(f == nullptr)
+		return false;
+	f->WriteString(ss.str());
+	return true;
+}
+bool prosper::read_shader_manifest(const std::string &fileName,std::vector<ShaderManifestEntry> &outEntries)
+{
+	auto f = FileManager::OpenFile(fileName.c_str(),"r");
+	if(f == nullptr)
+		return false;
+	std::vector<std::string> lines;
+	ustring::explode(f->ReadString(),"\n",lines);
+	std::unordered_set<std::string> added {};
+	for(auto &line : lines)
+	{
+		ustring::remove_whitespace(line);
+		auto sep = line.find_first_of(" \t");
+		if(line.empty() || sep == std::string::npos)
+			continue;
+		auto it = std::find(SHADER_STAGE_NAMES.begin(),SHADER_STAGE_NAMES.end(),line.substr(0,sep));
+		if(it == SHADER_STAGE_NAMES.end())
+			continue;
+		auto path = line.substr(sep +1);
+		ustring::remove_whitespace(path);
+		// Stages may be shared between shaders
+		if(path.empty() || added.insert(*it +' ' +path).second == false)
+			continue;
+		outEntries.push_back({static_cast<ShaderStage>(it -SHADER_STAGE_NAMES.begin()),path});
+	}
+	return true;
+}
+
 #endif
@@ -0,0 +1,236 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "stdafx_prosper.h"
+#include "prosper_indirect_draw_batcher.hpp"
+#include "prosper_context.hpp"
+#include "prosper_command_buffer.hpp"
+#include "prosper_util.hpp"
+#include "buffers/prosper_buffer.hpp"
+#include "shader/prosper_shader.hpp"
+#include <algorithm>
+
+using namespace prosper;
+
+static void hash_combine(size_t &seed,size_t value) {seed ^= value +0x9e3779b9 +(seed<<6) +(seed>>2);}
+static size_t get_draw_state_hash(const IndirectDrawBatcher::DrawState &state)
+{
+	size_t hash = 0;
+	hash_combine(hash,std::hash<const void*>{}(state.shader));
+	hash_combine(hash,state.pipelineIdx);
+	hash_combine(hash,state.firstSet);
+	for(auto *ds : state.descriptorSets)
+		hash_combine(hash,std::hash<const void*>{}(ds));
+	for(auto *buf : state.vertexBuffers)
+		hash_combine(hash,std::hash<const void*>{}(buf));
+	hash_combine(hash,std::hash<const void*>{}(state.indexBuffer));
+	hash_combine(hash,static_cast<size_t>(state.indexType));
+	return hash;
+}
+
+bool IndirectDrawBatcher::DrawState::operator==(const DrawState &other) const
+{
+	return shader == other.shader && pipelineIdx == other.pipelineIdx && firstSet == other.firstSet &&
+		descriptorSets == other.descriptorSets && vertexBuffers == other.vertexBuffers &&
+		indexBuffer == other.indexBuffer && indexType == other.indexType;
+}
+bool IndirectDrawBatcher::DrawState::operator!=(const DrawState &other) const {return !operator==(other);}
+
+std::shared_ptr<IndirectDrawBatcher> IndirectDrawBatcher::Create(IPrContext &context,uint32_t maxDrawCount,bool useCountBuffer)
+{
+	if(maxDrawCount == 0 || (useCountBuffer && util::is_draw_indirect_count_supported(context) == false))
+		return nullptr;
+	// Batches are recorded with a single draw call if a count buffer is used, so no batch may exceed the device limit
+	if(useCountBuffer)
+		maxDrawCount = std::min(maxDrawCount,std::max(util::get_physical_device_limits(context).maxDrawIndirectCount,1u));
+	util::BufferCreateInfo createInfo {};
+	createInfo.size = maxDrawCount *sizeof(util::DrawIndexedIndirectCommand);
+	createInfo.usageFlags = BufferUsageFlags::IndirectBufferBit | BufferUsageFlags::StorageBufferBit | BufferUsageFlags::TransferDstBit;
+	createInfo.memoryFeatures = MemoryFeatureFlags::DeviceLocal;
+	auto indirectBuffer = context.CreateBuffer(createInfo);
+	if(indirectBuffer == nullptr)
+		return nullptr;
+	indirectBuffer->SetDebugName("indirect_draw_batcher_cmd_buf");
+
+	std::shared_ptr<IBuffer> countBuffer = nullptr;
+	if(useCountBuffer)
+	{
+		// The number of batches is limited to the number of draws (see GetBatch)
+		createInfo.size = maxDrawCount *sizeof(uint32_t);
+		countBuffer = context.CreateBuffer(createInfo);
+		if(countBuffer == nullptr)
+			return nullptr;
+		countBuffer->SetDebugName("indirect_draw_batcher_count_buf");
+	}
+	return std::shared_ptr<IndirectDrawBatcher>{new IndirectDrawBatcher{context,indirectBuffer,countBuffer,maxDrawCount}};
+}
+
+IndirectDrawBatcher::IndirectDrawBatcher(IPrContext &context,const std::shared_ptr<IBuffer> &indirectBuffer,const std::shared_ptr<IBuffer> &countBuffer,uint32_t maxDrawCount)
+	: m_context{context},m_indirectBuffer{indirectBuffer},m_countBuffer{countBuffer},m_maxDrawCount{maxDrawCount},
+	m_maxDrawIndirectCount{std::max(util::get_physical_device_limits(context).maxDrawIndirectCount,1u)}
+{}
+
+IndirectDrawBatcher::BatchId IndirectDrawBatcher::GetBatch(const DrawState &state)
+{
+	auto hash = get_draw_state_hash(state);
+	auto range = m_stateToBatch.equal_range(hash);
+	for(auto it=range.first;it!=range.second;++it)
+	{
+		if(m_batches.at(it->second).state == state)
+			return it->second;
+	}
+	// The count buffer has room for one count per draw, so there can't be more batches than that
+	if(state.shader == nullptr || m_batches.size() >= m_maxDrawCount)
+		return INVALID_BATCH;
+	auto batchId = static_cast<BatchId>(m_batches.size());
+	m_batches.push_back({});
+	m_batches.back().state = state;
+	m_stateToBatch.insert(std::make_pair(hash,batchId));
+	m_uploaded = false;
+	return batchId;
+}
+
+bool IndirectDrawBatcher::AddDrawIndexed(BatchId batchId,const util::DrawIndexedIndirectCommand &cmd)
+{
+	if(batchId >= m_batches.size() || m_drawCount >= m_maxDrawCount)
+		return false;
+	m_batches.at(batchId).commands.push_back(cmd);
+	++m_drawCount;
+	m_uploaded = false;
+	return true;
+}
+bool IndirectDrawBatcher::AddDrawIndexed(BatchId batchId,uint32_t indexCount,uint32_t instanceCount,uint32_t firstIndex,int32_t vertexOffset,uint32_t firstInstance)
+{
+	return AddDrawIndexed(batchId,util::DrawIndexedIndirectCommand{indexCount,instanceCount,firstIndex,vertexOffset,firstInstance});
+}
+
+bool IndirectDrawBatcher::RecordUpload(ICommandBuffer &cmd,PipelineStageFlags dstStageMask,AccessFlags dstAccessMask)
+{
+	m_sortedBatches.clear();
+	m_sortedBatches.reserve(m_batches.size());
+	for(auto i=decltype(m_batches.size()){0u};i<m_batches.size();++i)
+	{
+		if(m_batches.at(i).commands.empty() == false)
+			m_sortedBatches.push_back(i);
+	}
+	std::stable_sort(m_sortedBatches.begin(),m_sortedBatches.end(),[this](BatchId a,BatchId b) {
+		auto &stateA = m_batches.at(a).state;
+		auto &stateB = m_batches.at(b).state;
+		if(stateA.shader != stateB.shader)
+			return stateA.shader < stateB.shader;
+		return stateA.pipelineIdx < stateB.pipelineIdx;
+	});
+
+	m_uploadData.clear();
+	m_uploadData.reserve(m_drawCount);
+	std::vector<uint32_t> counts {};
+	counts.reserve(m_batches.size());
+	for(auto batchId : m_sortedBatches)
+	{
+		auto &batch = m_batches.at(batchId);
+		batch.firstCommand = m_uploadData.size();
+		m_uploadData.insert(m_uploadData.end(),batch.commands.begin(),batch.commands.end());
+	}
+	if(m_countBuffer)
+	{
+		counts.resize(m_batches.size(),0u);
+		for(auto batchId=decltype(m_batches.size()){0u};batchId<m_batches.size();++batchId)
+			counts.at(batchId) = m_batches.at(batchId).commands.size();
+	}
+	m_uploaded = true;
+	if(m_uploadData.empty())
+		return true;
+
+	// Previous frames (or a culling pass) may still be reading from or writing to the buffers
+	auto srcStageMask = PipelineStageFlags::DrawIndirectBit | PipelineStageFlags::ComputeShaderBit;
+	auto srcAccessMask = AccessFlags::IndirectCommandReadBit | AccessFlags::ShaderWriteBit;
+	auto fUpdateBuffer = [this,&cmd,srcStageMask,srcAccessMask,dstStageMask,dstAccessMask](IBuffer &buf,const void *data,DeviceSize size) -> bool {
+		// The data is written to a host-visible staging buffer and copied with a single command
+		auto stagingBuffer = m_context.AllocateTemporaryBuffer(size,0u,data);
+		if(stagingBuffer == nullptr)
+			return false;
+		if(cmd.RecordBufferBarrier(buf,srcStageMask,PipelineStageFlags::TransferBit,srcAccessMask,AccessFlags::TransferWriteBit,0ull,size) == false)
+			return false;
+		util::BufferCopy copyInfo {};
+		copyInfo.size = size;
+		copyInfo.srcOffset = 0ull;
+		copyInfo.dstOffset = 0ull;
+		if(cmd.RecordCopyBuffer(copyInfo,*stagingBuffer,buf) == false)
+			return false;
+		m_context.KeepResourceAliveUntilPresentationComplete(stagingBuffer);
+		return cmd.RecordBufferBarrier(buf,PipelineStageFlags::TransferBit,dstStageMask,AccessFlags::TransferWriteBit,dstAccessMask,0ull,size);
+	};
+	if(fUpdateBuffer(*m_indirectBuffer,m_uploadData.data(),m_uploadData.size() *sizeof(m_uploadData.front())) == false)
+		return false;
+	return m_countBuffer == nullptr || fUpdateBuffer(*m_countBuffer,counts.data(),counts.size() *sizeof(counts.front()));
+}
+
+bool IndirectDrawBatcher::RecordDraws(const std::shared_ptr<IPrimaryCommandBuffer> &cmd)
+{
+	if(m_uploaded == false)
+		return false;
+	ShaderGraphics *curShader = nullptr;
+	auto curPipelineIdx = std::numeric_limits<uint32_t>::max();
+	auto success = true;
+	for(auto batchId : m_sortedBatches)
+	{
+		auto &batch = m_batches.at(batchId);
+		auto &state = batch.state;
+		if(state.shader != curShader || state.pipelineIdx != curPipelineIdx)
+		{
+			if(curShader)
+				curShader->EndDraw();
+			curShader = nullptr;
+			if(state.shader->BeginDraw(cmd,state.pipelineIdx) == false)
+			{
+				success = false;
+				continue;
+			}
+			curShader = state.shader;
+			curPipelineIdx = state.pipelineIdx;
+		}
+		auto &shader = *curShader;
+		if(
+			(state.descriptorSets.empty() == false && shader.RecordBindDescriptorSets(state.descriptorSets,state.firstSet) == false) ||
+			(state.vertexBuffers.empty() == false && shader.RecordBindVertexBuffers(state.vertexBuffers) == false) ||
+			(state.indexBuffer && shader.RecordBindIndexBuffer(*state.indexBuffer,state.indexType) == false)
+		)
+		{
+			success = false;
+			continue;
+		}
+		auto numCommands = static_cast<uint32_t>(batch.commands.size());
+		auto offset = GetCommandBufferOffset(batchId);
+		constexpr auto stride = static_cast<uint32_t>(sizeof(util::DrawIndexedIndirectCommand));
+		if(m_countBuffer)
+		{
+			success = shader.RecordDrawIndexedIndirectCount(*m_indirectBuffer,offset,*m_countBuffer,GetCountBufferOffset(batchId),numCommands,stride) && success;
+			continue;
+		}
+		// Without multi-draw-indirect support the batch has to be split up
+		for(auto i=0u;i<numCommands;i+=m_maxDrawIndirectCount)
+			success = shader.RecordDrawIndexedIndirect(*m_indirectBuffer,offset +i *stride,std::min(numCommands -i,m_maxDrawIndirectCount),stride) && success;
+	}
+	if(curShader)
+		curShader->EndDraw();
+	return success;
+}
+
+void IndirectDrawBatcher::Clear()
+{
+	m_batches.clear();
+	m_sortedBatches.clear();
+	m_stateToBatch.clear();
+	m_drawCount = 0u;
+	m_uploaded = false;
+}
+
+IBuffer &IndirectDrawBatcher::GetIndirectBuffer() const {return *m_indirectBuffer;}
+IBuffer *IndirectDrawBatcher::GetCountBuffer() const {return m_countBuffer.get();}
+DeviceSize IndirectDrawBatcher::GetCommandBufferOffset(BatchId batchId) const {return m_batches.at(batchId).firstCommand *sizeof(util::DrawIndexedIndirectCommand);}
+DeviceSize IndirectDrawBatcher::GetCountBufferOffset(BatchId batchId) const {return batchId *sizeof(uint32_t);}
+uint32_t IndirectDrawBatcher::GetDrawCount(BatchId batchId) const {return m_batches.at(batchId).commands.size();}
+uint32_t IndirectDrawBatcher::GetBatchCount() const {return m_batches.size();}
+uint32_t IndirectDrawBatcher::GetTotalDrawCount() const {return m_drawCount;}
+uint32_t IndirectDrawBatcher::GetMaxDrawCount() const {return m_maxDrawCount;}
@@ -0,0 +1,232 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "stdafx_prosper.h"
+#include "prosper_memory_budget_tracker.hpp"
+#include "prosper_memory_tracker.hpp"
+#include "prosper_context.hpp"
+#include "prosper_util.hpp"
+#include "vk_context.hpp"
+#include <wrappers/device.h>
+#include <wrappers/instance.h>
+#include <wrappers/physical_device.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace prosper;
+
+static const char *MEMORY_BUDGET_EXTENSION_NAME = "VK_EXT_memory_budget";
+static bool is_memory_budget_extension_supported(VkPhysicalDevice physDev)
+{
+	uint32_t extCount = 0u;
+	if(vkEnumerateDeviceExtensionProperties(physDev,nullptr,&extCount,nullptr) != VK_SUCCESS)
+		return false;
+	std::vector<VkExtensionProperties> extensions(extCount);
+	if(vkEnumerateDeviceExtensionProperties(physDev,nullptr,&extCount,extensions.data()) != VK_SUCCESS)
+		return false;
+	return std::find_if(extensions.begin(),extensions.end(),[](const VkExtensionProperties &props) {
+		return std::strcmp(props.extensionName,MEMORY_BUDGET_EXTENSION_NAME) == 0;
+	}) != extensions.end();
+}
+static PFN_vkGetPhysicalDeviceMemoryProperties2 get_memory_properties2_function(VkInstance instance)
+{
+	auto *f = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2>(vkGetInstanceProcAddr(instance,"vkGetPhysicalDeviceMemoryProperties2"));
+	if(f == nullptr)
+		f = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2>(vkGetInstanceProcAddr(instance,"vkGetPhysicalDeviceMemoryProperties2KHR"));
+	return f;
+}
+
+std::unique_ptr<MemoryBudgetTracker> MemoryBudgetTracker::Create(IPrContext &context)
+{
+	auto &vlkContext = static_cast<VlkContext&>(context);
+	auto *physDev = vlkContext.GetDevice().get_physical_device()->get_physical_device();
+	// The extension is enabled on device creation if it's available
+	auto driverBudgetAvailable = is_memory_budget_extension_supported(physDev) && get_memory_properties2_function(vlkContext.GetAnvilInstance().get_instance_vk()) != nullptr;
+	auto tracker = std::unique_ptr<MemoryBudgetTracker>{new MemoryBudgetTracker{context,driverBudgetAvailable}};
+	tracker->QueryBudgets();
+	return tracker;
+}
+
+MemoryBudgetTracker::MemoryBudgetTracker(IPrContext &context,bool driverBudgetAvailable)
+	: m_context{context},m_driverBudgetAvailable{driverBudgetAvailable}
+{}
+
+void MemoryBudgetTracker::SetUpdateInterval(uint32_t frameInterval) {m_updateInterval = std::max(frameInterval,1u);}
+uint32_t MemoryBudgetTracker::GetUpdateInterval() const {return m_updateInterval;}
+void MemoryBudgetTracker::SetThresholds(float targetThreshold,float evictionThreshold,float criticalThreshold)
+{
+	m_targetThreshold = targetThreshold;
+	m_evictionThreshold = std::max(evictionThreshold,targetThreshold);
+	m_criticalThreshold = std::max(criticalThreshold,m_evictionThreshold);
+}
+
+MemoryBudgetTracker::CallbackId MemoryBudgetTracker::AddEvictionCallback(int32_t priority,const EvictionCallback &callback)
+{
+	auto id = m_nextCallbackId++;
+	// Callbacks with the same priority are invoked in the order they were added
+	auto it = std::upper_bound(m_evictionCallbacks.begin(),m_evictionCallbacks.end(),priority,[](int32_t priority,const EvictionCallbackInfo &info) {
+		return priority < info.priority;
+	});
+	m_evictionCallbacks.insert(it,{id,priority,callback});
+	return id;
+}
+void MemoryBudgetTracker::RemoveEvictionCallback(CallbackId id)
+{
+	auto it = std::find_if(m_evictionCallbacks.begin(),m_evictionCallbacks.end(),[id](const EvictionCallbackInfo &info) {return info.id == id;});
+	if(it != m_evictionCallbacks.end())
+		m_evictionCallbacks.erase(it);
+}
+MemoryBudgetTracker::CallbackId MemoryBudgetTracker::AddUpdateCallback(const UpdateCallback &callback)
+{
+	auto id = m_nextCallbackId++;
+	m_updateCallbacks.push_back({id,callback});
+	return id;
+}
+void MemoryBudgetTracker::RemoveUpdateCallback(CallbackId id)
+{
+	auto it = std::find_if(m_updateCallbacks.begin(),m_updateCallbacks.end(),[id](const std::pair<CallbackId,UpdateCallback> &pair) {return pair.first == id;});
+	if(it != m_updateCallbacks.end())
+		m_updateCallbacks.erase(it);
+}
+
+void MemoryBudgetTracker::QueryBudgets()
+{
+	auto &vlkContext = static_cast<VlkContext&>(m_context);
+	auto &dev = vlkContext.GetDevice();
+	auto &memProps = dev.get_physical_device_memory_properties();
+	m_heapBudgets.resize(memProps.n_heaps);
+	for(auto i=decltype(memProps.n_heaps){0u};i<memProps.n_heaps;++i)
+	{
+		auto &heap = memProps.heaps[i];
+		auto &heapBudget = m_heapBudgets.at(i);
+		heapBudget.size = heap.size;
+		heapBudget.budget = heap.size;
+		heapBudget.trackedUsage = 0ull;
+		heapBudget.deviceLocal = (heap.flags &Anvil::MemoryHeapFlagBits::DEVICE_LOCAL_BIT) != Anvil::MemoryHeapFlagBits::NONE;
+	}
+
+	// Local counters
+	auto &memTracker = MemoryTracker::GetInstance();
+	for(auto i=decltype(memProps.types.size()){0u};i<memProps.types.size();++i)
+	{
+		auto &type = memProps.types.at(i);
+		if(type.heap_ptr == nullptr || type.heap_ptr->index >= m_heapBudgets.size())
+			continue;
+		uint64_t allocatedSize = 0ull;
+		uint64_t totalSize = 0ull;
+		if(memTracker.GetMemoryStats(m_context,i,allocatedSize,totalSize))
+			m_heapBudgets.at(type.heap_ptr->index).trackedUsage += allocatedSize;
+	}
+	for(auto &heapBudget : m_heapBudgets)
+		heapBudget.usage = heapBudget.trackedUsage;
+
+	if(m_driverBudgetAvailable == false)
+		return;
+	auto fGetMemoryProperties2 = get_memory_properties2_function(vlkContext.GetAnvilInstance().get_instance_vk());
+	if(fGetMemoryProperties2 == nullptr)
+		return;
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps {};
+	budgetProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	VkPhysicalDeviceMemoryProperties2 memProps2 {};
+	memProps2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+	memProps2.pNext = &budgetProps;
+	fGetMemoryProperties2(dev.get_physical_device()->get_physical_device(),&memProps2);
+	auto numHeaps = std::min<uint32_t>(m_heapBudgets.size(),VK_MAX_MEMORY_HEAPS);
+	for(auto i=decltype(numHeaps){0u};i<numHeaps;++i)
+	{
+		auto &heapBudget = m_heapBudgets.at(i);
+		// Some drivers report a budget of 0 for heaps they don't manage
+		if(budgetProps.heapBudget[i] > 0ull)
+			heapBudget.budget = budgetProps.heapBudget[i];
+		// The driver usage includes memory which isn't allocated through prosper (e.g. swapchain images, driver-internal allocations)
+		heapBudget.usage = std::max<DeviceSize>(budgetProps.heapUsage[i],heapBudget.trackedUsage);
+	}
+}
+
+void MemoryBudgetTracker::OnFrame()
+{
+	if(++m_framesSinceUpdate < m_updateInterval)
+		return;
+	Update();
+}
+
+void MemoryBudgetTracker::Update()
+{
+	m_framesSinceUpdate = 0u;
+	QueryBudgets();
+	for(auto i=decltype(m_heapBudgets.size()){0u};i<m_heapBudgets.size();++i)
+	{
+		auto &heapBudget = m_heapBudgets.at(i);
+		if(heapBudget.usage <= heapBudget.budget *m_evictionThreshold)
+			continue;
+		auto target = static_cast<DeviceSize>(heapBudget.budget *m_targetThreshold);
+		Evict(i,heapBudget.usage -target);
+	}
+	// Callbacks may remove themselves
+	auto updateCallbacks = m_updateCallbacks;
+	for(auto &pair : updateCallbacks)
+		pair.second(*this);
+}
+
+DeviceSize MemoryBudgetTracker::Evict(uint32_t heapIndex,DeviceSize size)
+{
+	if(m_evicting)
+		return 0ull; // An eviction callback has triggered an allocation
+	m_evicting = true;
+	DeviceSize released = 0ull;
+	auto evictionCallbacks = m_evictionCallbacks;
+	for(auto &info : evictionCallbacks)
+	{
+		if(released >= size)
+			break;
+		released += info.callback(heapIndex,size -released);
+	}
+	m_evicting = false;
+
+	// Released memory won't be reflected in the driver usage until the next query, so we account for it locally
+	auto &heapBudget = m_heapBudgets.at(heapIndex);
+	heapBudget.usage -= std::min(released,heapBudget.usage);
+	return released;
+}
+
+bool MemoryBudgetTracker::RequestMemory(uint32_t heapIndex,DeviceSize size)
+{
+	if(heapIndex >= m_heapBudgets.size())
+		return false;
+	QueryBudgets();
+	auto &heapBudget = m_heapBudgets.at(heapIndex);
+	if(heapBudget.usage +size > heapBudget.budget *m_evictionThreshold)
+	{
+		auto target = static_cast<DeviceSize>(heapBudget.budget *m_targetThreshold);
+		auto required = heapBudget.usage +size;
+		if(required > target)
+			Evict(heapIndex,required -target);
+	}
+	return heapBudget.usage +size <= heapBudget.budget;
+}
+
+bool MemoryBudgetTracker::IsDriverBudgetAvailable() const {return m_driverBudgetAvailable;}
+const std::vector<MemoryBudgetTracker::HeapBudget> &MemoryBudgetTracker::GetHeapBudgets() const {return m_heapBudgets;}
+const MemoryBudgetTracker::HeapBudget *MemoryBudgetTracker::GetHeapBudget(uint32_t heapIndex) const
+{
+	return (heapIndex < m_heapBudgets.size()) ? &m_heapBudgets.at(heapIndex) : nullptr;
+}
+std::optional<uint32_t> MemoryBudgetTracker::FindHeapIndex(MemoryFeatureFlags featureFlags) const
+{
+	auto r = util::find_compatible_memory_type(static_cast<VlkContext&>(m_context).GetDevice(),featureFlags);
+	if(r.first == nullptr || r.first->heap_ptr == nullptr)
+		return {};
+	return r.first->heap_ptr->index;
+}
+MemoryBudgetTracker::Pressure MemoryBudgetTracker::GetPressure(uint32_t heapIndex) const
+{
+	auto *heapBudget = GetHeapBudget(heapIndex);
+	if(heapBudget == nullptr)
+		return Pressure::None;
+	if(heapBudget->usage > heapBudget->budget *m_criticalThreshold)
+		return Pressure::Critical;
+	if(heapBudget->usage > heapBudget->budget *m_evictionThreshold)
+		return Pressure::High;
+	return Pressure::None;
+}
@@ -7,6 +7,7 @@
 #include <wrappers/pipeline_cache.h>
 #include <wrappers/device.h>
 #include <fsys/filesystem.h>
+#include <cstring>
 
 using namespace prosper;
 
@@ -26,16 +27,26 @@ Anvil::PipelineCacheUniquePtr PipelineCache::Load(Anvil::BaseDevice &dev,const s
 		outErr = LoadError::FileNotFound;
 		return nullptr;
 	}
-	auto header = f->Read<Header>();
+	std::vector<uint8_t> data;
+	data.resize(f->GetSize());
+	f->Read(data.data(),data.size() *sizeof(data.front()));
+	return Load(dev,data.data(),data.size(),outErr);
+}
+
+Anvil::PipelineCacheUniquePtr PipelineCache::Load(Anvil::BaseDevice &dev,const void *data,size_t size,LoadError &outErr)
+{
+	Header header;
+	if(size < sizeof(header))
+	{
+		outErr = LoadError::InvalidFormat;
+		return nullptr;
+	}
+	std::memcpy(&header,data,sizeof(header));
 	if(header.size != sizeof(Header))
 	{
 		outErr = LoadError::InvalidFormat;
 		return nullptr;
 	}
-	auto szData = f->GetSize() -f->Tell();
-	std::vector<uint8_t> data;
-	data.resize(szData);
-	f->Read(data.data(),data.size() *sizeof(data.front()));
 
 	static_assert(umath::to_integral(vk::PipelineCacheHeaderVersion::eOne) == VkPipelineCacheHeaderVersion::VK_PIPELINE_CACHE_HEADER_VERSION_END_RANGE,"Unsupported pipeline cache header version, please update header information! (See https://vulkan.lunarg.com/doc/view/1.0.26.0/linux/vkspec.chunked/ch09s06.html , table 9.1)");
 	if(header.version != vk::PipelineCacheHeaderVersion::eOne)
@@ -63,24 +74,34 @@ Anvil::PipelineCacheUniquePtr PipelineCache::Load(Anvil::BaseDevice &dev,const s
 		return nullptr;
 	}
 
-	auto cache = Anvil::PipelineCache::create(&dev,false,data.size(),data.data());
+	// The initial data has to include the header, the driver validates it as well
+	auto cache = Anvil::PipelineCache::create(&dev,false,size,data);
 	if(cache == nullptr)
 		return nullptr;
+	outErr = LoadError::Ok;
 	return std::move(cache);
 }
 
+bool PipelineCache::GetData(Anvil::PipelineCache &cache,std::vector<uint8_t> &outData)
+{
+	size_t cacheSize {0ull};
+	if(cache.get_data(&cacheSize,nullptr) == false || cacheSize == 0ull)
+		return false;
+	outData.resize(cacheSize);
+	if(cache.get_data(&cacheSize,outData.data()) == false)
+		return false;
+	outData.resize(cacheSize);
+	return true;
+}
+
 bool PipelineCache::Save(Anvil::PipelineCache &cache,const std::string &fileName)
 {
 	auto f = FileManager::OpenFile<VFilePtrReal>(fileName.c_str(),"wb");
 	if(f == nullptr)
 		return false;
-	size_t cacheSize {0ull};
-	if(cache.get_data(&cacheSize,nullptr) == false || cacheSize == 0ull)
-		return false;
 	std::vector<uint8_t> data;
-	data.resize(cacheSize);
-	if(cache.get_data(&cacheSize,data.data()) == false)
+	if(GetData(cache,data) == false)
 		return false;
-	f->Write(data.data(),cacheSize);
+	f->Write(data.data(),data.size());
 	return true;
 }
@@ -0,0 +1,388 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "stdafx_prosper.h"
+#include "prosper_render_graph.hpp"
+#include "prosper_context.hpp"
+#include "prosper_command_buffer.hpp"
+#include "prosper_util.hpp"
+#include "image/prosper_image.hpp"
+#include "buffers/prosper_buffer.hpp"
+#include <unordered_set>
+#include <algorithm>
+
+using namespace prosper;
+
+static bool is_same_image_create_info(const prosper::util::ImageCreateInfo &a,const prosper::util::ImageCreateInfo &b)
+{
+	return a.type == b.type && a.width == b.width && a.height == b.height && a.format == b.format && a.layers == b.layers &&
+		a.usage == b.usage && a.samples == b.samples && a.tiling == b.tiling && a.flags == b.flags &&
+		a.queueFamilyMask == b.queueFamilyMask && a.memoryFeatures == b.memoryFeatures;
+}
+
+RenderGraph::PassBuilder::PassBuilder(RenderGraph &graph,uint32_t passIndex)
+	: m_graph{graph},m_passIndex{passIndex}
+{}
+void RenderGraph::PassBuilder::AddAccess(ResourceId resource,PipelineStageFlags stageMask,AccessFlags accessMask,ImageLayout layout,bool write)
+{
+	auto &accesses = m_graph.m_passes.at(m_passIndex).accesses;
+	auto it = std::find_if(accesses.begin(),accesses.end(),[resource](const Access &access) {return access.resource == resource;});
+	if(it == accesses.end())
+	{
+		accesses.push_back({resource,stageMask,accessMask,layout,write,write == false});
+		return;
+	}
+	// A subresource may only appear once per pipeline barrier, so all accesses of the pass have to be covered by a single transition.
+	// If the pass requires the image in different layouts, the general layout is the only one that is valid for all of them.
+	it->stageMask |= stageMask;
+	it->accessMask |= accessMask;
+	it->write = it->write || write;
+	it->read = it->read || write == false;
+	if(it->layout != layout)
+		it->layout = ImageLayout::General;
+}
+void RenderGraph::PassBuilder::ReadImage(ResourceId img,PipelineStageFlags stageMask,ImageLayout layout,AccessFlags accessMask)
+{
+	AddAccess(img,stageMask,accessMask,layout,false);
+}
+void RenderGraph::PassBuilder::WriteImage(ResourceId img,PipelineStageFlags stageMask,ImageLayout layout,AccessFlags accessMask)
+{
+	AddAccess(img,stageMask,accessMask,layout,true);
+}
+void RenderGraph::PassBuilder::ReadBuffer(ResourceId buf,PipelineStageFlags stageMask,AccessFlags accessMask)
+{
+	AddAccess(buf,stageMask,accessMask,ImageLayout::Undefined,false);
+}
+void RenderGraph::PassBuilder::WriteBuffer(ResourceId buf,PipelineStageFlags stageMask,AccessFlags accessMask)
+{
+	AddAccess(buf,stageMask,accessMask,ImageLayout::Undefined,true);
+}
+void RenderGraph::PassBuilder::SetHasSideEffects(bool sideEffects) {m_graph.m_passes.at(m_passIndex).sideEffects = sideEffects;}
+
+///////////////////
+
+RenderGraph::RenderGraph(IPrContext &context)
+	: m_context{context}
+{}
+
+RenderGraph::ResourceId RenderGraph::AddResource(Resource &&resource)
+{
+	m_compiled = false;
+	m_resources.push_back(std::move(resource));
+	return static_cast<ResourceId>(m_resources.size() -1);
+}
+
+RenderGraph::ResourceId RenderGraph::ImportImage(
+	const std::shared_ptr<IImage> &img,const util::BarrierImageLayout &initialState,
+	const std::optional<util::BarrierImageLayout> &finalState,bool isOutput
+)
+{
+	Resource resource {};
+	resource.type = ResourceType::Image;
+	resource.image = img;
+	resource.initialState.stageMask = initialState.stageMask;
+	resource.initialState.accessMask = initialState.accessMask;
+	resource.initialState.layout = initialState.layout;
+	resource.initialState.lastAccessWasWrite = true; // We don't know what happened to the image before, so we have to assume it was written to
+	resource.finalState = finalState;
+	resource.isOutput = isOutput;
+	return AddResource(std::move(resource));
+}
+RenderGraph::ResourceId RenderGraph::ImportBuffer(const std::shared_ptr<IBuffer> &buf,PipelineStageFlags initialStageMask,AccessFlags initialAccessMask,bool isOutput)
+{
+	Resource resource {};
+	resource.type = ResourceType::Buffer;
+	resource.buffer = buf;
+	resource.initialState.stageMask = initialStageMask;
+	resource.initialState.accessMask = initialAccessMask;
+	resource.initialState.lastAccessWasWrite = true;
+	resource.isOutput = isOutput;
+	return AddResource(std::move(resource));
+}
+RenderGraph::ResourceId RenderGraph::CreateTransientImage(const util::ImageCreateInfo &createInfo)
+{
+	Resource resource {};
+	resource.type = ResourceType::Image;
+	resource.transientCreateInfo = createInfo;
+	resource.transientCreateInfo->postCreateLayout = ImageLayout::Undefined;
+	return AddResource(std::move(resource));
+}
+void RenderGraph::MarkAsOutput(ResourceId resource)
+{
+	m_resources.at(resource).isOutput = true;
+	m_compiled = false;
+}
+
+void RenderGraph::AddPass(const std::string &name,const std::function<void(PassBuilder&)> &setup,const std::function<void(ICommandBuffer&)> &execute)
+{
+	m_passes.push_back({});
+	auto &pass = m_passes.back();
+	pass.name = name;
+	pass.execute = execute;
+	PassBuilder builder {*this,static_cast<uint32_t>(m_passes.size() -1)};
+	if(setup)
+		setup(builder);
+	m_compiled = false;
+}
+
+void RenderGraph::CullPasses()
+{
+	// Walk the passes backwards and only keep those that produce something that is consumed later on
+	std::unordered_set<ResourceId> requiredResources {};
+	for(auto i=decltype(m_resources.size()){0u};i<m_resources.size();++i)
+	{
+		if(m_resources.at(i).isOutput)
+			requiredResources.insert(static_cast<ResourceId>(i));
+	}
+	for(auto it=m_passes.rbegin();it!=m_passes.rend();++it)
+	{
+		auto &pass = *it;
+		pass.culled = (pass.sideEffects == false) && std::find_if(pass.accesses.begin(),pass.accesses.end(),[&requiredResources](const Access &access) {
+			return access.write && requiredResources.find(access.resource) != requiredResources.end();
+		}) == pass.accesses.end();
+		if(pass.culled)
+			continue;
+		for(auto &access : pass.accesses)
+		{
+			if(access.read)
+				requiredResources.insert(access.resource);
+		}
+	}
+}
+
+bool RenderGraph::AssignTransientImages()
+{
+	struct Lifetime
+	{
+		ResourceId resource;
+		uint32_t firstPass;
+		uint32_t lastPass;
+	};
+	std::vector<Lifetime> lifetimes {};
+	for(auto passIdx=decltype(m_passes.size()){0u};passIdx<m_passes.size();++passIdx)
+	{
+		auto &pass = m_passes.at(passIdx);
+		if(pass.culled)
+			continue;
+		for(auto &access : pass.accesses)
+		{
+			auto &resource = m_resources.at(access.resource);
+			if(resource.transientCreateInfo.has_value() == false)
+				continue;
+			auto it = std::find_if(lifetimes.begin(),lifetimes.end(),[&access](const Lifetime &lifetime) {return lifetime.resource == access.resource;});
+			if(it == lifetimes.end())
+				lifetimes.push_back({access.resource,static_cast<uint32_t>(passIdx),static_cast<uint32_t>(passIdx)});
+			else
+				it->lastPass = static_cast<uint32_t>(passIdx);
+		}
+	}
+	// Lifetimes are already sorted by their first pass
+	for(auto &transientImage : m_transientImagePool)
+		transientImage.lastResource = INVALID_RESOURCE;
+	for(auto &lifetime : lifetimes)
+	{
+		auto &resource = m_resources.at(lifetime.resource);
+		auto it = std::find_if(m_transientImagePool.begin(),m_transientImagePool.end(),[&resource,&lifetime](const TransientImage &transientImage) {
+			return (transientImage.lastResource == INVALID_RESOURCE || transientImage.lastUsePass < lifetime.firstPass) &&
+				is_same_image_create_info(transientImage.createInfo,*resource.transientCreateInfo);
+		});
+		if(it == m_transientImagePool.end())
+		{
+			auto img = m_context.CreateImage(*resource.transientCreateInfo);
+			if(img == nullptr)
+				return false;
+			img->SetDebugName("render_graph_transient_img");
+			m_transientImagePool.push_back({img,*resource.transientCreateInfo});
+			it = m_transientImagePool.end() -1;
+		}
+		resource.image = it->image;
+		resource.transientImageIndex = static_cast<uint32_t>(it -m_transientImagePool.begin());
+		resource.aliasedResource = it->lastResource;
+		it->lastResource = lifetime.resource;
+		it->lastUsePass = lifetime.lastPass;
+	}
+	return true;
+}
+
+void RenderGraph::ComputeBarriers()
+{
+	auto &states = m_finalStates;
+	states.clear();
+	states.reserve(m_resources.size());
+	for(auto &resource : m_resources)
+	{
+		if(resource.transientImageIndex == std::numeric_limits<uint32_t>::max() || resource.aliasedResource != INVALID_RESOURCE)
+		{
+			states.push_back(resource.initialState);
+			continue;
+		}
+		// Physical transient images are re-used across executions, so the first use has to wait for the previous ones.
+		// The contents are discarded regardless.
+		auto state = m_transientImagePool.at(resource.transientImageIndex).lastState;
+		state.layout = ImageLayout::Undefined;
+		states.push_back(state);
+	}
+	std::vector<bool> touched(m_resources.size(),false);
+
+	for(auto &pass : m_passes)
+	{
+		pass.barrier = nullptr;
+		if(pass.culled)
+			continue;
+		auto barrierInfo = std::make_unique<util::PipelineBarrierInfo>();
+		barrierInfo->srcStageMask = PipelineStageFlags::None;
+		barrierInfo->dstStageMask = PipelineStageFlags::None;
+		for(auto &access : pass.accesses)
+		{
+			auto &resource = m_resources.at(access.resource);
+			auto &state = states.at(access.resource);
+			if(resource.aliasedResource != INVALID_RESOURCE && touched.at(access.resource) == false)
+			{
+				// The contents of the previous alias are discarded, but we still have to wait for it to be done with the image
+				auto &aliasState = states.at(resource.aliasedResource);
+				state.stageMask = aliasState.stageMask;
+				state.accessMask = aliasState.accessMask;
+				state.lastAccessWasWrite = aliasState.lastAccessWasWrite;
+				state.layout = ImageLayout::Undefined;
+			}
+			touched.at(access.resource) = true;
+			auto layoutTransition = (resource.type == ResourceType::Image && state.layout != access.layout);
+			if(layoutTransition == false && state.lastAccessWasWrite == false && access.write == false)
+			{
+				// Read after read; No barrier required, but later writes will have to wait for this read as well
+				state.stageMask |= access.stageMask;
+				state.accessMask |= access.accessMask;
+				continue;
+			}
+			// Only writes have to be made available, read-after-write and write-after-write
+			// hazards need a memory dependency, write-after-read only an execution dependency
+			auto srcAccessMask = state.lastAccessWasWrite ? state.accessMask : AccessFlags{};
+			barrierInfo->srcStageMask |= state.stageMask;
+			barrierInfo->dstStageMask |= access.stageMask;
+			if(resource.type == ResourceType::Image)
+			{
+				util::ImageBarrierInfo imgBarrierInfo {};
+				imgBarrierInfo.srcAccessMask = srcAccessMask;
+				imgBarrierInfo.dstAccessMask = access.accessMask;
+				imgBarrierInfo.oldLayout = state.layout;
+				imgBarrierInfo.newLayout = access.layout;
+				barrierInfo->imageBarriers.push_back(util::create_image_barrier(*resource.image,imgBarrierInfo));
+			}
+			else if(srcAccessMask != AccessFlags{})
+			{
+				util::BufferBarrierInfo bufBarrierInfo {};
+				bufBarrierInfo.srcAccessMask = srcAccessMask;
+				bufBarrierInfo.dstAccessMask = access.accessMask;
+				barrierInfo->bufferBarriers.push_back(util::create_buffer_barrier(bufBarrierInfo,*resource.buffer));
+			}
+			state.stageMask = access.stageMask;
+			state.accessMask = access.accessMask;
+			state.layout = access.layout;
+			state.lastAccessWasWrite = access.write;
+		}
+		if(barrierInfo->dstStageMask == PipelineStageFlags::None)
+			continue;
+		if(barrierInfo->srcStageMask == PipelineStageFlags::None)
+			barrierInfo->srcStageMask = PipelineStageFlags::TopOfPipeBit;
+		pass.barrier = std::move(barrierInfo);
+	}
+
+	m_finalBarrier = nullptr;
+	auto finalBarrier = std::make_unique<util::PipelineBarrierInfo>();
+	finalBarrier->srcStageMask = PipelineStageFlags::None;
+	finalBarrier->dstStageMask = PipelineStageFlags::None;
+	for(auto i=decltype(m_resources.size()){0u};i<m_resources.size();++i)
+	{
+		auto &resource = m_resources.at(i);
+		if(resource.type != ResourceType::Image || resource.finalState.has_value() == false)
+			continue;
+		auto &state = states.at(i);
+		finalBarrier->srcStageMask |= state.stageMask;
+		finalBarrier->dstStageMask |= resource.finalState->stageMask;
+		util::ImageBarrierInfo imgBarrierInfo {};
+		imgBarrierInfo.srcAccessMask = state.lastAccessWasWrite ? state.accessMask : AccessFlags{};
+		imgBarrierInfo.dstAccessMask = resource.finalState->accessMask;
+		imgBarrierInfo.oldLayout = state.layout;
+		imgBarrierInfo.newLayout = resource.finalState->layout;
+		finalBarrier->imageBarriers.push_back(util::create_image_barrier(*resource.image,imgBarrierInfo));
+	}
+	if(finalBarrier->imageBarriers.empty() == false)
+		m_finalBarrier = std::move(finalBarrier);
+}
+
+bool RenderGraph::UpdateTransientImageStates()
+{
+	auto changed = false;
+	for(auto &transientImage : m_transientImagePool)
+	{
+		if(transientImage.lastResource == INVALID_RESOURCE)
+			continue;
+		// The graph may be executed multiple times, so the state has to cover the accesses of all executions that may still be in flight
+		auto &finalState = m_finalStates.at(transientImage.lastResource);
+		auto &lastState = transientImage.lastState;
+		auto stageMask = lastState.stageMask | finalState.stageMask;
+		auto accessMask = lastState.accessMask | finalState.accessMask;
+		auto write = lastState.lastAccessWasWrite || finalState.lastAccessWasWrite;
+		if(stageMask == lastState.stageMask && accessMask == lastState.accessMask && write == lastState.lastAccessWasWrite)
+			continue;
+		lastState.stageMask = stageMask;
+		lastState.accessMask = accessMask;
+		lastState.lastAccessWasWrite = write;
+		changed = true;
+	}
+	return changed;
+}
+
+bool RenderGraph::Compile()
+{
+	CullPasses();
+	if(AssignTransientImages() == false)
+		return false;
+	ComputeBarriers();
+	// The final states don't depend on the initial states of the transient images, so a second pass is always sufficient
+	if(UpdateTransientImageStates())
+		ComputeBarriers();
+	m_compiled = true;
+	return true;
+}
+
+bool RenderGraph::Execute(ICommandBuffer &cmd)
+{
+	if(m_compiled == false && Compile() == false)
+		return false;
+	for(auto &pass : m_passes)
+	{
+		if(pass.culled)
+			continue;
+		if(pass.barrier && cmd.RecordPipelineBarrier(*pass.barrier) == false)
+			return false;
+		if(pass.execute)
+			pass.execute(cmd);
+	}
+	if(m_finalBarrier)
+		return cmd.RecordPipelineBarrier(*m_finalBarrier);
+	return true;
+}
+
+void RenderGraph::Reset()
+{
+	m_resources.clear();
+	m_passes.clear();
+	m_finalStates.clear();
+	m_finalBarrier = nullptr;
+	m_compiled = false;
+}
+
+IImage *RenderGraph::GetImage(ResourceId resource) const {return (resource < m_resources.size()) ? m_resources.at(resource).image.get() : nullptr;}
+IBuffer *RenderGraph::GetBuffer(ResourceId resource) const {return (resource < m_resources.size()) ? m_resources.at(resource).buffer.get() : nullptr;}
+uint32_t RenderGraph::GetPassCount() const {return static_cast<uint32_t>(m_passes.size());}
+uint32_t RenderGraph::GetCulledPassCount() const
+{
+	return static_cast<uint32_t>(std::count_if(m_passes.begin(),m_passes.end(),[](const Pass &pass) {return pass.culled;}));
+}
+uint32_t RenderGraph::GetBarrierCount() const
+{
+	auto count = static_cast<uint32_t>(std::count_if(m_passes.begin(),m_passes.end(),[](const Pass &pass) {return pass.barrier != nullptr;}));
+	return m_finalBarrier ? (count +1) : count;
+}
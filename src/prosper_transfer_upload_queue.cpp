@@ -0,0 +1,231 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "stdafx_prosper.h"
+#include "prosper_transfer_upload_queue.hpp"
+#include "prosper_context.hpp"
+#include "prosper_command_buffer.hpp"
+#include "buffers/prosper_buffer.hpp"
+#include "buffers/prosper_buffer_create_info.hpp"
+#include "image/prosper_image.hpp"
+#include "vk_context.hpp"
+#include "vk_command_buffer.hpp"
+#include "vk_submission_batcher.hpp"
+#include <misc/semaphore_create_info.h>
+#include <wrappers/device.h>
+#include <wrappers/queue.h>
+#include <wrappers/semaphore.h>
+#include <wrappers/command_buffer.h>
+#include <cstring>
+
+using namespace prosper;
+
+struct TransferUploadQueue::Batch
+{
+	std::shared_ptr<IBuffer> stagingBuffer = nullptr;
+	std::shared_ptr<IPrimaryCommandBuffer> cmdBuffer = nullptr;
+	Anvil::SemaphoreUniquePtr semaphore = nullptr;
+	// Destination resources have to be kept alive until the frame that has acquired them has been completed
+	std::vector<std::shared_ptr<void>> resources = {};
+	util::PipelineBarrierInfo acquireBarrierInfo {};
+};
+
+static constexpr DeviceSize STAGING_ALIGNMENT = 16ull; // Sufficient for the texel size of all uncompressed and block-compressed formats
+
+std::unique_ptr<TransferUploadQueue> TransferUploadQueue::Create(IPrContext &context,DeviceSize maxBatchSize)
+{
+	uint32_t universalQueueFamilyIndex;
+	if(context.GetQueueFamilyIndex(QueueFamilyType::Universal,universalQueueFamilyIndex) == false)
+		return nullptr;
+	// If there is no dedicated transfer queue family, uploads are submitted to the universal queue instead
+	uint32_t transferQueueFamilyIndex;
+	if(context.GetQueueFamilyIndex(QueueFamilyType::Transfer,transferQueueFamilyIndex) == false)
+		transferQueueFamilyIndex = universalQueueFamilyIndex;
+	return std::unique_ptr<TransferUploadQueue>{new TransferUploadQueue{context,maxBatchSize,transferQueueFamilyIndex,universalQueueFamilyIndex}};
+}
+
+TransferUploadQueue::TransferUploadQueue(IPrContext &context,DeviceSize maxBatchSize,uint32_t transferQueueFamilyIndex,uint32_t universalQueueFamilyIndex)
+	: m_context{context},m_maxBatchSize{maxBatchSize},m_transferQueueFamilyIndex{transferQueueFamilyIndex},
+	m_universalQueueFamilyIndex{universalQueueFamilyIndex}
+{}
+
+TransferUploadQueue::~TransferUploadQueue() {Flush();}
+
+DeviceSize TransferUploadQueue::AddStagingData(const void *data,DeviceSize size)
+{
+	auto offset = ((m_stagingData.size() +STAGING_ALIGNMENT -1ull) /STAGING_ALIGNMENT) *STAGING_ALIGNMENT;
+	m_stagingData.resize(offset +size);
+	std::memcpy(m_stagingData.data() +offset,data,size);
+	return offset;
+}
+
+bool TransferUploadQueue::UploadBuffer(const std::shared_ptr<IBuffer> &buffer,DeviceSize offset,DeviceSize size,const void *data,const BufferUploadInfo &uploadInfo)
+{
+	if(size == 0ull)
+		return true;
+	if((buffer->GetUsageFlags() &BufferUsageFlags::TransferDstBit) == BufferUsageFlags::None || offset +size > buffer->GetSize())
+		return false;
+	if(GetPendingUploadSize() +size > m_maxBatchSize && Flush() == false)
+		return false;
+	auto stagingOffset = AddStagingData(data,size);
+	m_bufferUploads.push_back({buffer,stagingOffset,offset,size,uploadInfo});
+	return true;
+}
+
+bool TransferUploadQueue::UploadImage(const std::shared_ptr<IImage> &image,const void *data,DeviceSize size,const ImageUploadInfo &uploadInfo)
+{
+	if(size == 0ull)
+		return true;
+	if(
+		(image->GetUsageFlags() &ImageUsageFlags::TransferDstBit) == ImageUsageFlags{} ||
+		uploadInfo.mipLevel >= image->GetMipmapCount() || uploadInfo.baseArrayLayer +uploadInfo.layerCount > image->GetLayerCount()
+	)
+		return false;
+	if(GetPendingUploadSize() +size > m_maxBatchSize && Flush() == false)
+		return false;
+	auto stagingOffset = AddStagingData(data,size);
+	m_imageUploads.push_back({image,stagingOffset,uploadInfo});
+	return true;
+}
+
+bool TransferUploadQueue::Flush()
+{
+	if(m_bufferUploads.empty() && m_imageUploads.empty())
+		return true;
+	auto bufferUploads = std::move(m_bufferUploads);
+	auto imageUploads = std::move(m_imageUploads);
+	auto stagingData = std::move(m_stagingData);
+	m_bufferUploads.clear();
+	m_imageUploads.clear();
+	m_stagingData.clear();
+
+	auto &vlkContext = static_cast<VlkContext&>(m_context);
+	auto batch = std::make_shared<Batch>();
+	util::BufferCreateInfo createInfo {};
+	createInfo.size = stagingData.size();
+	createInfo.usageFlags = BufferUsageFlags::TransferSrcBit;
+	createInfo.memoryFeatures = MemoryFeatureFlags::CPUToGPU;
+	createInfo.queueFamilyMask = HasDedicatedTransferQueue() ? QueueFamilyFlags::DMABit : QueueFamilyFlags::GraphicsBit;
+	batch->stagingBuffer = m_context.CreateBuffer(createInfo,stagingData.data());
+	if(batch->stagingBuffer == nullptr)
+		return false;
+	batch->stagingBuffer->SetDebugName("transfer_upload_staging_buf");
+
+	// Command buffers are allocated from the command pool of the transfer queue family
+	uint32_t queueFamilyIndex;
+	batch->cmdBuffer = m_context.AllocatePrimaryLevelCommandBuffer(QueueFamilyType::Transfer,queueFamilyIndex);
+	if(batch->cmdBuffer == nullptr || batch->cmdBuffer->StartRecording(true,false) == false)
+		return false;
+	auto &cmd = *batch->cmdBuffer;
+
+	// The ownership of the resources is transferred to the universal queue family. If both families are the same,
+	// the semaphore is sufficient to make the writes visible to the frame.
+	auto dedicated = HasDedicatedTransferQueue();
+	auto srcQueueFamilyIndex = dedicated ? m_transferQueueFamilyIndex : QUEUE_FAMILY_IGNORED;
+	auto dstQueueFamilyIndex = dedicated ? m_universalQueueFamilyIndex : QUEUE_FAMILY_IGNORED;
+	auto waitStageMask = PipelineStageFlags{};
+
+	util::PipelineBarrierInfo preCopyBarrierInfo {};
+	preCopyBarrierInfo.srcStageMask = PipelineStageFlags::TopOfPipeBit;
+	preCopyBarrierInfo.dstStageMask = PipelineStageFlags::TransferBit;
+	preCopyBarrierInfo.imageBarriers.reserve(imageUploads.size());
+	for(auto &upload : imageUploads)
+	{
+		auto &info = upload.uploadInfo;
+		preCopyBarrierInfo.imageBarriers.push_back(util::ImageBarrier{
+			AccessFlags{},AccessFlags::TransferWriteBit,ImageLayout::Undefined,ImageLayout::TransferDstOptimal,
+			QUEUE_FAMILY_IGNORED,QUEUE_FAMILY_IGNORED,upload.image.get(),util::ImageSubresourceRange{info.baseArrayLayer,info.layerCount,info.mipLevel}
+		});
+	}
+	if(preCopyBarrierInfo.imageBarriers.empty() == false)
+		cmd.RecordPipelineBarrier(preCopyBarrierInfo);
+
+	util::PipelineBarrierInfo releaseBarrierInfo {};
+	releaseBarrierInfo.srcStageMask = PipelineStageFlags::TransferBit;
+	releaseBarrierInfo.dstStageMask = PipelineStageFlags::BottomOfPipeBit;
+	releaseBarrierInfo.bufferBarriers.reserve(bufferUploads.size());
+	releaseBarrierInfo.imageBarriers.reserve(imageUploads.size());
+	batch->resources.reserve(bufferUploads.size() +imageUploads.size());
+	for(auto &upload : bufferUploads)
+	{
+		util::BufferCopy copyInfo {};
+		copyInfo.srcOffset = upload.stagingOffset;
+		copyInfo.dstOffset = upload.offset;
+		copyInfo.size = upload.size;
+		cmd.RecordCopyBuffer(copyInfo,*batch->stagingBuffer,*upload.buffer);
+
+		auto &info = upload.uploadInfo;
+		releaseBarrierInfo.bufferBarriers.push_back(util::BufferBarrier{
+			AccessFlags::TransferWriteBit,AccessFlags{},srcQueueFamilyIndex,dstQueueFamilyIndex,
+			upload.buffer.get(),upload.offset,upload.size
+		});
+		if(dedicated)
+		{
+			batch->acquireBarrierInfo.bufferBarriers.push_back(util::BufferBarrier{
+				AccessFlags{},info.dstAccessMask,srcQueueFamilyIndex,dstQueueFamilyIndex,
+				upload.buffer.get(),upload.offset,upload.size
+			});
+		}
+		waitStageMask = waitStageMask | info.dstStageMask;
+		batch->resources.push_back(upload.buffer);
+	}
+	for(auto &upload : imageUploads)
+	{
+		auto &info = upload.uploadInfo;
+		auto extents = upload.image->GetExtents(info.mipLevel);
+		util::BufferImageCopyInfo copyInfo {};
+		copyInfo.bufferOffset = upload.stagingOffset;
+		copyInfo.width = extents.width;
+		copyInfo.height = extents.height;
+		copyInfo.mipLevel = info.mipLevel;
+		copyInfo.baseArrayLayer = info.baseArrayLayer;
+		copyInfo.layerCount = info.layerCount;
+		copyInfo.aspectMask = info.aspectMask;
+		copyInfo.dstImageLayout = ImageLayout::TransferDstOptimal;
+		cmd.RecordCopyBufferToImage(copyInfo,*batch->stagingBuffer,*upload.image);
+
+		// The layout transition has to be identical in the release and acquire barriers
+		util::ImageSubresourceRange range {info.baseArrayLayer,info.layerCount,info.mipLevel};
+		releaseBarrierInfo.imageBarriers.push_back(util::ImageBarrier{
+			AccessFlags::TransferWriteBit,AccessFlags{},ImageLayout::TransferDstOptimal,info.dstImageLayout,
+			srcQueueFamilyIndex,dstQueueFamilyIndex,upload.image.get(),range
+		});
+		if(dedicated)
+		{
+			batch->acquireBarrierInfo.imageBarriers.push_back(util::ImageBarrier{
+				AccessFlags{},info.dstAccessMask,ImageLayout::TransferDstOptimal,info.dstImageLayout,
+				srcQueueFamilyIndex,dstQueueFamilyIndex,upload.image.get(),range
+			});
+		}
+		waitStageMask = waitStageMask | info.dstStageMask;
+		batch->resources.push_back(upload.image);
+	}
+	cmd.RecordPipelineBarrier(releaseBarrierInfo);
+	if(cmd.StopRecording() == false)
+		return false;
+
+	batch->semaphore = Anvil::Semaphore::create(Anvil::SemaphoreCreateInfo::create(&vlkContext.GetDevice()));
+	// The batch is flushed with (and ahead of) the next frame submission at the latest
+	VlkSubmissionBatcher::Submission submission {};
+	submission.queueFamilyType = QueueFamilyType::Transfer;
+	submission.cmdBuffers = {&dynamic_cast<VlkCommandBuffer&>(cmd).GetAnvilCommandBuffer()};
+	submission.signalSemaphores = {batch->semaphore.get()};
+	vlkContext.GetSubmissionBatcher().Add(std::move(submission));
+
+	// Hand the semaphore and the acquire barriers over to the next frame. The barrier is chained to the semaphore wait through its source stages.
+	batch->acquireBarrierInfo.srcStageMask = waitStageMask;
+	batch->acquireBarrierInfo.dstStageMask = waitStageMask;
+	vlkContext.AddFrameWaitSemaphore(*batch->semaphore,waitStageMask);
+	m_context.ScheduleRecordCommands([batch](IPrimaryCommandBuffer &drawCmd) {
+		if(batch->acquireBarrierInfo.bufferBarriers.empty() == false || batch->acquireBarrierInfo.imageBarriers.empty() == false)
+			drawCmd.RecordPipelineBarrier(batch->acquireBarrierInfo);
+		// The frame waits on the semaphore, so the transfer has been completed once the frame has been completed
+		drawCmd.GetContext().KeepResourceAliveUntilPresentationComplete(batch);
+	});
+	return true;
+}
+
+bool TransferUploadQueue::HasDedicatedTransferQueue() const {return m_transferQueueFamilyIndex != m_universalQueueFamilyIndex;}
+uint32_t TransferUploadQueue::GetPendingUploadCount() const {return m_bufferUploads.size() +m_imageUploads.size();}
+DeviceSize TransferUploadQueue::GetPendingUploadSize() const {return m_stagingData.size();}
@@ -0,0 +1,146 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "stdafx_prosper.h"
+#include "prosper_upload_context_pool.hpp"
+#include "prosper_context.hpp"
+#include "prosper_command_buffer.hpp"
+#include "prosper_fence.hpp"
+#include <algorithm>
+
+using namespace prosper;
+
+IPrimaryCommandBuffer &UploadContextPool::UploadContext::GetCommandBuffer() const {return *m_cmdBuffer;}
+void UploadContextPool::UploadContext::KeepResourceAlive(const std::shared_ptr<void> &resource) {m_resources.push_back(resource);}
+
+///////////////////
+
+std::unique_ptr<UploadContextPool> UploadContextPool::Create(IPrContext &context,uint32_t maxInFlight)
+{
+	return std::unique_ptr<UploadContextPool>{new UploadContextPool{context,std::max(maxInFlight,1u)}};
+}
+
+UploadContextPool::UploadContextPool(IPrContext &context,uint32_t maxInFlight)
+	: m_context{context},m_maxInFlight{maxInFlight}
+{}
+
+UploadContextPool::UploadContext &UploadContextPool::Acquire()
+{
+	if(m_free.empty())
+		Recycle();
+	if(m_free.empty())
+	{
+		if(m_inFlight.size() >= m_maxInFlight)
+		{
+			if(Wait(m_inFlight.front()->m_submissionId) == false || m_free.empty())
+				throw std::runtime_error{"Unable to wait for in-flight upload context!"};
+		}
+		else
+		{
+			auto context = std::unique_ptr<UploadContext>{new UploadContext{}};
+			uint32_t queueFamilyIndex;
+			context->m_cmdBuffer = m_context.AllocatePrimaryLevelCommandBuffer(QueueFamilyType::Universal,queueFamilyIndex);
+			context->m_fence = m_context.CreateFence(false);
+			if(context->m_cmdBuffer == nullptr || context->m_fence == nullptr)
+				throw std::runtime_error{"Unable to allocate upload context!"};
+			m_free.push_back(context.get());
+			m_contexts.push_back(std::move(context));
+		}
+	}
+	auto *context = m_free.back();
+	m_free.pop_back();
+	// The command pool is created with the reset flag, so the command buffer is reset implicitly
+	if(context->m_cmdBuffer->StartRecording(true,false) == false)
+		throw std::runtime_error("Unable to start recording for primary level command buffer!");
+	return *context;
+}
+
+UploadContextPool::SubmissionId UploadContextPool::Flush(UploadContext &context)
+{
+	if(context.m_cmdBuffer->StopRecording() == false)
+	{
+		ReleaseContext(context);
+		m_free.push_back(&context);
+		return INVALID_SUBMISSION_ID;
+	}
+	// The fence would never be signalled for a failed submission
+	if(m_context.SubmitCommandBuffer(*context.m_cmdBuffer,QueueFamilyType::Universal,false,context.m_fence.get()) == false)
+	{
+		ReleaseContext(context);
+		m_free.push_back(&context);
+		return INVALID_SUBMISSION_ID;
+	}
+	context.m_submissionId = m_nextSubmissionId++;
+	m_inFlight.push_back(&context);
+	return context.m_submissionId;
+}
+
+UploadContextPool::UploadContext *UploadContextPool::FindInFlightContext(SubmissionId submissionId) const
+{
+	auto it = std::find_if(m_inFlight.begin(),m_inFlight.end(),[submissionId](const UploadContext *context) {return context->m_submissionId == submissionId;});
+	return (it != m_inFlight.end()) ? *it : nullptr;
+}
+
+bool UploadContextPool::IsComplete(SubmissionId submissionId)
+{
+	if(submissionId == INVALID_SUBMISSION_ID || submissionId >= m_nextSubmissionId)
+		return false;
+	auto *context = FindInFlightContext(submissionId);
+	if(context == nullptr)
+		return true;
+	return context->m_fence->IsSet();
+}
+
+bool UploadContextPool::Wait(SubmissionId submissionId)
+{
+	if(submissionId == INVALID_SUBMISSION_ID || submissionId >= m_nextSubmissionId)
+		return false;
+	auto *context = FindInFlightContext(submissionId);
+	if(context == nullptr)
+		return true;
+	if(m_context.WaitForFence(*context->m_fence) != Result::Success)
+		return false;
+	Recycle();
+	return true;
+}
+
+bool UploadContextPool::WaitAll()
+{
+	if(m_inFlight.empty())
+		return true;
+	std::vector<IFence*> fences {};
+	fences.reserve(m_inFlight.size());
+	for(auto *context : m_inFlight)
+		fences.push_back(context->m_fence.get());
+	if(m_context.WaitForFences(fences) != Result::Success)
+		return false;
+	Recycle();
+	return true;
+}
+
+void UploadContextPool::ReleaseContext(UploadContext &context)
+{
+	context.m_resources.clear();
+	context.m_submissionId = INVALID_SUBMISSION_ID;
+}
+
+void UploadContextPool::Recycle()
+{
+	for(auto it=m_inFlight.begin();it!=m_inFlight.end();)
+	{
+		auto *context = *it;
+		if(context->m_fence->IsSet() == false)
+		{
+			++it;
+			continue;
+		}
+		context->m_fence->Reset();
+		ReleaseContext(*context);
+		m_free.push_back(context);
+		it = m_inFlight.erase(it);
+	}
+}
+
+uint32_t UploadContextPool::GetInFlightCount() const {return m_inFlight.size();}
+uint32_t UploadContextPool::GetContextCount() const {return m_contexts.size();}
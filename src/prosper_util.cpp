@@ -29,6 +29,8 @@
 #include "buffers/vk_dynamic_resizable_buffer.hpp"
 #include "prosper_memory_tracker.hpp"
 #include <sharedutils/util.h>
+#include <string_view>
+#include <type_traits>
 #include <config.h>
 #include <wrappers/image.h>
 #include <wrappers/image_view.h>
@@ -58,6 +60,8 @@
 #include <util_texture_info.hpp>
 #include <gli/gli.hpp>
 #include <sstream>
+#include <thread>
+#include <algorithm>
 
 #include "image/vk_sampler.hpp"
 #include "vk_context.hpp"
@@ -75,7 +79,8 @@ bool prosper::util::RenderPassCreateInfo::AttachmentInfo::operator==(const Attac
 		loadOp == other.loadOp &&
 		storeOp == other.storeOp &&
 		initialLayout == other.initialLayout &&
-		finalLayout == other.finalLayout;
+		finalLayout == other.finalLayout &&
+		resolveAttachment == other.resolveAttachment;
 }
 bool prosper::util::RenderPassCreateInfo::AttachmentInfo::operator!=(const AttachmentInfo &other) const {return !operator==(other);}
 
@@ -85,9 +90,17 @@ bool prosper::util::RenderPassCreateInfo::SubPass::operator==(const SubPass &oth
 {
 	return colorAttachments == other.colorAttachments &&
 		useDepthStencilAttachment == other.useDepthStencilAttachment &&
-		dependencies == other.dependencies;
+		dependencies == other.dependencies &&
+		inputAttachments == other.inputAttachments;
 }
 bool prosper::util::RenderPassCreateInfo::SubPass::operator!=(const SubPass &other) const {return !operator==(other);}
+bool prosper::util::RenderPassCreateInfo::SubPass::UsesAttachment(std::size_t attachmentIndex,bool isDepthStencilAttachment) const
+{
+	if(isDepthStencilAttachment && useDepthStencilAttachment)
+		return true;
+	return std::find(colorAttachments.begin(),colorAttachments.end(),attachmentIndex) != colorAttachments.end() ||
+		std::find(inputAttachments.begin(),inputAttachments.end(),attachmentIndex) != inputAttachments.end();
+}
 
 /////////////////
 
@@ -117,6 +130,13 @@ bool prosper::util::RenderPassCreateInfo::operator==(const RenderPassCreateInfo
 	return attachments == other.attachments && subPasses == other.subPasses;
 }
 bool prosper::util::RenderPassCreateInfo::operator!=(const RenderPassCreateInfo &other) const {return !operator==(other);}
+uint32_t prosper::util::RenderPassCreateInfo::GetSubPassCount() const {return umath::max(static_cast<uint32_t>(subPasses.size()),1u);}
+bool prosper::util::RenderPassCreateInfo::IsResolveAttachment(std::size_t attachmentIndex) const
+{
+	return std::find_if(attachments.begin(),attachments.end(),[attachmentIndex](const AttachmentInfo &attInfo) {
+		return attInfo.resolveAttachment.has_value() && *attInfo.resolveAttachment == attachmentIndex;
+	}) != attachments.end();
+}
 
 prosper::util::RenderPassCreateInfo::SubPass::SubPass(const std::vector<std::size_t> &colorAttachments,bool useDepthStencilAttachment,std::vector<Dependency> dependencies)
 	: colorAttachments{colorAttachments},useDepthStencilAttachment{useDepthStencilAttachment},dependencies{dependencies}
@@ -204,6 +224,14 @@ uint64_t prosper::util::clamp_gpu_memory_size(Anvil::BaseDevice &dev,uint64_t si
 	return umath::min(size,static_cast<uint64_t>(maxMem));
 }
 
+static bool is_lazily_allocated_memory_supported(Anvil::BaseDevice &dev)
+{
+	auto &memProps = dev.get_physical_device_memory_properties();
+	return std::find_if(memProps.types.begin(),memProps.types.end(),[](const Anvil::MemoryType &type) {
+		return (type.features &Anvil::MemoryFeatureFlagBits::LAZILY_ALLOCATED_BIT) != Anvil::MemoryFeatureFlagBits::NONE;
+	}) != memProps.types.end();
+}
+
 static void find_compatible_memory_feature_flags(Anvil::BaseDevice &dev,prosper::MemoryFeatureFlags &featureFlags)
 {
 	auto r = prosper::util::find_compatible_memory_type(dev,featureFlags);
@@ -366,7 +394,36 @@ std::shared_ptr<prosper::IImage> create_image(prosper::IPrContext &context,const
 	if(postCreateLayout == prosper::ImageLayout::ColorAttachmentOptimal && prosper::util::is_depth_format(createInfo.format))
 		postCreateLayout = prosper::ImageLayout::DepthStencilAttachmentOptimal;
 
+	auto usage = createInfo.usage;
 	auto memoryFeatures = createInfo.memoryFeatures;
+	auto useDiscreteMemory = umath::is_flag_set(createInfo.flags,prosper::util::ImageCreateInfo::Flags::AllocateDiscreteMemory);
+	if(umath::is_flag_set(createInfo.flags,prosper::util::ImageCreateInfo::Flags::TransientAttachment))
+	{
+		// Transient attachments must not have any usages other than attachment usages, and their contents can't be initialized
+		const auto attachmentUsage = prosper::ImageUsageFlags::ColorAttachmentBit | prosper::ImageUsageFlags::DepthStencilAttachmentBit |
+			prosper::ImageUsageFlags::InputAttachmentBit | prosper::ImageUsageFlags::TransientAttachmentBit;
+		if((usage |attachmentUsage) != attachmentUsage || (usage &attachmentUsage) == prosper::ImageUsageFlags::None)
+		{
+			std::cout<<"WARNING: Attempted to create transient attachment image with non-attachment usage flags! Skipping..."<<std::endl;
+			return nullptr;
+		}
+		if(data != nullptr)
+		{
+			std::cout<<"WARNING: Attempted to create transient attachment image with initial data! Skipping..."<<std::endl;
+			return nullptr;
+		}
+		usage |= prosper::ImageUsageFlags::TransientAttachmentBit;
+		if(is_lazily_allocated_memory_supported(static_cast<prosper::VlkContext&>(context).GetDevice()))
+		{
+			// Lazily allocated memory can't be sub-allocated from the device image buffers
+			memoryFeatures = prosper::MemoryFeatureFlags::DeviceLocal | prosper::MemoryFeatureFlags::LazilyAllocated;
+			useDiscreteMemory = true;
+		}
+	}
+	auto requestedMemoryFeatures = memoryFeatures;
+	auto imgCreateInfo = createInfo;
+	imgCreateInfo.usage = usage;
+	imgCreateInfo.memoryFeatures = requestedMemoryFeatures;
 	find_compatible_memory_feature_flags(static_cast<prosper::VlkContext&>(context).GetDevice(),memoryFeatures);
 	auto memoryFeatureFlags = memory_feature_flags_to_anvil_flags(memoryFeatures);
 	auto queueFamilies = queue_family_flags_to_anvil_queue_family(createInfo.queueFamilyMask);
@@ -374,11 +431,10 @@ std::shared_ptr<prosper::IImage> create_image(prosper::IPrContext &context,const
 	if((createInfo.flags &prosper::util::ImageCreateInfo::Flags::ConcurrentSharing) != prosper::util::ImageCreateInfo::Flags::None)
 		sharingMode = Anvil::SharingMode::CONCURRENT;
 
-	auto useDiscreteMemory = umath::is_flag_set(createInfo.flags,prosper::util::ImageCreateInfo::Flags::AllocateDiscreteMemory);
 	if(
 		useDiscreteMemory == false &&
-		((createInfo.memoryFeatures &prosper::MemoryFeatureFlags::HostAccessable) != prosper::MemoryFeatureFlags::None ||
-		(createInfo.memoryFeatures &prosper::MemoryFeatureFlags::DeviceLocal) == prosper::MemoryFeatureFlags::None)
+		((requestedMemoryFeatures &prosper::MemoryFeatureFlags::HostAccessable) != prosper::MemoryFeatureFlags::None ||
+		(requestedMemoryFeatures &prosper::MemoryFeatureFlags::DeviceLocal) == prosper::MemoryFeatureFlags::None)
 		)
 		useDiscreteMemory = true; // Pre-allocated memory currently only supported for device local memory
 
@@ -388,19 +444,23 @@ std::shared_ptr<prosper::IImage> create_image(prosper::IPrContext &context,const
 	auto bUseFullMipmapChain = (createInfo.flags &prosper::util::ImageCreateInfo::Flags::FullMipmapChain) != prosper::util::ImageCreateInfo::Flags::None;
 	if(useDiscreteMemory == false || sparse || dontAllocateMemory)
 	{
-		if((createInfo.flags &prosper::util::ImageCreateInfo::Flags::SparseAliasedResidency) != prosper::util::ImageCreateInfo::Flags::None)
-			imageCreateFlags |= Anvil::ImageCreateFlagBits::SPARSE_ALIASED_BIT | Anvil::ImageCreateFlagBits::SPARSE_RESIDENCY_BIT;
-		;
+		if(sparse)
+		{
+			// Memory for sparse images is bound page by page (see SparseImageManager)
+			imageCreateFlags |= Anvil::ImageCreateFlagBits::SPARSE_BINDING_BIT | Anvil::ImageCreateFlagBits::SPARSE_RESIDENCY_BIT;
+			if((createInfo.flags &prosper::util::ImageCreateInfo::Flags::SparseAliasedResidency) != prosper::util::ImageCreateInfo::Flags::None)
+				imageCreateFlags |= Anvil::ImageCreateFlagBits::SPARSE_ALIASED_BIT;
+		}
 		auto img = prosper::VlkImage::Create(context,Anvil::Image::create(
 			Anvil::ImageCreateInfo::create_no_alloc(
 				&static_cast<prosper::VlkContext&>(context).GetDevice(),static_cast<Anvil::ImageType>(createInfo.type),static_cast<Anvil::Format>(createInfo.format),
-				static_cast<Anvil::ImageTiling>(createInfo.tiling),static_cast<Anvil::ImageUsageFlagBits>(createInfo.usage),
+				static_cast<Anvil::ImageTiling>(createInfo.tiling),static_cast<Anvil::ImageUsageFlagBits>(usage),
 				createInfo.width,createInfo.height,1u,layers,
 				static_cast<Anvil::SampleCountFlagBits>(createInfo.samples),queueFamilies,
 				sharingMode,bUseFullMipmapChain,imageCreateFlags,
 				static_cast<Anvil::ImageLayout>(postCreateLayout),data
 			)
-		),createInfo,false);
+		),imgCreateInfo,false);
 		if(sparse == false && dontAllocateMemory == false)
 			context.AllocateDeviceImageBuffer(*img);
 		return img;
@@ -410,13 +470,13 @@ std::shared_ptr<prosper::IImage> create_image(prosper::IPrContext &context,const
 	auto result = prosper::VlkImage::Create(context,Anvil::Image::create(
 		Anvil::ImageCreateInfo::create_alloc(
 			&static_cast<prosper::VlkContext&>(context).GetDevice(),static_cast<Anvil::ImageType>(createInfo.type),static_cast<Anvil::Format>(createInfo.format),
-			static_cast<Anvil::ImageTiling>(createInfo.tiling),static_cast<Anvil::ImageUsageFlagBits>(createInfo.usage),
+			static_cast<Anvil::ImageTiling>(createInfo.tiling),static_cast<Anvil::ImageUsageFlagBits>(usage),
 			createInfo.width,createInfo.height,1u,layers,
 			static_cast<Anvil::SampleCountFlagBits>(createInfo.samples),queueFamilies,
 			sharingMode,bUseFullMipmapChain,memoryFeatureFlags,imageCreateFlags,
 			static_cast<Anvil::ImageLayout>(postCreateLayout),data
 		)
-	),createInfo,false);
+	),imgCreateInfo,false);
 	std::cout<<"Done!"<<std::endl;
 	return result;
 }
@@ -481,20 +541,91 @@ std::shared_ptr<prosper::IRenderPass> prosper::IPrContext::CreateRenderPass(cons
 		}
 		attachmentIds.push_back(attId);
 	}
+	for(auto &attInfo : renderPassInfo.attachments)
+	{
+		if(attInfo.resolveAttachment.has_value() == false)
+			continue;
+		if(*attInfo.resolveAttachment >= renderPassInfo.attachments.size())
+			throw std::logic_error("Attempted to create render pass with invalid resolve attachment index!");
+		auto &resolveAttInfo = renderPassInfo.attachments.at(*attInfo.resolveAttachment);
+		if(util::is_depth_format(attInfo.format) || attInfo.sampleCount == prosper::SampleCountFlags::e1Bit || resolveAttInfo.sampleCount != prosper::SampleCountFlags::e1Bit || resolveAttInfo.format != attInfo.format)
+			throw std::logic_error("Only multi-sampled color attachments can be resolved, and only to a single-sampled attachment of the same format!");
+	}
+	// Resolve attachments are written at the end of the sub-pass, after the multi-sampled attachment has been rendered to
+	const auto fAddColorAttachment = [&rpInfo,&renderPassInfo,&attachmentIds](Anvil::SubPassID subPassId,std::size_t attId,uint32_t location,Anvil::ImageLayout layout=Anvil::ImageLayout::COLOR_ATTACHMENT_OPTIMAL) {
+		auto &resolveAttachment = renderPassInfo.attachments.at(attId).resolveAttachment;
+		rpInfo->add_subpass_color_attachment(
+			subPassId,layout,attachmentIds.at(attId),location,
+			resolveAttachment.has_value() ? &attachmentIds.at(*resolveAttachment) : nullptr
+		);
+	};
 	if(renderPassInfo.subPasses.empty() == false)
 	{
-		for(auto &subPassInfo : renderPassInfo.subPasses)
+		for(auto subPassIdx=decltype(renderPassInfo.subPasses.size()){0u};subPassIdx<renderPassInfo.subPasses.size();++subPassIdx)
 		{
+			auto &subPassInfo = renderPassInfo.subPasses.at(subPassIdx);
 			Anvil::SubPassID subPassId;
 			rpInfo->add_subpass(&subPassId);
+			// Attachments that are written and read in the same sub-pass (feedback loop) have to be in the general layout for all of their references
+			const auto fIsInputAttachment = [&subPassInfo](std::size_t attId) {
+				return std::find(subPassInfo.inputAttachments.begin(),subPassInfo.inputAttachments.end(),attId) != subPassInfo.inputAttachments.end();
+			};
 			auto location = 0u;
 			for(auto attId : subPassInfo.colorAttachments)
-				rpInfo->add_subpass_color_attachment(subPassId,Anvil::ImageLayout::COLOR_ATTACHMENT_OPTIMAL,attId,location++,nullptr);
+				fAddColorAttachment(subPassId,attId,location++,fIsInputAttachment(attId) ? Anvil::ImageLayout::GENERAL : Anvil::ImageLayout::COLOR_ATTACHMENT_OPTIMAL);
 			if(subPassInfo.useDepthStencilAttachment)
 			{
 				if(depthStencilAttId == std::numeric_limits<Anvil::RenderPassAttachmentID>::max())
 					throw std::logic_error("Attempted to add depth stencil attachment sub-pass, but no depth stencil attachment has been specified!");
-				rpInfo->add_subpass_depth_stencil_attachment(subPassId,Anvil::ImageLayout::DEPTH_STENCIL_ATTACHMENT_OPTIMAL,depthStencilAttId);
+				auto isDepthInputAttachment = std::find_if(subPassInfo.inputAttachments.begin(),subPassInfo.inputAttachments.end(),[&renderPassInfo](std::size_t attId) {
+					return util::is_depth_format(renderPassInfo.attachments.at(attId).format);
+				}) != subPassInfo.inputAttachments.end();
+				rpInfo->add_subpass_depth_stencil_attachment(
+					subPassId,isDepthInputAttachment ? Anvil::ImageLayout::GENERAL : Anvil::ImageLayout::DEPTH_STENCIL_ATTACHMENT_OPTIMAL,depthStencilAttId
+				);
+			}
+			auto inputAttachmentIndex = 0u;
+			for(auto attId : subPassInfo.inputAttachments)
+			{
+				auto isDepth = util::is_depth_format(renderPassInfo.attachments.at(attId).format);
+				auto isFeedbackLoop = isDepth ? subPassInfo.useDepthStencilAttachment :
+					(std::find(subPassInfo.colorAttachments.begin(),subPassInfo.colorAttachments.end(),attId) != subPassInfo.colorAttachments.end());
+				auto layout = isFeedbackLoop ? Anvil::ImageLayout::GENERAL :
+					isDepth ? Anvil::ImageLayout::DEPTH_STENCIL_READ_ONLY_OPTIMAL : Anvil::ImageLayout::SHADER_READ_ONLY_OPTIMAL;
+				rpInfo->add_subpass_input_attachment(
+					subPassId,layout,attachmentIds.at(attId),inputAttachmentIndex++,
+					isDepth ? Anvil::ImageAspectFlagBits::DEPTH_BIT : Anvil::ImageAspectFlagBits::COLOR_BIT
+				);
+				auto srcStageMask = isDepth ? (prosper::PipelineStageFlags::EarlyFragmentTestsBit | prosper::PipelineStageFlags::LateFragmentTestsBit) : prosper::PipelineStageFlags::ColorAttachmentOutputBit;
+				auto srcAccessMask = isDepth ? prosper::AccessFlags::DepthStencilAttachmentWriteBit : prosper::AccessFlags::ColorAttachmentWriteBit;
+
+				// Feedback loops require a self-dependency, which allows a pipeline barrier within the sub-pass between the attachment write and the input attachment read
+				if(isFeedbackLoop)
+				{
+					rpInfo->add_subpass_to_subpass_dependency(
+						static_cast<Anvil::SubPassID>(subPassIdx),static_cast<Anvil::SubPassID>(subPassIdx),
+						static_cast<Anvil::PipelineStageFlagBits>(prosper::PipelineStageFlags::FragmentShaderBit),static_cast<Anvil::PipelineStageFlagBits>(srcStageMask),
+						static_cast<Anvil::AccessFlagBits>(prosper::AccessFlags::InputAttachmentReadBit),static_cast<Anvil::AccessFlagBits>(srcAccessMask),
+						Anvil::DependencyFlagBits::BY_REGION_BIT
+					);
+				}
+
+				// The input attachment depends on the last preceding sub-pass that has written to it. Only the same pixel can be read, so the dependency can be by region.
+				for(auto srcSubPassIdx=static_cast<int64_t>(subPassIdx) -1;srcSubPassIdx>=0;--srcSubPassIdx)
+				{
+					auto &srcSubPassInfo = renderPassInfo.subPasses.at(srcSubPassIdx);
+					auto written = isDepth ? srcSubPassInfo.useDepthStencilAttachment :
+						(std::find(srcSubPassInfo.colorAttachments.begin(),srcSubPassInfo.colorAttachments.end(),attId) != srcSubPassInfo.colorAttachments.end());
+					if(written == false)
+						continue;
+					rpInfo->add_subpass_to_subpass_dependency(
+						static_cast<Anvil::SubPassID>(subPassIdx),static_cast<Anvil::SubPassID>(srcSubPassIdx),
+						static_cast<Anvil::PipelineStageFlagBits>(prosper::PipelineStageFlags::FragmentShaderBit),static_cast<Anvil::PipelineStageFlagBits>(srcStageMask),
+						static_cast<Anvil::AccessFlagBits>(prosper::AccessFlags::InputAttachmentReadBit),static_cast<Anvil::AccessFlagBits>(srcAccessMask),
+						Anvil::DependencyFlagBits::BY_REGION_BIT
+					);
+					break;
+				}
 			}
 			for(auto &dependency : subPassInfo.dependencies)
 			{
@@ -519,8 +650,8 @@ std::shared_ptr<prosper::IRenderPass> prosper::IPrContext::CreateRenderPass(cons
 		auto location = 0u;
 		for(auto &attInfo : renderPassInfo.attachments)
 		{
-			if(util::is_depth_format(static_cast<prosper::Format>(attInfo.format)) == false)
-				rpInfo->add_subpass_color_attachment(subPassId,Anvil::ImageLayout::COLOR_ATTACHMENT_OPTIMAL,attId,location++,nullptr);
+			if(util::is_depth_format(static_cast<prosper::Format>(attInfo.format)) == false && renderPassInfo.IsResolveAttachment(attId) == false)
+				fAddColorAttachment(subPassId,attId,location++);
 			++attId;
 		}
 	}
@@ -620,6 +751,13 @@ std::shared_ptr<prosper::Texture> prosper::IPrContext::CreateTexture(
 		imgCreateInfo.memoryFeatures = prosper::MemoryFeatureFlags::GPUBulk;
 		imgCreateInfo.type = img.GetType();
 		imgCreateInfo.usage = img.GetUsageFlags() | ImageUsageFlags::TransferDstBit;
+		if(umath::is_flag_set(imgCreateInfo.usage,ImageUsageFlags::TransientAttachmentBit))
+		{
+			// Transient images only have attachment usages. The resolved image has to be backed by memory, and is the one
+			// that is sampled or copied from instead, so it gets the usages a resolvable texture would have had otherwise.
+			umath::set_flag(imgCreateInfo.usage,ImageUsageFlags::TransientAttachmentBit,false);
+			imgCreateInfo.usage |= ImageUsageFlags::SampledBit | ImageUsageFlags::TransferSrcBit;
+		}
 		imgCreateInfo.tiling = img.GetTiling();
 		imgCreateInfo.layers = img.GetLayerCount();
 		imgCreateInfo.postCreateLayout = ImageLayout::TransferDstOptimal;
@@ -773,11 +911,404 @@ static void init_base_pipeline_create_info(const prosper::BasePipelineCreateInfo
 	anvPipelineCreateInfo.set_descriptor_set_create_info(&anvDsInfos);
 }
 
+// Builds a 64-bit hash over all pipeline state that affects the baked pipeline, including the SPIR-V of all stages.
+// State that is unused by the pipeline (e.g. blend factors with blending disabled, or dynamic viewports) is omitted,
+// so shader variants that only differ in unused state end up with the same key.
+// The SPIR-V blobs are only referenced, they're copied into the shared pipeline table once a new pipeline is added.
+struct PipelineKey
+{
+	uint64_t hash = 14'695'981'039'346'656'037ull;
+	std::string description;
+	std::vector<const std::vector<uint32_t>*> spirv;
+	bool Matches(const std::string &otherDescription,const std::vector<std::vector<uint32_t>> &otherSpirv) const
+	{
+		if(description != otherDescription || spirv.size() != otherSpirv.size())
+			return false;
+		for(auto i=decltype(spirv.size()){0u};i<spirv.size();++i)
+		{
+			if(*spirv[i] != otherSpirv[i])
+				return false;
+		}
+		return true;
+	}
+	std::vector<std::vector<uint32_t>> CopySPIRV() const
+	{
+		std::vector<std::vector<uint32_t>> blobs {};
+		blobs.reserve(spirv.size());
+		for(auto *blob : spirv)
+			blobs.push_back(*blob);
+		return blobs;
+	}
+};
+class PipelineKeyBuilder
+{
+public:
+	template<typename T>
+		void Add(const T &value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		AddBytes(&value,sizeof(value));
+	}
+	void Add(const void *data,size_t size)
+	{
+		Add(size);
+		AddBytes(data,size);
+	}
+	void Add(const std::string &str) {Add(str.data(),str.size());}
+	void AddSPIRV(const std::vector<uint32_t> &spirv)
+	{
+		// The blob is hashed, but not copied into the description; Hash collisions are resolved by comparing the referenced blobs
+		auto size = spirv.size() *sizeof(uint32_t);
+		Add(size);
+		Hash(spirv.data(),size);
+		m_key.spirv.push_back(&spirv);
+	}
+	void AddRenderPass(const prosper::util::RenderPassCreateInfo &rpInfo)
+	{
+		// Render pass objects may be re-created at the same address, so the key is based on the description instead.
+		// Pipelines can be used with any compatible render pass, so sharing them between render passes with the same description is valid.
+		Add(rpInfo.attachments.size());
+		for(auto &att : rpInfo.attachments)
+		{
+			Add(att.format);
+			Add(att.sampleCount);
+			Add(att.loadOp);
+			Add(att.storeOp);
+			Add(att.initialLayout);
+			Add(att.finalLayout);
+			Add(att.resolveAttachment.has_value() ? static_cast<int64_t>(*att.resolveAttachment) : int64_t{-1});
+		}
+		Add(rpInfo.subPasses.size());
+		for(auto &subPass : rpInfo.subPasses)
+		{
+			Add(subPass.colorAttachments.data(),subPass.colorAttachments.size() *sizeof(subPass.colorAttachments.front()));
+			Add(subPass.inputAttachments.data(),subPass.inputAttachments.size() *sizeof(subPass.inputAttachments.front()));
+			Add(subPass.useDepthStencilAttachment);
+			Add(subPass.dependencies.size());
+			for(auto &dependency : subPass.dependencies)
+			{
+				Add(dependency.sourceSubPassId);
+				Add(dependency.destinationSubPassId);
+				Add(dependency.sourceStageMask);
+				Add(dependency.destinationStageMask);
+				Add(dependency.sourceAccessMask);
+				Add(dependency.destinationAccessMask);
+			}
+		}
+	}
+	void AddStage(const prosper::ShaderStageData *stage)
+	{
+		Add(stage != nullptr);
+		if(stage == nullptr)
+			return;
+		Add(stage->stage);
+		if(stage->entryPoint == nullptr)
+			return;
+		Add(stage->entryPoint->name);
+		auto *module = stage->entryPoint->shader_module_ptr;
+		auto *spirv = (module && module->GetSPIRVData().has_value()) ? &*module->GetSPIRVData() : &stage->spirvBlob;
+		AddSPIRV(*spirv);
+	}
+	void AddBaseState(const prosper::BasePipelineCreateInfo &createInfo,bool computePipeline)
+	{
+		for(auto i=decltype(umath::to_integral(prosper::ShaderStage::Count)){0u};i<umath::to_integral(prosper::ShaderStage::Count);++i)
+		{
+			auto stage = static_cast<prosper::ShaderStage>(i);
+			if(computePipeline && stage != prosper::ShaderStage::Compute)
+				continue;
+			const std::vector<prosper::SpecializationConstant> *specializationConstants;
+			const uint8_t *dataBuffer;
+			if(createInfo.GetSpecializationConstants(stage,&specializationConstants,&dataBuffer) == false)
+				continue;
+			Add(specializationConstants->size());
+			for(auto &specializationConstant : *specializationConstants)
+			{
+				Add(specializationConstant.constantId);
+				Add(dataBuffer +specializationConstant.startOffset,specializationConstant.numBytes);
+			}
+		}
+		auto &pushConstantRanges = createInfo.GetPushConstantRanges();
+		Add(pushConstantRanges.size());
+		for(auto &range : pushConstantRanges)
+		{
+			Add(range.offset);
+			Add(range.size);
+			Add(range.stages);
+		}
+		auto *dsInfos = createInfo.GetDsCreateInfoItems();
+		Add(dsInfos->size());
+		for(auto &dsInfo : *dsInfos)
+		{
+			auto numBindings = dsInfo->GetBindingCount();
+			Add(numBindings);
+			for(auto j=decltype(numBindings){0u};j<numBindings;++j)
+			{
+				uint32_t bindingIndex;
+				prosper::DescriptorType type;
+				uint32_t arraySize;
+				prosper::ShaderStageFlags stageFlags;
+				bool immutableSamplers;
+				prosper::DescriptorBindingFlags flags;
+				if(const_cast<prosper::DescriptorSetCreateInfo&>(*dsInfo).GetBindingPropertiesByIndexNumber(j,&bindingIndex,&type,&arraySize,&stageFlags,&immutableSamplers,&flags) == false)
+					continue;
+				Add(bindingIndex);
+				Add(type);
+				Add(arraySize);
+				Add(stageFlags);
+				Add(immutableSamplers);
+				Add(flags);
+			}
+		}
+	}
+	PipelineKey &GetKey() {return m_key;}
+private:
+	void Hash(const void *data,size_t size)
+	{
+		// FNV-1a
+		auto *bytes = static_cast<const uint8_t*>(data);
+		for(auto i=decltype(size){0u};i<size;++i)
+			m_key.hash = (m_key.hash ^bytes[i]) *1'099'511'628'211ull;
+	}
+	void AddBytes(const void *data,size_t size)
+	{
+		m_key.description.append(static_cast<const char*>(data),size);
+		Hash(data,size);
+	}
+	PipelineKey m_key;
+};
+
+static PipelineKey get_compute_pipeline_key(const prosper::ComputePipelineCreateInfo &createInfo,const prosper::ShaderStageData &stage)
+{
+	PipelineKeyBuilder builder {};
+	builder.AddStage(&stage);
+	builder.AddBaseState(createInfo,true);
+	return std::move(builder.GetKey());
+}
+
+static PipelineKey get_graphics_pipeline_key(
+	const prosper::GraphicsPipelineCreateInfo &createInfo,const prosper::IRenderPass &rp,prosper::SubPassID subPassId,
+	const std::array<const prosper::ShaderStageData*,5> &stages
+)
+{
+	PipelineKeyBuilder builder {};
+	builder.AddRenderPass(rp.GetCreateInfo());
+	builder.Add(subPassId);
+	for(auto *stage : stages)
+		builder.AddStage(stage);
+	builder.AddBaseState(createInfo,false);
+
+	const prosper::DynamicState *dynamicStates;
+	uint32_t numDynamicStates;
+	createInfo.GetEnabledDynamicStates(&dynamicStates,&numDynamicStates);
+	uint32_t dynamicStateMask = 0u;
+	for(auto i=decltype(numDynamicStates){0u};i<numDynamicStates;++i)
+		dynamicStateMask |= 1u<<umath::to_integral(dynamicStates[i]);
+	auto isDynamic = [dynamicStateMask](prosper::DynamicState state) {return (dynamicStateMask &(1u<<umath::to_integral(state))) != 0u;};
+	builder.Add(dynamicStateMask);
+
+	builder.Add(createInfo.AreDepthWritesEnabled());
+	builder.Add(createInfo.IsAlphaToCoverageEnabled());
+	builder.Add(createInfo.IsAlphaToOneEnabled());
+	builder.Add(createInfo.IsDepthClampEnabled());
+	builder.Add(createInfo.IsDepthClipEnabled());
+	builder.Add(createInfo.IsPrimitiveRestartEnabled());
+	builder.Add(createInfo.IsRasterizerDiscardEnabled());
+	builder.Add(createInfo.IsSampleMaskEnabled());
+	builder.Add(createInfo.GetPrimitiveTopology());
+
+	const float *blendConstants;
+	uint32_t numBlendAttachments;
+	createInfo.GetBlendingProperties(&blendConstants,&numBlendAttachments);
+	builder.Add(numBlendAttachments);
+	auto usesBlendConstants = false;
+	for(auto attId=decltype(numBlendAttachments){0u};attId<numBlendAttachments;++attId)
+	{
+		bool blendingEnabled;
+		prosper::BlendOp blendOps[2];
+		prosper::BlendFactor blendFactors[4];
+		prosper::ColorComponentFlags channelWriteMask;
+		if(createInfo.GetColorBlendAttachmentProperties(
+			attId,&blendingEnabled,&blendOps[0],&blendOps[1],
+			&blendFactors[0],&blendFactors[1],&blendFactors[2],&blendFactors[3],
+			&channelWriteMask
+		) == false)
+			continue;
+		builder.Add(channelWriteMask);
+		builder.Add(blendingEnabled);
+		if(blendingEnabled == false)
+			continue;
+		builder.Add(blendOps);
+		builder.Add(blendFactors);
+		for(auto factor : blendFactors)
+		{
+			switch(factor)
+			{
+			case prosper::BlendFactor::ConstantColor:
+			case prosper::BlendFactor::OneMinusConstantColor:
+			case prosper::BlendFactor::ConstantAlpha:
+			case prosper::BlendFactor::OneMinusConstantAlpha:
+				usesBlendConstants = true;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+	if(usesBlendConstants && isDynamic(prosper::DynamicState::BlendConstants) == false)
+		builder.Add(blendConstants,sizeof(float) *4);
+
+	bool isDepthBiasStateEnabled;
+	float depthBias[3];
+	createInfo.GetDepthBiasState(&isDepthBiasStateEnabled,&depthBias[0],&depthBias[1],&depthBias[2]);
+	builder.Add(isDepthBiasStateEnabled);
+	if(isDepthBiasStateEnabled && isDynamic(prosper::DynamicState::DepthBias) == false)
+		builder.Add(depthBias);
+
+	bool isDepthBoundsStateEnabled;
+	float depthBounds[2];
+	createInfo.GetDepthBoundsState(&isDepthBoundsStateEnabled,&depthBounds[0],&depthBounds[1]);
+	builder.Add(isDepthBoundsStateEnabled);
+	if(isDepthBoundsStateEnabled && isDynamic(prosper::DynamicState::DepthBounds) == false)
+		builder.Add(depthBounds);
+
+	bool isDepthTestEnabled;
+	prosper::CompareOp depthCompareOp;
+	createInfo.GetDepthTestState(&isDepthTestEnabled,&depthCompareOp);
+	builder.Add(isDepthTestEnabled);
+	if(isDepthTestEnabled)
+		builder.Add(depthCompareOp);
+
+	uint32_t numScissors;
+	uint32_t numViewports;
+	uint32_t numVertexBindings;
+	createInfo.GetGraphicsPipelineProperties(&numScissors,&numViewports,&numVertexBindings,nullptr,nullptr);
+	builder.Add(createInfo.GetDynamicScissorBoxesCount());
+	builder.Add(createInfo.GetDynamicViewportsCount());
+	if(isDynamic(prosper::DynamicState::Scissor) == false)
+	{
+		builder.Add(numScissors);
+		for(auto i=decltype(numScissors){0u};i<numScissors;++i)
+		{
+			int32_t offset[2];
+			uint32_t extents[2];
+			if(createInfo.GetScissorBoxProperties(i,&offset[0],&offset[1],&extents[0],&extents[1]) == false)
+				continue;
+			builder.Add(offset);
+			builder.Add(extents);
+		}
+	}
+	if(isDynamic(prosper::DynamicState::Viewport) == false)
+	{
+		builder.Add(numViewports);
+		for(auto i=decltype(numViewports){0u};i<numViewports;++i)
+		{
+			float viewport[6];
+			if(createInfo.GetViewportProperties(i,&viewport[0],&viewport[1],&viewport[2],&viewport[3],&viewport[4],&viewport[5]) == false)
+				continue;
+			builder.Add(viewport);
+		}
+	}
+	builder.Add(numVertexBindings);
+	for(auto i=decltype(numVertexBindings){0u};i<numVertexBindings;++i)
+	{
+		uint32_t bindingIndex;
+		uint32_t stride;
+		prosper::VertexInputRate rate;
+		uint32_t numAttributes;
+		const prosper::VertexInputAttribute *attributes;
+		uint32_t divisor;
+		if(createInfo.GetVertexBindingProperties(i,&bindingIndex,&stride,&rate,&numAttributes,&attributes,&divisor) == false)
+			continue;
+		builder.Add(bindingIndex);
+		builder.Add(stride);
+		builder.Add(rate);
+		builder.Add(divisor);
+		builder.Add(attributes,numAttributes *sizeof(attributes[0]));
+	}
+
+	bool isLogicOpEnabled;
+	prosper::LogicOp logicOp;
+	createInfo.GetLogicOpState(&isLogicOpEnabled,&logicOp);
+	builder.Add(isLogicOpEnabled);
+	if(isLogicOpEnabled)
+		builder.Add(logicOp);
+
+	bool isSampleShadingEnabled;
+	float minSampleShading;
+	createInfo.GetSampleShadingState(&isSampleShadingEnabled,&minSampleShading);
+	builder.Add(isSampleShadingEnabled);
+	if(isSampleShadingEnabled)
+		builder.Add(minSampleShading);
+
+	prosper::SampleCountFlags sampleCount;
+	const prosper::SampleMask *sampleMask;
+	createInfo.GetMultisamplingProperties(&sampleCount,&sampleMask);
+	builder.Add(sampleCount);
+	if(createInfo.IsSampleMaskEnabled())
+		builder.Add(*sampleMask);
+
+	prosper::PolygonMode polygonMode;
+	prosper::CullModeFlags cullMode;
+	prosper::FrontFace frontFace;
+	float lineWidth;
+	createInfo.GetRasterizationProperties(&polygonMode,&cullMode,&frontFace,&lineWidth);
+	builder.Add(polygonMode);
+	builder.Add(cullMode);
+	builder.Add(frontFace);
+	if(isDynamic(prosper::DynamicState::LineWidth) == false)
+		builder.Add(lineWidth);
+
+	bool isStencilTestEnabled;
+	prosper::StencilOp stencilOps[6];
+	prosper::CompareOp stencilCompareOps[2];
+	uint32_t stencilValues[6];
+	createInfo.GetStencilTestProperties(
+		&isStencilTestEnabled,
+		&stencilOps[0],&stencilOps[1],&stencilOps[2],&stencilCompareOps[0],
+		&stencilValues[0],&stencilValues[1],&stencilValues[2],
+		&stencilOps[3],&stencilOps[4],&stencilOps[5],&stencilCompareOps[1],
+		&stencilValues[3],&stencilValues[4],&stencilValues[5]
+	);
+	builder.Add(isStencilTestEnabled);
+	if(isStencilTestEnabled)
+	{
+		builder.Add(stencilOps);
+		builder.Add(stencilCompareOps);
+		if(isDynamic(prosper::DynamicState::StencilCompareMask) == false)
+		{
+			builder.Add(stencilValues[0]);
+			builder.Add(stencilValues[3]);
+		}
+		if(isDynamic(prosper::DynamicState::StencilWriteMask) == false)
+		{
+			builder.Add(stencilValues[1]);
+			builder.Add(stencilValues[4]);
+		}
+		if(isDynamic(prosper::DynamicState::StencilReference) == false)
+		{
+			builder.Add(stencilValues[2]);
+			builder.Add(stencilValues[5]);
+		}
+	}
+	return std::move(builder.GetKey());
+}
+
 std::optional<prosper::PipelineID> prosper::IPrContext::AddPipeline(
 	const prosper::ComputePipelineCreateInfo &createInfo,
 	prosper::ShaderStageData &stage,PipelineID basePipelineId
 )
 {
+	std::scoped_lock lock {m_pipelineMutex};
+	auto key = get_compute_pipeline_key(createInfo,stage);
+	auto range = m_sharedComputePipelines.keyToPipeline.equal_range(key.hash);
+	for(auto it=range.first;it!=range.second;++it)
+	{
+		if(key.Matches(it->second.description,it->second.spirv) == false)
+			continue;
+		++it->second.refCount;
+		return it->second.pipelineId;
+	}
+
 	Anvil::PipelineCreateFlags createFlags = Anvil::PipelineCreateFlagBits::ALLOW_DERIVATIVES_BIT;
 	auto bIsDerivative = basePipelineId != std::numeric_limits<Anvil::PipelineID>::max();
 	if(bIsDerivative)
@@ -797,10 +1328,25 @@ std::optional<prosper::PipelineID> prosper::IPrContext::AddPipeline(
 	if(r == false)
 		return {};
 	computePipelineManager->bake();
+	m_sharedComputePipelines.keyToPipeline.insert({key.hash,{pipelineId,1u,std::move(key.description),key.CopySPIRV()}});
+	m_sharedComputePipelines.pipelineToKey[pipelineId] = key.hash;
 	return pipelineId;
 }
 bool prosper::IPrContext::ClearPipeline(bool graphicsShader,PipelineID pipelineId)
 {
+	std::scoped_lock lock {m_pipelineMutex};
+	auto &sharedPipelines = graphicsShader ? m_sharedGraphicsPipelines : m_sharedComputePipelines;
+	auto itKey = sharedPipelines.pipelineToKey.find(pipelineId);
+	if(itKey != sharedPipelines.pipelineToKey.end())
+	{
+		auto range = sharedPipelines.keyToPipeline.equal_range(itKey->second);
+		auto itShared = std::find_if(range.first,range.second,[pipelineId](const auto &pair) {return pair.second.pipelineId == pipelineId;});
+		if(itShared != range.second && --itShared->second.refCount > 0)
+			return true; // Still in use by another shader
+		if(itShared != range.second)
+			sharedPipelines.keyToPipeline.erase(itShared);
+		sharedPipelines.pipelineToKey.erase(itKey);
+	}
 	auto &dev = static_cast<VlkContext&>(*this).GetDevice();
 	if(graphicsShader)
 		return dev.get_graphics_pipeline_manager()->delete_pipeline(pipelineId);
@@ -819,6 +1365,17 @@ std::optional<prosper::PipelineID> prosper::IPrContext::AddPipeline(
 	PipelineID basePipelineId
 )
 {
+	std::scoped_lock lock {m_pipelineMutex};
+	auto key = get_graphics_pipeline_key(createInfo,rp,subPassId,{shaderStageFs,shaderStageVs,shaderStageGs,shaderStageTc,shaderStageTe});
+	auto range = m_sharedGraphicsPipelines.keyToPipeline.equal_range(key.hash);
+	for(auto it=range.first;it!=range.second;++it)
+	{
+		if(key.Matches(it->second.description,it->second.spirv) == false)
+			continue;
+		++it->second.refCount;
+		return it->second.pipelineId;
+	}
+
 	auto &dev = static_cast<VlkContext&>(*this).GetDevice();
 	Anvil::PipelineCreateFlags createFlags = Anvil::PipelineCreateFlagBits::ALLOW_DERIVATIVES_BIT;
 	auto bIsDerivative = basePipelineId != std::numeric_limits<Anvil::PipelineID>::max();
@@ -1027,6 +1584,8 @@ std::optional<prosper::PipelineID> prosper::IPrContext::AddPipeline(
 	auto r = gfxPipelineManager->add_pipeline(std::move(gfxPipelineInfo),&pipelineId);
 	if(r == false)
 		return {};
+	m_sharedGraphicsPipelines.keyToPipeline.insert({key.hash,{pipelineId,1u,std::move(key.description),key.CopySPIRV()}});
+	m_sharedGraphicsPipelines.pipelineToKey[pipelineId] = key.hash;
 	return pipelineId;
 }
 
@@ -1815,7 +2374,25 @@ prosper::util::Limits prosper::util::get_physical_device_limits(const IPrContext
 	Limits limits {};
 	limits.maxSamplerAnisotropy = vkLimits.max_sampler_anisotropy;
 	limits.maxStorageBufferRange = vkLimits.max_storage_buffer_range;
+	limits.maxUniformBufferRange = vkLimits.max_uniform_buffer_range;
+	limits.minUniformBufferOffsetAlignment = vkLimits.min_uniform_buffer_offset_alignment;
 	limits.maxImageArrayLayers = vkLimits.max_image_array_layers;
+	limits.maxPerStageDescriptorSamplers = vkLimits.max_per_stage_descriptor_samplers;
+	limits.maxPerStageDescriptorSampledImages = vkLimits.max_per_stage_descriptor_sampled_images;
+	limits.maxDrawIndirectCount = vkLimits.max_draw_indirect_count;
+
+	auto &dev = static_cast<VlkContext&>(const_cast<IPrContext&>(context)).GetDevice();
+	auto *descIndexingFeatures = dev.get_physical_device_features().ext_descriptor_indexing_features_ptr;
+	auto *descIndexingProps = dev.get_physical_device_properties().ext_descriptor_indexing_properties_ptr;
+	if(
+		dev.get_extension_info()->ext_descriptor_indexing() && descIndexingFeatures && descIndexingProps &&
+		descIndexingFeatures->descriptor_binding_partially_bound && descIndexingFeatures->descriptor_binding_sampled_image_update_after_bind &&
+		descIndexingFeatures->descriptor_binding_update_unused_while_pending
+	)
+	{
+		limits.maxPerStageDescriptorUpdateAfterBindSamplers = descIndexingProps->max_per_stage_descriptor_update_after_bind_samplers;
+		limits.maxPerStageDescriptorUpdateAfterBindSampledImages = descIndexingProps->max_per_stage_descriptor_update_after_bind_sampled_images;
+	}
 
 	Anvil::SurfaceCapabilities surfCapabilities {};
 	if(static_cast<VlkContext&>(const_cast<IPrContext&>(context)).GetSurfaceCapabilities(surfCapabilities))
@@ -1823,6 +2400,11 @@ prosper::util::Limits prosper::util::get_physical_device_limits(const IPrContext
 	return limits;
 }
 
+bool prosper::util::is_draw_indirect_count_supported(const IPrContext &context)
+{
+	return static_cast<VlkContext&>(const_cast<IPrContext&>(context)).GetDevice().get_extension_info()->khr_draw_indirect_count();
+}
+
 std::optional<prosper::util::PhysicalDeviceImageFormatProperties> prosper::util::get_physical_device_image_format_properties(const IPrContext &context,const ImageFormatPropertiesQuery &query)
 {
 	auto &dev = static_cast<VlkContext&>(const_cast<IPrContext&>(context)).GetDevice();
@@ -2122,283 +2704,282 @@ static bool is_compatible(prosper::Format imgFormat,uimg::TextureInfo::OutputFor
 	}
 	return false;
 }
-bool prosper::util::save_texture(const std::string &fileName,prosper::IImage &image,const uimg::TextureInfo &texInfo,const std::function<void(const std::string&)> &errorHandler)
+namespace
+{
+	// Intermediate state of a texture readback, shared between save_texture and save_texture_async
+	struct TextureReadback
+	{
+		// Image data is written through gli if the output format matches the image format (or the image is compressed), otherwise through util_image
+		bool useGli = false;
+		prosper::Format readFormat = prosper::Format::Unknown;
+		std::optional<uimg::TextureInfo> convTexInfo = {};
+
+		// GPU resources, which have to be kept alive until the copy has been completed
+		std::shared_ptr<prosper::IImage> srcImage = nullptr;
+		std::shared_ptr<prosper::IImage> readImage = nullptr; // Same as srcImage if no format conversion is required
+		std::shared_ptr<prosper::IBuffer> buffer = nullptr;
+
+		std::vector<std::vector<size_t>> layerMipmapOffsets = {};
+		uint64_t size = 0ull;
+		prosper::Extent2D extents = {};
+		uint32_t numLayers = 0u;
+		uint32_t numMipmaps = 0u;
+		bool cubemap = false;
+
+		// Host copy of the image data
+		std::shared_ptr<gli::texture2d> gliTex = nullptr;
+		std::vector<uint8_t> data = {};
+	};
+};
+static void init_texture_readback_format(prosper::IImage &image,const uimg::TextureInfo &texInfo,TextureReadback &readback)
 {
-	std::shared_ptr<prosper::IImage> imgRead = image.shared_from_this();
 	auto srcFormat = image.GetFormat();
 	auto dstFormat = srcFormat;
 	if(texInfo.inputFormat != uimg::TextureInfo::InputFormat::KeepInputImageFormat)
 		dstFormat = static_cast<prosper::Format>(get_anvil_format(texInfo.inputFormat));
-	if(texInfo.outputFormat == uimg::TextureInfo::OutputFormat::KeepInputImageFormat || is_compressed_format(imgRead->GetFormat()))
+	readback.useGli = (texInfo.outputFormat == uimg::TextureInfo::OutputFormat::KeepInputImageFormat || prosper::util::is_compressed_format(srcFormat));
+	readback.readFormat = dstFormat;
+	if(readback.useGli == false)
+		return;
+	readback.readFormat = srcFormat;
+	if(is_compatible(srcFormat,texInfo.outputFormat))
+		return;
+	// Note: We should just be able to convert the image to
+	// the destination format directly, but for some reason this code
+	// causes issues when dealing with compressed formats. So instead,
+	// we convert it to a generic color format, and then redirect the image compression
+	// to the util_image library instead of gli.
+	// TODO: It would be much more efficient to use gli for this, too, find out why this isn't working?
+	readback.readFormat = prosper::Format::R32G32B32A32_SFloat;
+	readback.convTexInfo = texInfo;
+	readback.convTexInfo->inputFormat = uimg::TextureInfo::InputFormat::R32G32B32A32_Float;
+}
+// Creates all resources required for the readback. Nothing is recorded yet, so a failure doesn't leave any commands behind.
+static bool init_texture_readback_resources(prosper::IImage &image,TextureReadback &readback)
+{
+	auto &context = image.GetContext();
+	readback.srcImage = image.shared_from_this();
+	readback.readImage = readback.srcImage;
+	if(readback.readFormat != image.GetFormat())
 	{
-		std::optional<uimg::TextureInfo> convTexInfo = {};
-		if(is_compatible(imgRead->GetFormat(),texInfo.outputFormat) == false)
+		auto copyCreateInfo = image.GetCreateInfo();
+		copyCreateInfo.format = readback.readFormat;
+		copyCreateInfo.usage |= prosper::ImageUsageFlags::TransferSrcBit | prosper::ImageUsageFlags::TransferDstBit;
+		copyCreateInfo.memoryFeatures = prosper::MemoryFeatureFlags::DeviceLocal;
+		copyCreateInfo.postCreateLayout = prosper::ImageLayout::TransferDstOptimal;
+		copyCreateInfo.tiling = prosper::ImageTiling::Optimal; // Needs to be in optimal tiling because some GPUs do not support linear tiling with mipmaps
+		readback.readImage = context.CreateImage(copyCreateInfo);
+		if(readback.readImage == nullptr)
+			return false;
+	}
+	auto &imgRead = *readback.readImage;
+	readback.extents = imgRead.GetExtents();
+	readback.numLayers = imgRead.GetLayerCount();
+	readback.numMipmaps = imgRead.GetMipmapCount();
+	readback.cubemap = imgRead.IsCubemap();
+	if(readback.useGli)
+		readback.gliTex = std::make_shared<gli::texture2d>(static_cast<gli::texture::format_type>(readback.readFormat),gli::extent2d{readback.extents.width,readback.extents.height},readback.numMipmaps);
+	auto sizePerPixel = prosper::util::is_compressed_format(readback.readFormat) ? gli::block_size(static_cast<gli::texture::format_type>(readback.readFormat)) : prosper::util::get_byte_size(readback.readFormat);
+	readback.layerMipmapOffsets.resize(readback.numLayers);
+	readback.size = 0ull;
+	for(auto iLayer=decltype(readback.numLayers){0u};iLayer<readback.numLayers;++iLayer)
+	{
+		auto &mipmapOffsets = readback.layerMipmapOffsets.at(iLayer);
+		mipmapOffsets.resize(readback.numMipmaps);
+		for(auto iMipmap=decltype(readback.numMipmaps){0u};iMipmap<readback.numMipmaps;++iMipmap)
 		{
-			// Convert the image into the target format
-			auto &context = image.GetContext();
-			auto &setupCmd = context.GetSetupCommandBuffer();
-
-			// Note: We should just be able to convert the image to
-			// the destination format directly, but for some reason this code
-			// causes issues when dealing with compressed formats. So instead,
-			// we convert it to a generic color format, and then redirect the image compression
-			// to the util_image library instead of gli.
-			// TODO: It would be much more efficient to use gli for this, too, find out why this isn't working?
-			auto copyCreateInfo = image.GetCreateInfo();
-			//copyCreateInfo.format = Anvil::Format::BC1_RGBA_UNORM_BLOCK;//get_anvil_format(texInfo.outputFormat);
-			copyCreateInfo.format = Format::R32G32B32A32_SFloat;
-			copyCreateInfo.memoryFeatures = prosper::MemoryFeatureFlags::DeviceLocal;
-			copyCreateInfo.postCreateLayout = ImageLayout::TransferDstOptimal;
-			copyCreateInfo.tiling = ImageTiling::Optimal; // Needs to be in optimal tiling because some GPUs do not support linear tiling with mipmaps
-			setupCmd->RecordImageBarrier(image,ImageLayout::ShaderReadOnlyOptimal,ImageLayout::TransferSrcOptimal);
-			imgRead = image.Copy(*setupCmd,copyCreateInfo);
-			setupCmd->RecordImageBarrier(image,ImageLayout::TransferSrcOptimal,ImageLayout::ShaderReadOnlyOptimal);
-			setupCmd->RecordImageBarrier(*imgRead,ImageLayout::TransferDstOptimal,ImageLayout::ShaderReadOnlyOptimal);
-			context.FlushSetupCommandBuffer();
-
-			convTexInfo = texInfo;
-			convTexInfo->inputFormat = uimg::TextureInfo::InputFormat::R32G32B32A32_Float;
+			mipmapOffsets.at(iMipmap) = readback.size;
+			auto extents = imgRead.GetExtents(iMipmap);
+			readback.size += readback.gliTex ? readback.gliTex->size(iMipmap) : (extents.width *extents.height *sizePerPixel);
 		}
+	}
 
-		// No conversion needed, just copy the image data to a buffer and save it directly
-		auto extents = imgRead->GetExtents();
-		auto numLayers = imgRead->GetLayerCount();
-		auto numLevels = imgRead->GetMipmapCount();
-		auto &context = imgRead->GetContext();
-		auto &setupCmd = context.GetSetupCommandBuffer();
-
-		gli::extent2d gliExtents {extents.width,extents.height};
-		gli::texture2d gliTex {static_cast<gli::texture::format_type>(imgRead->GetFormat()),gliExtents,numLevels};
-
-		prosper::util::BufferCreateInfo bufCreateInfo {};
-		bufCreateInfo.memoryFeatures = prosper::MemoryFeatureFlags::GPUToCPU;
-		bufCreateInfo.size = gliTex.size();
-		bufCreateInfo.usageFlags = prosper::BufferUsageFlags::TransferDstBit;
-		auto buf = context.CreateBuffer(bufCreateInfo);
-		buf->SetPermanentlyMapped(true);
-
-		setupCmd->RecordImageBarrier(*imgRead,ImageLayout::ShaderReadOnlyOptimal,ImageLayout::TransferSrcOptimal);
-		// Initialize buffer with image data
-		size_t bufferOffset = 0;
-		for(auto iLayer=decltype(numLayers){0u};iLayer<numLayers;++iLayer)
+	prosper::util::BufferCreateInfo bufCreateInfo {};
+	bufCreateInfo.memoryFeatures = prosper::MemoryFeatureFlags::GPUToCPU;
+	bufCreateInfo.size = readback.size;
+	bufCreateInfo.usageFlags = prosper::BufferUsageFlags::TransferDstBit;
+	readback.buffer = context.CreateBuffer(bufCreateInfo);
+	return readback.buffer != nullptr;
+}
+// Records the format conversion (if required) and the copy of all layers and mipmaps into the readback buffer.
+// The image is expected to be in the shader read-only layout and is transitioned back to it afterwards.
+static void record_texture_readback(prosper::ICommandBuffer &cmd,TextureReadback &readback)
+{
+	auto &image = *readback.srcImage;
+	auto &imgRead = *readback.readImage;
+	cmd.RecordImageBarrier(image,prosper::ImageLayout::ShaderReadOnlyOptimal,prosper::ImageLayout::TransferSrcOptimal);
+	if(&imgRead != &image)
+	{
+		prosper::util::BlitInfo blitInfo {};
+		blitInfo.dstSubresourceLayer.layerCount = blitInfo.srcSubresourceLayer.layerCount = umath::min(imgRead.GetLayerCount(),image.GetLayerCount());
+		auto numMipmaps = umath::min(imgRead.GetMipmapCount(),image.GetMipmapCount());
+		for(auto i=decltype(numMipmaps){0u};i<numMipmaps;++i)
 		{
-			for(auto iMipmap=decltype(numLevels){0u};iMipmap<numLevels;++iMipmap)
-			{
-				auto extents = imgRead->GetExtents(iMipmap);
-				auto mipmapSize = gliTex.size(iMipmap);
-				prosper::util::BufferImageCopyInfo copyInfo {};
-				copyInfo.baseArrayLayer = iLayer;
-				copyInfo.bufferOffset = bufferOffset;
-				copyInfo.dstImageLayout = ImageLayout::TransferSrcOptimal;
-				copyInfo.width = extents.width;
-				copyInfo.height = extents.height;
-				copyInfo.layerCount = 1;
-				copyInfo.mipLevel = iMipmap;
-				setupCmd->RecordCopyImageToBuffer(copyInfo,*imgRead,ImageLayout::TransferSrcOptimal,*buf);
-
-				bufferOffset += mipmapSize;
-			}
+			blitInfo.dstSubresourceLayer.mipLevel = blitInfo.srcSubresourceLayer.mipLevel = i;
+			cmd.RecordBlitImage(blitInfo,image,imgRead);
 		}
-		setupCmd->RecordImageBarrier(*imgRead,ImageLayout::TransferSrcOptimal,ImageLayout::ShaderReadOnlyOptimal);
-		context.FlushSetupCommandBuffer();
-
-		// Copy the data to a gli texture object
-		bufferOffset = 0ull;
-		for(auto iLayer=decltype(numLayers){0u};iLayer<numLayers;++iLayer)
+		cmd.RecordImageBarrier(image,prosper::ImageLayout::TransferSrcOptimal,prosper::ImageLayout::ShaderReadOnlyOptimal);
+		cmd.RecordImageBarrier(imgRead,prosper::ImageLayout::TransferDstOptimal,prosper::ImageLayout::TransferSrcOptimal);
+	}
+	for(auto iLayer=decltype(readback.numLayers){0u};iLayer<readback.numLayers;++iLayer)
+	{
+		for(auto iMipmap=decltype(readback.numMipmaps){0u};iMipmap<readback.numMipmaps;++iMipmap)
 		{
-			for(auto iMipmap=decltype(numLevels){0u};iMipmap<numLevels;++iMipmap)
-			{
-				auto extents = imgRead->GetExtents(iMipmap);
-				auto mipmapSize = gliTex.size(iMipmap);
-				auto *dstData = gliTex.data(iLayer,0u /* face */,iMipmap);
-				memset(dstData,1,mipmapSize);
-				buf->Read(bufferOffset,mipmapSize,dstData);
-				bufferOffset += mipmapSize;
-			}
+			auto extents = imgRead.GetExtents(iMipmap);
+			prosper::util::BufferImageCopyInfo copyInfo {};
+			copyInfo.baseArrayLayer = iLayer;
+			copyInfo.bufferOffset = readback.layerMipmapOffsets.at(iLayer).at(iMipmap);
+			copyInfo.dstImageLayout = prosper::ImageLayout::TransferSrcOptimal;
+			copyInfo.width = extents.width;
+			copyInfo.height = extents.height;
+			copyInfo.layerCount = 1;
+			copyInfo.mipLevel = iMipmap;
+			cmd.RecordCopyImageToBuffer(copyInfo,imgRead,prosper::ImageLayout::TransferSrcOptimal,*readback.buffer);
 		}
-		if(convTexInfo.has_value())
+	}
+	cmd.RecordImageBarrier(imgRead,prosper::ImageLayout::TransferSrcOptimal,prosper::ImageLayout::ShaderReadOnlyOptimal);
+	cmd.RecordBufferBarrier(
+		*readback.buffer,prosper::PipelineStageFlags::TransferBit,prosper::PipelineStageFlags::HostBit,
+		prosper::AccessFlags::TransferWriteBit,prosper::AccessFlags::HostReadBit
+	);
+}
+// Moves the image data into host memory and releases the GPU resources. Has to be called once the copy has been completed.
+static bool read_texture_readback(TextureReadback &readback)
+{
+	auto success = true;
+	if(readback.gliTex)
+	{
+		for(auto iLayer=decltype(readback.numLayers){0u};iLayer<readback.numLayers && success;++iLayer)
 		{
-			std::vector<std::vector<const void*>> layerMipmapData {};
-			layerMipmapData.reserve(numLayers);
-			for(auto iLayer=decltype(numLayers){0u};iLayer<numLayers;++iLayer)
-			{
-				layerMipmapData.push_back({});
-				auto &mipmapData = layerMipmapData.back();
-				mipmapData.reserve(numLevels);
-				for(auto iMipmap=decltype(numLevels){0u};iMipmap<numLevels;++iMipmap)
-				{
-					auto *dstData = gliTex.data(iLayer,0u /* face */,iMipmap);
-					mipmapData.push_back(dstData);
-				}
-			}
-			return uimg::save_texture(fileName,layerMipmapData,extents.width,extents.height,sizeof(float) *4,*convTexInfo,false);
+			for(auto iMipmap=decltype(readback.numMipmaps){0u};iMipmap<readback.numMipmaps && success;++iMipmap)
+				success = readback.buffer->Read(readback.layerMipmapOffsets.at(iLayer).at(iMipmap),readback.gliTex->size(iMipmap),readback.gliTex->data(iLayer,0u /* face */,iMipmap));
 		}
-		auto fullFileName = uimg::get_absolute_path(fileName,texInfo.containerFormat);
-		switch(texInfo.containerFormat)
+	}
+	else
+	{
+		readback.data.resize(readback.size);
+		success = readback.buffer->Read(0ull,readback.size,readback.data.data());
+	}
+	readback.buffer = nullptr;
+	readback.readImage = nullptr;
+	readback.srcImage = nullptr;
+	return success;
+}
+// Encodes the host copy of the image data and writes it to the file. Doesn't access any GPU resources.
+static bool write_texture_readback(const std::string &fileName,const uimg::TextureInfo &texInfo,const TextureReadback &readback,const std::function<void(const std::string&)> &errorHandler)
+{
+	if(readback.gliTex == nullptr)
+	{
+		return uimg::save_texture(fileName,[&readback](uint32_t iLayer,uint32_t iMipmap,std::function<void(void)> &outDeleter) -> const uint8_t* {
+			return readback.data.data() +readback.layerMipmapOffsets.at(iLayer).at(iMipmap);
+		},readback.extents.width,readback.extents.height,prosper::util::get_byte_size(readback.readFormat),readback.numLayers,readback.numMipmaps,readback.cubemap,texInfo,errorHandler);
+	}
+	if(readback.convTexInfo.has_value())
+	{
+		std::vector<std::vector<const void*>> layerMipmapData {};
+		layerMipmapData.reserve(readback.numLayers);
+		for(auto iLayer=decltype(readback.numLayers){0u};iLayer<readback.numLayers;++iLayer)
 		{
-		case uimg::TextureInfo::ContainerFormat::DDS:
-			return gli::save_dds(gliTex,fullFileName);
-		case uimg::TextureInfo::ContainerFormat::KTX:
-			return gli::save_ktx(gliTex,fullFileName);
+			layerMipmapData.push_back({});
+			auto &mipmapData = layerMipmapData.back();
+			mipmapData.reserve(readback.numMipmaps);
+			for(auto iMipmap=decltype(readback.numMipmaps){0u};iMipmap<readback.numMipmaps;++iMipmap)
+				mipmapData.push_back(readback.gliTex->data(iLayer,0u /* face */,iMipmap));
 		}
-		return false;
+		return uimg::save_texture(fileName,layerMipmapData,readback.extents.width,readback.extents.height,sizeof(float) *4,*readback.convTexInfo,false);
 	}
-
-	std::shared_ptr<prosper::IBuffer> buf = nullptr;
-	std::vector<std::vector<size_t>> layerMipmapOffsets {};
-	uint32_t sizePerPixel = 0u;
+	auto fullFileName = uimg::get_absolute_path(fileName,texInfo.containerFormat);
+	switch(texInfo.containerFormat)
+	{
+	case uimg::TextureInfo::ContainerFormat::DDS:
+		return gli::save_dds(*readback.gliTex,fullFileName);
+	case uimg::TextureInfo::ContainerFormat::KTX:
+		return gli::save_ktx(*readback.gliTex,fullFileName);
+	}
+	return false;
+}
+bool prosper::util::save_texture(const std::string &fileName,prosper::IImage &image,const uimg::TextureInfo &texInfo,const std::function<void(const std::string&)> &errorHandler)
+{
+	TextureReadback readback {};
+	init_texture_readback_format(image,texInfo,readback);
 	if(
-		image.GetTiling() != ImageTiling::Linear ||
-		umath::is_flag_set(image.GetCreateInfo().memoryFeatures,prosper::MemoryFeatureFlags::HostAccessable) == false ||
-		image.GetFormat() != dstFormat
-		)
+		readback.useGli == false && image.GetTiling() == ImageTiling::Linear &&
+		umath::is_flag_set(image.GetCreateInfo().memoryFeatures,prosper::MemoryFeatureFlags::HostAccessable) &&
+		image.GetFormat() == readback.readFormat
+	)
 	{
-		// Convert the image into the target format
-		auto &context = image.GetContext();
-		auto &setupCmd = context.GetSetupCommandBuffer();
+		// The image memory can be read directly
+		std::shared_ptr<prosper::IImage> imgRead = image.shared_from_this();
+		auto extents = imgRead->GetExtents();
+		return uimg::save_texture(fileName,[imgRead](uint32_t iLayer,uint32_t iMipmap,std::function<void(void)> &outDeleter) -> const uint8_t* {
+			auto subresourceLayout = imgRead->GetSubresourceLayout(iLayer,iMipmap);
+			if(subresourceLayout.has_value() == false)
+				return nullptr;
+			void *data;
+			auto *memBlock = static_cast<prosper::VlkImage&>(*imgRead)->get_memory_block();
+			if(memBlock->map(subresourceLayout->offset,subresourceLayout->size,&data) == false)
+				return nullptr;
+			outDeleter = [memBlock]() {
+				memBlock->unmap(); // Note: setMipmapData copies the data, so we don't need to keep it mapped
+			};
+			return static_cast<uint8_t*>(data);
+		},extents.width,extents.height,get_byte_size(readback.readFormat),imgRead->GetLayerCount(),imgRead->GetMipmapCount(),imgRead->IsCubemap(),texInfo,errorHandler);
+	}
+	if(init_texture_readback_resources(image,readback) == false)
+		return false;
+	auto &context = image.GetContext();
+	record_texture_readback(*context.GetSetupCommandBuffer(),readback);
+	context.FlushSetupCommandBuffer();
+	return read_texture_readback(readback) && write_texture_readback(fileName,texInfo,readback,errorHandler);
+}
+std::future<bool> prosper::util::save_texture_async(const std::string &fileName,prosper::IImage &image,const uimg::TextureInfo &texInfo,const std::function<void(const std::string&)> &errorHandler)
+{
+	auto result = std::make_shared<std::promise<bool>>();
+	auto future = result->get_future();
 
-		auto copyCreateInfo = image.GetCreateInfo();
-		copyCreateInfo.format = dstFormat;
-		copyCreateInfo.memoryFeatures = prosper::MemoryFeatureFlags::DeviceLocal;
-		copyCreateInfo.postCreateLayout = ImageLayout::TransferDstOptimal;
-		copyCreateInfo.tiling = ImageTiling::Optimal; // Needs to be in optimal tiling because some GPUs do not support linear tiling with mipmaps
-		setupCmd->RecordImageBarrier(image,ImageLayout::ShaderReadOnlyOptimal,ImageLayout::TransferSrcOptimal);
-		imgRead = image.Copy(*setupCmd,copyCreateInfo);
-		setupCmd->RecordImageBarrier(image,ImageLayout::TransferSrcOptimal,ImageLayout::ShaderReadOnlyOptimal);
-
-		// Copy the image data to a buffer
-		uint64_t size = 0;
-		uint64_t offset = 0;
-		auto numLayers = image.GetLayerCount();
-		auto numMipmaps = image.GetMipmapCount();
-		sizePerPixel = prosper::util::is_compressed_format(dstFormat) ? gli::block_size(static_cast<gli::texture::format_type>(dstFormat)) : prosper::util::get_byte_size(dstFormat);
-		layerMipmapOffsets.resize(numLayers);
-		for(auto iLayer=decltype(numLayers){0u};iLayer<numLayers;++iLayer)
-		{
-			auto &mipmapOffsets = layerMipmapOffsets.at(iLayer);
-			mipmapOffsets.resize(numMipmaps);
-			for(auto iMipmap=decltype(numMipmaps){0u};iMipmap<numMipmaps;++iMipmap)
-			{
-				mipmapOffsets.at(iMipmap) = size;
+	auto readback = std::make_shared<TextureReadback>();
+	init_texture_readback_format(image,texInfo,*readback);
+	if(init_texture_readback_resources(image,*readback) == false)
+	{
+		result->set_value(false);
+		return future;
+	}
 
-				auto extents = image.GetExtents(iMipmap);
-				size += extents.width *extents.height *sizePerPixel;
-			}
-		}
-		buf = context.AllocateTemporaryBuffer(size);
-		if(buf == nullptr)
+	auto &context = image.GetContext();
+	// The copy is recorded into the current frame if possible. Buffer copies are not allowed within a render pass,
+	// in which case (or if no frame is being recorded) we have to fall back to the setup command buffer.
+	auto recordIntoFrame = context.IsRecording() && get_current_render_pass_target(*context.GetDrawCommandBuffer()) == false;
+	auto &cmd = recordIntoFrame ? context.GetDrawCommandBuffer() : context.GetSetupCommandBuffer();
+	record_texture_readback(*cmd,*readback);
+
+	// Executed on the main thread once the GPU has completed the copy. The data is moved into host memory right away, so the
+	// GPU resources are released on the main thread and the worker thread only has to deal with plain memory.
+	auto fOnCopyComplete = [&context,readback,result,fileName,texInfo,errorHandler]() {
+		if(read_texture_readback(*readback) == false)
 		{
-			context.FlushSetupCommandBuffer();
-			return false; // Buffer allocation failed; Requested size too large?
+			result->set_value(false);
+			return;
 		}
-		setupCmd->RecordImageBarrier(*imgRead,ImageLayout::TransferDstOptimal,ImageLayout::TransferSrcOptimal);
-
-		prosper::util::BufferImageCopyInfo copyInfo {};
-		copyInfo.dstImageLayout = ImageLayout::TransferSrcOptimal;
-
-		struct ImageMipmapData
-		{
-			uint32_t mipmapIndex = 0u;
-			uint64_t bufferOffset = 0ull;
-			uint64_t bufferSize = 0ull;
-			vk::Extent2D extents = {};
-		};
-		struct ImageLayerData
-		{
-			std::vector<ImageMipmapData> mipmaps = {};
-			uint32_t layerIndex = 0u;
-		};
-		std::vector<ImageLayerData> layers = {};
-		for(auto iLayer=decltype(numLayers){0u};iLayer<numLayers;++iLayer)
-		{
-			layers.push_back({});
-			auto &layerData = layers.back();
-			layerData.layerIndex = iLayer;
-			for(auto iMipmap=decltype(numMipmaps){0u};iMipmap<numMipmaps;++iMipmap)
+		context.AddWorkerTask([readback,result,fileName,texInfo,errorHandler]() {
+			try
 			{
-				layerData.mipmaps.push_back({});
-				auto &mipmapData = layerData.mipmaps.back();
-				mipmapData.mipmapIndex = iMipmap;
-				mipmapData.bufferOffset = layerMipmapOffsets.at(iLayer).at(iMipmap);
-
-				auto extents = image.GetExtents(iMipmap);
-				static_assert(sizeof(prosper::Extent2D) == sizeof(vk::Extent2D));
-				mipmapData.extents = reinterpret_cast<vk::Extent2D&>(extents);
-				mipmapData.bufferSize = extents.width *extents.height *sizePerPixel;
+				result->set_value(write_texture_readback(fileName,texInfo,*readback,errorHandler));
 			}
-		}
-		for(auto &layerData : layers)
-		{
-			for(auto &mipmapData : layerData.mipmaps)
+			catch(...)
 			{
-				copyInfo.mipLevel = mipmapData.mipmapIndex;
-				copyInfo.baseArrayLayer = layerData.layerIndex;
-				copyInfo.bufferOffset = mipmapData.bufferOffset;
-				setupCmd->RecordCopyImageToBuffer(copyInfo,*imgRead,ImageLayout::TransferSrcOptimal,*buf);
+				result->set_exception(std::current_exception());
 			}
-		}
-		context.FlushSetupCommandBuffer();
-
-		/*// The dds library expects the image data in RGB form, so we have to do some conversions in some cases.
-		std::optional<util::ImageBuffer::Format> imgBufFormat = {};
-		switch(srcFormat)
-		{
-		case Anvil::Format::B8G8R8_UNORM:
-		case Anvil::Format::B8G8R8A8_UNORM:
-		imgBufFormat = util::ImageBuffer::Format::RGBA32; // TODO: dst format
-		break;
-		}
-		if(imgBufFormat.has_value())
-		{
-		for(auto &layerData : layers)
-		{
-		for(auto &mipmapData : layerData.mipmaps)
-		{
-		std::vector<uint8_t> imgData {};
-		imgData.resize(mipmapData.bufferSize);
-		if(buf->Read(mipmapData.bufferOffset,mipmapData.bufferSize,imgData.data()))
-		{
-		// Swap red and blue channels, then write the new image data back to the buffer
-		auto imgBuf = util::ImageBuffer::Create(imgData.data(),mipmapData.extents.width,mipmapData.extents.height,*imgBufFormat,true);
-		imgBuf->SwapChannels(util::ImageBuffer::Channel::Red,util::ImageBuffer::Channel::Blue);
-		buf->Write(mipmapData.bufferOffset,mipmapData.bufferSize,imgData.data());
-		}
-		}
-		}
-		}*/
-	}
-	auto numLayers = imgRead->GetLayerCount();
-	auto numMipmaps = imgRead->GetMipmapCount();
-	auto cubemap = imgRead->IsCubemap();
-	auto extents = imgRead->GetExtents();
-	if(buf != nullptr)
+		});
+	};
+	if(recordIntoFrame)
+		context.AddFrameCompletionCallback(fOnCopyComplete);
+	else
 	{
-		return uimg::save_texture(fileName,[imgRead,buf,&layerMipmapOffsets,sizePerPixel](uint32_t iLayer,uint32_t iMipmap,std::function<void(void)> &outDeleter) -> const uint8_t* {
-			void *data;
-			auto *memBlock = dynamic_cast<VlkBuffer&>(*buf)->get_memory_block(0u);
-			auto offset = layerMipmapOffsets.at(iLayer).at(iMipmap);
-			auto extents = imgRead->GetExtents(iMipmap);
-			auto size = extents.width *extents.height *sizePerPixel;
-			if(memBlock->map(offset,sizePerPixel,&data) == false)
-				return nullptr;
-			outDeleter = [memBlock]() {
-				memBlock->unmap(); // Note: setMipmapData copies the data, so we don't need to keep it mapped
-			};
-			return static_cast<uint8_t*>(data);
-		},extents.width,extents.height,get_byte_size(dstFormat),numLayers,numMipmaps,cubemap,texInfo,errorHandler);
+		// No frame is being recorded, so there's nothing we could defer the copy to.
+		// The copy itself is cheap, the encoding will still happen on the worker thread.
+		context.FlushSetupCommandBuffer();
+		fOnCopyComplete();
 	}
-	return uimg::save_texture(fileName,[imgRead](uint32_t iLayer,uint32_t iMipmap,std::function<void(void)> &outDeleter) -> const uint8_t* {
-		auto subresourceLayout = imgRead->GetSubresourceLayout(iLayer,iMipmap);
-		if(subresourceLayout.has_value() == false)
-			return nullptr;
-		void *data;
-		auto *memBlock = static_cast<prosper::VlkImage&>(*imgRead)->get_memory_block();
-		if(memBlock->map(subresourceLayout->offset,subresourceLayout->size,&data) == false)
-			return nullptr;
-		outDeleter = [memBlock]() {
-			memBlock->unmap(); // Note: setMipmapData copies the data, so we don't need to keep it mapped
-		};
-		return static_cast<uint8_t*>(data);
-		},extents.width,extents.height,get_byte_size(dstFormat),numLayers,numMipmaps,cubemap,texInfo,errorHandler);
+	return future;
 }
 #pragma optimize("",on)
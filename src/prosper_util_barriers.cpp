@@ -9,6 +9,7 @@
 #include "vk_command_buffer.hpp"
 #include "debug/prosper_debug.hpp"
 #include "image/prosper_render_target.hpp"
+#include "image/prosper_msaa_texture.hpp"
 #include "image/vk_image_view.hpp"
 #include "image/vk_image.hpp"
 #include "vk_command_buffer.hpp"
@@ -375,6 +376,7 @@ struct DebugRenderTargetInfo
 	std::weak_ptr<prosper::IImage> image;
 	std::weak_ptr<prosper::IFramebuffer> framebuffer;
 	std::weak_ptr<prosper::RenderTarget> renderTarget;
+	uint32_t subPassId = 0u;
 };
 static std::unordered_map<prosper::IPrimaryCommandBuffer*,DebugRenderTargetInfo> s_wpCurrentRenderTargets = {};
 bool prosper::util::get_current_render_pass_target(prosper::IPrimaryCommandBuffer &cmdBuffer,prosper::IRenderPass **outRp,prosper::IImage **outImg,prosper::IFramebuffer **outFb,prosper::RenderTarget **outRt)
@@ -393,6 +395,11 @@ bool prosper::util::get_current_render_pass_target(prosper::IPrimaryCommandBuffe
 		*outRt = dbgInfo.renderTarget.lock().get();
 	return true;
 }
+uint32_t prosper::util::get_current_sub_pass_id(prosper::IPrimaryCommandBuffer &cmdBuffer)
+{
+	auto it = s_wpCurrentRenderTargets.find(&cmdBuffer);
+	return (it != s_wpCurrentRenderTargets.end()) ? it->second.subPassId : std::numeric_limits<uint32_t>::max();
+}
 
 bool prosper::IPrimaryCommandBuffer::DoRecordBeginRenderPass(
 	prosper::IImage &img,prosper::IRenderPass &rp,prosper::IFramebuffer &fb,
@@ -455,7 +462,7 @@ bool prosper::IPrimaryCommandBuffer::DoRecordBeginRenderPass(
 	auto extents = img.GetExtents();
 	static_assert(sizeof(prosper::Extent2D) == sizeof(vk::Extent2D));
 	auto renderArea = vk::Rect2D(vk::Offset2D(),reinterpret_cast<vk::Extent2D&>(extents));
-	s_wpCurrentRenderTargets[&*this] = {rp.shared_from_this(),(layerId != nullptr) ? *layerId : std::numeric_limits<uint32_t>::max(),img.shared_from_this(),fb.shared_from_this(),std::weak_ptr<prosper::RenderTarget>{}};
+	s_wpCurrentRenderTargets[&*this] = {rp.shared_from_this(),(layerId != nullptr) ? *layerId : std::numeric_limits<uint32_t>::max(),img.shared_from_this(),fb.shared_from_this(),std::weak_ptr<prosper::RenderTarget>{},0u};
 	return static_cast<prosper::VlkPrimaryCommandBuffer&>(*this)->record_begin_render_pass(
 		clearValues.size(),reinterpret_cast<const VkClearValue*>(clearValues.data()),
 		&static_cast<prosper::VlkFramebuffer&>(fb).GetAnvilFramebuffer(),renderArea,&static_cast<prosper::VlkRenderPass&>(rp).GetAnvilRenderPass(),Anvil::SubpassContents::INLINE
@@ -472,7 +479,23 @@ bool prosper::IPrimaryCommandBuffer::DoRecordBeginRenderPass(prosper::RenderTarg
 		throw std::runtime_error("Attempted to begin render pass with NULL render pass object!");
 	auto &tex = rt.GetTexture();
 	auto &img = tex.GetImage();
-	return DoRecordBeginRenderPass(img,*rp,*fb,layerId,clearValues);
+	if(DoRecordBeginRenderPass(img,*rp,*fb,layerId,clearValues) == false)
+		return false;
+	// MSAA textures whose resolved texture is bound as their resolve attachment are resolved by this render pass;
+	// Any other use of an MSAA texture as attachment invalidates a previous resolve by a render pass.
+	auto &rpCreateInfo = rp->GetCreateInfo();
+	auto numAttachments = umath::min(static_cast<size_t>(rt.GetAttachmentCount()),rpCreateInfo.attachments.size());
+	for(auto i=decltype(numAttachments){0u};i<numAttachments;++i)
+	{
+		auto *attTex = rt.GetTexture(i);
+		if(attTex == nullptr || attTex->IsMSAATexture() == false)
+			continue;
+		auto &msaaTex = static_cast<prosper::MSAATexture&>(*attTex);
+		auto &resolveAttachment = rpCreateInfo.attachments.at(i).resolveAttachment;
+		msaaTex.m_bResolvedByRenderPass = resolveAttachment.has_value() && *resolveAttachment < rt.GetAttachmentCount() &&
+			rt.GetTexture(*resolveAttachment) == msaaTex.GetResolvedTexture().get();
+	}
+	return true;
 }
 bool prosper::IPrimaryCommandBuffer::RecordBeginRenderPass(prosper::RenderTarget &rt,uint32_t layerId,const prosper::ClearValue *clearValue,prosper::IRenderPass *rp)
 {
@@ -495,6 +518,25 @@ bool prosper::IPrimaryCommandBuffer::RecordBeginRenderPass(prosper::IImage &img,
 	return DoRecordBeginRenderPass(img,rp,fb,0u,clearValues);
 }
 
+bool prosper::VlkPrimaryCommandBuffer::RecordNextSubPass()
+{
+	auto it = s_wpCurrentRenderTargets.find(this);
+	if(it != s_wpCurrentRenderTargets.end())
+	{
+		auto &dbgInfo = it->second;
+		auto rp = dbgInfo.renderPass.lock();
+		if(GetContext().IsValidationEnabled() && rp && dbgInfo.subPassId +1 >= rp->GetCreateInfo().GetSubPassCount())
+		{
+			prosper::debug::exec_debug_validation_callback(
+				prosper::DebugReportObjectTypeEXT::RenderPass,"Next sub-pass: Render pass '" +rp->GetDebugName() +"' has no sub-pass after sub-pass " +std::to_string(dbgInfo.subPassId) +"!"
+			);
+			return false;
+		}
+		++dbgInfo.subPassId;
+	}
+	return (*this)->record_next_subpass(Anvil::SubpassContents::INLINE);
+}
+
 bool prosper::VlkCommandBuffer::RecordClearImage(IImage &img,ImageLayout layout,const std::array<float,4> &clearColor,const util::ClearImageInfo &clearImageInfo)
 {
 	// TODO
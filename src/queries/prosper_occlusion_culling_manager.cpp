@@ -0,0 +1,214 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "stdafx_prosper.h"
+#include "queries/prosper_occlusion_culling_manager.hpp"
+#include "queries/prosper_query_pool.hpp"
+#include "prosper_context.hpp"
+#include "prosper_command_buffer.hpp"
+#include "vk_command_buffer.hpp"
+#include <wrappers/command_buffer.h>
+#include <wrappers/query_pool.h>
+#include <algorithm>
+
+using namespace prosper;
+
+std::shared_ptr<OcclusionCullingManager> OcclusionCullingManager::Create(IPrContext &context,const CreateInfo &createInfo)
+{
+	if(createInfo.maxQueriesPerFrame == 0u)
+		return nullptr;
+	// Queries of a frame can only be re-used once the frame has been completed, so we need one batch per frame in flight,
+	// plus one for the frame that is currently being recorded
+	auto batchCount = context.GetSwapchainImageCount() +1u;
+	auto queryPool = util::create_query_pool(context,QueryType::Occlusion,createInfo.maxQueriesPerFrame *batchCount);
+	if(queryPool == nullptr)
+		return nullptr;
+	return std::shared_ptr<OcclusionCullingManager>{new OcclusionCullingManager{context,queryPool,createInfo,batchCount}};
+}
+
+OcclusionCullingManager::OcclusionCullingManager(IPrContext &context,const std::shared_ptr<QueryPool> &queryPool,const CreateInfo &createInfo,uint32_t batchCount)
+	: m_context{context},m_createInfo{createInfo},m_queryPool{queryPool},m_batches(batchCount)
+{
+	m_createInfo.stableResultCount = std::clamp(m_createInfo.stableResultCount,1u,32u);
+	m_createInfo.visibleRetestInterval = std::max(m_createInfo.visibleRetestInterval,1u);
+	m_createInfo.occludedRetestInterval = std::max(m_createInfo.occludedRetestInterval,1u);
+	for(auto &batch : m_batches)
+		batch.queries.reserve(m_createInfo.maxQueriesPerFrame);
+}
+
+OcclusionCullingManager::~OcclusionCullingManager()
+{
+	// Queries may still be in flight
+	m_context.KeepResourceAliveUntilPresentationComplete(m_queryPool);
+}
+
+OcclusionCullingManager::ObjectId OcclusionCullingManager::AddObject()
+{
+	ObjectId id;
+	if(m_freeObjects.empty() == false)
+	{
+		id = m_freeObjects.front();
+		m_freeObjects.pop();
+	}
+	else
+	{
+		id = m_objects.size();
+		m_objects.push_back({});
+	}
+	auto &o = m_objects.at(id);
+	auto generation = o.generation;
+	o = {};
+	o.generation = generation;
+	o.valid = true;
+	++m_numObjects;
+	return id;
+}
+void OcclusionCullingManager::RemoveObject(ObjectId id)
+{
+	if(id >= m_objects.size() || m_objects.at(id).valid == false)
+		return;
+	auto &o = m_objects.at(id);
+	o.valid = false;
+	++o.generation; // Results of pending queries for this object will be discarded
+	m_freeObjects.push(id);
+	--m_numObjects;
+}
+
+bool OcclusionCullingManager::BeginFrame(ICommandBuffer &cmdBuffer)
+{
+	auto frameId = m_context.GetLastFrameId();
+	if(frameId == m_frameId)
+		return m_currentBatch != std::numeric_limits<uint32_t>::max();
+	m_frameId = frameId;
+	m_currentBatch = std::numeric_limits<uint32_t>::max();
+	m_activeQuery = std::numeric_limits<uint32_t>::max();
+	auto it = std::find_if(m_batches.begin(),m_batches.end(),[](const Batch &batch) {return batch.inUse == false;});
+	if(it == m_batches.end())
+		return false; // All batches are still in flight; No queries will be issued this frame
+	auto batchIdx = static_cast<uint32_t>(it -m_batches.begin());
+	auto firstQuery = batchIdx *m_createInfo.maxQueriesPerFrame;
+	if(dynamic_cast<VlkCommandBuffer&>(cmdBuffer)->record_reset_query_pool(&m_queryPool->GetAnvilQueryPool(),firstQuery,m_createInfo.maxQueriesPerFrame) == false)
+		return false;
+	it->inUse = true;
+	it->queries.clear();
+	m_currentBatch = batchIdx;
+
+	// The callback is executed once the GPU has finished this frame, at which point the results are guaranteed to be available
+	std::weak_ptr<OcclusionCullingManager> wpThis = shared_from_this();
+	m_context.AddFrameCompletionCallback([wpThis,batchIdx]() {
+		if(wpThis.expired() == false)
+			wpThis.lock()->ProcessBatchResults(batchIdx);
+	});
+	return true;
+}
+
+void OcclusionCullingManager::ProcessBatchResults(uint32_t batchIdx)
+{
+	auto &batch = m_batches.at(batchIdx);
+	auto numQueries = static_cast<uint32_t>(batch.queries.size());
+	if(numQueries > 0u)
+	{
+		// Result and availability per query
+		m_resultData.resize(numQueries *2u);
+		auto bAllQueryResultsRetrieved = false;
+		auto bSuccess = m_queryPool->GetAnvilQueryPool().get_query_pool_results(
+			batchIdx *m_createInfo.maxQueriesPerFrame,numQueries,
+			static_cast<Anvil::QueryResultFlagBits>(QueryResultFlags::e64Bit | QueryResultFlags::WithAvailabilityBit),
+			m_resultData.data(),&bAllQueryResultsRetrieved
+		);
+		if(bSuccess)
+		{
+			for(auto i=decltype(numQueries){0u};i<numQueries;++i)
+			{
+				auto &query = batch.queries.at(i);
+				auto available = m_resultData.at(i *2u +1u) != 0ull;
+				if(available == false || query.object >= m_objects.size())
+					continue; // Object keeps its previous state
+				auto &o = m_objects.at(query.object);
+				if(o.valid == false || o.generation != query.generation)
+					continue;
+				auto visible = m_resultData.at(i *2u) > 0ull;
+				o.history = (o.history<<1u) | (visible ? 1u : 0u);
+				o.resultCount = std::min(o.resultCount +1u,32u);
+			}
+		}
+	}
+	batch.queries.clear();
+	batch.inUse = false;
+}
+
+bool OcclusionCullingManager::IsStable(const Object &o) const
+{
+	auto n = m_createInfo.stableResultCount;
+	if(o.resultCount < n)
+		return false;
+	auto mask = (n >= 32u) ? std::numeric_limits<uint32_t>::max() : ((1u<<n) -1u);
+	auto bits = o.history &mask;
+	return bits == 0u || bits == mask;
+}
+
+bool OcclusionCullingManager::ShouldTest(ObjectId id) const
+{
+	if(id >= m_objects.size())
+		return false;
+	auto &o = m_objects.at(id);
+	if(o.valid == false)
+		return false;
+	if(o.lastTestFrame == std::numeric_limits<uint64_t>::max())
+		return true;
+	auto frameId = m_context.GetLastFrameId();
+	if(o.lastTestFrame == frameId)
+		return false;
+	if(IsStable(o) == false)
+		return true;
+	auto interval = IsVisible(id) ? m_createInfo.visibleRetestInterval : m_createInfo.occludedRetestInterval;
+	return (frameId -o.lastTestFrame) >= interval;
+}
+
+bool OcclusionCullingManager::IsVisible(ObjectId id) const
+{
+	if(id >= m_objects.size())
+		return true;
+	auto &o = m_objects.at(id);
+	if(o.valid == false || o.resultCount == 0u)
+		return true;
+	return (o.history &1u) != 0u;
+}
+
+bool OcclusionCullingManager::RecordBeginQuery(ICommandBuffer &cmdBuffer,ObjectId id)
+{
+	if(
+		m_currentBatch == std::numeric_limits<uint32_t>::max() || m_frameId != m_context.GetLastFrameId() ||
+		m_activeQuery != std::numeric_limits<uint32_t>::max() || id >= m_objects.size() || m_objects.at(id).valid == false
+	)
+		return false;
+	auto &batch = m_batches.at(m_currentBatch);
+	if(batch.queries.size() >= m_createInfo.maxQueriesPerFrame)
+		return false;
+	auto queryId = m_currentBatch *m_createInfo.maxQueriesPerFrame +static_cast<uint32_t>(batch.queries.size());
+	if(dynamic_cast<VlkCommandBuffer&>(cmdBuffer)->record_begin_query(&m_queryPool->GetAnvilQueryPool(),queryId,{}) == false)
+		return false;
+	auto &o = m_objects.at(id);
+	batch.queries.push_back({id,o.generation});
+	o.lastTestFrame = m_frameId;
+	m_activeQuery = queryId;
+	return true;
+}
+bool OcclusionCullingManager::RecordEndQuery(ICommandBuffer &cmdBuffer)
+{
+	if(m_activeQuery == std::numeric_limits<uint32_t>::max())
+		return false;
+	auto queryId = m_activeQuery;
+	m_activeQuery = std::numeric_limits<uint32_t>::max();
+	return dynamic_cast<VlkCommandBuffer&>(cmdBuffer)->record_end_query(&m_queryPool->GetAnvilQueryPool(),queryId);
+}
+
+uint32_t OcclusionCullingManager::GetQueryCount() const
+{
+	if(m_currentBatch == std::numeric_limits<uint32_t>::max())
+		return 0u;
+	return m_batches.at(m_currentBatch).queries.size();
+}
+uint32_t OcclusionCullingManager::GetObjectCount() const {return m_numObjects;}
+const OcclusionCullingManager::CreateInfo &OcclusionCullingManager::GetCreateInfo() const {return m_createInfo;}
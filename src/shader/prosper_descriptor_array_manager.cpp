@@ -11,18 +11,31 @@
 
 using namespace prosper;
 
+uint32_t DescriptorArrayManager::GetMaxArraySize(prosper::IPrContext &context,bool *outUpdateAfterBind)
+{
+	auto limits = prosper::util::get_physical_device_limits(context);
+	// Each combined image sampler counts against both the sampler and the sampled image limits
+	auto updateAfterBind = (limits.maxPerStageDescriptorUpdateAfterBindSamplers > 0 && limits.maxPerStageDescriptorUpdateAfterBindSampledImages > 0);
+	auto arraySize = updateAfterBind ?
+		std::min(limits.maxPerStageDescriptorUpdateAfterBindSamplers,limits.maxPerStageDescriptorUpdateAfterBindSampledImages) :
+		std::min(limits.maxPerStageDescriptorSamplers,limits.maxPerStageDescriptorSampledImages);
+	if(outUpdateAfterBind)
+		*outUpdateAfterBind = updateAfterBind;
+	return std::min(arraySize,MAX_ARRAY_SIZE);
+}
+
 DescriptorArrayManager::DescriptorArrayManager(const std::shared_ptr<prosper::IDescriptorSetGroup> &matArrayDsg,ArrayIndex maxArrayLayers,uint32_t bindingIndex)
 	: m_dsgArray{matArrayDsg},m_maxArrayLayers{maxArrayLayers},m_bindingIndex{bindingIndex}
 {}
 
-void DescriptorArrayManager::PushFreeIndex(ArrayIndex index) {m_freeIndices.push(index);}
+void DescriptorArrayManager::PushFreeIndex(ArrayIndex index) {m_freeIndices.push_back(index);}
 
 std::optional<DescriptorArrayManager::ArrayIndex> DescriptorArrayManager::PopFreeIndex()
 {
 	if(m_freeIndices.empty() == false)
 	{
-		auto index = m_freeIndices.front();
-		m_freeIndices.pop();
+		auto index = m_freeIndices.back();
+		m_freeIndices.pop_back();
 		return index;
 	}
 	if(m_nextIndex >= m_maxArrayLayers)
@@ -35,11 +48,43 @@ std::optional<DescriptorArrayManager::ArrayIndex> DescriptorArrayManager::AddIte
 	auto index = PopFreeIndex();
 	if(index.has_value() == false)
 		return {};
+	// The binding callback only stages the descriptor write; It will be pushed to the device with the next flush
 	if(fAddBinding(*m_dsgArray->GetDescriptorSet(),*index,m_bindingIndex) == false)
 	{
 		PushFreeIndex(*index);
 		return {};
 	}
+	if(m_pendingUpdates == false)
+	{
+		m_pendingUpdates = true;
+		// All writes staged until then are pushed in one batch, before anything of the next frame is recorded
+		auto wpThis = std::weak_ptr<DescriptorArrayManager>{shared_from_this()};
+		m_dsgArray->GetContext().ScheduleRecordCommands([wpThis](prosper::IPrimaryCommandBuffer &cmd) {
+			if(wpThis.expired())
+				return;
+			wpThis.lock()->FlushPendingUpdates();
+		});
+	}
 	return index;
 }
-void DescriptorArrayManager::RemoveItem(ArrayIndex index) {PushFreeIndex(index);}
+void DescriptorArrayManager::RemoveItem(ArrayIndex index)
+{
+	// Command buffers of frames that are still in flight may still access the slot,
+	// so we can't hand it out again until they have completed.
+	auto wpThis = std::weak_ptr<DescriptorArrayManager>{shared_from_this()};
+	m_dsgArray->GetContext().AddFrameCompletionCallback([wpThis,index]() {
+		if(wpThis.expired())
+			return;
+		wpThis.lock()->PushFreeIndex(index);
+	});
+}
+void DescriptorArrayManager::FlushPendingUpdates()
+{
+	if(m_pendingUpdates == false)
+		return;
+	m_pendingUpdates = false;
+	m_dsgArray->GetDescriptorSet()->Update();
+}
+bool DescriptorArrayManager::HasPendingUpdates() const {return m_pendingUpdates;}
+DescriptorArrayManager::ArrayIndex DescriptorArrayManager::GetArraySize() const {return m_maxArrayLayers;}
+const std::shared_ptr<prosper::IDescriptorSetGroup> &DescriptorArrayManager::GetDescriptorSetGroup() const {return m_dsgArray;}
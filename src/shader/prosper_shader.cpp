@@ -23,6 +23,9 @@
 #include <misc/render_pass_create_info.h>
 #include <misc/image_view_create_info.h>
 #include <iostream>
+#include <future>
+#include <atomic>
+#include <algorithm>
 #include <fsys/filesystem.h>
 #include <sharedutils/util.h>
 
@@ -34,12 +37,78 @@ prosper::DescriptorSetInfo::DescriptorSetInfo(DescriptorSetInfo *parent,const st
 {}
 bool prosper::DescriptorSetInfo::WasBaked() const {return m_bWasBaked;}
 bool prosper::DescriptorSetInfo::IsValid() const {return WasBaked();}
-prosper::DescriptorSetInfo::Binding::Binding(DescriptorType type,ShaderStageFlags shaderStages,uint32_t descriptorArraySize,uint32_t bindingIndex)
-	: bindingIndex(bindingIndex),type(type),shaderStages(shaderStages),descriptorArraySize(descriptorArraySize)
+prosper::DescriptorSetInfo::Binding::Binding(DescriptorType type,ShaderStageFlags shaderStages,uint32_t descriptorArraySize,uint32_t bindingIndex,DescriptorBindingFlags flags)
+	: bindingIndex(bindingIndex),type(type),shaderStages(shaderStages),descriptorArraySize(descriptorArraySize),flags(flags)
 {}
 
 ///////////////////////////
 
+void prosper::SpecializationConstantValues::Set(ShaderStage stage,uint32_t constantId,uint32_t numBytes,const void *data)
+{
+	m_keyDirty = true;
+	auto it = std::find_if(m_entries.begin(),m_entries.end(),[stage,constantId](const Entry &entry) {
+		return entry.stage > stage || (entry.stage == stage && entry.constantId >= constantId);
+	});
+	if(it != m_entries.end() && it->stage == stage && it->constantId == constantId)
+	{
+		if(it->numBytes == numBytes)
+		{
+			memcpy(m_data.data() +it->offset,data,numBytes);
+			return;
+		}
+		it = m_entries.erase(it);
+	}
+	Entry entry {stage,constantId,numBytes,static_cast<uint32_t>(m_data.size())};
+	m_data.resize(m_data.size() +numBytes);
+	memcpy(m_data.data() +entry.offset,data,numBytes);
+	m_entries.insert(it,entry);
+}
+void prosper::SpecializationConstantValues::Clear()
+{
+	m_entries.clear();
+	m_data.clear();
+	m_keyDirty = true;
+}
+bool prosper::SpecializationConstantValues::IsEmpty() const {return m_entries.empty();}
+void prosper::SpecializationConstantValues::ForEach(const std::function<void(ShaderStage,uint32_t,uint32_t,const void*)> &f) const
+{
+	for(auto &entry : m_entries)
+		f(entry.stage,entry.constantId,entry.numBytes,m_data.data() +entry.offset);
+}
+bool prosper::SpecializationConstantValues::Contains(ShaderStage stage,uint32_t constantId) const
+{
+	return std::find_if(m_entries.begin(),m_entries.end(),[stage,constantId](const Entry &entry) {
+		return entry.stage == stage && entry.constantId == constantId;
+	}) != m_entries.end();
+}
+const std::string &prosper::SpecializationConstantValues::GetKey() const
+{
+	if(m_keyDirty == false)
+		return m_key;
+	m_keyDirty = false;
+	m_key.clear();
+	auto fAppend = [this](const void *data,size_t size) {m_key.append(static_cast<const char*>(data),size);};
+	for(auto &entry : m_entries)
+	{
+		auto stage = static_cast<uint32_t>(entry.stage);
+		fAppend(&stage,sizeof(stage));
+		fAppend(&entry.constantId,sizeof(entry.constantId));
+		fAppend(&entry.numBytes,sizeof(entry.numBytes));
+		fAppend(m_data.data() +entry.offset,entry.numBytes);
+	}
+	return m_key;
+}
+
+///////////////////////////
+
+struct prosper::Shader::PipelineVariant
+{
+	std::shared_future<void> task;
+	// Only valid once 'complete' has been set
+	PipelineID pipelineId = std::numeric_limits<PipelineID>::max();
+	std::atomic<bool> complete {false};
+};
+
 decltype(prosper::Shader::s_logCallback) prosper::Shader::s_logCallback = nullptr;
 void prosper::Shader::SetLogCallback(const std::function<void(Shader&,ShaderStage,const std::string&,const std::string&)> &fLogCallback) {s_logCallback = fLogCallback;}
 
@@ -62,6 +131,19 @@ prosper::Shader::Shader(IPrContext &context,const std::string &identifier,const
 		(m_stages.at(umath::to_integral(ShaderStage::Compute)) = std::make_shared<ShaderStageData>())->path = csShader;
 	SetPipelineCount(1u);
 }
+prosper::Shader::~Shader()
+{
+	// Variants that are still being created reference this shader
+	std::scoped_lock lock {m_pipelineVariantMutex};
+	for(auto &variants : m_pipelineVariants)
+	{
+		for(auto &pair : variants)
+		{
+			if(pair.second->task.valid())
+				pair.second->task.wait();
+		}
+	}
+}
 void prosper::Shader::Release(bool bDelete)
 {
 	ClearPipelines();
@@ -99,6 +181,7 @@ prosper::PipelineBindPoint prosper::Shader::GetPipelineBindPoint() const {return
 
 prosper::ShaderModule *prosper::Shader::GetModule(ShaderStage stage)
 {
+	EnsureInitialized();
 	auto *stageModule = GetStage(stage);
 	if(stageModule == nullptr)
 		return nullptr;
@@ -120,7 +203,7 @@ void prosper::Shader::SetRootShaderLocation(const std::string &location)
 }
 const std::string &prosper::Shader::GetRootShaderLocation() {return g_shaderLocation;}
 
-bool prosper::Shader::InitializeSources(bool bReload)
+bool prosper::Shader::InitializeSources(bool bReload,bool bLogErrors)
 {
 	auto &context = GetContext();
 	for(auto i=decltype(m_stages.size()){0};i<m_stages.size();++i)
@@ -138,7 +221,7 @@ bool prosper::Shader::InitializeSources(bool bReload)
 		auto bSuccess = prosper::glsl_to_spv(context,i,shaderLocation +stage->path,stage->spirvBlob,&infoLog,&debugInfoLog,bReload);
 		if(bSuccess == false)
 		{
-			if(s_logCallback != nullptr)
+			if(bLogErrors && s_logCallback != nullptr)
 				s_logCallback(*this,static_cast<ShaderStage>(i),infoLog,debugInfoLog);
 			return false;
 		}
@@ -146,7 +229,11 @@ bool prosper::Shader::InitializeSources(bool bReload)
 	return true;
 }
 
-bool prosper::Shader::IsValid() const {return m_bValid;}
+bool prosper::Shader::IsValid() const
+{
+	const_cast<Shader*>(this)->EnsureInitialized();
+	return m_bValid;
+}
 
 void prosper::Shader::SetIdentifier(const std::string &identifier) {m_identifier = identifier;}
 uint32_t prosper::Shader::GetCurrentPipelineIndex() const {return m_currentPipelineIdx;}
@@ -154,16 +241,59 @@ std::shared_ptr<prosper::IPrimaryCommandBuffer> prosper::Shader::GetCurrentComma
 
 uint32_t prosper::Shader::GetPipelineCount() const {return m_pipelineInfos.size();}
 void prosper::Shader::ReloadPipelines(bool bReloadSourceCode) {Initialize(bReloadSourceCode);}
+void prosper::Shader::SetInitializationPending() {m_bInitializationPending = true;}
+bool prosper::Shader::IsInitializationPending() const {return m_bInitializationPending;}
+bool prosper::Shader::EnsureInitialized()
+{
+	if(m_bInitializationPending == false)
+		return m_bValid;
+	std::scoped_lock lock {m_initializationMutex};
+	if(m_bInitializationPending == false) // May have been initialized by another thread in the meantime
+		return m_bValid;
+	auto &context = GetContext();
+	if(context.IsRecording())
+	{
+		// Shaders mustn't be initialized in the middle of a frame; The initialization is deferred until the frame has been recorded.
+		// Until then the shader is treated as invalid.
+		if(m_bInitializationScheduled == false)
+		{
+			m_bInitializationScheduled = true;
+			auto wpThis = weak_from_this();
+			context.AddFrameCompletionCallback([wpThis]() {
+				auto shader = wpThis.lock();
+				if(shader != nullptr)
+					shader->EnsureInitialized();
+			});
+		}
+		return false;
+	}
+	m_bInitializationScheduled = false;
+	Initialize();
+	return m_bValid;
+}
+void prosper::Shader::PrefetchSources()
+{
+	std::scoped_lock lock {m_initializationMutex};
+	if(m_bInitializationPending == false || m_bSourcesPrefetched)
+		return;
+	// Errors are reported once the shader is initialized
+	m_bSourcesPrefetched = InitializeSources(false,false);
+}
 void prosper::Shader::Initialize(bool bReloadSourceCode)
 {
+	std::scoped_lock lock {m_initializationMutex};
+	// Has to be cleared first, since the pipeline initialization may call functions which would otherwise trigger the initialization again
+	m_bInitializationPending = false;
 	auto bValidation = GetContext().IsValidationEnabled();
 	if(bValidation)
 		std::cout<<"[VK] Initializing shader '"<<GetIdentifier()<<"'"<<std::endl;
 	m_bValid = false;
 	ClearPipelines();
+	auto bSourcesPrefetched = m_bSourcesPrefetched && bReloadSourceCode == false;
+	m_bSourcesPrefetched = false;
 	if(bValidation)
 		std::cout<<"[VK] Initializing shader sources..."<<std::endl;
-	if(InitializeSources(bReloadSourceCode) == false)
+	if(bSourcesPrefetched == false && InitializeSources(bReloadSourceCode) == false)
 		return;
 	if(bValidation)
 		std::cout<<"[VK] Initializing shader stages..."<<std::endl;
@@ -265,7 +395,14 @@ void prosper::Shader::OnPipelineInitialized(uint32_t pipelineIdx)
 }
 void prosper::Shader::ClearPipelines()
 {
+	// Nothing to clear if the shader hasn't been initialized yet, in which case we don't need to wait for the device either
+	auto hasPipelines = std::find_if(m_pipelineInfos.begin(),m_pipelineInfos.end(),[](const PipelineInfo &pipelineInfo) {
+		return pipelineInfo.id != std::numeric_limits<Anvil::PipelineID>::max();
+	}) != m_pipelineInfos.end();
+	if(hasPipelines == false)
+		return;
 	GetContext().WaitIdle();
+	ClearPipelineVariants();
 	for(auto &pipelineInfo : m_pipelineInfos)
 	{
 		if(pipelineInfo.id == std::numeric_limits<Anvil::PipelineID>::max())
@@ -275,6 +412,169 @@ void prosper::Shader::ClearPipelines()
 		pipelineInfo.id = std::numeric_limits<Anvil::PipelineID>::max();
 	}
 }
+std::optional<prosper::PipelineID> prosper::Shader::GetPipelineVariant(uint32_t pipelineIdx,const SpecializationConstantValues &values,bool wait)
+{
+	EnsureInitialized();
+	if(pipelineIdx >= m_pipelineInfos.size() || m_pipelineInfos.at(pipelineIdx).id == std::numeric_limits<PipelineID>::max())
+		return {};
+	if(values.IsEmpty())
+		return m_pipelineInfos.at(pipelineIdx).id;
+	std::shared_ptr<PipelineVariant> variant = nullptr;
+	{
+		std::scoped_lock lock {m_pipelineVariantMutex};
+		if(m_pipelineVariants.size() < m_pipelineInfos.size())
+			m_pipelineVariants.resize(m_pipelineInfos.size());
+		auto &variants = m_pipelineVariants.at(pipelineIdx);
+		auto &key = values.GetKey();
+		auto it = variants.find(key);
+		if(it == variants.end())
+		{
+			variant = std::make_shared<PipelineVariant>();
+			auto *pVariant = variant.get();
+			variant->task = std::async(std::launch::async,[this,pipelineIdx,values,pVariant]() {
+				auto pipelineId = CreatePipelineVariant(pipelineIdx,values);
+				if(pipelineId.has_value())
+					pVariant->pipelineId = *pipelineId;
+				pVariant->complete = true;
+			}).share();
+			variants.insert(std::make_pair(key,variant));
+		}
+		else
+			variant = it->second;
+	}
+	if(variant->complete == false)
+	{
+		if(wait == false)
+			return {};
+		variant->task.wait();
+	}
+	if(variant->pipelineId == std::numeric_limits<PipelineID>::max())
+		return {};
+	return variant->pipelineId;
+}
+
+bool prosper::Shader::BindPipelineVariant(prosper::ICommandBuffer &cmdBuffer,uint32_t pipelineIdx,const SpecializationConstantValues &values,bool fallbackToBasePipeline)
+{
+	auto pipelineId = GetPipelineVariant(pipelineIdx,values);
+	if(pipelineId.has_value() == false)
+		return fallbackToBasePipeline && BindPipeline(cmdBuffer,pipelineIdx);
+	m_currentPipelineIdx = pipelineIdx;
+	auto r = cmdBuffer.RecordBindPipeline(m_pipelineBindPoint,*pipelineId);
+	if(r == true)
+		OnPipelineBound();
+	return r;
+}
+
+uint32_t prosper::Shader::GetPipelineVariantCount(uint32_t pipelineIdx) const
+{
+	std::scoped_lock lock {m_pipelineVariantMutex};
+	return (pipelineIdx < m_pipelineVariants.size()) ? m_pipelineVariants.at(pipelineIdx).size() : 0u;
+}
+
+std::optional<prosper::PipelineID> prosper::Shader::CreatePipelineVariant(uint32_t pipelineIdx,const SpecializationConstantValues &values)
+{
+	// Note: This is executed on a background thread; ClearPipelines waits for all variants to be completed
+	// before the pipeline infos are changed.
+	auto &pipelineInfo = m_pipelineInfos.at(pipelineIdx);
+	auto basePipelineId = pipelineInfo.id;
+	if(basePipelineId == std::numeric_limits<PipelineID>::max() || pipelineInfo.createInfo == nullptr)
+		return {};
+	auto &baseCreateInfo = *pipelineInfo.createInfo;
+
+	// Constants of the base pipeline which aren't overwritten by the variant have to be kept
+	auto mergedValues = values;
+	for(auto i=decltype(m_stages.size()){0};i<m_stages.size();++i)
+	{
+		if(m_stages.at(i) == nullptr)
+			continue;
+		auto stage = static_cast<ShaderStage>(i);
+		const std::vector<SpecializationConstant> *specializationConstants = nullptr;
+		const unsigned char *dataBuffer = nullptr;
+		if(baseCreateInfo.GetSpecializationConstants(stage,&specializationConstants,&dataBuffer) == false || specializationConstants == nullptr)
+			continue;
+		for(auto &constant : *specializationConstants)
+		{
+			if(values.Contains(stage,constant.constantId) == false)
+				mergedValues.Set(stage,constant.constantId,constant.numBytes,dataBuffer +constant.startOffset);
+		}
+	}
+
+	auto &context = GetContext();
+	auto createFlags = prosper::PipelineCreateFlags::AllowDerivativesBit | prosper::PipelineCreateFlags::DerivativeBit;
+	if(IsGraphicsShader())
+	{
+		if(pipelineInfo.renderPass == nullptr)
+			return {};
+		auto &baseGfxCreateInfo = static_cast<const prosper::GraphicsPipelineCreateInfo&>(baseCreateInfo);
+		auto *modFs = GetStage(ShaderStage::Fragment);
+		auto *modVs = GetStage(ShaderStage::Vertex);
+		auto *modGs = GetStage(ShaderStage::Geometry);
+		auto *modTessControl = GetStage(ShaderStage::TessellationControl);
+		auto *modTessEval = GetStage(ShaderStage::TessellationEvaluation);
+		auto subPassId = baseGfxCreateInfo.GetSubpassId();
+		// The fixed-function state is copied from the base pipeline
+		auto gfxPipelineInfo = prosper::GraphicsPipelineCreateInfo::Create(
+			createFlags,
+			pipelineInfo.renderPass.get(),
+			subPassId,
+			(modFs != nullptr) ? *modFs->entryPoint : prosper::ShaderModuleStageEntryPoint(),
+			(modGs != nullptr) ? *modGs->entryPoint : prosper::ShaderModuleStageEntryPoint(),
+			(modTessControl != nullptr) ? *modTessControl->entryPoint : prosper::ShaderModuleStageEntryPoint(),
+			(modTessEval != nullptr) ? *modTessEval->entryPoint : prosper::ShaderModuleStageEntryPoint(),
+			(modVs != nullptr) ? *modVs->entryPoint : prosper::ShaderModuleStageEntryPoint(),
+			&baseGfxCreateInfo,&basePipelineId
+		);
+		if(gfxPipelineInfo == nullptr)
+			return {};
+		mergedValues.ForEach([&gfxPipelineInfo](ShaderStage stage,uint32_t constantId,uint32_t numBytes,const void *data) {
+			gfxPipelineInfo->AddSpecializationConstant(stage,constantId,numBytes,data);
+		});
+		auto result = context.AddPipeline(*gfxPipelineInfo,*pipelineInfo.renderPass,modFs,modVs,modGs,modTessControl,modTessEval,subPassId,basePipelineId);
+		// Graphics pipelines are baked lazily by default, which would happen on the thread binding the pipeline
+		if(result.has_value())
+			static_cast<VlkContext&>(context).GetDevice().get_graphics_pipeline_manager()->bake();
+		return result;
+	}
+	auto *modCmp = GetStage(ShaderStage::Compute);
+	if(modCmp == nullptr)
+		return {};
+	auto computePipelineInfo = prosper::ComputePipelineCreateInfo::Create(createFlags,*modCmp->entryPoint,&basePipelineId);
+	if(computePipelineInfo == nullptr)
+		return {};
+	std::vector<const prosper::DescriptorSetCreateInfo*> dsInfos;
+	dsInfos.reserve(pipelineInfo.descSetInfos.size());
+	for(auto &dsInfo : pipelineInfo.descSetInfos)
+		dsInfos.push_back(dsInfo.get());
+	computePipelineInfo->SetDescriptorSetCreateInfo(&dsInfos);
+	for(auto &range : pipelineInfo.pushConstantRanges)
+		computePipelineInfo->AttachPushConstantRange(range.offset,range.size,range.stages);
+	mergedValues.ForEach([&computePipelineInfo](ShaderStage stage,uint32_t constantId,uint32_t numBytes,const void *data) {
+		computePipelineInfo->AddSpecializationConstant(constantId,numBytes,data);
+	});
+	return context.AddPipeline(*computePipelineInfo,*modCmp,basePipelineId);
+}
+
+void prosper::Shader::ClearPipelineVariants()
+{
+	std::vector<std::shared_ptr<PipelineVariant>> variants {};
+	{
+		std::scoped_lock lock {m_pipelineVariantMutex};
+		for(auto &pipelineVariants : m_pipelineVariants)
+		{
+			for(auto &pair : pipelineVariants)
+				variants.push_back(pair.second);
+		}
+		m_pipelineVariants.clear();
+	}
+	for(auto &variant : variants)
+	{
+		if(variant->task.valid())
+			variant->task.wait();
+		if(variant->pipelineId != std::numeric_limits<PipelineID>::max())
+			GetContext().ClearPipeline(IsGraphicsShader(),variant->pipelineId);
+	}
+}
+
 bool prosper::Shader::GetSourceFilePath(ShaderStage stage,std::string &sourceFilePath) const
 {
 	auto *ptrStage = GetStage(stage);
@@ -300,6 +600,7 @@ void prosper::Shader::SetBaseShader(Shader &shader) {m_basePipeline = shader.sha
 void prosper::Shader::ClearBaseShader() {m_basePipeline = {};}
 const prosper::ShaderModuleStageEntryPoint *prosper::Shader::GetModuleStageEntryPoint(prosper::ShaderStage stage,uint32_t pipelineIdx) const
 {
+	const_cast<Shader*>(this)->EnsureInitialized();
 	auto *stageData = GetStage(stage);
 	if(stageData == nullptr)
 		return nullptr;
@@ -307,6 +608,7 @@ const prosper::ShaderModuleStageEntryPoint *prosper::Shader::GetModuleStageEntry
 }
 bool prosper::Shader::GetPipelineId(Anvil::PipelineID &pipelineId,uint32_t pipelineIdx) const
 {
+	const_cast<Shader*>(this)->EnsureInitialized();
 	if(pipelineIdx >= m_pipelineInfos.size())
 		return false;
 	pipelineId = m_pipelineInfos.at(pipelineIdx).id;
@@ -320,19 +622,48 @@ bool prosper::Shader::RecordPushConstants(uint32_t size,const void *data,uint32_
 		return false;
 	auto cmdBuffer = GetCurrentCommandBuffer();
 	auto *info = GetPipelineInfo(m_currentPipelineIdx);
-	if(cmdBuffer == nullptr || info == nullptr)
+	if(cmdBuffer == nullptr || info == nullptr || size == 0)
 		return false;
-	for(auto &range : info->pushConstantRanges)
+	auto &stageTable = info->pushConstantStages;
+	auto firstWord = offset /sizeof(uint32_t);
+	auto lastWord = (offset +size -1u) /sizeof(uint32_t);
+	if(lastWord >= stageTable.size())
+		return false;
+	// All stages of every range overlapping the update have to be specified, and each of these stages
+	// has to cover the entire update (VUID-vkCmdPushConstants-offset-01795/01796)
+	auto stages = ShaderStageFlags{};
+	for(auto i=firstWord;i<=lastWord;++i)
+		stages |= stageTable[i];
+	if(stages == ShaderStageFlags{})
+		return false;
+	for(auto i=firstWord;i<=lastWord;++i)
+	{
+		if(stageTable[i] != stages)
+			return false;
+	}
+	return cmdBuffer->RecordPushConstants(*this,m_currentPipelineIdx,stages,offset,size,data);
+}
+
+void prosper::Shader::InitializePushConstantStages(PipelineInfo &pipelineInfo)
+{
+	auto &stageTable = pipelineInfo.pushConstantStages;
+	stageTable.clear();
+	for(auto &range : pipelineInfo.pushConstantRanges)
 	{
-		if(offset >= range.offset && (offset +size) <= (range.offset +range.size))
-			return cmdBuffer->RecordPushConstants(*this,m_currentPipelineIdx,range.stages,offset,size,data);
+		if(range.size == 0)
+			continue;
+		auto lastWord = (range.offset +range.size -1u) /sizeof(uint32_t);
+		if(lastWord >= stageTable.size())
+			stageTable.resize(lastWord +1u,ShaderStageFlags{});
+		for(auto i=range.offset /sizeof(uint32_t);i<=lastWord;++i)
+			stageTable[i] |= range.stages;
 	}
-	return false;
 }
 
 const prosper::PipelineInfo *prosper::Shader::GetPipelineInfo(PipelineID id) const {return const_cast<Shader*>(this)->GetPipelineInfo(id);}
 prosper::PipelineInfo *prosper::Shader::GetPipelineInfo(PipelineID id)
 {
+	EnsureInitialized();
 	return (id < m_pipelineInfos.size()) ? &m_pipelineInfos.at(id) : nullptr;
 }
 const prosper::BasePipelineCreateInfo *prosper::Shader::GetPipelineCreateInfo(PipelineID id) const
@@ -435,6 +766,7 @@ void prosper::Shader::UnbindPipeline()
 }
 bool prosper::Shader::BindPipeline(prosper::ICommandBuffer&cmdBuffer,uint32_t pipelineIdx)
 {
+	EnsureInitialized();
 	if(pipelineIdx >= m_pipelineInfos.size())
 		return false;
 	m_currentPipelineIdx = pipelineIdx;
@@ -451,7 +783,7 @@ std::unique_ptr<prosper::DescriptorSetCreateInfo> prosper::DescriptorSetInfo::To
 	{
 		dsInfo->AddBinding(
 			binding.bindingIndex,binding.type,binding.descriptorArraySize,
-			binding.shaderStages
+			binding.shaderStages,binding.flags
 		);
 	}
 	return dsInfo;
@@ -463,7 +795,8 @@ std::unique_ptr<Anvil::DescriptorSetCreateInfo> prosper::DescriptorSetInfo::ToAn
 	{
 		dsInfo->add_binding(
 			binding.bindingIndex,static_cast<Anvil::DescriptorType>(binding.type),binding.descriptorArraySize,
-			static_cast<Anvil::ShaderStageFlagBits>(binding.shaderStages)
+			static_cast<Anvil::ShaderStageFlagBits>(binding.shaderStages),
+			static_cast<Anvil::DescriptorBindingFlagBits>(binding.flags)
 		);
 	}
 	return dsInfo;
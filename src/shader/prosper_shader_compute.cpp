@@ -51,6 +51,7 @@ void prosper::ShaderCompute::InitializePipeline()
 		auto &pipelineInitInfo = m_pipelineInfos.at(pipelineIdx);
 		for(auto &range : pipelineInitInfo.pushConstantRanges)
 			computePipelineInfo->AttachPushConstantRange(range.offset,range.size,range.stages);
+		InitializePushConstantStages(pipelineInitInfo);
 
 		m_currentPipelineIdx = std::numeric_limits<decltype(m_currentPipelineIdx)>::max();
 		
@@ -195,7 +195,7 @@ void prosper::ShaderGraphics::InitializePipeline()
 		InitializeRenderPass(renderPass,pipelineIdx);
 		if(renderPass == nullptr)
 			continue;
-		Anvil::SubPassID subPassId {0};
+		Anvil::SubPassID subPassId = GetSubPassId(pipelineIdx);
 
 		auto basePipelineId = std::numeric_limits<Anvil::PipelineID>::max();
 		if(firstPipelineId != std::numeric_limits<Anvil::PipelineID>::max())
@@ -234,6 +234,8 @@ void prosper::ShaderGraphics::InitializePipeline()
 		auto &rpInfo = renderPass->GetCreateInfo();
 		auto numAttachments = rpInfo.attachments.size();
 		auto samples = (numAttachments > 0) ? rpInfo.attachments.front().sampleCount : prosper::SampleCountFlags::e1Bit;
+		if(subPassId < rpInfo.subPasses.size() && rpInfo.subPasses.at(subPassId).colorAttachments.empty() == false)
+			samples = rpInfo.attachments.at(rpInfo.subPasses.at(subPassId).colorAttachments.front()).sampleCount;
 		if(samples != prosper::SampleCountFlags::e1Bit)
 			gfxPipelineInfo->SetMultisamplingProperties(samples,0.f,std::numeric_limits<VkSampleMask>::max());
 
@@ -244,6 +246,7 @@ void prosper::ShaderGraphics::InitializePipeline()
 		auto &pipelineInitInfo = m_pipelineInfos.at(pipelineIdx);
 		for(auto &range : pipelineInitInfo.pushConstantRanges)
 			gfxPipelineInfo->AttachPushConstantRange(range.offset,range.size,range.stages);
+		InitializePushConstantStages(pipelineInitInfo);
 
 		PrepareGfxPipeline(*gfxPipelineInfo);
 		m_currentPipelineIdx = std::numeric_limits<decltype(m_currentPipelineIdx)>::max();
@@ -371,6 +374,7 @@ void prosper::ShaderGraphics::InitializeRenderPass(std::shared_ptr<IRenderPass>
 {
 	CreateCachedRenderPass<prosper::ShaderGraphics>({{prosper::util::RenderPassCreateInfo::AttachmentInfo{}}},outRenderPass,pipelineIdx);
 }
+uint32_t prosper::ShaderGraphics::GetSubPassId(uint32_t pipelineIdx) const {return 0u;}
 void prosper::ShaderGraphics::SetGenericAlphaColorBlendAttachmentProperties(prosper::GraphicsPipelineCreateInfo &pipelineInfo)
 {
 	prosper::util::set_generic_alpha_color_blend_attachment_properties(pipelineInfo);
@@ -389,6 +393,7 @@ void prosper::ShaderGraphics::ToggleDynamicScissorState(prosper::GraphicsPipelin
 
 const std::shared_ptr<prosper::IRenderPass> &prosper::ShaderGraphics::GetRenderPass(uint32_t pipelineIdx) const
 {
+	const_cast<ShaderGraphics*>(this)->EnsureInitialized();
 	auto &pipelineInfo = m_pipelineInfos.at(pipelineIdx);
 	return pipelineInfo.renderPass;
 }
@@ -443,6 +448,16 @@ bool prosper::ShaderGraphics::RecordDrawIndexed(uint32_t indexCount,uint32_t ins
 	auto cmdBuffer = GetCurrentCommandBuffer();
 	return cmdBuffer != nullptr && dynamic_cast<prosper::VlkCommandBuffer&>(*cmdBuffer)->record_draw_indexed(indexCount,instanceCount,firstIndex,vertexOffset,firstInstance);
 }
+bool prosper::ShaderGraphics::RecordDrawIndexedIndirect(prosper::IBuffer &buffer,DeviceSize offset,uint32_t drawCount,uint32_t stride)
+{
+	auto cmdBuffer = GetCurrentCommandBuffer();
+	return cmdBuffer != nullptr && cmdBuffer->RecordDrawIndexedIndirect(buffer,offset,drawCount,stride);
+}
+bool prosper::ShaderGraphics::RecordDrawIndexedIndirectCount(prosper::IBuffer &buffer,DeviceSize offset,prosper::IBuffer &countBuffer,DeviceSize countBufferOffset,uint32_t maxDrawCount,uint32_t stride)
+{
+	auto cmdBuffer = GetCurrentCommandBuffer();
+	return cmdBuffer != nullptr && cmdBuffer->RecordDrawIndexedIndirectCount(buffer,offset,countBuffer,countBufferOffset,maxDrawCount,stride);
+}
 bool prosper::ShaderGraphics::AddSpecializationConstant(prosper::GraphicsPipelineCreateInfo &pipelineInfo,prosper::ShaderStage stage,uint32_t constantId,uint32_t numBytes,const void *data)
 {
 	return pipelineInfo.AddSpecializationConstant(stage,constantId,numBytes,data);
@@ -515,16 +530,30 @@ bool prosper::ShaderGraphics::BeginDrawViewport(const std::shared_ptr<prosper::I
 		if(prosper::util::get_current_render_pass_target(*cmdBuffer,&rp,&img,&fb,&rt) && fb && rp)
 		{
 			auto &rpCreateInfo = rp->GetCreateInfo();
+			auto subPassId = GetSubPassId(pipelineIdx);
+			auto curSubPassId = prosper::util::get_current_sub_pass_id(*cmdBuffer);
+			if(subPassId != curSubPassId)
+			{
+				debug::exec_debug_validation_callback(
+					DebugReportObjectTypeEXT::Pipeline,"Begin draw: Shader pipeline '" +*GetDebugName(pipelineIdx) +"' belongs to sub-pass " +std::to_string(subPassId) +
+					", but sub-pass " +std::to_string(curSubPassId) +" of render pass '" +rp->GetDebugName() +"' is active!"
+				);
+				return false;
+			}
+			auto *subPassInfo = (subPassId < rpCreateInfo.subPasses.size()) ? &rpCreateInfo.subPasses.at(subPassId) : nullptr;
 			prosper::SampleCountFlags sampleCount;
 			info->GetMultisamplingProperties(&sampleCount,nullptr);
 			auto numAttachments = umath::min(fb->GetAttachmentCount(),static_cast<uint32_t>(rpCreateInfo.attachments.size()));
 			for(auto i=decltype(numAttachments){0};i<numAttachments;++i)
 			{
 				auto *imgView = fb->GetAttachment(i);
-				if(imgView == nullptr)
+				if(imgView == nullptr || rpCreateInfo.IsResolveAttachment(i))
 					continue;
 				auto &img = imgView->GetImage();
 				auto &attInfo = rpCreateInfo.attachments.at(i);
+				// Attachments that aren't used by the sub-pass of this pipeline may have a different sample count
+				if(subPassInfo && subPassInfo->UsesAttachment(i,util::is_depth_format(attInfo.format)) == false)
+					continue;
 				auto rpSampleCount = attInfo.sampleCount;
 				auto bRpHasColorAttachment = false;
 				if(util::is_depth_format(attInfo.format) == false)
@@ -10,10 +10,54 @@
 #include <sharedutils/util_shaderinfo.hpp>
 #include <sharedutils/util_string.h>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 
 prosper::ShaderManager::ShaderManager(IPrContext &context)
 	: ContextObject(context)
 {}
+prosper::ShaderManager::~ShaderManager()
+{
+	// Prefetch tasks hold references to the shaders
+	for(auto &task : m_prefetchTasks)
+		task.wait();
+}
+void prosper::ShaderManager::SetLazyInitializationEnabled(bool enabled) {m_lazyInitializationEnabled = enabled;}
+bool prosper::ShaderManager::IsLazyInitializationEnabled() const {return m_lazyInitializationEnabled;}
+void prosper::ShaderManager::InitializeLazyShader(Shader &shader) const {shader.EnsureInitialized();}
+void prosper::ShaderManager::PrefetchShaders(const std::vector<std::string> &identifiers)
+{
+	m_prefetchTasks.erase(std::remove_if(m_prefetchTasks.begin(),m_prefetchTasks.end(),[](const std::future<void> &task) {
+		return task.wait_for(std::chrono::seconds{0}) == std::future_status::ready;
+	}),m_prefetchTasks.end());
+
+	auto shaders = std::make_shared<std::vector<std::weak_ptr<Shader>>>();
+	shaders->reserve(identifiers.size());
+	for(auto &identifier : identifiers)
+	{
+		auto lidentifier = identifier;
+		ustring::to_lower(lidentifier);
+		auto it = m_shaders.find(lidentifier);
+		if(it != m_shaders.end() && it->second->IsInitializationPending())
+			shaders->push_back(it->second);
+	}
+	if(shaders->empty())
+		return;
+	auto numThreads = std::min(std::max(std::thread::hardware_concurrency(),1u),static_cast<uint32_t>(shaders->size()));
+	auto nextShader = std::make_shared<std::atomic<size_t>>(0u);
+	for(auto i=decltype(numThreads){0u};i<numThreads;++i)
+	{
+		m_prefetchTasks.push_back(std::async(std::launch::async,[shaders,nextShader]() {
+			for(auto idx=(*nextShader)++;idx<shaders->size();idx=(*nextShader)++)
+			{
+				auto shader = shaders->at(idx).lock();
+				if(shader != nullptr)
+					shader->PrefetchSources();
+			}
+		}));
+	}
+}
 util::WeakHandle<::util::ShaderInfo> prosper::ShaderManager::PreRegisterShader(const std::string &identifier)
 {
 	auto lidentifier = identifier;
@@ -30,9 +74,10 @@ util::WeakHandle<::util::ShaderInfo> prosper::ShaderManager::PreRegisterShader(c
 {
 	if(GetContext().IsValidationEnabled())
 		std::cout<<"[VK] Registering shader '"<<identifier<<"'..."<<std::endl;
-	auto wpShaderInfo = PreRegisterShader(identifier);
 	auto lidentifier = identifier;
 	ustring::to_lower(lidentifier);
+	auto bLazy = m_lazyInitializationEnabled && m_shaderInfo.find(lidentifier) != m_shaderInfo.end();
+	auto wpShaderInfo = PreRegisterShader(identifier);
 	auto bExternalOwnership = false;
 	auto *ptrShader = fFactory(GetContext(),lidentifier,bExternalOwnership);
 	std::shared_ptr<Shader> shader = nullptr;
@@ -43,7 +88,10 @@ util::WeakHandle<::util::ShaderInfo> prosper::ShaderManager::PreRegisterShader(c
 	m_shaders[lidentifier] = shader;
 	auto wpShader = ::util::WeakHandle<Shader>(shader);
 	wpShaderInfo.get()->SetShader(std::make_shared<::util::WeakHandle<Shader>>(wpShader));
-	shader->Initialize();
+	if(bLazy)
+		shader->SetInitializationPending();
+	else
+		shader->Initialize();
 	return wpShader;
 }
 util::WeakHandle<prosper::Shader> prosper::ShaderManager::RegisterShader(const std::string &identifier,const std::function<Shader*(IPrContext&,const std::string&)> &fFactory)
@@ -57,7 +105,10 @@ util::WeakHandle<prosper::Shader> prosper::ShaderManager::GetShader(const std::s
 {
 	auto lidentifier = identifier;
 	auto it = m_shaders.find(lidentifier);
-	return (it != m_shaders.end()) ? ::util::WeakHandle<Shader>(it->second) : ::util::WeakHandle<Shader>();
+	if(it == m_shaders.end())
+		return {};
+	it->second->EnsureInitialized();
+	return ::util::WeakHandle<Shader>(it->second);
 }
 const std::unordered_map<std::string,std::shared_ptr<prosper::Shader>> &prosper::ShaderManager::GetShaders() const {return m_shaders;}
 bool prosper::ShaderManager::RemoveShader(Shader &shader)
@@ -6,11 +6,13 @@
 #include "vk_context.hpp"
 #include <misc/types.h>
 #include "vk_fence.hpp"
+#include "vk_submission_batcher.hpp"
 #include "vk_command_buffer.hpp"
 #include "vk_render_pass.hpp"
 #include "buffers/vk_buffer.hpp"
 #include "vk_descriptor_set_group.hpp"
 #include "prosper_pipeline_cache.hpp"
+#include "prosper_cache_archive.hpp"
 #include "shader/prosper_shader.hpp"
 #include "shader/prosper_pipeline_create_info.hpp"
 #include "image/vk_image.hpp"
@@ -71,6 +73,7 @@ decltype(VlkContext::s_devToContext) VlkContext::s_devToContext = {};
 VlkContext::VlkContext(const std::string &appName,bool bEnableValidation)
 	: IPrContext{appName,bEnableValidation}
 {}
+VlkContext::~VlkContext() {}
 
 prosper::Result VlkContext::WaitForFence(const IFence &fence,uint64_t timeout) const
 {
@@ -128,6 +131,7 @@ void VlkContext::DrawFrame(const std::function<void(const std::shared_ptr<prospe
 		throw std::runtime_error(errMsg);
 
 	ClearKeepAliveResources();
+	RunFrameCompletionCallbacks();
 
 	//auto &keepAliveResources = m_keepAliveResources.at(m_n_swapchain_image);
 	//auto numKeepAliveResources = keepAliveResources.size(); // We can clear the resources from the previous render pass of this swapchain after we've waited for the semaphore (i.e. after the frame rendering is complete)
@@ -137,12 +141,11 @@ void VlkContext::DrawFrame(const std::function<void(const std::shared_ptr<prospe
 	static_cast<Anvil::PrimaryCommandBuffer&>(static_cast<prosper::VlkPrimaryCommandBuffer&>(*cmd_buffer_ptr).GetAnvilCommandBuffer()).start_recording(false,true);
 	umath::set_flag(m_stateFlags,StateFlags::IsRecording);
 	umath::set_flag(m_stateFlags,StateFlags::Idle,false);
-	while(m_scheduledBufferUpdates.empty() == false)
-	{
-		auto &f = m_scheduledBufferUpdates.front();
-		f(*cmd_buffer_ptr);
-		m_scheduledBufferUpdates.pop();
-	}
+	// Semaphores belong to the commands that have been scheduled up to this point; Anything that is added while this frame is being recorded
+	// will be waited on by the next frame.
+	auto additionalWaitSemaphores = std::move(m_pendingFrameWaitSemaphores);
+	m_pendingFrameWaitSemaphores.clear();
+	RecordScheduledCommands(*cmd_buffer_ptr);
 	drawFrame(GetDrawCommandBuffer(),m_n_swapchain_image);
 	/* Close the recording process */
 	umath::set_flag(m_stateFlags,StateFlags::IsRecording,false);
@@ -151,17 +154,34 @@ void VlkContext::DrawFrame(const std::function<void(const std::shared_ptr<prospe
 
 	/* Submit work chunk and present */
 	auto *signalSemaphore = curr_frame_signal_semaphore_ptr;
-	auto *waitSemaphore = curr_frame_wait_semaphore_ptr;
-	m_devicePtr->get_universal_queue(0)->submit(Anvil::SubmitInfo::create(
-		&static_cast<prosper::VlkPrimaryCommandBuffer&>(*m_commandBuffers[m_n_swapchain_image]).GetAnvilCommandBuffer(),
-		1, /* n_semaphores_to_signal */
-		&signalSemaphore,
-		1, /* n_semaphores_to_wait_on */
-		&waitSemaphore,
-		&wait_stage_mask,
-		false, /* should_block  */
-		m_cmdFences.at(m_n_swapchain_image).get()
-	)); /* opt_fence_ptr */
+	std::vector<Anvil::Semaphore*> signalSemaphores {signalSemaphore};
+	signalSemaphores.insert(signalSemaphores.end(),m_pendingFrameSignalSemaphores.begin(),m_pendingFrameSignalSemaphores.end());
+	m_pendingFrameSignalSemaphores.clear();
+	std::vector<Anvil::Semaphore*> waitSemaphores {curr_frame_wait_semaphore_ptr};
+	std::vector<Anvil::PipelineStageFlags> waitStageMasks {wait_stage_mask};
+	waitSemaphores.reserve(waitSemaphores.size() +additionalWaitSemaphores.size());
+	waitStageMasks.reserve(waitStageMasks.size() +additionalWaitSemaphores.size());
+	for(auto &pair : additionalWaitSemaphores)
+	{
+		waitSemaphores.push_back(pair.first);
+		waitStageMasks.push_back(static_cast<Anvil::PipelineStageFlagBits>(pair.second));
+	}
+	// Everything that has been submitted while the frame was being recorded is flushed together with the frame (which has a fence, so it's flushed right away)
+	VlkSubmissionBatcher::Submission frameSubmission {};
+	frameSubmission.cmdBuffers = {&static_cast<prosper::VlkPrimaryCommandBuffer&>(*m_commandBuffers[m_n_swapchain_image]).GetAnvilCommandBuffer()};
+	frameSubmission.signalSemaphores = std::move(signalSemaphores);
+	frameSubmission.waitSemaphores = std::move(waitSemaphores);
+	frameSubmission.waitStageMasks = std::move(waitStageMasks);
+	frameSubmission.fence = m_cmdFences.at(m_n_swapchain_image).get();
+	m_submissionBatcher->Add(std::move(frameSubmission));
+
+	// Callbacks may add new callbacks for the next frame
+	auto frameSubmissionCallbacks = std::move(m_frameSubmissionCallbacks);
+	m_frameSubmissionCallbacks.clear();
+	for(auto &f : frameSubmissionCallbacks)
+		f();
+	// Work that depends on the frame (e.g. async compute) should start as early as possible
+	m_submissionBatcher->Flush();
 
 		//ClearKeepAliveResources(numKeepAliveResources);
 
@@ -187,11 +207,7 @@ void VlkContext::DrawFrame(const std::function<void(const std::shared_ptr<prospe
 
 bool VlkContext::Submit(ICommandBuffer &cmdBuf,bool shouldBlock,IFence *optFence)
 {
-	auto &dev = GetDevice();
-	return dev.get_universal_queue(0)->submit(Anvil::SubmitInfo::create(
-		&dynamic_cast<VlkCommandBuffer&>(cmdBuf).GetAnvilCommandBuffer(),0u,nullptr,
-		0u,nullptr,nullptr,shouldBlock,optFence ? &dynamic_cast<VlkFence*>(optFence)->GetAnvilFence() : nullptr
-	));
+	return SubmitCommandBuffer(cmdBuf,prosper::QueueFamilyType::Universal,shouldBlock,optFence);
 }
 
 bool VlkContext::GetSurfaceCapabilities(Anvil::SurfaceCapabilities &caps) const
@@ -243,6 +259,11 @@ void VlkContext::Release()
 	if(m_devicePtr == nullptr)
 		return;
 	ReleaseSwapchain();
+	m_pendingFrameWaitSemaphores.clear();
+	m_pendingFrameSignalSemaphores.clear();
+	m_frameSubmissionCallbacks.clear();
+	FlushSubmissions();
+	GetDevice().wait_idle();
 
 	IPrContext::Release();
 
@@ -264,6 +285,7 @@ std::shared_ptr<Anvil::Swapchain> VlkContext::GetSwapchain() {return m_swapchain
 
 void VlkContext::DoWaitIdle()
 {
+	FlushSubmissions();
 	auto &dev = GetDevice();
 	dev.wait_idle();
 }
@@ -271,11 +293,11 @@ void VlkContext::DoWaitIdle()
 void VlkContext::DoFlushSetupCommandBuffer()
 {
 	auto bSuccess = static_cast<Anvil::PrimaryCommandBuffer&>(static_cast<prosper::VlkPrimaryCommandBuffer&>(*m_setupCmdBuffer).GetAnvilCommandBuffer()).stop_recording();
-	auto &dev = GetDevice();
-	dev.get_universal_queue(0)->submit(Anvil::SubmitInfo::create(
-		&static_cast<prosper::VlkPrimaryCommandBuffer&>(*m_setupCmdBuffer).GetAnvilCommandBuffer(),0u,nullptr,
-		0u,nullptr,nullptr,true
-	));
+	// Callers rely on the setup commands having been executed once this returns, so the flush has to block
+	VlkSubmissionBatcher::Submission submission {};
+	submission.cmdBuffers = {&static_cast<prosper::VlkPrimaryCommandBuffer&>(*m_setupCmdBuffer).GetAnvilCommandBuffer()};
+	submission.shouldBlock = true;
+	m_submissionBatcher->Add(std::move(submission));
 }
 
 
@@ -289,13 +311,17 @@ bool VlkContext::IsImageFormatSupported(prosper::Format format,prosper::ImageUsa
 	);
 }
 
-const std::string PIPELINE_CACHE_PATH = "cache/shader.cache";
+const std::string PIPELINE_CACHE_ARCHIVE_ENTRY = "pipeline_cache";
 bool VlkContext::SavePipelineCache()
 {
 	auto *pPipelineCache = m_devicePtr->get_pipeline_cache();
-	if(pPipelineCache == nullptr)
+	auto *archive = GetCacheArchive();
+	if(pPipelineCache == nullptr || archive == nullptr)
 		return false;
-	return PipelineCache::Save(*pPipelineCache,PIPELINE_CACHE_PATH);
+	std::vector<uint8_t> data;
+	if(PipelineCache::GetData(*pPipelineCache,data))
+		archive->Store(PIPELINE_CACHE_ARCHIVE_ENTRY,std::move(data));
+	return archive->Write();
 }
 
 std::shared_ptr<prosper::IPrimaryCommandBuffer> VlkContext::AllocatePrimaryLevelCommandBuffer(prosper::QueueFamilyType queueFamilyType,uint32_t &universalQueueFamilyIndex)
@@ -673,27 +699,40 @@ void VlkContext::InitVulkan(const CreateInfo &createInfo)
 	devExtConfig.extension_status["VK_NV_external_memory_win32"] = Anvil::ExtensionAvailability::ENABLE_IF_AVAILABLE;
 	devExtConfig.extension_status["VK_NV_win32_keyed_mutex"] = Anvil::ExtensionAvailability::ENABLE_IF_AVAILABLE;
 
+	// Required for bindless descriptor arrays (see DescriptorArrayManager)
+	devExtConfig.extension_status["VK_EXT_descriptor_indexing"] = Anvil::ExtensionAvailability::ENABLE_IF_AVAILABLE;
+	// Required for GPU-driven draw counts (see IndirectDrawBatcher)
+	devExtConfig.extension_status["VK_KHR_draw_indirect_count"] = Anvil::ExtensionAvailability::ENABLE_IF_AVAILABLE;
+	// Driver-reported memory budgets (see MemoryBudgetTracker)
+	devExtConfig.extension_status["VK_EXT_memory_budget"] = Anvil::ExtensionAvailability::ENABLE_IF_AVAILABLE;
+
 	auto devCreateInfo = Anvil::DeviceCreateInfo::create_sgpu(
 		m_physicalDevicePtr,
 		true, /* in_enable_shader_module_cache */
 		devExtConfig,
 		std::vector<std::string>(),
 		Anvil::CommandPoolCreateFlagBits::CREATE_RESET_COMMAND_BUFFER_BIT,
-		false /* in_mt_safe */
+		true /* in_mt_safe */ // Pipeline variants are created and baked on background threads (see Shader::GetPipelineVariant)
 	);
-	// devCreateInfo->set_pipeline_cache_ptr() // TODO
 	m_devicePtr = Anvil::SGPUDevice::create(
 		std::move(devCreateInfo)
 	);
-	/*[](Anvil::BaseDevice &dev) -> Anvil::PipelineCacheUniquePtr {
-	prosper::PipelineCache::LoadError loadErr {};
-	auto pipelineCache = PipelineCache::Load(dev,PIPELINE_CACHE_PATH,loadErr);
-	if(pipelineCache == nullptr)
-	pipelineCache = PipelineCache::Create(dev);
-	if(pipelineCache == nullptr)
-	throw std::runtime_error("Unable to create pipeline cache!");
-	return pipelineCache;
-	}*/
+	// The device creates its own (empty) pipeline cache, so the cached data is merged into it.
+	// The archive entry is mapped into memory and handed to the driver without an intermediate copy.
+	auto *archive = GetCacheArchive();
+	if(archive)
+	{
+		archive->Read(PIPELINE_CACHE_ARCHIVE_ENTRY,[this](const void *data,uint64_t size) -> bool {
+			auto *devPipelineCache = m_devicePtr->get_pipeline_cache();
+			prosper::PipelineCache::LoadError loadErr {};
+			auto pipelineCache = PipelineCache::Load(*m_devicePtr,data,size,loadErr);
+			if(devPipelineCache == nullptr || pipelineCache == nullptr)
+				return false;
+			const Anvil::PipelineCache *srcCaches[] = {pipelineCache.get()};
+			devPipelineCache->merge(1u,srcCaches);
+			return true;
+		});
+	}
 
 	m_pGpuDevice = static_cast<Anvil::SGPUDevice*>(m_devicePtr.get());
 	s_devToContext[m_devicePtr.get()] = this;
@@ -741,25 +780,51 @@ Anvil::PipelineLayout *VlkContext::GetPipelineLayout(bool graphicsShader,Anvil::
 	return dev.get_compute_pipeline_manager()->get_pipeline_layout(pipelineId);
 }
 
-void VlkContext::SubmitCommandBuffer(prosper::ICommandBuffer &cmd,prosper::QueueFamilyType queueFamilyType,bool shouldBlock,prosper::IFence *fence)
+bool VlkContext::SubmitCommandBuffer(prosper::ICommandBuffer &cmd,prosper::QueueFamilyType queueFamilyType,bool shouldBlock,prosper::IFence *fence)
 {
 	switch(queueFamilyType)
 	{
 	case prosper::QueueFamilyType::Universal:
-		m_devicePtr->get_universal_queue(0u)->submit(Anvil::SubmitInfo::create(
-			&dynamic_cast<VlkCommandBuffer&>(cmd).GetAnvilCommandBuffer(),0u,nullptr,0u,nullptr,nullptr,shouldBlock,fence ? &static_cast<VlkFence*>(fence)->GetAnvilFence() : nullptr
-		));
-		break;
 	case prosper::QueueFamilyType::Compute:
-		m_devicePtr->get_compute_queue(0u)->submit(Anvil::SubmitInfo::create(
-			&dynamic_cast<VlkCommandBuffer&>(cmd).GetAnvilCommandBuffer(),0u,nullptr,0u,nullptr,nullptr,shouldBlock,fence ? &static_cast<VlkFence*>(fence)->GetAnvilFence() : nullptr
-		));
+	case prosper::QueueFamilyType::Transfer:
 		break;
 	default:
 		throw std::invalid_argument("No device queue exists for queue family " +std::to_string(umath::to_integral(queueFamilyType)) +"!");
 	}
+	VlkSubmissionBatcher::Submission submission {};
+	submission.queueFamilyType = queueFamilyType;
+	submission.cmdBuffers = {&dynamic_cast<VlkCommandBuffer&>(cmd).GetAnvilCommandBuffer()};
+	submission.fence = fence ? &static_cast<VlkFence*>(fence)->GetAnvilFence() : nullptr;
+	submission.shouldBlock = shouldBlock;
+	return m_submissionBatcher->Add(std::move(submission));
 }
 
+VlkSubmissionBatcher &VlkContext::GetSubmissionBatcher() {return *m_submissionBatcher;}
+bool VlkContext::FlushSubmissions() {return m_submissionBatcher ? m_submissionBatcher->Flush() : false;}
+
+bool VlkContext::GetQueueFamilyIndex(prosper::QueueFamilyType queueFamilyType,uint32_t &queueFamilyIndex) const {return GetUniversalQueueFamilyIndex(queueFamilyType,queueFamilyIndex);}
+
+Anvil::Queue &VlkContext::GetQueue(prosper::QueueFamilyType queueFamilyType)
+{
+	Anvil::Queue *queue = nullptr;
+	switch(queueFamilyType)
+	{
+	case prosper::QueueFamilyType::Compute:
+		queue = m_devicePtr->get_compute_queue(0u);
+		break;
+	case prosper::QueueFamilyType::Transfer:
+		queue = m_devicePtr->get_transfer_queue(0u);
+		break;
+	default:
+		break;
+	}
+	return queue ? *queue : *m_devicePtr->get_universal_queue(0u);
+}
+
+void VlkContext::AddFrameWaitSemaphore(Anvil::Semaphore &semaphore,PipelineStageFlags waitStageMask) {m_pendingFrameWaitSemaphores.push_back({&semaphore,waitStageMask});}
+void VlkContext::AddFrameSignalSemaphore(Anvil::Semaphore &semaphore) {m_pendingFrameSignalSemaphores.push_back(&semaphore);}
+void VlkContext::AddFrameSubmissionCallback(const std::function<void()> &callback) {m_frameSubmissionCallbacks.push_back(callback);}
+
 bool VlkContext::GetUniversalQueueFamilyIndex(prosper::QueueFamilyType queueFamilyType,uint32_t &queueFamilyIndex) const
 {
 	auto n_universal_queue_family_indices = 0u;
@@ -777,6 +842,7 @@ bool VlkContext::GetUniversalQueueFamilyIndex(prosper::QueueFamilyType queueFami
 void VlkContext::InitAPI(const CreateInfo &createInfo)
 {
 	InitVulkan(createInfo);
+	m_submissionBatcher = std::make_unique<VlkSubmissionBatcher>(*this);
 	InitWindow();
 	ReloadSwapchain();
 }
@@ -924,7 +990,14 @@ static void init_default_dsg_bindings(Anvil::BaseDevice &dev,Anvil::DescriptorSe
 		{
 			Anvil::DescriptorType descType;
 			uint32_t arraySize;
-			info.get_binding_properties_by_index_number(j,nullptr,&descType,&arraySize,nullptr,nullptr);
+			Anvil::DescriptorBindingFlags flags;
+			info.get_binding_properties_by_index_number(j,nullptr,&descType,&arraySize,nullptr,nullptr,&flags);
+			if((flags &Anvil::DescriptorBindingFlagBits::PARTIALLY_BOUND_BIT) != Anvil::DescriptorBindingFlagBits::NONE)
+			{
+				// Unused elements of partially bound arrays (e.g. bindless texture tables) can be left unwritten
+				++bindingIndex;
+				continue;
+			}
 			switch(descType)
 			{
 			case Anvil::DescriptorType::COMBINED_IMAGE_SAMPLER:
@@ -976,9 +1049,25 @@ static void init_default_dsg_bindings(Anvil::BaseDevice &dev,Anvil::DescriptorSe
 }
 std::shared_ptr<prosper::IDescriptorSetGroup> prosper::VlkContext::CreateDescriptorSetGroup(const DescriptorSetCreateInfo &descSetCreateInfo,std::unique_ptr<Anvil::DescriptorSetCreateInfo> descSetInfo)
 {
+	// Bindings with update-after-bind require both the layout and the pool to be created with the corresponding flag
+	auto updateAfterBind = false;
+	auto numBindings = descSetInfo->get_n_bindings();
+	for(auto i=decltype(numBindings){0u};i<numBindings && updateAfterBind == false;++i)
+	{
+		Anvil::DescriptorBindingFlags flags;
+		if(descSetInfo->get_binding_properties_by_index_number(i,nullptr,nullptr,nullptr,nullptr,nullptr,&flags))
+			updateAfterBind = (flags &Anvil::DescriptorBindingFlagBits::UPDATE_AFTER_BIND_BIT) != Anvil::DescriptorBindingFlagBits::NONE;
+	}
+	Anvil::DescriptorPoolCreateFlags poolFlags = Anvil::DescriptorPoolCreateFlagBits::FREE_DESCRIPTOR_SET_BIT;
+	if(updateAfterBind)
+	{
+		descSetInfo->set_descriptor_set_layout_flags(Anvil::DescriptorSetLayoutCreateFlagBits::UPDATE_AFTER_BIND_POOL_BIT);
+		poolFlags |= Anvil::DescriptorPoolCreateFlagBits::UPDATE_AFTER_BIND_BIT;
+	}
+
 	std::vector<std::unique_ptr<Anvil::DescriptorSetCreateInfo>> descSetInfos = {};
 	descSetInfos.push_back(std::move(descSetInfo));
-	auto dsg = Anvil::DescriptorSetGroup::create(&static_cast<VlkContext&>(*this).GetDevice(),descSetInfos,Anvil::DescriptorPoolCreateFlagBits::FREE_DESCRIPTOR_SET_BIT);
+	auto dsg = Anvil::DescriptorSetGroup::create(&static_cast<VlkContext&>(*this).GetDevice(),descSetInfos,poolFlags);
 	init_default_dsg_bindings(static_cast<VlkContext&>(*this).GetDevice(),*dsg);
 	return prosper::VlkDescriptorSetGroup::Create(*this,descSetCreateInfo,std::move(dsg));
 }
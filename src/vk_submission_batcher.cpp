@@ -0,0 +1,177 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "stdafx_prosper.h"
+#include "vk_submission_batcher.hpp"
+#include "vk_context.hpp"
+#include <wrappers/queue.h>
+#include <wrappers/command_buffer.h>
+#include <wrappers/semaphore.h>
+#include <wrappers/fence.h>
+#include <wrappers/device.h>
+#include <algorithm>
+#include <unordered_set>
+
+using namespace prosper;
+
+VlkSubmissionBatcher::VlkSubmissionBatcher(VlkContext &context)
+	: m_context{context}
+{}
+
+bool VlkSubmissionBatcher::Add(Submission &&submission)
+{
+	std::scoped_lock lock {m_mutex};
+	// Queue types without a dedicated queue share the universal queue
+	auto *queue = &m_context.GetQueue(submission.queueFamilyType);
+	auto it = std::find_if(m_pending.begin(),m_pending.end(),[queue](const QueueSubmissions &queueSubmissions) {return queueSubmissions.queue == queue;});
+	if(it == m_pending.end())
+	{
+		m_pending.push_back({queue});
+		it = m_pending.end() -1;
+	}
+	auto flush = submission.fence != nullptr || submission.shouldBlock;
+	it->submissions.push_back(std::move(submission));
+	return flush ? Flush() : true;
+}
+
+bool VlkSubmissionBatcher::Submit(QueueSubmissions &queueSubmissions)
+{
+	// Each submission gets its own VkSubmitInfo with its own waits and signals, so merging them into a single vkQueueSubmit doesn't
+	// change the synchronization between them. Only one fence can be signalled per vkQueueSubmit, so a fence ends the group.
+	struct SubmitInfoData
+	{
+		std::vector<VkCommandBuffer> cmdBuffers;
+		std::vector<VkSemaphore> waitSemaphores;
+		std::vector<VkPipelineStageFlags> waitStageMasks;
+		std::vector<VkSemaphore> signalSemaphores;
+	};
+	auto &submissions = queueSubmissions.submissions;
+	std::vector<SubmitInfoData> submitInfoData(submissions.size());
+	std::vector<VkSubmitInfo> submitInfos(submissions.size());
+	for(auto i=decltype(submissions.size()){0u};i<submissions.size();++i)
+	{
+		auto &submission = submissions.at(i);
+		auto &data = submitInfoData.at(i);
+		data.cmdBuffers.reserve(submission.cmdBuffers.size());
+		for(auto *cmdBuffer : submission.cmdBuffers)
+			data.cmdBuffers.push_back(cmdBuffer->get_command_buffer());
+		data.waitSemaphores.reserve(submission.waitSemaphores.size());
+		for(auto *semaphore : submission.waitSemaphores)
+			data.waitSemaphores.push_back(semaphore->get_semaphore());
+		data.waitStageMasks.reserve(submission.waitStageMasks.size());
+		for(auto &stageMask : submission.waitStageMasks)
+			data.waitStageMasks.push_back(stageMask.get_vk());
+		data.signalSemaphores.reserve(submission.signalSemaphores.size());
+		for(auto *semaphore : submission.signalSemaphores)
+			data.signalSemaphores.push_back(semaphore->get_semaphore());
+
+		auto &submitInfo = submitInfos.at(i);
+		submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = static_cast<uint32_t>(data.cmdBuffers.size());
+		submitInfo.pCommandBuffers = data.cmdBuffers.data();
+		submitInfo.waitSemaphoreCount = static_cast<uint32_t>(data.waitSemaphores.size());
+		submitInfo.pWaitSemaphores = data.waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = data.waitStageMasks.data();
+		submitInfo.signalSemaphoreCount = static_cast<uint32_t>(data.signalSemaphores.size());
+		submitInfo.pSignalSemaphores = data.signalSemaphores.data();
+	}
+
+	auto vkQueue = queueSubmissions.queue->get_queue();
+	auto vkDevice = m_context.GetDevice().get_device_vk();
+	auto success = true;
+	size_t first = 0;
+	while(first < submissions.size())
+	{
+		auto last = first;
+		auto shouldBlock = false;
+		Anvil::Fence *fence = nullptr;
+		for(;last<submissions.size();++last)
+		{
+			auto &submission = submissions.at(last);
+			shouldBlock = shouldBlock || submission.shouldBlock;
+			if(submission.fence != nullptr)
+			{
+				fence = submission.fence;
+				++last;
+				break;
+			}
+		}
+		auto vkFence = (fence != nullptr) ? fence->get_fence() : VK_NULL_HANDLE;
+		auto result = vkQueueSubmit(vkQueue,static_cast<uint32_t>(last -first),submitInfos.data() +first,vkFence);
+		++m_lastSubmitCount;
+		if(result != VK_SUCCESS)
+			success = false;
+		else if(shouldBlock)
+		{
+			if(vkFence != VK_NULL_HANDLE)
+				success = (vkWaitForFences(vkDevice,1,&vkFence,true,std::numeric_limits<uint64_t>::max()) == VK_SUCCESS) && success;
+			else
+				success = (vkQueueWaitIdle(vkQueue) == VK_SUCCESS) && success;
+		}
+		first = last;
+	}
+	return success;
+}
+
+bool VlkSubmissionBatcher::Flush()
+{
+	std::scoped_lock lock {m_mutex};
+	m_lastSubmitCount = 0u;
+	if(m_pending.empty())
+		return true;
+	// Submissions made from within the flush (e.g. by a resource destructor) belong to the next flush
+	auto pending = std::move(m_pending);
+	m_pending.clear();
+
+	// A queue has to be submitted after all queues that signal semaphores it waits on
+	auto fGetSignalSemaphores = [](const QueueSubmissions &queueSubmissions) {
+		std::unordered_set<Anvil::Semaphore*> semaphores;
+		for(auto &submission : queueSubmissions.submissions)
+			semaphores.insert(submission.signalSemaphores.begin(),submission.signalSemaphores.end());
+		return semaphores;
+	};
+	std::vector<std::unordered_set<Anvil::Semaphore*>> signalSemaphores;
+	signalSemaphores.reserve(pending.size());
+	for(auto &queueSubmissions : pending)
+		signalSemaphores.push_back(fGetSignalSemaphores(queueSubmissions));
+	std::vector<bool> submitted(pending.size(),false);
+	auto fIsReady = [&](size_t idx) {
+		for(auto &submission : pending.at(idx).submissions)
+		{
+			for(auto *semaphore : submission.waitSemaphores)
+			{
+				for(auto i=decltype(pending.size()){0u};i<pending.size();++i)
+				{
+					if(i != idx && submitted.at(i) == false && signalSemaphores.at(i).find(semaphore) != signalSemaphores.at(i).end())
+						return false;
+				}
+			}
+		}
+		return true;
+	};
+	auto success = true;
+	for(auto numSubmitted=decltype(pending.size()){0u};numSubmitted<pending.size();++numSubmitted)
+	{
+		size_t idx = 0;
+		for(;idx<pending.size();++idx)
+		{
+			if(submitted.at(idx) == false && fIsReady(idx))
+				break;
+		}
+		// Cyclic dependencies can't be resolved, in which case the remaining queues are submitted in the order they were added
+		if(idx == pending.size())
+			idx = std::find(submitted.begin(),submitted.end(),false) -submitted.begin();
+		submitted.at(idx) = true;
+		success = Submit(pending.at(idx)) && success;
+	}
+	return success;
+}
+
+bool VlkSubmissionBatcher::HasPendingSubmissions() const
+{
+	std::scoped_lock lock {m_mutex};
+	return m_pending.empty() == false;
+}
+uint32_t VlkSubmissionBatcher::GetLastSubmitCount() const {return m_lastSubmitCount;}
@@ -0,0 +1,68 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __PR_PROSPER_VK_SUBMISSION_BATCHER_HPP__
+#define __PR_PROSPER_VK_SUBMISSION_BATCHER_HPP__
+
+#include "prosper_definitions.hpp"
+#include "prosper_enums.hpp"
+#include <misc/types.h>
+#include <vector>
+#include <mutex>
+
+#pragma warning(push)
+#pragma warning(disable : 4251)
+namespace prosper
+{
+	class VlkContext;
+	// Collects queue submissions and flushes them with a single vkQueueSubmit per queue. Every submission keeps its own VkSubmitInfo
+	// (and therefore its own wait and signal semaphores).
+	// Queues are flushed in the order of the semaphore dependencies between them.
+	// Submissions with a fence, or which block, are flushed right away (together with everything pending), since fences may be polled
+	// directly (e.g. via IFence::IsSet). All other submissions are deferred until the next flush, which happens at the latest
+	// at the end of the current frame.
+	// Submissions may be added and flushed from any thread.
+	class DLLPROSPER VlkSubmissionBatcher
+	{
+	public:
+		struct DLLPROSPER Submission
+		{
+			QueueFamilyType queueFamilyType = QueueFamilyType::Universal;
+			std::vector<Anvil::CommandBufferBase*> cmdBuffers = {};
+			std::vector<Anvil::Semaphore*> waitSemaphores = {};
+			std::vector<Anvil::PipelineStageFlags> waitStageMasks = {};
+			std::vector<Anvil::Semaphore*> signalSemaphores = {};
+			Anvil::Fence *fence = nullptr;
+			// If set, the submission is flushed immediately and the calling thread waits until it has been executed
+			bool shouldBlock = false;
+		};
+		VlkSubmissionBatcher(VlkContext &context);
+		VlkSubmissionBatcher(const VlkSubmissionBatcher&)=delete;
+		VlkSubmissionBatcher &operator=(const VlkSubmissionBatcher&)=delete;
+
+		// All resources referenced by the submission have to be kept alive until the submission has been flushed.
+		// Returns false if the submission was flushed and the submit failed.
+		bool Add(Submission &&submission);
+		bool Flush();
+		bool HasPendingSubmissions() const;
+		// Number of vkQueueSubmit calls made by the last flush
+		uint32_t GetLastSubmitCount() const;
+	private:
+		struct QueueSubmissions
+		{
+			Anvil::Queue *queue = nullptr;
+			std::vector<Submission> submissions;
+		};
+		bool Submit(QueueSubmissions &queueSubmissions);
+
+		VlkContext &m_context;
+		std::vector<QueueSubmissions> m_pending = {};
+		uint32_t m_lastSubmitCount = 0u;
+		// Recursive, since resources released during a flush may add new submissions
+		mutable std::recursive_mutex m_mutex;
+	};
+};
+#pragma warning(pop)
+
+#endif
@@ -0,0 +1,111 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <prosper_glstospv.hpp>
+#include <prosper_cache_archive.hpp>
+#include <shader/prosper_shader.hpp>
+#include <sharedutils/util.h>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+
+// Compiles all shaders listed in a shader manifest (see prosper::write_shader_manifest) into a precompiled shader archive.
+// The archive has to be placed in the root shader directory of the application as 'shaders.prc'.
+// Usage: shader_precompiler <manifest> -o <archive> [-root <shader root>] [-j <thread count>]
+static void print_usage()
+{
+	std::cout<<"Usage: shader_precompiler <manifest> -o <archive> [-root <shader root>] [-j <thread count>]"<<std::endl;
+}
+
+int main(int argc,char *argv[])
+{
+	std::string manifestFileName;
+	std::string archiveFileName;
+	auto numThreads = std::max(std::thread::hardware_concurrency(),1u);
+	for(auto i=1;i<argc;++i)
+	{
+		std::string arg = argv[i];
+		if(arg == "-o" && i +1 < argc)
+			archiveFileName = argv[++i];
+		else if(arg == "-root" && i +1 < argc)
+			prosper::Shader::SetRootShaderLocation(argv[++i]);
+		else if(arg == "-j" && i +1 < argc)
+			numThreads = std::max(static_cast<uint32_t>(std::strtoul(argv[++i],nullptr,10)),1u);
+		else if(manifestFileName.empty())
+			manifestFileName = arg;
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if(manifestFileName.empty() || archiveFileName.empty())
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	std::vector<prosper::ShaderManifestEntry> entries;
+	if(prosper::read_shader_manifest(manifestFileName,entries) == false)
+	{
+		std::cout<<"ERROR: Unable to read shader manifest '"<<manifestFileName<<"'!"<<std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// Always start with an empty archive, so shaders which have been removed from the manifest don't remain in it
+	std::remove(archiveFileName.c_str());
+	auto archive = prosper::CacheArchive::Open(archiveFileName);
+
+	// Compilation is independent per entry and the archive is thread-safe
+	std::atomic<uint32_t> nextEntry = 0u;
+	std::atomic<uint32_t> numFailed = 0u;
+	std::mutex logMutex;
+	auto &shaderLocation = prosper::Shader::GetRootShaderLocation();
+	std::vector<std::thread> threads;
+	numThreads = std::min<uint32_t>(numThreads,std::max<uint32_t>(entries.size(),1u));
+	threads.reserve(numThreads);
+	for(auto i=decltype(numThreads){0u};i<numThreads;++i)
+	{
+		threads.push_back(std::thread{[&]() {
+			for(auto idx=nextEntry++;idx<entries.size();idx=nextEntry++)
+			{
+				auto &entry = entries.at(idx);
+				// Has to match the path used by Shader::InitializeSources
+				auto fileName = shaderLocation +'\\' +entry.path;
+				std::string infoLog;
+				auto success = prosper::precompile_shader(*archive,entry.stage,fileName,&infoLog);
+				std::scoped_lock lock {logMutex};
+				if(success == false)
+				{
+					++numFailed;
+					std::cout<<"ERROR: Unable to compile shader '"<<entry.path<<"':\n"<<infoLog<<std::endl;
+				}
+				else
+					std::cout<<"Compiled shader '"<<entry.path<<"'."<<std::endl;
+			}
+		}});
+	}
+	for(auto &t : threads)
+		t.join();
+
+	if(numFailed > 0u)
+	{
+		std::cout<<numFailed<<" of "<<entries.size()<<" shaders could not be compiled, no archive has been written."<<std::endl;
+		return EXIT_FAILURE;
+	}
+	prosper::write_shader_archive_version(*archive);
+	if(archive->Write() == false)
+	{
+		std::cout<<"ERROR: Unable to write shader archive '"<<archiveFileName<<"'!"<<std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout<<"Wrote "<<entries.size()<<" shaders to '"<<archiveFileName<<"'."<<std::endl;
+	return EXIT_SUCCESS;
+}